@@ -11,9 +11,11 @@
 
 CONFIG_FILE=config
 
-#KZIMP_DIR="../kzimp/kzimp_allMessagesArea"
-#KZIMP_DIR="../kzimp/kzimp_splice"
-KZIMP_DIR="../kzimp/kzimp_reader_splice"
+KZIMP_DIR="../kzimp/kzimp_allMessagesArea"
+
+# Data path of the channels: 0 to copy the messages, 1 for writer splice
+# (no copy when sending), 2 for reader splice (no copy when receiving)
+DATA_PATH=2
 
 # Do we compute the checksum?
 COMPUTE_CHKSUM=0
@@ -53,7 +55,7 @@ fi
 cd $KZIMP_DIR
 make
 ./kzimp.sh unload
-./kzimp.sh load nb_max_communication_channels=${NB_MAX_CHANNELS} default_channel_size=${MSG_CHANNEL} default_max_msg_size=${MESSAGE_MAX_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM}
+./kzimp.sh load nb_max_communication_channels=${NB_MAX_CHANNELS} default_channel_size=${MSG_CHANNEL} default_max_msg_size=${MESSAGE_MAX_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM} default_data_path=${DATA_PATH}
 if [ $? -eq 1 ]; then
    echo "An error has occured when loading kzimp. Aborting the experiment"
    exit 0
@@ -66,10 +68,10 @@ echo "-DMESSAGE_MAX_SIZE=${MESSAGE_MAX_SIZE} -DMESSAGE_MAX_SIZE_CHKPT_REQ=${CHKP
 if [ $ONE_CHANNEL_PER_NODE -eq 1 ]; then
    echo "-DONE_CHANNEL_PER_NODE" >> KZIMP_PROPERTIES
 fi
-if [ $KZIMP_DIR = "../kzimp/kzimp_splice" ]; then
+if [ $DATA_PATH -eq 1 ]; then
    echo "-DKZIMP_SPLICE -DCHANNEL_SIZE=$((${MSG_CHANNEL}+1))" >> KZIMP_PROPERTIES
 fi
-if [ $KZIMP_DIR = "../kzimp/kzimp_reader_splice" ]; then
+if [ $DATA_PATH -eq 2 ]; then
    echo "-DKZIMP_READ_SPLICE -DCHANNEL_SIZE=${MSG_CHANNEL}" >> KZIMP_PROPERTIES
 fi
 make kzimp_checkpointing
@@ -29,9 +29,9 @@
 
 // Define MESSAGE_MAX_SIZE as the max size of a message in the channel
 // Define ONE_CHANNEL_PER_NODE if you want to run the version with 1 channel per learner i -> client 0
-// Define KZIMP_SPLICE if you want to use the splice version of kzimp (no copy when sending)
+// Define KZIMP_SPLICE if the channels have the writer splice data path of kzimp (no copy when sending)
 // If KZIMP_SPLICE is defined, you also have to define CHANNEL_SIZE
-// Define KZIMP_READ_SPLICE if you want to use the reader_splice version of kzimp (no copy when receiving)
+// Define KZIMP_READ_SPLICE if the channels have the reader splice data path of kzimp (no copy when receiving)
 // Note that it does not work with ONE_CHANNEL_PER_LEARNER.
 // You also need to define CHANNEL_SIZE
 
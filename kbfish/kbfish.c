@@ -106,10 +106,15 @@ static int kbfish_open(struct inode *inode, struct file *filp)
         = (typeof(ump_chan->send_chan.buf)) chan->sender_to_receiver;
   }
 
-  ump_chan->inchanlen = (size_t) chan->channel_size
-      * (size_t) chan->max_msg_size;
-  ump_chan->outchanlen = (size_t) chan->channel_size
-      * (size_t) chan->max_msg_size;
+  ump_chan->recv_chan.slot_bytes = get_ump_message_size(chan->max_msg_size);
+  ump_chan->send_chan.slot_bytes = ump_chan->recv_chan.slot_bytes;
+  ump_chan->recv_chan.slot_payload = ump_chan->recv_chan.slot_bytes
+      - sizeof(union ump_header);
+  ump_chan->send_chan.slot_payload = ump_chan->recv_chan.slot_payload;
+
+  ump_chan->inchanlen = get_ump_area_size(chan->channel_size,
+      chan->max_msg_size);
+  ump_chan->outchanlen = ump_chan->inchanlen;
 
   ump_chan->recv_chan.dir = UMP_INCOMING;
   ump_chan->send_chan.dir = UMP_OUTGOING;
@@ -119,11 +124,23 @@ static int kbfish_open(struct inode *inode, struct file *filp)
 
   for (i = 0; i < ump_chan->send_chan.bufmsgs; i++)
   {
-    ump_chan->send_chan.buf[i].header.raw = 0;
+    ump_slot_header(&ump_chan->send_chan, i)->raw = 0;
   }
 
+  // the cursors are after the slots
+  ump_chan->local_cursor = (struct ump_cursor*) ump_slot_data(
+      &ump_chan->send_chan, chan->channel_size);
+  ump_chan->remote_cursor = (struct ump_cursor*) ump_slot_data(
+      &ump_chan->recv_chan, chan->channel_size);
+  ump_chan->local_cursor->read = 0;
+  ump_chan->local_cursor->sleeping = 0;
+
   ump_chan->max_recv_msgs = chan->channel_size;
   ump_chan->max_send_msgs = chan->channel_size;
+  ump_chan->max_msg_len = (size_t) chan->channel_size
+      * ump_chan->send_chan.slot_payload;
+  ump_chan->ack_window = (ack_window > 0 ? ack_window : chan->channel_size / 2);
+  ump_chan->ack_window = clamp_t(int, ump_chan->ack_window, 1, chan->channel_size);
 
   ump_chan->recv_chan.epoch = 1;
   ump_chan->recv_chan.pos = 0;
@@ -131,14 +148,20 @@ static int kbfish_open(struct inode *inode, struct file *filp)
   ump_chan->send_chan.epoch = 1;
   ump_chan->send_chan.pos = 0;
 
-  ump_chan->sent_id = 1;
+  ump_chan->sent_id = 0;
   ump_chan->seq_id = 0;
   ump_chan->ack_id = 0;
   ump_chan->last_ack = 0;
+  ump_chan->sleeps = 0;
+  ump_chan->woken = 0;
+
+  // a wake up for the previous process of this end is not for us
+  clear_bit(ctrl->is_sender, &chan->wakeups);
 
   ctrl->pid = current->pid;
   ctrl->ump_chan = ump_chan;
   ctrl->chan = chan;
+  ctrl->is_mapped = 0;
   filp->private_data = ctrl;
   retval = 0;
 
@@ -179,6 +202,127 @@ static int kbfish_release(struct inode *inode, struct file *filp)
   return 0;
 }
 
+/*
+ * write in the n next slots of ump_chan a message of type msgtype, whose payload is the len
+ * bytes of the user-space buffer buf, or nothing if buf is NULL.
+ * The payload is copied before the slots are taken, so that a failed copy leaves the channel
+ * untouched. The control word of the first slot is written last.
+ * Return 0, or -EFAULT if the buffer buf is not valid.
+ */
+static int ump_write_msg(struct ump_channel *ump_chan, int msgtype,
+    const char __user *buf, size_t len, ump_index_t n)
+{
+  struct ump_chan_state *c;
+  struct ump_control ctrl, cont;
+  union ump_header *h;
+  ump_index_t first, i;
+  size_t off;
+
+  c = &ump_chan->send_chan;
+
+  if (buf)
+  {
+    for (off = 0; off < len; off += c->slot_payload)
+    {
+      // copy_from_user returns the number of bytes left to copy
+      if (unlikely(copy_from_user(ump_slot_data(c, c->pos + off / c->slot_payload),
+          buf + off, min_t(size_t, c->slot_payload, len - off))))
+      {
+        printk(KERN_ERR "kbfish: copy_from_user failed for process %i in write\n", current->pid);
+        return -EFAULT;
+      }
+    }
+  }
+
+  first = ump_impl_get_next(c, &ctrl, n);
+
+  cont.epoch = ctrl.epoch;
+  cont.header = (uintptr_t) UMP_CONT << UMP_INDEX_BITS;
+  for (i = 1; i < n; i++)
+  {
+    ump_set_control(ump_slot_header(c, first + i), cont);
+  }
+
+  ump_control_fill(ump_chan, &ctrl, msgtype, n);
+  h = ump_slot_header(c, first);
+  h->msg.len = len;
+  BARRIER();
+  ump_set_control(h, ctrl);
+
+  return 0;
+}
+
+/*
+ * copy in the user-space buffer buf of size count the payload of the message of msg_len
+ * bytes that starts at the slot first of c.
+ * Return the number of copied bytes, or -EFAULT if the buffer buf is not valid.
+ */
+static ssize_t ump_read_payload(struct ump_chan_state *c, ump_index_t first,
+    size_t msg_len, char __user *buf, size_t count)
+{
+  size_t off;
+
+  count = min(count, msg_len);
+  for (off = 0; off < count; off += c->slot_payload)
+  {
+    // copy_to_user returns the number of bytes left to copy
+    if (unlikely(copy_to_user(buf + off,
+        ump_slot_data(c, first + off / c->slot_payload),
+        min_t(size_t, c->slot_payload, count - off))))
+    {
+      printk(KERN_ERR "kbfish: copy_to_user failed for process %i in read\n", current->pid);
+      return -EFAULT;
+    }
+  }
+
+  return count;
+}
+
+/*
+ * wake up the other end of ctrl if it sleeps, i.e. if it has set the sleeping flag of its
+ * cursor, and if we have not woken up this wait yet. It may sleep in kbfish_read(), in
+ * wait_for_slots() or in KBFISH_IOCTL_WAIT.
+ */
+static void kbfish_wake_peer(struct kbfish_ctrl *ctrl)
+{
+  uint32_t sleeping;
+
+  // the message or the acks are visible before the flag is read. The other end sets the
+  // flag before it checks the channel one last time
+  smp_mb();
+  // written by the other end: it is only compared, never used as an index
+  sleeping = ACCESS_ONCE(ctrl->ump_chan->remote_cursor->sleeping);
+  if (sleeping && sleeping != ctrl->ump_chan->woken)
+  {
+    ctrl->ump_chan->woken = sleeping;
+    set_bit(!ctrl->is_sender, &ctrl->chan->wakeups);
+    wake_up(&ctrl->chan->rq);
+  }
+}
+
+/*
+ * publish the acks of ctrl in its local cursor if the ack window is reached, or if idle
+ * is set and there is something to publish. An end publishes all its acks before it waits:
+ * a peer that waits for slots can always make progress.
+ */
+static void ump_ack(struct kbfish_ctrl *ctrl, int idle)
+{
+  struct ump_channel *ump_chan = ctrl->ump_chan;
+
+  if (!ump_send_ack_is_needed(ump_chan)
+      && (!idle || ump_chan->seq_id == ump_chan->last_ack))
+  {
+    return;
+  }
+
+  // the payloads have been read before the slots are given back
+  BARRIER();
+  ump_chan->local_cursor->read = ump_chan->seq_id;
+  ump_chan->last_ack = ump_chan->seq_id;
+
+  kbfish_wake_peer(ctrl);
+}
+
 /*
  * recv a message.
  * Return values:
@@ -187,6 +331,7 @@ static int kbfish_release(struct inode *inode, struct file *filp)
  *  . -EFAULT if the buffer *buf is not valid
  *  . -EINTR if the process has been interrupted by a signal while waiting
  *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . -EINVAL if the areas of the channel are mmap'ed: the messages are received in user space
  *  . The number of written bytes otherwise
  */
 static ssize_t kbfish_read
@@ -196,9 +341,10 @@ static ssize_t kbfish_read
   struct ump_channel *ump_chan; /* channel information */
   struct kbfish_ctrl *kbf_ctrl;
 
-  struct ump_control ctrl;
-  struct ump_message *ump_msg;
-  int call_recv_again;
+  union ump_header *h;
+  ump_index_t first, n;
+  size_t len;
+  ssize_t r;
   int msgtype;
   DEFINE_WAIT(__wait);
 
@@ -212,126 +358,139 @@ static ssize_t kbfish_read
       ump_chan->seq_id, ump_chan->last_ack);
   */
 
-  while (!ump_endpoint_can_recv(&ump_chan->recv_chan))
+  if (unlikely(kbf_ctrl->is_mapped))
   {
-    // file is open in no-blocking mode
-    if (filp->f_flags & O_NONBLOCK)
-    {
-      return -EAGAIN;
-    }
-
-    prepare_to_wait(&chan->rq, &__wait, TASK_INTERRUPTIBLE);
-
-    if (unlikely(signal_pending(current)))
-    {
-      printk(KERN_WARNING "kbfish: process %i in write has been interrupted\n", current->pid);
-      return -EINTR;
-    }
-
-    schedule();
+    return -EINVAL;
   }
-  finish_wait(&chan->rq, &__wait);
 
-  ump_msg = ump_impl_recv(&ump_chan->recv_chan);
-  if (unlikely(ump_msg == NULL))
+  // set by kbfish_poll()
+  if (ump_chan->local_cursor->sleeping)
   {
-    printk(KERN_WARNING "{%i}[%s:%i] Error: ump_msg should not be null\n", current->pid, __func__, __LINE__);
-    return -EIO;
+    ump_chan->local_cursor->sleeping = 0;
   }
 
-  // what kind of message is this?
-  msgtype = ump_control_process(ump_chan, ump_msg->header.control);
-  switch (msgtype)
+  while (1)
   {
-    case UMP_ACK: // this is an ack, we need to call recv again
-    //printk(KERN_DEBUG "{%i}[%s:%i] Has received an ack\n", current->pid, __func__, __LINE__);
-    call_recv_again = 1;
-    break;
-
-    case UMP_MSG: // this is a message, we return it
-    //printk(KERN_DEBUG "{%i}[%s:%i] Has received a message\n", current->pid, __func__, __LINE__);
-    count = (MESSAGE_BYTES < count ? MESSAGE_BYTES : count);
-
-    // copy_from_user returns the number of bytes left to copy
-    if (unlikely(copy_to_user(buf, ump_msg->data, count)))
+    while (!ump_endpoint_can_recv(&ump_chan->recv_chan))
     {
-      printk(KERN_ERR "kbfish: copy_to_user failed for process %i in write\n", current->pid);
-      return -EFAULT;
+      ump_ack(kbf_ctrl, 1);
+
+      // file is open in no-blocking mode
+      if (filp->f_flags & O_NONBLOCK)
+      {
+        finish_wait(&chan->rq, &__wait);
+        return -EAGAIN;
+      }
+
+      prepare_to_wait(&chan->rq, &__wait, TASK_INTERRUPTIBLE);
+
+      if (unlikely(signal_pending(current)))
+      {
+        finish_wait(&chan->rq, &__wait);
+        printk(KERN_WARNING "kbfish: process %i in read has been interrupted\n", current->pid);
+        return -EINTR;
+      }
+
+      // the writer wakes us up only if it sees the flag
+      ump_set_sleeping(ump_chan);
+      smp_mb();
+      if (!ump_endpoint_can_recv(&ump_chan->recv_chan))
+      {
+        schedule();
+      }
+      ump_chan->local_cursor->sleeping = 0;
     }
+    finish_wait(&chan->rq, &__wait);
 
-    call_recv_again = 0;
-    break;
-
-    default:
-    //printk(KERN_DEBUG "{%i}[%s:%i] Error: unknown message type %i\n", current->pid, __func__, __LINE__,
-    //   msgtype);
-    call_recv_again = 1;
-    break;
-  }
-
-  if (ump_send_ack_is_needed(ump_chan))
-  {
-    /*
-    printk(KERN_DEBUG "{%i}[%s:%i] sent_id=%hu, ack_id=%hu, max_send_msgs=%hu, seq_id=%hu, last_ack=%hu\n", current->pid,
-        __func__, __LINE__, ump_chan->sent_id, ump_chan->ack_id, ump_chan->max_send_msgs,
-        ump_chan->seq_id, ump_chan->last_ack);
-    printk(KERN_DEBUG "{%i}[%s:%i] I need to send an ack\n", current->pid, __func__, __LINE__);
-    */
-
-    // this shouldn't happen: I have received a message, thus I have updated my information
-    // concerning acks.
-    if (unlikely(!ump_can_send(ump_chan)))
+    h = ump_impl_recv(&ump_chan->recv_chan, &first, &len, &n);
+    if (unlikely(h == NULL))
     {
-      printk(KERN_DEBUG "{%i}[%s:%i] I need to send an ack but I cannot\n", current->pid, __func__, __LINE__);
+      printk(KERN_WARNING "{%i}[%s:%i] Error: ump_msg should not be null\n", current->pid, __func__, __LINE__);
       return -EIO;
     }
+    if (unlikely(IS_ERR(h)))
+    {
+      printk(KERN_WARNING "{%i}[%s:%i] Error: message larger than the end of the ring\n", current->pid, __func__, __LINE__);
+      return PTR_ERR(h);
+    }
 
-    ump_msg = ump_impl_get_next(&ump_chan->send_chan, &ctrl);
-    ump_control_fill(ump_chan, &ctrl, UMP_ACK);
-    BARRIER();
-    ump_msg->header.control = ctrl;
+    // what kind of message is this?
+    msgtype = ump_control_process(ump_chan, h->msg.control, n);
+    switch (msgtype)
+    {
+      case UMP_PAD: // the end of the ring is skipped
+      break;
 
-    // wake up the other end
-    wake_up(&chan->rq);
-  }
+      case UMP_MSG: // this is a message, we return it
+      //printk(KERN_DEBUG "{%i}[%s:%i] Has received a message\n", current->pid, __func__, __LINE__);
+      r = ump_read_payload(&ump_chan->recv_chan, first, len, buf, count);
 
-  if (call_recv_again)
-  {
-    //printk(KERN_DEBUG "{%i}[%s:%i] Going to receive again\n", current->pid, __func__, __LINE__);
-    return kbfish_read(filp, buf, count, f_pos);
-  }
-  else
-  {
-    return count;
+      // the message is consumed, even if it could not be copied
+      ump_ack(kbf_ctrl, 0);
+      return r;
+
+      default:
+      //printk(KERN_DEBUG "{%i}[%s:%i] Error: unknown message type %i\n", current->pid, __func__, __LINE__,
+      //   msgtype);
+      break;
+    }
+
+    ump_ack(kbf_ctrl, 0);
   }
 }
 
 /*
- * wait for an ack
+ * wait until n consecutive slots can be sent, padding the end of the ring if needed.
+ * The slots acknowledged by the receiver are read in its cursor.
  * Return 0 if there was no error, the error otherwise.
  * Possible errors:
- *  . -EIO: there should be a message but there isn't
  *  . -EINTR if the process has been interrupted by a signal while waiting
  *  . -EAGAIN if the operations are non-blocking and the call would block.
  */
-static int recv_ack(struct file* filp)
+static int wait_for_slots(struct file* filp, ump_index_t n)
 {
   struct kbfish_ctrl *ctrl;
   struct ump_channel *chan;
   struct kbfish_channel *kb_chan;
-  struct ump_message *ump_msg;
-  int msgtype;
+  ump_index_t pad;
   DEFINE_WAIT(__wait);
 
   ctrl = (typeof(ctrl)) filp->private_data;
   chan = ctrl->ump_chan;
   kb_chan = ctrl->chan;
 
-  while (!ump_endpoint_can_recv(&chan->recv_chan))
+  while (1)
   {
+    // a message does not wrap around the end of the ring
+    pad = chan->send_chan.bufmsgs - chan->send_chan.pos;
+    if (pad < n)
+    {
+      if (ump_can_send(chan, pad))
+      {
+        ump_write_msg(chan, UMP_PAD, NULL, (size_t) pad
+            * chan->send_chan.slot_payload, pad);
+        // the reader must consume the padding before it can ack the slots we wait for
+        kbfish_wake_peer(ctrl);
+        continue;
+      }
+    }
+    else if (ump_can_send(chan, n))
+    {
+      finish_wait(&kb_chan->rq, &__wait);
+      return 0;
+    }
+
+    if (ump_read_remote_cursor(chan))
+    {
+      continue;
+    }
+
+    ump_ack(ctrl, 1);
+
     // file is open in no-blocking mode
     if (filp->f_flags & O_NONBLOCK)
     {
+      finish_wait(&kb_chan->rq, &__wait);
       return -EAGAIN;
     }
 
@@ -339,39 +498,21 @@ static int recv_ack(struct file* filp)
 
     if (unlikely(signal_pending(current)))
     {
+      finish_wait(&kb_chan->rq, &__wait);
       printk(KERN_WARNING "kbfish: process %i in write has been interrupted\n", current->pid);
       return -EINTR;
     }
 
-    schedule();
-  }
-  finish_wait(&kb_chan->rq, &__wait);
-
-  ump_msg = ump_impl_recv(&chan->recv_chan);
-  if (unlikely(ump_msg == NULL))
-  {
-    printk(KERN_DEBUG "{%i} [%s:%i] Error: ump_msg should not be null\n", current->pid, __func__, __LINE__);
-    return -EIO;
-  }
-
-  // what kind of message is this?
-  msgtype = ump_control_process(chan, ump_msg->header.control);
-  switch (msgtype)
-  {
-  case UMP_ACK: // this is an ack, we need to call recv again
-    //printk(KERN_DEBUG "[%s:%i] Has received an ack\n", __func__, __LINE__);
-    break;
-  case UMP_MSG: // this is a message, we return it
-    //printk(KERN_DEBUG "{%i} [%s:%i] Should not have received a message; expecting an ack\n", current->pid,
-    //    __func__, __LINE__);
-    break;
-  default:
-    //printk(KERN_DEBUG "{%i} [%s:%i] Error: unknown message type %i\n", current->pid, __func__, __LINE__,
-    //    msgtype);
-    break;
+    // the cursor may have moved before we were on the wait queue. The reader wakes us up
+    // only if it sees the flag
+    ump_set_sleeping(chan);
+    smp_mb();
+    if (!ump_read_remote_cursor(chan))
+    {
+      schedule();
+    }
+    chan->local_cursor->sleeping = 0;
   }
-
-  return 0;
 }
 
 /*
@@ -380,10 +521,10 @@ static int recv_ack(struct file* filp)
  * Sleeps until it can write the message.
  * Returns:
  *  . 0 if the size of the user-level buffer is less or equal than 0 or greater than the maximal message size
- *  . -EIO if there should be a message but there is not
  *  . -EFAULT if the buffer *buf is not valid
  *  . -EINTR if the process has been interrupted by a signal while waiting
  *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . -EINVAL if the areas of the channel are mmap'ed: the messages are sent in user space
  *  . The number of written bytes otherwise
  */
 static ssize_t kbfish_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
@@ -392,8 +533,6 @@ static ssize_t kbfish_write(struct file *filp, const char __user *buf, size_t co
   struct ump_channel *ump_chan; /* channel information */
   struct kbfish_ctrl *kbf_ctrl;
 
-  struct ump_control ctrl;
-  struct ump_message *ump_msg;
   int r;
 
   kbf_ctrl = (typeof(kbf_ctrl))filp->private_data;
@@ -406,40 +545,34 @@ static ssize_t kbfish_write(struct file *filp, const char __user *buf, size_t co
       ump_chan->seq_id, ump_chan->last_ack);
   */
 
+  if (unlikely(kbf_ctrl->is_mapped))
+  {
+    return -EINVAL;
+  }
+
   // Check the validity of the arguments
-  if (unlikely(count <= 0 || count > chan->max_msg_size))
+  if (unlikely(count <= 0 || count > ump_chan->max_msg_len))
   {
     printk(KERN_ERR "kbfish: count is not valid: %lu (process %i in write on channel %i)\n", (unsigned long)count, current->pid, chan->chan_id);
     return 0;
   }
 
-  while (!ump_can_send(ump_chan))
+  r = wait_for_slots(filp, ump_nb_slots(&ump_chan->send_chan, count));
+  if (r < 0)
   {
-    //printk(KERN_DEBUG "{%i} [%s:%i] Going to receive an ack\n", current->pid, __func__, __LINE__);
-    r = recv_ack(filp);
-    if (r < 0)
-    {
-      return r;
-    }
+    return r;
   }
 
   //code to send:
-  ump_msg = ump_impl_get_next(&ump_chan->send_chan, &ctrl);
-  count = (MESSAGE_BYTES < count ? MESSAGE_BYTES : count);
-
-  // copy_from_user returns the number of bytes left to copy
-  if (unlikely(copy_from_user(ump_msg->data, buf, count)))
+  r = ump_write_msg(ump_chan, UMP_MSG, buf, count,
+      ump_nb_slots(&ump_chan->send_chan, count));
+  if (unlikely(r < 0))
   {
-    printk(KERN_ERR "kbfish: copy_from_user failed for process %i in write\n", current->pid);
-    return -EFAULT;
+    return r;
   }
 
-  ump_control_fill(ump_chan, &ctrl, UMP_MSG);
-  BARRIER();
-  ump_msg->header.control = ctrl;
-
-  // wake up sleeping readers
-  wake_up(&chan->rq);
+  // wake up the reader if it sleeps
+  kbfish_wake_peer(kbf_ctrl);
 
   return count;
 }
@@ -459,8 +592,22 @@ static unsigned int kbfish_poll(struct file *filp, poll_table *wait)
   ump_chan = kbf_ctrl->ump_chan;
   chan = kbf_ctrl->chan;
 
+  if (unlikely(kbf_ctrl->is_mapped))
+  {
+    return POLLERR;
+  }
+
   poll_wait(filp, &chan->rq, wait);
 
+  if (!ump_endpoint_can_recv(&ump_chan->recv_chan))
+  {
+    // the caller is going to wait: the writer wakes it up only if it sees the flag.
+    // kbfish_read() clears it
+    ump_ack(kbf_ctrl, 1);
+    ump_set_sleeping(ump_chan);
+    smp_mb();
+  }
+
   if (ump_endpoint_can_recv(&ump_chan->recv_chan))
   {
     mask |= POLLIN | POLLRDNORM;
@@ -469,6 +616,144 @@ static unsigned int kbfish_poll(struct file *filp, poll_table *wait)
   return mask;
 }
 
+/*
+ * kbfish ioctl operation. The commands are:
+ *  . KBFISH_IOCTL_GET_PARAMS: copy the parameters of the channel in the struct
+ *    kbfish_channel_params pointed to by arg
+ *  . KBFISH_IOCTL_WAIT: sleep until the other end calls KBFISH_IOCTL_WAKE
+ *  . KBFISH_IOCTL_WAKE: wake up the other end
+ * The last 2 are used by the processes that send and receive the messages in user space,
+ * on the mmap'ed areas: they only enter the kernel when the other end sleeps.
+ * Returns:
+ *  . -EFAULT if arg is not valid
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . -EINVAL bad ioctl command
+ *  . 0 otherwise
+ */
+static long kbfish_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+  struct kbfish_channel_params params;
+  struct kbfish_ctrl *ctrl;
+  struct kbfish_channel *chan;
+
+  ctrl = filp->private_data;
+  chan = ctrl->chan;
+
+  switch (cmd)
+  {
+  case KBFISH_IOCTL_GET_PARAMS:
+    params.channel_size = chan->channel_size;
+    params.max_msg_size = chan->max_msg_size;
+    params.ack_window = ctrl->ump_chan->ack_window;
+    if (copy_to_user((void __user *) arg, &params, sizeof(params)))
+    {
+      return -EFAULT;
+    }
+    return 0;
+
+  case KBFISH_IOCTL_WAIT:
+    // the wake up is consumed
+    if (wait_event_interruptible(chan->rq,
+        test_and_clear_bit(ctrl->is_sender, &chan->wakeups)))
+    {
+      return -EINTR;
+    }
+    return 0;
+
+  case KBFISH_IOCTL_WAKE:
+    set_bit(!ctrl->is_sender, &chan->wakeups);
+    wake_up(&chan->rq);
+    return 0;
+
+  default:
+    return -EINVAL;
+  }
+}
+
+static int kbfish_vma_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+  struct kbfish_channel *chan;
+  struct page *peyj;
+  unsigned long offset;
+  char *area;
+
+  chan = vma->vm_private_data;
+  offset = (vmf->pgoff - vma->vm_pgoff) * PAGE_SIZE;
+
+  // vma->vm_pgoff is the area, checked by kbfish_mmap().
+  // vmf->pgoff is the offset of the page that we need to get.
+  if (vma->vm_pgoff == KBFISH_SENDER_TO_RECEIVER_PGOFF)
+  {
+    area = chan->sender_to_receiver;
+  }
+  else
+  {
+    area = chan->receiver_to_sender;
+  }
+
+  if (offset >= chan->size_in_bytes)
+  {
+    printk(KERN_ERR "kbfish: process %i: offset %lu is out of the area\n", current->pid, offset);
+    return VM_FAULT_SIGBUS;
+  }
+
+  peyj = vmalloc_to_page((const void*) &area[offset]);
+  get_page(peyj);
+  vmf->page = peyj;
+
+  return VM_FAULT_MINOR;
+}
+
+/*
+ * kbfish mmap operation.
+ * An end maps its own area (KBFISH_SENDER_TO_RECEIVER_PGOFF for the sender,
+ * KBFISH_RECEIVER_TO_SENDER_PGOFF for the receiver) in write mode and the area of the other
+ * end in read mode only: it can never write in it, even with mprotect().
+ * Then the messages of this end are sent and received in user space, and read() and write()
+ * are no longer allowed.
+ * Returns:
+ *  . -EACCES if the process has not the credentials for the requested permission.
+ *  . -EINVAL if offset is not valid
+ *  . 0 otherwise.
+ */
+static int kbfish_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+  struct kbfish_ctrl *ctrl;
+  unsigned long own_area;
+
+  ctrl = filp->private_data;
+
+  own_area = (ctrl->is_sender ? KBFISH_SENDER_TO_RECEIVER_PGOFF
+      : KBFISH_RECEIVER_TO_SENDER_PGOFF);
+
+  if (vma->vm_pgoff != KBFISH_SENDER_TO_RECEIVER_PGOFF
+      && vma->vm_pgoff != KBFISH_RECEIVER_TO_SENDER_PGOFF)
+  {
+    printk(KERN_ERR "kbfish: process %i in mmap does not have a valid offset: %lu\n", current->pid, vma->vm_pgoff);
+    return -EINVAL;
+  }
+
+  if (vma->vm_pgoff != own_area)
+  {
+    if (vma->vm_flags & VM_WRITE)
+    {
+      printk(KERN_ERR "kbfish: process %i in mmap cannot write in the area of the other end\n", current->pid);
+      return -EACCES;
+    }
+    vma->vm_flags &= ~VM_MAYWRITE;
+  }
+
+  /* don't do anything here: fault handles the page faults and the mapping */
+  vma->vm_ops = &kbfish_vm_ops;
+  vma->vm_flags |= VM_RESERVED; // do not attempt to swap out the vma
+  vma->vm_flags |= VM_CAN_NONLINEAR; // Has ->fault & does nonlinear pages
+  vma->vm_private_data = ctrl->chan;
+
+  ctrl->is_mapped = 1;
+
+  return 0;
+}
+
 static int kbfish_init_channel(struct kbfish_channel *channel, int chan_id,
     int max_msg_size, int channel_size, int init_lock)
 {
@@ -477,8 +762,7 @@ static int kbfish_init_channel(struct kbfish_channel *channel, int chan_id,
   channel->receiver = -1;
   channel->channel_size = channel_size;
   channel->max_msg_size = max_msg_size;
-  channel->size_in_bytes = (unsigned long) channel_size
-      * (unsigned long) max_msg_size;
+  channel->size_in_bytes = get_ump_area_size(channel_size, max_msg_size);
   channel->sender_to_receiver = vmalloc(channel->size_in_bytes);
   channel->receiver_to_sender = vmalloc(channel->size_in_bytes);
   if (!channel->sender_to_receiver || !channel->receiver_to_sender)
@@ -492,6 +776,7 @@ static int kbfish_init_channel(struct kbfish_channel *channel, int chan_id,
   memset(channel->receiver_to_sender, 0, channel->size_in_bytes);
 
   init_waitqueue_head(&channel->rq);
+  channel->wakeups = 0;
 
   if (init_lock)
   {
@@ -529,11 +814,64 @@ static int kbfish_read_proc_file(char *page, char **start, off_t off,
   return len;
 }
 
+// change the number of slots and the max message size of a channel which is not opened.
+// The new areas are allocated before the lock is taken, as vmalloc() and vfree() can sleep.
+// Return 0, -ENOMEM if the new areas cannot be allocated or -EBUSY if the channel is opened.
+static int kbfish_resize_channel(struct kbfish_channel *channel,
+    int max_msg_size, int channel_size)
+{
+  unsigned long size_in_bytes;
+  char *sender_to_receiver, *receiver_to_sender;
+
+  size_in_bytes = get_ump_area_size(channel_size, max_msg_size);
+  sender_to_receiver = vmalloc(size_in_bytes);
+  receiver_to_sender = vmalloc(size_in_bytes);
+  if (!sender_to_receiver || !receiver_to_sender)
+  {
+    printk(KERN_ERR "kbfish: vmalloc error of %lu bytes: %p %p\n", size_in_bytes, sender_to_receiver, receiver_to_sender);
+    vfree(sender_to_receiver);
+    vfree(receiver_to_sender);
+    return -ENOMEM;
+  }
+
+  // set the 2 areas to 0
+  memset(sender_to_receiver, 0, size_in_bytes);
+  memset(receiver_to_sender, 0, size_in_bytes);
+
+  spin_lock(&channel->bcl);
+
+  if (channel->sender != -1 || channel->receiver != -1)
+  {
+    spin_unlock(&channel->bcl);
+    printk(KERN_WARNING "kbfish: channel %i is opened by %i and %i, its parameters cannot be changed\n", channel->chan_id, channel->sender, channel->receiver);
+    vfree(sender_to_receiver);
+    vfree(receiver_to_sender);
+    return -EBUSY;
+  }
+
+  // swap the areas: the old ones are freed once the lock is released
+  swap(channel->sender_to_receiver, sender_to_receiver);
+  swap(channel->receiver_to_sender, receiver_to_sender);
+  channel->channel_size = channel_size;
+  channel->max_msg_size = max_msg_size;
+  channel->size_in_bytes = size_in_bytes;
+
+  spin_unlock(&channel->bcl);
+
+  vfree(sender_to_receiver);
+  vfree(receiver_to_sender);
+
+  return 0;
+}
+
 // called when writing to file /proc/<procfs_name>
+// The format is "chan_id channel_size max_msg_size": the channel chan_id gets channel_size
+// slots of max_msg_size bytes. A message longer than max_msg_size spans several slots.
 static int kbfish_write_proc_file(struct file *file, const char *buffer,
     unsigned long count, void *data)
 {
-  int len;
+  int len, nb_args, err;
+  int chan_id, channel_size, max_msg_size;
   char* kbuff;
 
   len = count;
@@ -548,11 +886,44 @@ static int kbfish_write_proc_file(struct file *file, const char *buffer,
 
   kbuff[len - 1] = '\0';
 
-  //TODO: sscanf(kbuff, "", ...);
-  //for a channel, change the parameters
+  nb_args = sscanf(kbuff, "%i %i %i", &chan_id, &channel_size, &max_msg_size);
 
   kfree(kbuff);
 
+  if (nb_args != 3)
+  {
+    printk(KERN_WARNING "kbfish: expected \"chan_id channel_size max_msg_size\", got %i values\n", nb_args);
+    return len;
+  }
+
+  if (chan_id < 0 || chan_id >= nb_max_communication_channels)
+  {
+    // channel id not valid
+    printk(KERN_WARNING "kbfish: channel id not valid: %i <= %i < %i\n", 0, chan_id, nb_max_communication_channels);
+    return len;
+  }
+
+  // a message needs at least 1 slot in each direction and the slots are counted with ump_index_t
+  if (channel_size < 2 || channel_size > UMP_INDEX_MASK)
+  {
+    // channel size not valid
+    printk(KERN_WARNING "kbfish: channel size not valid: %i <= %i <= %lu\n", 2, channel_size, (unsigned long) UMP_INDEX_MASK);
+    return len;
+  }
+
+  if (max_msg_size <= 0)
+  {
+    // max message size not valid
+    printk(KERN_WARNING "kbfish: max message size not valid: %i <= %i\n", max_msg_size, 0);
+    return len;
+  }
+
+  err = kbfish_resize_channel(&channels[chan_id], max_msg_size, channel_size);
+  if (err)
+  {
+    return err;
+  }
+
   return len;
 }
 
@@ -597,10 +968,11 @@ static int __init kbfish_start(void)
   int i;
   int result;
 
-  //check that the max message size is equal to the macro MESSAGE_BYTES
-  if (default_max_msg_size != MESSAGE_BYTES)
+  // a message needs at least 1 slot in each direction and the slots are counted with ump_index_t
+  if (default_channel_size < 2 || default_channel_size > UMP_INDEX_MASK
+      || default_max_msg_size <= 0)
   {
-    printk(KERN_ERR "kbfish: default_max_msg_size != MESSAGE_BYTES (%i != %i). You need to recompile the module with the appropriate value, or change default_max_msg_size\n", default_max_msg_size, MESSAGE_BYTES);
+    printk(KERN_ERR "kbfish: default_channel_size or default_max_msg_size not valid: %i %i\n", default_channel_size, default_max_msg_size);
     return -1;
   }
 
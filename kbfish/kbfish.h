@@ -7,8 +7,6 @@
  *  represents the whole memory.
  */
 
-// Note that you need to define MESSAGE_BYTES at compile time
-
 #ifndef _KZIMP_MODULE_
 #define _KZIMP_MODULE_
 
@@ -17,6 +15,8 @@
 #include <linux/fs.h>           /* (un)register the block device - file operations */
 #include <linux/cdev.h>         /* char device */
 #include <linux/poll.h>         /* poll_table structure */
+#include <linux/mm.h>           /* about vma_struct */
+#include <linux/err.h>          /* ERR_PTR */
 
 #define DRIVER_AUTHOR "Pierre Louis Aublin <pierre-louis.aublin@inria.fr>"
 #define DRIVER_DESC   "Kernel module of the Barrelfish Message Passing (UMP) communication mechanism"
@@ -41,6 +41,33 @@ static int default_max_msg_size = 1024;
 module_param(default_max_msg_size, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(default_max_msg_size, " The default max size of the new channels messages.");
 
+static int ack_window = 0;
+module_param(ack_window, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ack_window, " The number of received slots after which a reader publishes its cursor. 0 is half of the channel.");
+
+// IOCTL commands. They are also defined in libkbfish/kbfish_ump.h
+// arg is a pointer to a struct kbfish_channel_params
+#define KBFISH_IOCTL_GET_PARAMS 0x1
+// sleep until the other end calls KBFISH_IOCTL_WAKE. Returns at once if it has already
+// called it since the last KBFISH_IOCTL_WAIT. arg is not used
+#define KBFISH_IOCTL_WAIT 0x2
+// wake up the other end. arg is not used
+#define KBFISH_IOCTL_WAKE 0x3
+
+// mmap offsets of the 2 areas of a channel. They are also defined in libkbfish/kbfish_ump.h
+// The sender can only write the first one and read the second one, and conversely.
+#define KBFISH_SENDER_TO_RECEIVER_PGOFF 1
+#define KBFISH_RECEIVER_TO_SENDER_PGOFF 2
+
+// Parameters of a channel, for KBFISH_IOCTL_GET_PARAMS.
+// It is also defined in libkbfish/kbfish_ump.h
+struct kbfish_channel_params
+{
+  int channel_size; /* number of slots */
+  int max_msg_size; /* payload size of a slot */
+  int ack_window;   /* number of received slots after which a reader publishes its cursor */
+};
+
 // file /dev/<DEVICE_NAME>
 #define DEVICE_NAME "kbfish"
 
@@ -53,6 +80,8 @@ static int kbfish_release(struct inode *, struct file *);
 static ssize_t kbfish_read(struct file *, char __user *, size_t, loff_t *);
 static ssize_t kbfish_write(struct file *, const char __user *, size_t, loff_t *);
 static unsigned int kbfish_poll(struct file *, poll_table *);
+static long kbfish_ioctl(struct file *, unsigned int, unsigned long);
+static int kbfish_mmap(struct file *, struct vm_area_struct *);
 
 // an open file is associated with a set of functions
 static struct file_operations kbfish_fops =
@@ -63,9 +92,18 @@ static struct file_operations kbfish_fops =
     .read = kbfish_read,
     .write = kbfish_write,
     .poll = kbfish_poll,
+    .unlocked_ioctl = kbfish_ioctl,
+    .mmap = kbfish_mmap,
 };
 
-#define UMP_PAYLOAD_WORDS  (MESSAGE_BYTES / sizeof(uintptr_t))
+// VMA OPERATIONS
+static int kbfish_vma_fault(struct vm_area_struct *, struct vm_fault *);
+
+// operations for mmap on the vmas
+static struct vm_operations_struct kbfish_vm_ops =
+{
+    .fault = kbfish_vma_fault,
+};
 
 // control word is 32-bit, because it must be possible to atomically write it
 typedef uint32_t ump_control_t;
@@ -77,14 +115,18 @@ struct ump_control
   ump_control_t header :UMP_HEADER_BITS;
 };
 
-struct ump_message
+// A one-way channel is a ring of slots of get_ump_message_size(max_msg_size) bytes.
+// Each slot ends with a control word. A message spans as many consecutive slots as its
+// length needs and never wraps around the end of the ring: it is published by the control
+// word of its first slot, which holds its length. The other slots only get the epoch.
+union ump_header
 {
-  uintptr_t data[UMP_PAYLOAD_WORDS] __attribute__((aligned (CACHE_LINE_SIZE)));
-  union
+  struct
   {
-    struct ump_control control;
-    uintptr_t raw;
-  } header;
+    struct ump_control control; ///< written last: publishes the message
+    uint32_t len; ///< length of the message in bytes, written before control
+  } msg;
+  uint64_t raw;
 };
 
 /// Type used for indices of UMP message slots
@@ -104,19 +146,36 @@ enum ump_direction
 #define BARRIER()   __asm volatile ("" : : : "memory")
 
 /// Special message types
+// UMP_PAD fills the end of the ring and UMP_CONT marks the other slots of a message.
+// The acks are not messages: see struct ump_cursor.
 enum ump_msgtype
 {
-  UMP_MSG = 0, UMP_ACK = 1,
+  UMP_MSG = 0, UMP_PAD = 1, UMP_CONT = 2,
 };
 
+// The acks of a one-way channel: the number of slots the receiver has consumed, on a cache
+// line of its own right after the ring of the other direction. The receiver publishes it
+// lazily; the sender only reads it when the ring looks full.
+// sleeping is set by the owner of the area before it waits (for a message or for slots),
+// to a number that changes at each wait, and cleared when it wakes up: the other end only
+// wakes it up when it is set, and once per wait.
+// It is also defined in libkbfish/kbfish_ump.h
+struct ump_cursor
+{
+  volatile ump_index_t read;
+  volatile uint32_t sleeping;
+} __attribute__((aligned (CACHE_LINE_SIZE)));
+
 /**
  * \brief State of a (one-way) UMP channel
  */
 struct ump_chan_state
 {
-  struct ump_message *buf; ///< Ring buffer
+  char *buf; ///< Ring buffer
+  size_t slot_bytes; ///< Size of a slot, control word included
+  size_t slot_payload; ///< Payload bytes of a slot
   ump_index_t pos; ///< Current position
-  ump_index_t bufmsgs; ///< Buffer size in messages
+  ump_index_t bufmsgs; ///< Buffer size in slots
   int epoch; ///< Next Message epoch
   enum ump_direction dir; ///< Channel direction
 };
@@ -127,13 +186,21 @@ struct ump_channel
   struct ump_chan_state send_chan; ///< Outgoing UMP channel state
   struct ump_chan_state recv_chan; ///< Incoming UMP channel state
 
-  ump_index_t sent_id; ///< Sequence number of next message to be sent
-  ump_index_t seq_id; ///< Last sequence number received from remote
-  ump_index_t ack_id; ///< Last sequence number acknowledged by remote
-  ump_index_t last_ack; ///< Last acknowledgement we sent to remote
+  ump_index_t sent_id; ///< Number of slots sent
+  ump_index_t seq_id; ///< Number of slots received from remote
+  ump_index_t ack_id; ///< Number of slots acknowledged by remote (last value read in remote_cursor)
+  ump_index_t last_ack; ///< Last acknowledgement we published in local_cursor
+  ump_index_t ack_window; ///< Number of received slots after which local_cursor is published
+
+  struct ump_cursor *local_cursor; ///< Acks of the recv channel, written by us
+  struct ump_cursor *remote_cursor; ///< Acks of the send channel, written by remote
 
-  ump_index_t max_send_msgs; ///< Number of messages that fit in the send channel
-  ump_index_t max_recv_msgs; ///< Number of messages that fit in the recv channel
+  ump_index_t max_send_msgs; ///< Number of slots that fit in the send channel
+  ump_index_t max_recv_msgs; ///< Number of slots that fit in the recv channel
+  size_t max_msg_len; ///< Max length of a message, in bytes
+
+  uint32_t sleeps; ///< Number of the last wait, written in the sleeping flag of local_cursor
+  uint32_t woken; ///< Number of the last wait of remote we have woken up
 
   size_t inchanlen, outchanlen;
 };
@@ -144,11 +211,12 @@ struct kbfish_channel
   int chan_id; /* id of this channel */
   pid_t sender; /* pid of the sender */
   pid_t receiver; /* pid of the receiver */
-  int channel_size; /* max number of messages */
-  unsigned long size_in_bytes; /* channel size in bytes. Is a multiple of the page size */
-  int max_msg_size; /* max message size */
+  int channel_size; /* number of slots */
+  unsigned long size_in_bytes; /* size in bytes of an area, ump_cursor included. Is a multiple of the page size */
+  int max_msg_size; /* payload size of a slot. Longer messages span several slots */
   spinlock_t bcl; /* the Big Channel Lock :) */
   wait_queue_head_t rq; /* the wait queue */
+  unsigned long wakeups; /* bit is_sender: KBFISH_IOCTL_WAKE has been called for this end */
   char* sender_to_receiver; /* shared area used by the sender to send messages */
   char* receiver_to_sender; /* shared area used by the receiver to send messages */
 
@@ -162,82 +230,154 @@ struct kbfish_ctrl
   struct kbfish_channel *chan; /* pointer to the kernel channel */
   struct ump_channel *ump_chan; /* pointer to the UMP channel */
   int is_sender; /* is this process a sender? */
+  int is_mapped; /* are the areas mmap'ed? Then the messages are sent and received in user space */
 };
 
+// return the size of a slot that holds message_size bytes
+static inline size_t get_ump_message_size(size_t message_size)
+{
+  return roundup(message_size + sizeof(union ump_header), CACHE_LINE_SIZE);
+}
+
+// return the size of the area of one direction of a channel of channel_size slots that hold
+// message_size bytes, ump_cursor included. It is rounded up to the page size, for mmap
+static inline unsigned long get_ump_area_size(int channel_size,
+    size_t message_size)
+{
+  return PAGE_ALIGN((unsigned long) channel_size
+      * get_ump_message_size(message_size) + sizeof(struct ump_cursor));
+}
+
 /********************* inline "private" methods *********************/
+
+// set the sleeping flag of the cursor of chan to the number of a new wait, never 0
+static inline void ump_set_sleeping(struct ump_channel *chan)
+{
+  if (++chan->sleeps == 0)
+  {
+    chan->sleeps = 1;
+  }
+  chan->local_cursor->sleeping = chan->sleeps;
+}
+// return the address of the slot i of c, i.e. of its payload
+static inline char *ump_slot_data(struct ump_chan_state *c, ump_index_t i)
+{
+  return c->buf + (size_t) i * c->slot_bytes;
+}
+
+// return the control word of the slot i of c
+static inline union ump_header *ump_slot_header(struct ump_chan_state *c,
+    ump_index_t i)
+{
+  return (union ump_header*) (ump_slot_data(c, i) + c->slot_payload);
+}
+
+// write ctrl in the control word of h with a single store, so that the epoch bit and the
+// header bits are seen together by the other end
+static inline void ump_set_control(union ump_header *h, struct ump_control ctrl)
+{
+  *(volatile struct ump_control*) &h->msg.control = ctrl;
+}
+
+// return the number of slots of a message of len bytes on c
+static inline ump_index_t ump_nb_slots(struct ump_chan_state *c, size_t len)
+{
+  if (len <= c->slot_payload)
+  {
+    return 1;
+  }
+  return DIV_ROUND_UP(len, c->slot_payload);
+}
+
 /**
- * \brief Determine next position for an outgoing message on a channel, and
- *   advance send pointer.
+ * \brief Determine next position for an outgoing message of n slots on a channel, and
+ *   advance send pointer. The n slots must fit before the end of the ring.
  *
  * \param c     Pointer to UMP channel-state structure.
  * \param ctrl  Pointer to storage for control word for next message, to be filled in
+ * \param n     Number of slots of the message
  *
- * \return Pointer to message if outstanding, or NULL.
+ * \return Index of the first slot of the message.
  */
-static inline struct ump_message *ump_impl_get_next(struct ump_chan_state *c,
-    struct ump_control *ctrl)
+static inline ump_index_t ump_impl_get_next(struct ump_chan_state *c,
+    struct ump_control *ctrl, ump_index_t n)
 {
-  struct ump_message *msg;
+  ump_index_t first;
 
   // construct header
   ctrl->epoch = c->epoch;
 
-  msg = &c->buf[c->pos];
+  first = c->pos;
 
   // update pos
-  if (++c->pos == c->bufmsgs)
+  c->pos += n;
+  if (c->pos == c->bufmsgs)
   {
     c->pos = 0;
     c->epoch = !c->epoch;
   }
 
-  return msg;
+  return first;
 }
 
-/// Prepare a "control" word (header for each UMP message fragment)
+/// Prepare a "control" word (header for each UMP message fragment) of a message of n slots
 static inline void ump_control_fill(struct ump_channel *s,
-    struct ump_control *ctrl, int msgtype)
+    struct ump_control *ctrl, int msgtype, ump_index_t n)
 {
-  ctrl->header = ((uintptr_t) msgtype << UMP_INDEX_BITS)
-          | (uintptr_t) s->seq_id;
-  s->last_ack = s->seq_id;
-  s->sent_id++;
+  ctrl->header = (uintptr_t) msgtype << UMP_INDEX_BITS;
+  s->sent_id += n;
 }
 
-/// Process a "control" word
+/// Process a "control" word of a message of n slots
 static inline int ump_control_process(struct ump_channel *s,
-    struct ump_control ctrl)
+    struct ump_control ctrl, ump_index_t n)
 {
-  s->ack_id = ctrl.header & UMP_INDEX_MASK;
-  s->seq_id++;
+  s->seq_id += n;
   return ctrl.header >> UMP_INDEX_BITS;
 }
 
-/// Computes (from seq/ack numbers) whether we can currently send on the channel
-static inline int ump_can_send(struct ump_channel *s)
+/// Computes (from seq/ack numbers) whether we can currently send n slots on the channel
+static inline int ump_can_send(struct ump_channel *s, ump_index_t n)
+{
+  return (ump_index_t) (s->sent_id + n - s->ack_id) <= s->max_send_msgs;
+}
+
+// read the acks of remote. Return 1 if there are new ones, 0 otherwise.
+// The cursor can be written at any time by a remote that has mmap'ed its area: it is read
+// once, and ignored if it acks slots that have not been sent
+static inline int ump_read_remote_cursor(struct ump_channel *s)
 {
-  return (ump_index_t) (s->sent_id - s->ack_id) < s->max_send_msgs;
+  ump_index_t read = ACCESS_ONCE(s->remote_cursor->read);
+
+  if (read == s->ack_id
+      || (ump_index_t) (read - s->ack_id) > (ump_index_t) (s->sent_id - s->ack_id))
+  {
+    return 0;
+  }
+  s->ack_id = read;
+  return 1;
 }
 
-// return 1 if an ack is needed (to be sent), 0 otherwise
+// return 1 if an ack is needed (to be published), 0 otherwise
 static inline int ump_send_ack_is_needed(struct ump_channel *s)
 {
-  return (ump_index_t) (s->seq_id - s->last_ack) >= s->max_send_msgs - 1;
+  return (ump_index_t) (s->seq_id - s->last_ack) >= s->ack_window;
 }
 
 /**
- * \brief Return pointer to a message if outstanding on 'c'.
+ * \brief Return the control word of a message if outstanding on 'c'.
  *
  * \param c     Pointer to UMP channel-state structure.
  *
- * \return Pointer to message if outstanding, or NULL.
+ * \return Pointer to the control word of the message if outstanding, or NULL.
  */
-static inline struct ump_message *ump_impl_poll(struct ump_chan_state *c)
+static inline union ump_header *ump_impl_poll(struct ump_chan_state *c)
 {
-  struct ump_control ctrl = c->buf[c->pos].header.control;
+  union ump_header *h = ump_slot_header(c, c->pos);
+  struct ump_control ctrl = *(volatile struct ump_control*) &h->msg.control;
   if (ctrl.epoch == c->epoch)
   {
-    return &c->buf[c->pos];
+    return h;
   }
   else
   {
@@ -246,25 +386,47 @@ static inline struct ump_message *ump_impl_poll(struct ump_chan_state *c)
 }
 
 /**
- * \brief Return pointer to a message if outstanding on 'c' and
- * advance pointer.
+ * \brief Return the control word of a message if outstanding on 'c' and
+ * advance pointer past its slots.
+ * The other end can write the length at any time if it has mmap'ed its area: it is read
+ * once, checked against the end of the ring, and only this copy must be used.
  *
  * \param c     Pointer to UMP channel-state structure.
+ * \param first Pointer to storage for the index of the first slot of the message
+ * \param len   Pointer to storage for the length of the message, in bytes
+ * \param n     Pointer to storage for the number of slots of the message
  *
- * \return Pointer to message if outstanding, or NULL.
+ * \return Pointer to the control word of the message if outstanding, NULL if there is
+ *   none, or ERR_PTR(-EIO) if the message does not fit before the end of the ring.
  */
-static inline struct ump_message *ump_impl_recv(struct ump_chan_state *c)
+static inline union ump_header *ump_impl_recv(struct ump_chan_state *c,
+    ump_index_t *first, size_t *len, ump_index_t *n)
 {
-  struct ump_message *msg = ump_impl_poll(c);
+  union ump_header *h = ump_impl_poll(c);
+  size_t l;
 
-  if (msg != NULL)
+  if (h != NULL)
   {
-    if (++c->pos == c->bufmsgs)
+    // the length has been written before the control word
+    BARRIER();
+    l = ACCESS_ONCE(h->msg.len);
+
+    // in size_t: ump_nb_slots() returns an ump_index_t, which could wrap around
+    if (unlikely(l > (size_t) (c->bufmsgs - c->pos) * c->slot_payload))
+    {
+      return ERR_PTR(-EIO);
+    }
+
+    *first = c->pos;
+    *len = l;
+    *n = ump_nb_slots(c, l);
+    c->pos += *n;
+    if (c->pos >= c->bufmsgs)
     {
       c->pos = 0;
       c->epoch = !c->epoch;
     }
-    return msg;
+    return h;
   }
   else
   {
@@ -280,28 +442,6 @@ static inline int ump_endpoint_can_recv(struct ump_chan_state *chan)
   return ump_impl_poll(chan) != NULL;
 }
 
-/**
- * \brief Retrieve a message from the given UMP channel, if possible
- *
- * Non-blocking, may fail if there are no messages available.
- *
- * Return 0 if there is a message, 1 otherwise
- */
-static inline int ump_endpoint_recv(struct ump_chan_state *chan,
-    volatile struct ump_message **msg)
-{
-  *msg = ump_impl_recv(chan);
-
-  if (*msg != NULL)
-  {
-    return 0;
-  }
-  else
-  {
-    return 1;
-  }
-}
-
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);
 MODULE_DESCRIPTION(DRIVER_DESC);
@@ -0,0 +1,504 @@
+/*
+ * Small library to send and receive the messages of a kbfish channel in user space.
+ * The UMP protocol is the one of kbfish.c: a message spans consecutive slots and never
+ * wraps, the end of the ring is padded, and the acks are the cursor of the reader.
+ * It can be compiled with a C or a C++ compiler.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kbfish_ump.h"
+
+#define UMP_INDEX_BITS (sizeof(ump_index_t) * 8)
+
+// the control word, accessed as a whole
+typedef ump_control_t __attribute__((may_alias)) ump_control_word_t;
+
+#define BARRIER() __asm volatile ("" : : : "memory")
+
+#define min(a, b) (a < b ? a : b)
+#define max(a, b) (a > b ? a : b)
+
+/// Special message types, as in kbfish.h
+enum ump_msgtype
+{
+  UMP_MSG = 0, UMP_PAD = 1, UMP_CONT = 2,
+};
+
+// return the size of a slot that holds message_size bytes
+static size_t get_ump_message_size(size_t message_size)
+{
+  return (message_size + sizeof(union ump_header) + KBFISH_CACHE_LINE_SIZE - 1)
+      / KBFISH_CACHE_LINE_SIZE * KBFISH_CACHE_LINE_SIZE;
+}
+
+// return the address of the slot i of r, i.e. of its payload
+static inline char *ump_slot_data(struct kbfish_ump_ring *r, ump_index_t i)
+{
+  return r->buf + (size_t) i * r->slot_bytes;
+}
+
+// return the control word of the slot i of r
+static inline union ump_header *ump_slot_header(struct kbfish_ump_ring *r,
+    ump_index_t i)
+{
+  return (union ump_header*) (ump_slot_data(r, i) + r->slot_payload);
+}
+
+// write ctrl in the control word of h with a single store.
+// The word is accessed as a ump_control_t, for the C++ compilers
+static inline void ump_set_control(union ump_header *h, struct ump_control ctrl)
+{
+  ump_control_t v;
+
+  memcpy(&v, &ctrl, sizeof(v));
+  *(volatile ump_control_word_t*) &h->msg.control = v;
+}
+
+// return the number of slots of a message of len bytes on r
+static inline ump_index_t ump_nb_slots(struct kbfish_ump_ring *r, size_t len)
+{
+  if (len <= r->slot_payload)
+  {
+    return 1;
+  }
+  return (len + r->slot_payload - 1) / r->slot_payload;
+}
+
+// return the control word of the message at the current position of r, or NULL
+static inline union ump_header *ump_poll(struct kbfish_ump_ring *r)
+{
+  union ump_header *h = ump_slot_header(r, r->pos);
+  ump_control_t v = *(volatile ump_control_word_t*) &h->msg.control;
+  struct ump_control ctrl;
+
+  memcpy(&ctrl, &v, sizeof(ctrl));
+
+  return (ctrl.epoch == r->epoch ? h : NULL);
+}
+
+// can we send n slots?
+static inline int ump_can_send(struct kbfish_ump *chan, ump_index_t n)
+{
+  return (ump_index_t) (chan->sent_id + n - chan->ack_id)
+      <= chan->send_ring.bufmsgs;
+}
+
+// read the acks of remote. Return 1 if there are new ones, 0 otherwise.
+// The cursor is written by the other end: it is ignored if it acks slots we have not sent
+static inline int ump_read_remote_cursor(struct kbfish_ump *chan)
+{
+  ump_index_t read = chan->remote_cursor->read;
+
+  if (read == chan->ack_id
+      || (ump_index_t) (read - chan->ack_id) > (ump_index_t) (chan->sent_id - chan->ack_id))
+  {
+    return 0;
+  }
+  chan->ack_id = read;
+  return 1;
+}
+
+// wake up the other end if it sleeps, i.e. if it has set the sleeping flag of its cursor,
+// and if we have not woken up this wait yet
+static void kbfish_ump_wake_peer(struct kbfish_ump *chan)
+{
+  uint32_t sleeping;
+
+  // the message or the acks are visible before the flag is read. The other end sets the
+  // flag before it checks the channel one last time
+  __sync_synchronize();
+  sleeping = chan->remote_cursor->sleeping;
+  if (sleeping && sleeping != chan->woken)
+  {
+    chan->woken = sleeping;
+    ioctl(chan->fd, KBFISH_IOCTL_WAKE, 0);
+    chan->nb_syscalls++;
+  }
+}
+
+// wait until ready(chan) is true: poll, then sleep in the kernel.
+// Return 0 or -1 if the wait has been interrupted (errno is set)
+static int kbfish_ump_wait(struct kbfish_ump *chan,
+    int (*ready)(struct kbfish_ump *))
+{
+  int i, r;
+
+  for (i = 0; i < KBFISH_UMP_SPIN_LOOPS; i++)
+  {
+    if (ready(chan))
+    {
+      return 0;
+    }
+    __asm volatile ("pause" : : : "memory");
+  }
+
+  while (1)
+  {
+    // the other end wakes us up only if it sees the flag. It is never 0
+    if (++chan->sleeps == 0)
+    {
+      chan->sleeps = 1;
+    }
+    chan->local_cursor->sleeping = chan->sleeps;
+    __sync_synchronize();
+    if (ready(chan))
+    {
+      chan->local_cursor->sleeping = 0;
+      return 0;
+    }
+
+    r = ioctl(chan->fd, KBFISH_IOCTL_WAIT, 0);
+    chan->nb_syscalls++;
+    chan->local_cursor->sleeping = 0;
+    if (r < 0)
+    {
+      return -1;
+    }
+  }
+}
+
+static int ump_can_recv(struct kbfish_ump *chan)
+{
+  return ump_poll(&chan->recv_ring) != NULL;
+}
+
+static int ump_has_new_acks(struct kbfish_ump *chan)
+{
+  return ump_read_remote_cursor(chan);
+}
+
+/*
+ * publish the acks of chan in its local cursor if the ack window is reached, or if idle is
+ * set and there is something to publish. An end publishes all its acks before it waits:
+ * a peer that waits for slots can always make progress.
+ */
+static void ump_ack(struct kbfish_ump *chan, int idle)
+{
+  if ((ump_index_t) (chan->seq_id - chan->last_ack) < chan->ack_window
+      && (!idle || chan->seq_id == chan->last_ack))
+  {
+    return;
+  }
+
+  // the payloads have been read before the slots are given back
+  BARRIER();
+  chan->local_cursor->read = chan->seq_id;
+  chan->last_ack = chan->seq_id;
+
+  kbfish_ump_wake_peer(chan);
+}
+
+/*
+ * write in the n next slots of chan a message of type msgtype, whose payload is the len bytes
+ * of msg, or nothing if msg is NULL. The control word of the first slot is written last.
+ */
+static void ump_write_msg(struct kbfish_ump *chan, int msgtype,
+    const char *msg, size_t len, ump_index_t n)
+{
+  struct kbfish_ump_ring *r;
+  struct ump_control ctrl, cont;
+  union ump_header *h;
+  ump_index_t first, i;
+  size_t off;
+
+  r = &chan->send_ring;
+  first = r->pos;
+  ctrl.epoch = r->epoch;
+  ctrl.header = (ump_control_t) msgtype << UMP_INDEX_BITS;
+
+  r->pos += n;
+  if (r->pos == r->bufmsgs)
+  {
+    r->pos = 0;
+    r->epoch = !r->epoch;
+  }
+
+  cont.epoch = ctrl.epoch;
+  cont.header = (ump_control_t) UMP_CONT << UMP_INDEX_BITS;
+  for (i = 1; i < n; i++)
+  {
+    off = (size_t) i * r->slot_payload;
+    if (msg && off < len)
+    {
+      memcpy(ump_slot_data(r, first + i), msg + off,
+          min(r->slot_payload, len - off));
+    }
+    ump_set_control(ump_slot_header(r, first + i), cont);
+  }
+  if (msg)
+  {
+    memcpy(ump_slot_data(r, first), msg, min(r->slot_payload, len));
+  }
+
+  chan->sent_id += n;
+  h = ump_slot_header(r, first);
+  h->msg.len = len;
+  BARRIER();
+  ump_set_control(h, ctrl);
+}
+
+/*
+ * wait until n consecutive slots can be sent on chan, padding the end of the ring if needed.
+ * Return 0 or -1 if the wait has been interrupted (errno is set)
+ */
+static int wait_for_slots(struct kbfish_ump *chan, ump_index_t n)
+{
+  ump_index_t pad;
+
+  while (1)
+  {
+    // a message does not wrap around the end of the ring
+    pad = chan->send_ring.bufmsgs - chan->send_ring.pos;
+    if (pad < n)
+    {
+      if (ump_can_send(chan, pad))
+      {
+        ump_write_msg(chan, UMP_PAD, NULL,
+            (size_t) pad * chan->send_ring.slot_payload, pad);
+        // the reader must consume the padding before it can ack the slots we wait for
+        kbfish_ump_wake_peer(chan);
+        continue;
+      }
+    }
+    else if (ump_can_send(chan, n))
+    {
+      return 0;
+    }
+
+    if (!ump_read_remote_cursor(chan))
+    {
+      ump_ack(chan, 1);
+      if (kbfish_ump_wait(chan, ump_has_new_acks) < 0)
+      {
+        return -1;
+      }
+    }
+  }
+}
+
+/*
+ * receive the message at the current position of chan, which must be there, and place it in
+ * msg of size len.
+ * The other end can write the length at any time: it is read once, checked against the end
+ * of the ring, and only this copy is used.
+ * Return its size, 0 if it is not a message (e.g. the padding of the end of the ring), or -1
+ * if it does not fit before the end of the ring (errno is set to EIO)
+ */
+static int ump_recv_one(struct kbfish_ump *chan, void *msg, size_t len)
+{
+  struct kbfish_ump_ring *r;
+  union ump_header *h;
+  ump_index_t first, n;
+  size_t off, msg_len;
+  int msgtype;
+
+  r = &chan->recv_ring;
+  h = ump_poll(r);
+
+  // the length has been written before the control word
+  BARRIER();
+  msg_len = *(volatile uint32_t*) &h->msg.len;
+
+  // in size_t: ump_nb_slots() returns an ump_index_t, which could wrap around
+  first = r->pos;
+  if (msg_len > (size_t) (r->bufmsgs - first) * r->slot_payload)
+  {
+    printf("[%s:%i] Error: message of %lu bytes larger than the ring\n", __func__,
+        __LINE__, (unsigned long) msg_len);
+    errno = EIO;
+    return -1;
+  }
+  n = ump_nb_slots(r, msg_len);
+  r->pos += n;
+  if (r->pos >= r->bufmsgs)
+  {
+    r->pos = 0;
+    r->epoch = !r->epoch;
+  }
+  chan->seq_id += n;
+
+  msgtype = h->msg.control.header >> UMP_INDEX_BITS;
+  if (msgtype != UMP_MSG)
+  {
+    ump_ack(chan, 0);
+    return 0;
+  }
+
+  len = min(len, msg_len);
+  for (off = 0; off < len; off += r->slot_payload)
+  {
+    memcpy((char*) msg + off, ump_slot_data(r, first + off / r->slot_payload),
+        min(r->slot_payload, len - off));
+  }
+
+  ump_ack(chan, 0);
+
+  return len;
+}
+
+int kbfish_ump_open(struct kbfish_ump *chan, const char *devfile,
+    int is_receiver)
+{
+  struct kbfish_channel_params params;
+  off_t own, other;
+  char *send_buf, *recv_buf;
+  int err;
+
+  chan->fd = open(devfile, (is_receiver ? O_RDWR | O_CREAT : O_RDWR), 0666);
+  if (chan->fd < 0)
+  {
+    return -1;
+  }
+
+  if (ioctl(chan->fd, KBFISH_IOCTL_GET_PARAMS, &params) < 0)
+  {
+    goto error;
+  }
+
+  chan->send_ring.slot_bytes = get_ump_message_size(params.max_msg_size);
+  chan->send_ring.slot_payload = chan->send_ring.slot_bytes
+      - sizeof(union ump_header);
+  chan->send_ring.bufmsgs = params.channel_size;
+  chan->recv_ring = chan->send_ring;
+
+  chan->area_len = (size_t) params.channel_size * chan->send_ring.slot_bytes
+      + sizeof(struct ump_cursor);
+
+  own = (is_receiver ? KBFISH_RECEIVER_TO_SENDER_PGOFF
+      : KBFISH_SENDER_TO_RECEIVER_PGOFF) * sysconf(_SC_PAGESIZE);
+  other = (is_receiver ? KBFISH_SENDER_TO_RECEIVER_PGOFF
+      : KBFISH_RECEIVER_TO_SENDER_PGOFF) * sysconf(_SC_PAGESIZE);
+
+  // the kernel refuses to map the area of the other end in write mode
+  send_buf = (char*) mmap(NULL, chan->area_len, PROT_WRITE, MAP_SHARED, chan->fd,
+      own);
+  if (send_buf == MAP_FAILED)
+  {
+    goto error;
+  }
+  recv_buf = (char*) mmap(NULL, chan->area_len, PROT_READ, MAP_SHARED, chan->fd,
+      other);
+  if (recv_buf == MAP_FAILED)
+  {
+    err = errno;
+    munmap(send_buf, chan->area_len);
+    errno = err;
+    goto error;
+  }
+
+  // kbfish has initialized the ring of this end, and its cursor, when it has been opened
+  chan->send_ring.buf = send_buf;
+  chan->send_ring.pos = 0;
+  chan->send_ring.epoch = 1;
+  chan->recv_ring.buf = recv_buf;
+  chan->recv_ring.pos = 0;
+  chan->recv_ring.epoch = 1;
+
+  chan->local_cursor = (struct ump_cursor*) ump_slot_data(&chan->send_ring,
+      params.channel_size);
+  chan->remote_cursor = (struct ump_cursor*) ump_slot_data(&chan->recv_ring,
+      params.channel_size);
+
+  chan->sent_id = 0;
+  chan->seq_id = 0;
+  chan->ack_id = 0;
+  chan->last_ack = 0;
+  chan->ack_window = max(params.ack_window, 1);
+
+  chan->max_msg_len = (size_t) params.channel_size * chan->send_ring.slot_payload;
+  chan->sleeps = 0;
+  chan->woken = 0;
+  chan->nb_syscalls = 0;
+
+  return 0;
+
+  error:
+  // close() must not overwrite the error
+  err = errno;
+  close(chan->fd);
+  errno = err;
+  return -1;
+}
+
+void kbfish_ump_close(struct kbfish_ump *chan)
+{
+  munmap(chan->send_ring.buf, chan->area_len);
+  munmap(chan->recv_ring.buf, chan->area_len);
+
+  close(chan->fd);
+}
+
+int kbfish_ump_send(struct kbfish_ump *chan, const void *msg, size_t len)
+{
+  ump_index_t n;
+
+  // as write() on kbfish, which does not send empty messages
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  len = min(chan->max_msg_len, len);
+  n = ump_nb_slots(&chan->send_ring, len);
+
+  if (wait_for_slots(chan, n) < 0)
+  {
+    return -1;
+  }
+
+  ump_write_msg(chan, UMP_MSG, (const char*) msg, len, n);
+
+  // wake up the reader if it sleeps
+  kbfish_ump_wake_peer(chan);
+
+  return len;
+}
+
+int kbfish_ump_recv(struct kbfish_ump *chan, void *msg, size_t len)
+{
+  int r;
+
+  while (1)
+  {
+    if (!ump_can_recv(chan))
+    {
+      ump_ack(chan, 1);
+      if (kbfish_ump_wait(chan, ump_can_recv) < 0)
+      {
+        return -1;
+      }
+    }
+
+    r = ump_recv_one(chan, msg, len);
+    if (r != 0)
+    {
+      return r;
+    }
+  }
+}
+
+int kbfish_ump_recv_nonblocking(struct kbfish_ump *chan, void *msg, size_t len)
+{
+  int r;
+
+  while (ump_can_recv(chan))
+  {
+    r = ump_recv_one(chan, msg, len);
+    if (r != 0)
+    {
+      return r;
+    }
+  }
+
+  ump_ack(chan, 1);
+  return 0;
+}
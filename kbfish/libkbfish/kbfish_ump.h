@@ -0,0 +1,143 @@
+/*
+ * Small library to send and receive the messages of a kbfish channel in user space.
+ * The 2 areas of the channel are mmap'ed: the messages and the acks are written and polled
+ * directly, as in bfishmprotect. The kernel is only entered, with the ioctls of kbfish, when
+ * the other end sleeps. The kernel still isolates the 2 ends: each one can only write
+ * in its own area.
+ * It can be compiled with a C or a C++ compiler.
+ */
+
+#ifndef _KBFISH_UMP_LIB_
+#define _KBFISH_UMP_LIB_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// IOCTL commands. They are also defined in kbfish.h
+// arg is a pointer to a struct kbfish_channel_params
+#define KBFISH_IOCTL_GET_PARAMS 0x1
+// sleep until the other end calls KBFISH_IOCTL_WAKE. arg is not used
+#define KBFISH_IOCTL_WAIT 0x2
+// wake up the other end. arg is not used
+#define KBFISH_IOCTL_WAKE 0x3
+
+// mmap offsets (in pages) of the 2 areas of a channel. They are also defined in kbfish.h
+#define KBFISH_SENDER_TO_RECEIVER_PGOFF 1
+#define KBFISH_RECEIVER_TO_SENDER_PGOFF 2
+
+// number of polls of the channel before going to sleep in the kernel
+#define KBFISH_UMP_SPIN_LOOPS 1000
+
+#define KBFISH_CACHE_LINE_SIZE 64
+
+// Parameters of a channel. It is also defined in kbfish.h
+struct kbfish_channel_params
+{
+  int channel_size; /* number of slots */
+  int max_msg_size; /* payload size of a slot */
+  int ack_window;   /* number of received slots after which a reader publishes its cursor */
+};
+
+// Layout of the areas. They are also defined in kbfish.h
+typedef uint32_t ump_control_t;
+struct ump_control
+{
+  ump_control_t epoch :1;
+  ump_control_t header :31;
+};
+
+union ump_header
+{
+  struct
+  {
+    struct ump_control control; ///< written last: publishes the message
+    uint32_t len; ///< length of the message in bytes, written before control
+  } msg;
+  uint64_t raw;
+};
+
+typedef uint16_t ump_index_t;
+
+// the number of slots consumed by the owner of the area, and whether it sleeps: sleeping is
+// 0 or the number of its current wait, so that it is woken up once per wait
+struct ump_cursor
+{
+  volatile ump_index_t read;
+  volatile uint32_t sleeping;
+} __attribute__((aligned (KBFISH_CACHE_LINE_SIZE)));
+
+// State of a (one-way) ring
+struct kbfish_ump_ring
+{
+  char *buf; ///< Ring buffer
+  size_t slot_bytes; ///< Size of a slot, control word included
+  size_t slot_payload; ///< Payload bytes of a slot
+  ump_index_t pos; ///< Current position
+  ump_index_t bufmsgs; ///< Buffer size in slots
+  int epoch; ///< Next Message epoch
+};
+
+// An end of a kbfish channel whose areas are mmap'ed
+struct kbfish_ump
+{
+  int fd; ///< file descriptor of /dev/kbfish<i>
+  size_t area_len; ///< size of the mapping of each area
+
+  struct kbfish_ump_ring send_ring; ///< Outgoing ring
+  struct kbfish_ump_ring recv_ring; ///< Incoming ring
+
+  ump_index_t sent_id; ///< Number of slots sent
+  ump_index_t seq_id; ///< Number of slots received from remote
+  ump_index_t ack_id; ///< Number of slots acknowledged by remote
+  ump_index_t last_ack; ///< Last acknowledgement we published in local_cursor
+  ump_index_t ack_window; ///< Number of received slots after which local_cursor is published
+
+  struct ump_cursor *local_cursor; ///< Acks of the recv ring, written by us
+  struct ump_cursor *remote_cursor; ///< Acks of the send ring, written by remote
+
+  size_t max_msg_len; ///< Max length of a message, in bytes
+
+  uint32_t sleeps; ///< Number of the last wait, written in the sleeping flag of local_cursor
+  uint32_t woken; ///< Number of the last wait of remote we have woken up
+
+  unsigned long nb_syscalls; ///< Number of ioctls made to wait or to wake up the other end
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/********************** Exported interface **********************/
+
+// Open the channel of device file devfile, as the receiver if is_receiver is 1 and
+// as the sender otherwise, and map its areas.
+// Return 0 or -1 if an error has occured (errno is set)
+int kbfish_ump_open(struct kbfish_ump *chan, const char *devfile,
+    int is_receiver);
+
+// Unmap the areas and close the channel
+void kbfish_ump_close(struct kbfish_ump *chan);
+
+// Send the message msg of size len, which is truncated to chan->max_msg_len.
+// Is blocking.
+// Return the size of the sent message, 0 if len is 0, or -1 if an error has occured
+// (errno is set)
+int kbfish_ump_send(struct kbfish_ump *chan, const void *msg, size_t len);
+
+// Receive a message and place it in msg of size len.
+// Is blocking.
+// Return the size of the received message or -1 if an error has occured (errno is set)
+int kbfish_ump_recv(struct kbfish_ump *chan, void *msg, size_t len);
+
+// Receive a message and place it in msg of size len.
+// Is not blocking.
+// Return the size of the received message, 0 if there is no message, or -1 if an error has
+// occured (errno is set)
+int kbfish_ump_recv_nonblocking(struct kbfish_ump *chan, void *msg, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -11,6 +11,13 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UMP_COPY_X86
+#endif
 
 #include "bfishmprotect.h"
 
@@ -25,9 +32,11 @@
 #undef BFISH_MPROTECT_DEBUG
 
 /// Special message types
+// UMP_PAD fills the end of the ring and UMP_CONT marks the other slots of a message.
+// The acks are not messages: see struct ump_cursor.
 enum ump_msgtype
 {
-  UMP_MSG = 0, UMP_ACK = 1,
+  UMP_MSG = 0, UMP_PAD = 1, UMP_CONT = 2,
 };
 
 #define MAX_NB_CHANNELS 256
@@ -35,6 +44,236 @@ enum ump_msgtype
 // an array: memory protection file number -> the 2 corresponding channels
 struct ump_channel all_channels[MAX_NB_CHANNELS][2];
 
+// the receive sets: their doorbells and their number of channels
+struct
+{
+  struct ump_doorbell *doorbell;
+  int nb_channels;
+} all_recv_sets[MAX_NB_CHANNELS];
+
+/// Instruction set of the non-temporal copy
+enum ump_nt_isa
+{
+  UMP_NT_UNKNOWN = -1, UMP_NT_NONE = 0, UMP_NT_SSE2 = 1, UMP_NT_AVX = 2,
+};
+
+static enum ump_nt_isa nt_isa = UMP_NT_UNKNOWN;
+static size_t nt_copy_threshold = DEFAULT_NT_COPY_THRESHOLD;
+static size_t prefetch_copy_threshold = DEFAULT_PREFETCH_COPY_THRESHOLD;
+
+// -1 until it has been read in the environment
+static int ack_window = -1;
+static int spin_loops = -1;
+
+// detect the instruction set of the non-temporal copy and read the thresholds
+// in the environment, once
+static void ump_copy_init(void)
+{
+  char *s;
+
+  if (nt_isa != UMP_NT_UNKNOWN)
+  {
+    return;
+  }
+
+  nt_isa = UMP_NT_NONE;
+#ifdef UMP_COPY_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx"))
+  {
+    nt_isa = UMP_NT_AVX;
+  }
+  else if (__builtin_cpu_supports("sse2"))
+  {
+    nt_isa = UMP_NT_SSE2;
+  }
+#endif
+
+  s = getenv("BFISH_NT_COPY_THRESHOLD");
+  if (s)
+  {
+    nt_copy_threshold = strtoul(s, NULL, 10);
+  }
+
+  s = getenv("BFISH_PREFETCH_COPY_THRESHOLD");
+  if (s)
+  {
+    prefetch_copy_threshold = strtoul(s, NULL, 10);
+  }
+}
+
+/*
+ * The sender copies the payloads of at least nt_copy_threshold bytes with non-temporal
+ * stores, so that it does not fill its cache with data that only the receiver reads.
+ * The receiver copies the payloads of at least prefetch_copy_threshold bytes with software
+ * prefetching. 0 disables the copy. The instruction set of the non-temporal stores is
+ * detected at run time.
+ */
+void set_copy_thresholds(size_t nt_threshold, size_t prefetch_threshold)
+{
+  ump_copy_init();
+
+  nt_copy_threshold = nt_threshold;
+  prefetch_copy_threshold = prefetch_threshold;
+}
+
+#ifdef UMP_COPY_X86
+// Copy len bytes of src in dst, aligned on a cache line, with SSE2 non-temporal stores.
+// The end of the last cache line is copied with memcpy().
+__attribute__((target("sse2")))
+static void ump_nt_copy_sse2(char *dst, const char *src, size_t len)
+{
+  __m128i a, b, c, d;
+
+  for (; len >= CACHELINE_BYTES; len -= CACHELINE_BYTES)
+  {
+    a = _mm_loadu_si128((const __m128i*) src);
+    b = _mm_loadu_si128((const __m128i*) (src + 16));
+    c = _mm_loadu_si128((const __m128i*) (src + 32));
+    d = _mm_loadu_si128((const __m128i*) (src + 48));
+    _mm_stream_si128((__m128i*) dst, a);
+    _mm_stream_si128((__m128i*) (dst + 16), b);
+    _mm_stream_si128((__m128i*) (dst + 32), c);
+    _mm_stream_si128((__m128i*) (dst + 48), d);
+    src += CACHELINE_BYTES;
+    dst += CACHELINE_BYTES;
+  }
+  memcpy(dst, src, len);
+
+  // the non-temporal stores are weakly ordered: they must be visible before the header
+  _mm_sfence();
+}
+
+// Same as ump_nt_copy_sse2(), with AVX non-temporal stores.
+__attribute__((target("avx")))
+static void ump_nt_copy_avx(char *dst, const char *src, size_t len)
+{
+  __m256i a, b;
+
+  for (; len >= CACHELINE_BYTES; len -= CACHELINE_BYTES)
+  {
+    a = _mm256_loadu_si256((const __m256i*) src);
+    b = _mm256_loadu_si256((const __m256i*) (src + 32));
+    _mm256_stream_si256((__m256i*) dst, a);
+    _mm256_stream_si256((__m256i*) (dst + 32), b);
+    src += CACHELINE_BYTES;
+    dst += CACHELINE_BYTES;
+  }
+  memcpy(dst, src, len);
+
+  // the non-temporal stores are weakly ordered: they must be visible before the header
+  _mm_sfence();
+}
+#endif
+
+/*
+ * The receiver publishes its acks every window received slots, and whenever it has no more
+ * message to receive. 0 is half of the ring. Applies to the channels opened afterwards.
+ */
+void set_ack_window(int window)
+{
+  ack_window = window;
+}
+
+// return the ack window of a channel of nb_messages slots
+static ump_index_t get_ack_window(int nb_messages)
+{
+  char *s;
+  int w;
+
+  if (ack_window < 0)
+  {
+    s = getenv("BFISH_ACK_WINDOW");
+    ack_window = (s ? atoi(s) : DEFAULT_ACK_WINDOW);
+    ack_window = max(ack_window, 0);
+  }
+
+  w = (ack_window > 0 ? ack_window : nb_messages / 2);
+  return min(max(w, 1), nb_messages);
+}
+
+/*
+ * A process that waits for a message, or for free slots, polls the channel loops times
+ * before it sleeps on the futex. 0 sleeps at once.
+ */
+void set_spin_loops(int loops)
+{
+  spin_loops = max(loops, 0);
+}
+
+// return the number of polls before sleeping
+static int get_spin_loops(void)
+{
+  char *s;
+
+  if (spin_loops < 0)
+  {
+    s = getenv("BFISH_SPIN_LOOPS");
+    spin_loops = (s ? atoi(s) : DEFAULT_SPIN_LOOPS);
+    spin_loops = max(spin_loops, 0);
+
+    // the other end cannot run while we poll
+    if (!s && sysconf(_SC_NPROCESSORS_ONLN) == 1)
+    {
+      spin_loops = 0;
+    }
+  }
+
+  return spin_loops;
+}
+
+/*
+ * copy the payload src of size len in dst, a message of a channel.
+ * dst must be aligned on a cache line.
+ */
+void ump_copy_to_message(void *dst, const void *src, size_t len)
+{
+#ifdef UMP_COPY_X86
+  if (nt_copy_threshold > 0 && len >= nt_copy_threshold)
+  {
+    switch (nt_isa)
+    {
+    case UMP_NT_AVX:
+      ump_nt_copy_avx((char*) dst, (const char*) src, len);
+      return;
+    case UMP_NT_SSE2:
+      ump_nt_copy_sse2((char*) dst, (const char*) src, len);
+      return;
+    default:
+      break;
+    }
+  }
+#endif
+
+  memcpy(dst, src, len);
+}
+
+/*
+ * copy the payload src of size len, a message of a channel, in dst.
+ */
+void ump_copy_from_message(void *dst, const void *src, size_t len)
+{
+  size_t off, p;
+
+  if (prefetch_copy_threshold == 0 || len < prefetch_copy_threshold)
+  {
+    memcpy(dst, src, len);
+    return;
+  }
+
+  // the next block is prefetched while memcpy() copies the current one
+  for (off = 0; off < len; off += PREFETCH_DISTANCE)
+  {
+    for (p = off + PREFETCH_DISTANCE; p < min(off + 2 * PREFETCH_DISTANCE, len);
+        p += CACHELINE_BYTES)
+    {
+      __builtin_prefetch((const char*) src + p, 0, 0);
+    }
+    memcpy((char*) dst + off, (const char*) src + off,
+        min(PREFETCH_DISTANCE, len - off));
+  }
+}
+
 /* create 2 channels that will use mprotectfile mprotectfile of number n for memory protection */
 int create_channel(char *mprotectfile, int n)
 {
@@ -76,6 +315,93 @@ void destroy_channel(int n)
   futex_destroy(all_channels[n][0].recv_chan.f);
 }
 
+/*
+ * create the receive set s, whose doorbell is a shared memory segment identified by the file
+ * path. Like create_channel(), it is called before the processes are created.
+ * Return 0, or -1 if an error has occured.
+ */
+int create_recv_set(char *path, int s)
+{
+  struct ump_doorbell *d;
+  key_t key;
+  int shmid;
+
+  if (s >= MAX_NB_CHANNELS)
+  {
+    printf("[%s:%i] Receive set number is too high: %i >= %i\n", __func__,
+        __LINE__, s, MAX_NB_CHANNELS);
+    return -1;
+  }
+
+  key = ftok(path, 'd');
+  if (key == -1)
+  {
+    perror("Receive set ftok");
+    return -1;
+  }
+
+  shmid = shmget(key, sizeof(*d), IPC_CREAT | 0666);
+  if (shmid == -1)
+  {
+    perror("Receive set shmget");
+    return -1;
+  }
+
+  d = (struct ump_doorbell*) shmat(shmid, NULL, 0);
+  if (d == (void*) -1)
+  {
+    perror("Receive set shmat");
+    return -1;
+  }
+
+  d->f.seq = 0;
+  d->f.waiters = 0;
+  d->bits = 0;
+
+  all_recv_sets[s].doorbell = d;
+  all_recv_sets[s].nb_channels = 0;
+
+  return 0;
+}
+
+/* destroy the receive set s */
+void destroy_recv_set(int s)
+{
+  if (all_recv_sets[s].doorbell)
+  {
+    shmdt(all_recv_sets[s].doorbell);
+    all_recv_sets[s].doorbell = NULL;
+  }
+}
+
+/*
+ * add the channel using memory protection file number n, created with create_channel(), to
+ * the receive set s: its sender rings the doorbell of s. Is called before the processes are
+ * created, after create_channel() and create_recv_set().
+ * Return the bit of the channel in the set, or -1 if the set is full.
+ */
+int add_channel_to_recv_set(int n, int s)
+{
+  int bit;
+
+  bit = all_recv_sets[s].nb_channels;
+  if (bit >= UMP_RECV_SET_MAX_CHANNELS)
+  {
+    printf("[%s:%i] Receive set %i is full: %i channels\n", __func__, __LINE__,
+        s, bit);
+    return -1;
+  }
+  all_recv_sets[s].nb_channels++;
+
+  // the messages go from all_channels[n][0] to all_channels[n][1]
+  all_channels[n][0].send_chan.doorbell = all_recv_sets[s].doorbell;
+  all_channels[n][0].send_chan.doorbell_bit = (uint64_t) 1 << bit;
+  all_channels[n][1].recv_chan.doorbell = all_recv_sets[s].doorbell;
+  all_channels[n][1].recv_chan.doorbell_bit = (uint64_t) 1 << bit;
+
+  return bit;
+}
+
 /*
  * open a channel using the special file mprotectfile for memory protection.
  * The channel size is (for both direction) nb_messages * message_size.
@@ -89,6 +415,8 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
   struct ump_channel *chan;
   ump_index_t i;
 
+  ump_copy_init();
+
   if (is_receiver)
   {
     chan = &all_channels[nb][1];
@@ -98,8 +426,14 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
     chan = &all_channels[nb][0];
   }
 
-  chan->inchanlen = (size_t) nb_messages * sizeof(struct ump_message);
-  chan->outchanlen = (size_t) nb_messages * sizeof(struct ump_message);
+  chan->recv_chan.slot_bytes = get_ump_message_size(message_size);
+  chan->send_chan.slot_bytes = chan->recv_chan.slot_bytes;
+  chan->recv_chan.slot_payload = chan->recv_chan.slot_bytes
+      - sizeof(union ump_header);
+  chan->send_chan.slot_payload = chan->recv_chan.slot_payload;
+
+  chan->inchanlen = get_ump_area_size(nb_messages, message_size);
+  chan->outchanlen = get_ump_area_size(nb_messages, message_size);
 
   if (is_receiver)
   {
@@ -110,7 +444,7 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
       exit(-1);
     }
 
-    chan->recv_chan.buf = (struct ump_message*) mmap(NULL, chan->inchanlen,
+    chan->recv_chan.buf = (char*) mmap(NULL, chan->inchanlen,
         PROT_READ, MAP_SHARED, chan->fd, SENDER_TO_RECEIVER_OFFSET);
     if (!chan->recv_chan.buf)
     {
@@ -118,7 +452,7 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
       exit(-1);
     }
 
-    chan->send_chan.buf = (struct ump_message*) mmap(NULL, chan->outchanlen,
+    chan->send_chan.buf = (char*) mmap(NULL, chan->outchanlen,
         PROT_WRITE, MAP_SHARED, chan->fd, RECEIVER_TO_SENDER_OFFSET);
     if (!chan->send_chan.buf)
     {
@@ -135,7 +469,7 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
       exit(-1);
     }
 
-    chan->recv_chan.buf = (struct ump_message*) mmap(NULL, chan->inchanlen,
+    chan->recv_chan.buf = (char*) mmap(NULL, chan->inchanlen,
         PROT_READ, MAP_SHARED, chan->fd, RECEIVER_TO_SENDER_OFFSET);
     if (!chan->recv_chan.buf)
     {
@@ -143,7 +477,7 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
       exit(-1);
     }
 
-    chan->send_chan.buf = (struct ump_message*) mmap(NULL, chan->outchanlen,
+    chan->send_chan.buf = (char*) mmap(NULL, chan->outchanlen,
         PROT_WRITE, MAP_SHARED, chan->fd, SENDER_TO_RECEIVER_OFFSET);
     if (!chan->send_chan.buf)
     {
@@ -160,11 +494,20 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
 
   for (i = 0; i < chan->send_chan.bufmsgs; i++)
   {
-    chan->send_chan.buf[i].header.raw = 0;
+    ump_slot_header(&chan->send_chan, i)->raw = 0;
   }
 
+  // the cursors are after the slots
+  chan->local_cursor = (struct ump_cursor*) ump_slot_data(&chan->send_chan,
+      nb_messages);
+  chan->remote_cursor = (struct ump_cursor*) ump_slot_data(&chan->recv_chan,
+      nb_messages);
+  chan->local_cursor->read = 0;
+
   chan->max_recv_msgs = nb_messages;
   chan->max_send_msgs = nb_messages;
+  chan->max_msg_len = (size_t) nb_messages * chan->send_chan.slot_payload;
+  chan->ack_window = get_ack_window(nb_messages);
 
   chan->recv_chan.epoch = 1;
   chan->recv_chan.pos = 0;
@@ -172,7 +515,7 @@ struct ump_channel open_channel(char *mprotectfile, int nb, int nb_messages,
   chan->send_chan.epoch = 1;
   chan->send_chan.pos = 0;
 
-  chan->sent_id = 1;
+  chan->sent_id = 0;
   chan->seq_id = 0;
   chan->ack_id = 0;
   chan->last_ack = 0;
@@ -191,53 +534,207 @@ void close_channel(struct ump_channel *chan)
   close(chan->fd);
 }
 
-void recv_ack(struct ump_channel *chan)
+/*
+ * write in the n next slots of chan a message of type msgtype, whose payload is the len bytes
+ * of msg, or nothing if msg is NULL. The control word of the first slot is written last.
+ */
+static void ump_write_msg(struct ump_channel *chan, int msgtype,
+    const char *msg, size_t len, ump_index_t n)
 {
-  struct ump_message *ump_msg;
+  struct ump_chan_state *c;
+  struct ump_control ctrl, cont;
+  union ump_header *h;
+  ump_index_t first, i;
+  size_t off;
+
+  c = &chan->send_chan;
+  first = ump_impl_get_next(c, &ctrl, n);
+
+  cont.epoch = ctrl.epoch;
+  cont.header = (uintptr_t) UMP_CONT << UMP_INDEX_BITS;
+  for (i = 1; i < n; i++)
+  {
+    off = (size_t) i * c->slot_payload;
+    if (msg && off < len)
+    {
+      ump_copy_to_message(ump_slot_data(c, first + i), msg + off,
+          min(c->slot_payload, len - off));
+    }
+    ump_set_control(ump_slot_header(c, first + i), cont);
+  }
+  if (msg)
+  {
+    ump_copy_to_message(ump_slot_data(c, first), msg, min(c->slot_payload, len));
+  }
+
+  ump_control_fill(chan, &ctrl, msgtype, n);
+  h = ump_slot_header(c, first);
+  h->msg.len = len;
+  BARRIER();
+  ump_set_control(h, ctrl);
+}
+
+/*
+ * copy in msg of size len the payload of the message of msg_len bytes that starts at the
+ * slot first of c.
+ * Return the number of copied bytes.
+ */
+static size_t ump_read_payload(struct ump_chan_state *c, ump_index_t first,
+    size_t msg_len, char *msg, size_t len)
+{
+  size_t off;
 
-  while (!ump_endpoint_can_recv(&chan->recv_chan))
+  len = min(len, msg_len);
+  for (off = 0; off < len; off += c->slot_payload)
   {
+    ump_copy_from_message(msg + off,
+        ump_slot_data(c, first + off / c->slot_payload),
+        min(c->slot_payload, len - off));
+  }
+
+  return len;
+}
+
+/*
+ * publish the acks of chan in its local cursor if the ack window is reached, or if idle is
+ * set and there is something to publish. An endpoint publishes all its acks before it waits:
+ * a peer that waits for slots can always make progress.
+ */
+static void ump_ack(struct ump_channel *chan, int idle)
+{
+  if (!ump_send_ack_is_needed(chan) && (!idle || chan->seq_id == chan->last_ack))
+  {
+    return;
+  }
+
+  // the payloads have been read before the slots are given back
+  BARRIER();
+  chan->local_cursor->read = chan->seq_id;
+  chan->last_ack = chan->seq_id;
+
+#ifdef BFISH_MPROTECT_DEBUG
+  printf("[%s:%i] Going to unlock futex @ %p for channel %i.\n", __func__,
+      __LINE__, chan->send_chan.f, chan->mprotectfile_nb);
+#endif
+  futex_unlock(chan->send_chan.f);
+}
+
+static int ump_chan_can_recv(struct ump_channel *chan)
+{
+  return ump_endpoint_can_recv(&chan->recv_chan);
+}
+
+static int ump_chan_has_new_acks(struct ump_channel *chan)
+{
+  return ump_read_remote_cursor(chan);
+}
+
+/*
+ * wait until ready(chan) is true: poll it, then sleep on the futex of the recv channel of
+ * chan. The other end wakes it up after it has sent a message or published acks, only if
+ * we are registered as a waiter.
+ */
+static void ump_wait(struct ump_channel *chan,
+    int (*ready)(struct ump_channel *))
+{
+  int i, n, v;
+
+  n = get_spin_loops();
+  for (i = 0; i < n; i++)
+  {
+    if (ready(chan))
+    {
+      return;
+    }
+#ifdef UMP_COPY_X86
+    _mm_pause();
+#endif
+  }
+
+  while (1)
+  {
+    v = futex_lock_prepare(chan->recv_chan.f);
+    if (ready(chan))
+    {
+      futex_lock_cancel(chan->recv_chan.f);
+      return;
+    }
+
 #ifdef BFISH_MPROTECT_DEBUG
     printf("[%s:%i] Going to lock futex @ %p for channel %i.\n", __func__,
         __LINE__, chan->recv_chan.f, chan->mprotectfile_nb);
 #endif
-    futex_lock(chan->recv_chan.f);
+    futex_lock_commit(chan->recv_chan.f, v);
   }
+}
+
+/*
+ * wake up the receiver of chan after a message has been published: ring the doorbell of its
+ * receive set, if any, and unlock the futex of the channel
+ */
+static void ump_wake_receiver(struct ump_channel *chan)
+{
+  struct ump_doorbell *d = chan->send_chan.doorbell;
 
-  ump_msg = ump_impl_recv(&chan->recv_chan);
-  if (ump_msg == NULL)
+  if (d)
   {
-    printf("[%s:%i] Error: ump_msg should not be null\n", __func__, __LINE__);
-    exit(-1);
+    // the message is visible before the bit is read: the receiver takes the bits, then
+    // polls the channels. The bit is only written if it is not already set
+    __sync_synchronize();
+    if (!(d->bits & chan->send_chan.doorbell_bit))
+    {
+      __sync_fetch_and_or(&d->bits, chan->send_chan.doorbell_bit);
+    }
+    futex_unlock(&d->f);
   }
 
-  // what kind of message is this?
-  int msgtype = ump_control_process(chan, ump_msg->header.control);
-  switch (msgtype)
+  futex_unlock(chan->send_chan.f);
+}
+
+/*
+ * wait until n consecutive slots can be sent on chan, padding the end of the ring if needed.
+ * The slots acknowledged by the receiver are read in its cursor.
+ */
+static void wait_for_slots(struct ump_channel *chan, ump_index_t n)
+{
+  ump_index_t pad;
+
+  while (1)
   {
-  case UMP_ACK: // this is an ack, we need to call recv again
-    //printf("[%s:%i] Has received an ack\n", __func__, __LINE__);
-    break;
-  case UMP_MSG: // this is a message, we return it
-    printf("[%s:%i] Should not have received a message; expecting an ack\n",
-        __func__, __LINE__);
-    break;
-  default:
-    printf("[%s:%i] Error: unknown message type %i\n", __func__, __LINE__,
-        msgtype);
-    break;
+    // a message does not wrap around the end of the ring
+    pad = chan->send_chan.bufmsgs - chan->send_chan.pos;
+    if (pad < n)
+    {
+      if (ump_can_send(chan, pad))
+      {
+        ump_write_msg(chan, UMP_PAD, NULL, (size_t) pad
+            * chan->send_chan.slot_payload, pad);
+        // the receiver must consume the padding before it can ack the slots we wait for
+        ump_wake_receiver(chan);
+        continue;
+      }
+    }
+    else if (ump_can_send(chan, n))
+    {
+      return;
+    }
+
+    if (!ump_read_remote_cursor(chan))
+    {
+      ump_ack(chan, 1);
+      ump_wait(chan, ump_chan_has_new_acks);
+    }
   }
 }
 
 /*
  * send the message msg of size len through the channel *chan.
- * Is blocking.
- * Return the size of the sent message or an error code.
+ * Is blocking. Empty messages are not sent.
+ * Return the size of the sent message, 0 if len is 0, or an error code.
  */
 int send_msg(struct ump_channel *chan, char *msg, size_t len)
 {
-  struct ump_control ctrl;
-  struct ump_message *ump_msg;
+  ump_index_t n;
 
   /*
    printf(
@@ -246,25 +743,26 @@ int send_msg(struct ump_channel *chan, char *msg, size_t len)
    chan->seq_id, chan->last_ack);
    */
 
-  while (!ump_can_send(chan))
+  // as libkbfish: empty messages are not sent, the receivers could not tell them from
+  // the absence of message
+  if (len == 0)
   {
-    //printf("[%s:%i] Going to receive an ack\n", __func__, __LINE__);
-    recv_ack(chan);
+    return 0;
   }
 
+  len = min(chan->max_msg_len, len);
+  n = ump_nb_slots(&chan->send_chan, len);
+
+  wait_for_slots(chan, n);
+
   //code to send:
-  ump_msg = ump_impl_get_next(&chan->send_chan, &ctrl);
-  len = min(MESSAGE_BYTES, len);
-  memcpy(ump_msg->data, msg, len);
-  ump_control_fill(chan, &ctrl, UMP_MSG);
-  BARRIER();
-  ump_msg->header.control = ctrl;
+  ump_write_msg(chan, UMP_MSG, msg, len, n);
 
 #ifdef BFISH_MPROTECT_DEBUG
   printf("[%s:%i] Going to unlock futex @ %p for channel %i.\n", __func__,
       __LINE__, chan->send_chan.f, chan->mprotectfile_nb);
 #endif
-  futex_unlock(chan->send_chan.f);
+  ump_wake_receiver(chan);
 
   return len;
 }
@@ -276,9 +774,10 @@ int send_msg(struct ump_channel *chan, char *msg, size_t len)
  */
 int recv_msg(struct ump_channel *chan, char *msg, size_t len)
 {
-  struct ump_control ctrl;
-  struct ump_message *ump_msg;
-  int call_recv_again;
+  union ump_header *h;
+  ump_index_t first, n;
+  size_t msg_len;
+  int msgtype;
 
   /*
    printf(
@@ -287,94 +786,60 @@ int recv_msg(struct ump_channel *chan, char *msg, size_t len)
    chan->seq_id, chan->last_ack);
    */
 
-  while (!ump_endpoint_can_recv(&chan->recv_chan))
-  {
-#ifdef BFISH_MPROTECT_DEBUG
-    printf("[%s:%i] Going to lock futex @ %p for channel %i.\n", __func__,
-        __LINE__, chan->recv_chan.f, chan->mprotectfile_nb);
-#endif
-    futex_lock(chan->recv_chan.f);
-  }
-
-  ump_msg = ump_impl_recv(&chan->recv_chan);
-  if (ump_msg == NULL)
-  {
-    printf("[%s:%i] Error: ump_msg should not be null\n", __func__, __LINE__);
-    exit(-1);
-  }
-
-  // what kind of message is this?
-  int msgtype = ump_control_process(chan, ump_msg->header.control);
-  switch (msgtype)
-  {
-  case UMP_ACK: // this is an ack, we need to call recv again
-    //printf("[%s:%i] Has received an ack\n", __func__, __LINE__);
-    call_recv_again = 1;
-    break;
-  case UMP_MSG: // this is a message, we return it
-    //printf("[%s:%i] Has received a message\n", __func__, __LINE__);
-    len = min(len, MESSAGE_BYTES);
-    memcpy(msg, ump_msg->data, len);
-    call_recv_again = 0;
-    break;
-  default:
-    printf("[%s:%i] Error: unknown message type %i\n", __func__, __LINE__,
-        msgtype);
-    call_recv_again = 1;
-    break;
-  }
-
-  if (ump_send_ack_is_needed(chan))
+  while (1)
   {
-    /*
-     printf(
-     "[%s:%i] sent_id=%hu, ack_id=%hu, max_send_msgs=%hu, seq_id=%hu, last_ack=%hu\n",
-     __func__, __LINE__, chan->sent_id, chan->ack_id, chan->max_send_msgs,
-     chan->seq_id, chan->last_ack);
-     printf("[%s:%i] I need to send an ack\n", __func__, __LINE__);
-     */
+    if (!ump_endpoint_can_recv(&chan->recv_chan))
+    {
+      ump_ack(chan, 1);
+      ump_wait(chan, ump_chan_can_recv);
+    }
 
-    // this shouldn't happen: I have received a message, thus I have updated my information
-    // concerning acks.
-    if (!ump_can_send(chan))
+    h = ump_impl_recv(&chan->recv_chan, &first, &msg_len, &n);
+    if (h == NULL)
     {
-      printf("[%s:%i] I need to send an ack but I cannot\n", __func__, __LINE__);
+      printf("[%s:%i] Error: ump_msg should not be null\n", __func__, __LINE__);
+      exit(-1);
+    }
+    if (h == UMP_MSG_TOO_LARGE)
+    {
+      printf("[%s:%i] Error: message larger than the end of the ring\n",
+          __func__, __LINE__);
       exit(-1);
     }
 
-    ump_msg = ump_impl_get_next(&chan->send_chan, &ctrl);
-    ump_control_fill(chan, &ctrl, UMP_ACK);
-    BARRIER();
-    ump_msg->header.control = ctrl;
-
-#ifdef BFISH_MPROTECT_DEBUG
-    printf("[%s:%i] Going to unlock futex @ %p for channel %i.\n", __func__,
-        __LINE__, chan->send_chan.f, chan->mprotectfile_nb);
-#endif
-    futex_unlock(chan->send_chan.f);
-  }
+    // what kind of message is this?
+    msgtype = ump_control_process(chan, h->msg.control, n);
+    switch (msgtype)
+    {
+    case UMP_PAD: // the end of the ring is skipped
+      break;
+    case UMP_MSG: // this is a message, we return it
+      //printf("[%s:%i] Has received a message\n", __func__, __LINE__);
+      len = ump_read_payload(&chan->recv_chan, first, msg_len, msg, len);
+      ump_ack(chan, 0);
+      return len;
+    default:
+      printf("[%s:%i] Error: unknown message type %i\n", __func__, __LINE__,
+          msgtype);
+      break;
+    }
 
-  if (call_recv_again)
-  {
-    //printf("[%s:%i] Going to receive again\n", __func__, __LINE__);
-    return recv_msg(chan, msg, len);
-  }
-  else
-  {
-    return len;
+    ump_ack(chan, 0);
   }
 }
 
 /*
  * receive a message and place it in msg of size len.
  * Is not blocking.
- * Return the size of the received message or 0 if there is no message or -1 if an error has occured (cannot send the ack)
+ * Return the size of the received message, which is 0 if len is 0, or -1 if there is
+ * no message
  */
-int recv_msg_nonblocking(struct ump_channel *chan, char *msg, size_t len)
+static int ump_recv_nonblocking(struct ump_channel *chan, char *msg, size_t len)
 {
-  struct ump_control ctrl;
-  struct ump_message *ump_msg;
-  int call_recv_again;
+  union ump_header *h;
+  ump_index_t first, n;
+  size_t msg_len;
+  int msgtype;
 
   /*
    printf(
@@ -383,70 +848,158 @@ int recv_msg_nonblocking(struct ump_channel *chan, char *msg, size_t len)
    chan->seq_id, chan->last_ack);
    */
 
-  if (!ump_endpoint_can_recv(&chan->recv_chan))
+  while (ump_endpoint_can_recv(&chan->recv_chan))
   {
-    return 0;
-  }
+    h = ump_impl_recv(&chan->recv_chan, &first, &msg_len, &n);
+    if (h == NULL)
+    {
+      printf("[%s:%i] Error: ump_msg should not be null\n", __func__, __LINE__);
+      exit(-1);
+    }
+    if (h == UMP_MSG_TOO_LARGE)
+    {
+      printf("[%s:%i] Error: message larger than the end of the ring\n",
+          __func__, __LINE__);
+      exit(-1);
+    }
 
-  ump_msg = ump_impl_recv(&chan->recv_chan);
-  if (ump_msg == NULL)
-  {
-    printf("[%s:%i] Error: ump_msg should not be null\n", __func__, __LINE__);
-    exit(-1);
+    // what kind of message is this?
+    msgtype = ump_control_process(chan, h->msg.control, n);
+    switch (msgtype)
+    {
+    case UMP_PAD: // the end of the ring is skipped
+      break;
+    case UMP_MSG: // this is a message, we return it
+      //printf("[%s:%i] Has received a message\n", __func__, __LINE__);
+      len = ump_read_payload(&chan->recv_chan, first, msg_len, msg, len);
+      ump_ack(chan, 0);
+      return len;
+    default:
+      printf("[%s:%i] Error: unknown message type %i\n", __func__, __LINE__,
+          msgtype);
+      break;
+    }
+
+    ump_ack(chan, 0);
   }
 
-  // what kind of message is this?
-  int msgtype = ump_control_process(chan, ump_msg->header.control);
-  switch (msgtype)
+  ump_ack(chan, 1);
+  return -1;
+}
+
+/*
+ * receive a message and place it in msg of size len.
+ * Is not blocking.
+ * Return the size of the received message or 0 if there is no message
+ */
+int recv_msg_nonblocking(struct ump_channel *chan, char *msg, size_t len)
+{
+  int r;
+
+  r = ump_recv_nonblocking(chan, msg, len);
+  return (r < 0 ? 0 : r);
+}
+
+/*
+ * initialize in *set the receiver side of the receive set s. The channels are added with
+ * recv_set_add_channel().
+ */
+void open_recv_set(struct ump_recv_set *set, int s)
+{
+  memset(set, 0, sizeof(*set));
+  set->doorbell = all_recv_sets[s].doorbell;
+}
+
+/*
+ * add the channel *chan, opened as the receiver end of a channel added to a receive set with
+ * add_channel_to_recv_set(), to *set. chan must not move afterwards.
+ * Return 0, or -1 if chan has not been added to the receive set of set.
+ */
+int recv_set_add_channel(struct ump_recv_set *set, struct ump_channel *chan)
+{
+  if (!chan->recv_chan.doorbell_bit || chan->recv_chan.doorbell != set->doorbell)
   {
-  case UMP_ACK: // this is an ack, we need to call recv again
-    //printf("[%s:%i] Has received an ack\n", __func__, __LINE__);
-    call_recv_again = 1;
-    break;
-  case UMP_MSG: // this is a message, we return it
-    //printf("[%s:%i] Has received a message\n", __func__, __LINE__);
-    len = min(len, MESSAGE_BYTES);
-    memcpy(msg, ump_msg->data, len);
-    call_recv_again = 0;
-    break;
-  default:
-    printf("[%s:%i] Error: unknown message type %i\n", __func__, __LINE__,
-        msgtype);
-    call_recv_again = 1;
-    break;
+    printf("[%s:%i] Channel %i is not in this receive set\n", __func__,
+        __LINE__, chan->mprotectfile_nb);
+    return -1;
   }
 
-  if (ump_send_ack_is_needed(chan))
+  set->chans[__builtin_ctzll(chan->recv_chan.doorbell_bit)] = chan;
+
+  // it may have received messages before
+  set->pending |= chan->recv_chan.doorbell_bit;
+
+  return 0;
+}
+
+/*
+ * receive a message from one of the channels of *set and place it in msg of size len.
+ * The channels with messages are served in a round-robin order. Only the channels whose bits
+ * are set in the doorbell are polled, and the process sleeps on the futex of the set.
+ * Is blocking. The message is truncated to len bytes.
+ * Return the size of the received message. If from is not NULL, *from is its channel.
+ */
+int recv_msg_from_set(struct ump_recv_set *set, char *msg, size_t len,
+    struct ump_channel **from)
+{
+  struct ump_channel *chan;
+  uint64_t above, bit;
+  int i, n, r, v;
+
+  while (1)
   {
-    /*
-     printf(
-     "[%s:%i] sent_id=%hu, ack_id=%hu, max_send_msgs=%hu, seq_id=%hu, last_ack=%hu\n",
-     __func__, __LINE__, chan->sent_id, chan->ack_id, chan->max_send_msgs,
-     chan->seq_id, chan->last_ack);
-     printf("[%s:%i] I need to send an ack\n", __func__, __LINE__);
-     */
+    // the channels whose senders have rung since we have last looked
+    if (!set->pending && set->doorbell->bits)
+    {
+      set->pending = __sync_lock_test_and_set(&set->doorbell->bits, 0);
+    }
 
-    // this shouldn't happen: I have received a message, thus I have updated my information
-    // concerning acks.
-    if (!ump_can_send(chan))
+    while (set->pending)
     {
-      printf("[%s:%i] I need to send an ack but I cannot\n", __func__, __LINE__);
-      exit(-1);
+      // the first pending channel from set->next, then from the first one
+      above = set->pending & (~(uint64_t) 0 << set->next);
+      i = __builtin_ctzll(above ? above : set->pending);
+      bit = (uint64_t) 1 << i;
+      chan = set->chans[i];
+
+      // a message of 0 byte (len is 0) is still a message: the channel is empty only at -1
+      r = (chan ? ump_recv_nonblocking(chan, msg, len) : -1);
+      if (r >= 0)
+      {
+        // the channel stays pending: it may have other messages
+        set->next = (i + 1) % UMP_RECV_SET_MAX_CHANNELS;
+        if (from)
+        {
+          *from = chan;
+        }
+        return r;
+      }
+
+      // the channel is empty and ump_recv_nonblocking() has published its acks
+      set->pending &= ~bit;
     }
 
-    ump_msg = ump_impl_get_next(&chan->send_chan, &ctrl);
-    ump_control_fill(chan, &ctrl, UMP_ACK);
-    BARRIER();
-    ump_msg->header.control = ctrl;
-  }
+    n = get_spin_loops();
+    for (i = 0; i < n && !set->doorbell->bits; i++)
+    {
+#ifdef UMP_COPY_X86
+      _mm_pause();
+#endif
+    }
+    if (set->doorbell->bits)
+    {
+      continue;
+    }
 
-  if (call_recv_again)
-  {
-    return 0;
-  }
-  else
-  {
-    return len;
+    v = futex_lock_prepare(&set->doorbell->f);
+    if (set->doorbell->bits)
+    {
+      futex_lock_cancel(&set->doorbell->f);
+    }
+    else
+    {
+      futex_lock_commit(&set->doorbell->f, v);
+    }
   }
 }
 
@@ -471,6 +1024,15 @@ struct ump_channel* bfish_mprotect_select(struct ump_channel* chans, int l,
       }
     }
 
+    // no message: the acks are published before waiting
+    if (n == 1)
+    {
+      for (i = 0; i < l; i++)
+      {
+        ump_ack(&chans[i], 1);
+      }
+    }
+
     n++;
     if (nb_iter > 0 && n >= nb_iter)
     {
@@ -6,10 +6,12 @@
 #define BFISH_MEM_PROTECT
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "futex.h"
 
-// Define MESSAGE_BYTES as the size of a message in bytes at compile time.
+// The size of the messages is given at run time, to open_channel().
 // Define WAIT_TYPE as either USLEEP or BUSY, depending on whether you want to sleep or to busy wait
 // when waiting for a message to receive.
 
@@ -18,7 +20,25 @@
 #define WAIT() do { usleep(1); } while (0);
 
 #define CACHELINE_BYTES 64
-#define UMP_PAYLOAD_WORDS  (MESSAGE_BYTES / sizeof(uintptr_t))
+
+// Default thresholds of the copies of the payloads, in bytes (see set_copy_thresholds()).
+// They can be overriden with the environment variables BFISH_NT_COPY_THRESHOLD and
+// BFISH_PREFETCH_COPY_THRESHOLD. 0 disables the copy.
+// bfishmprotect_copy_bench gives the crossover sizes of the machine.
+#define DEFAULT_NT_COPY_THRESHOLD 4096
+#define DEFAULT_PREFETCH_COPY_THRESHOLD 0
+
+// Default ack window, in slots (see set_ack_window()). Can be overriden with the environment
+// variable BFISH_ACK_WINDOW. 0 is half of the ring.
+#define DEFAULT_ACK_WINDOW 0
+
+// Default number of polls of a channel before sleeping on its futex (see set_spin_loops()).
+// Can be overriden with the environment variable BFISH_SPIN_LOOPS. It is 0 on a single CPU.
+#define DEFAULT_SPIN_LOOPS 1000
+
+// size (in bytes) of the blocks that the receiver prefetches ahead: the hardware
+// prefetchers stop at the page boundaries
+#define PREFETCH_DISTANCE 4096
 
 // control word is 32-bit, because it must be possible to atomically write it
 typedef uint32_t ump_control_t;
@@ -31,14 +51,24 @@ struct ump_control
   ump_control_t header :UMP_HEADER_BITS;
 };
 
-struct ump_message
+// the control word, accessed as a whole
+typedef ump_control_t __attribute__((may_alias)) ump_control_word_t;
+
+// A one-way channel is a ring of slots of slot_bytes bytes, a multiple of the cache line size.
+// Each slot ends with a control word, its payload is the rest of the slot.
+// A message spans as many consecutive slots as its length needs, without wrapping around
+// the end of the ring (the sender pads the end of the ring instead). It is published by the
+// control word of its first slot, which holds its length and is written last. The control
+// words of the other slots only hold the epoch, so that the receiver does not mistake a
+// stale payload for a message at the next round.
+union ump_header
 {
-  uintptr_t data[UMP_PAYLOAD_WORDS] __attribute__((aligned (CACHELINE_BYTES)));
-  union
+  struct
   {
-    struct ump_control control;
-    uintptr_t raw;
-  } header;
+    struct ump_control control; ///< written last: publishes the message
+    uint32_t len; ///< length of the message in bytes, written before control
+  } msg;
+  uint64_t raw;
 };
 
 /// Type used for indices of UMP message slots
@@ -55,17 +85,41 @@ enum ump_direction
   UMP_OUTGOING, UMP_INCOMING
 };
 
+// The acks of a one-way channel: the number of slots the receiver has consumed, on a cache
+// line of its own right after the ring of the other direction, in the memory area of the
+// receiver. The receiver publishes it lazily; the sender only reads it when the ring looks full.
+struct ump_cursor
+{
+  volatile ump_index_t read;
+} __attribute__((aligned (CACHELINE_BYTES)));
+
+// max number of channels in a receive set: 1 bit per channel in the doorbell
+#define UMP_RECV_SET_MAX_CHANNELS 64
+
+// The doorbell of a receive set, in a shared memory segment. The sender of a channel of the
+// set sets the bit of the channel after it has published a message; the receiver takes the
+// bits, then polls the corresponding channels. It sleeps on f for the whole set.
+struct ump_doorbell
+{
+  futex f; ///< The futex of the set
+  volatile uint64_t bits; ///< Bit i: channel i of the set may have messages
+} __attribute__((aligned (CACHELINE_BYTES)));
+
 /**
  * \brief State of a (one-way) UMP channel
  */
 struct ump_chan_state
 {
-  struct ump_message *buf; ///< Ring buffer
+  char *buf; ///< Ring buffer
+  size_t slot_bytes; ///< Size of a slot, control word included
+  size_t slot_payload; ///< Payload bytes of a slot
   ump_index_t pos; ///< Current position
-  ump_index_t bufmsgs; ///< Buffer size in messages
+  ump_index_t bufmsgs; ///< Buffer size in slots
   int epoch; ///< Next Message epoch
   enum ump_direction dir; ///< Channel direction
   futex *f; // the futex. 1 per one-way channel
+  struct ump_doorbell *doorbell; ///< Doorbell of the receive set of the receiver, or NULL
+  uint64_t doorbell_bit; ///< Bit of this channel in doorbell
 };
 
 struct ump_channel
@@ -73,13 +127,18 @@ struct ump_channel
   struct ump_chan_state send_chan; ///< Outgoing UMP channel state
   struct ump_chan_state recv_chan; ///< Incoming UMP channel state
 
-  ump_index_t sent_id; ///< Sequence number of next message to be sent
-  ump_index_t seq_id; ///< Last sequence number received from remote
-  ump_index_t ack_id; ///< Last sequence number acknowledged by remote
-  ump_index_t last_ack; ///< Last acknowledgement we sent to remote
+  ump_index_t sent_id; ///< Number of slots sent
+  ump_index_t seq_id; ///< Number of slots received from remote
+  ump_index_t ack_id; ///< Number of slots acknowledged by remote (last value read in remote_cursor)
+  ump_index_t last_ack; ///< Last acknowledgement we published in local_cursor
+  ump_index_t ack_window; ///< Number of received slots after which local_cursor is published
 
-  ump_index_t max_send_msgs; ///< Number of messages that fit in the send channel
-  ump_index_t max_recv_msgs; ///< Number of messages that fit in the recv channel
+  struct ump_cursor *local_cursor; ///< Acks of the recv channel, written by us
+  struct ump_cursor *remote_cursor; ///< Acks of the send channel, written by remote
+
+  ump_index_t max_send_msgs; ///< Number of slots that fit in the send channel
+  ump_index_t max_recv_msgs; ///< Number of slots that fit in the recv channel
+  size_t max_msg_len; ///< Max length of a message, in bytes
 
   int mprotectfile_nb; // the number of the special file used for memory protection
   int fd; // file descriptor associated with the protected memory areas
@@ -87,6 +146,16 @@ struct ump_channel
   size_t inchanlen, outchanlen;
 };
 
+// The receiver side of a receive set: the channels on which a process receives, in the
+// order of their bits in the doorbell
+struct ump_recv_set
+{
+  struct ump_doorbell *doorbell; ///< Doorbell of the set
+  struct ump_channel *chans[UMP_RECV_SET_MAX_CHANNELS]; ///< Channel of each bit, or NULL
+  uint64_t pending; ///< Bits taken from the doorbell whose channels have not been drained
+  int next; ///< Bit from which the next channel is searched, for the round-robin
+};
+
 /********************* exported interface *********************/
 
 /* create 2 channels that will use mprotectfile mprotectfile of number n for memory protection */
@@ -97,7 +166,10 @@ void destroy_channel(int n);
 
 /*
  * open a channel using the special file mprotectfile for memory protection.
- * The channel size is (for both direction) nb_messages * message_size.
+ * The channel has (for both direction) nb_messages slots of get_ump_message_size(message_size)
+ * bytes, which hold message_size bytes each. A longer message spans several slots,
+ * up to nb_messages * message_size bytes. Each direction also has a struct ump_cursor after
+ * its slots: see get_ump_area_size().
  * is_receiver must be set to 1 if called by the receiver end, 0 otherwise.
  * nb is the memory protection file number
  * Return the new channel if ok.
@@ -112,112 +184,248 @@ void close_channel(struct ump_channel *chan);
 
 /*
  * send the message msg of size len through the channel *chan.
- * Is blocking.
- * Return the size of the sent message or an error code.
+ * Is blocking. The message is truncated to chan->max_msg_len bytes. Empty messages
+ * are not sent.
+ * Return the size of the sent message, 0 if len is 0, or an error code.
  */
 int send_msg(struct ump_channel *chan, char *msg, size_t len);
 
 /*
  * receive a message and place it in msg of size len.
- * Is blocking.
- * Return the size of the received message or -1 if an error has occured (cannot send the ack)
+ * Is blocking. The message is truncated to len bytes.
+ * Return the size of the received message
  */
 int recv_msg(struct ump_channel *chan, char *msg, size_t len);
 
 /*
  * receive a message and place it in msg of size len.
  * Is not blocking.
- * Return the size of the received message or 0 if there is no message or -1 if an error has occured (cannot send the ack)
+ * Return the size of the received message or 0 if there is no message
  */
 int recv_msg_nonblocking(struct ump_channel *chan, char *msg, size_t len);
 
+/*
+ * create the receive set s, whose doorbell is a shared memory segment identified by the file
+ * path. Like create_channel(), it is called before the processes are created.
+ * Return 0, or -1 if an error has occured.
+ */
+int create_recv_set(char *path, int s);
+
+/* destroy the receive set s */
+void destroy_recv_set(int s);
+
+/*
+ * add the channel using memory protection file number n, created with create_channel(), to
+ * the receive set s: its sender rings the doorbell of s. Is called before the processes are
+ * created, after create_channel() and create_recv_set().
+ * Return the bit of the channel in the set, or -1 if the set is full.
+ */
+int add_channel_to_recv_set(int n, int s);
+
+/*
+ * initialize in *set the receiver side of the receive set s. The channels are added with
+ * recv_set_add_channel().
+ */
+void open_recv_set(struct ump_recv_set *set, int s);
+
+/*
+ * add the channel *chan, opened as the receiver end of a channel added to a receive set with
+ * add_channel_to_recv_set(), to *set. chan must not move afterwards.
+ * Return 0, or -1 if chan has not been added to the receive set of set.
+ */
+int recv_set_add_channel(struct ump_recv_set *set, struct ump_channel *chan);
+
+/*
+ * receive a message from one of the channels of *set and place it in msg of size len.
+ * The channels with messages are served in a round-robin order. Only the channels whose bits
+ * are set in the doorbell are polled, and the process sleeps on the futex of the set.
+ * Is blocking. The message is truncated to len bytes.
+ * Return the size of the received message. If from is not NULL, *from is its channel.
+ */
+int recv_msg_from_set(struct ump_recv_set *set, char *msg, size_t len,
+    struct ump_channel **from);
+
 // select on n channels that can be found in chans.
 // Note that you give an array of channel pointers.
 // Return NULL if there is no message, or a pointer to a channel on which a message is available.
 // Before returning NULL (if there is no message), performs nb_iter iterations.
 // If nb_iter is 0 then the call is blocking.
+// Each iteration polls all the channels: with many channels, use a receive set and
+// recv_msg_from_set().
 struct ump_channel* bfish_mprotect_select(struct ump_channel* chans, int l,
     int nb_iter);
 
-// return the size of a struct ump_message. Is used to know the size of the memory area
-// to allocate in kbfishmem.
-static inline size_t get_ump_message_size(void)
+/*
+ * The sender copies the payloads of at least nt_copy_threshold bytes with non-temporal
+ * stores, so that it does not fill its cache with data that only the receiver reads.
+ * The receiver copies the payloads of at least prefetch_copy_threshold bytes with software
+ * prefetching. 0 disables the copy. The instruction set of the non-temporal stores is
+ * detected at run time.
+ */
+void set_copy_thresholds(size_t nt_copy_threshold, size_t prefetch_copy_threshold);
+
+/*
+ * The receiver publishes its acks every window received slots, and whenever it has no more
+ * message to receive. 0 is half of the ring. Applies to the channels opened afterwards.
+ */
+void set_ack_window(int window);
+
+/*
+ * A process that waits for a message, or for free slots, polls the channel loops times
+ * before it sleeps on the futex. 0 sleeps at once.
+ */
+void set_spin_loops(int loops);
+
+/*
+ * copy the payload src of size len in dst, a message of a channel.
+ * dst must be aligned on a cache line.
+ */
+void ump_copy_to_message(void *dst, const void *src, size_t len);
+
+/*
+ * copy the payload src of size len, a message of a channel, in dst.
+ */
+void ump_copy_from_message(void *dst, const void *src, size_t len);
+
+// return the size of a slot that holds message_size bytes. Is used to know the size of the
+// memory area to allocate in kbfishmem.
+static inline size_t get_ump_message_size(size_t message_size)
 {
-  return sizeof(struct ump_message);
+  return (message_size + sizeof(union ump_header) + CACHELINE_BYTES - 1)
+      / CACHELINE_BYTES * CACHELINE_BYTES;
+}
+
+// return the size of the memory area of one direction of a channel of nb_messages slots
+// that hold message_size bytes, ump_cursor included
+static inline size_t get_ump_area_size(int nb_messages, size_t message_size)
+{
+  return (size_t) nb_messages * get_ump_message_size(message_size)
+      + sizeof(struct ump_cursor);
 }
 
 /********************* inline "private" methods *********************/
+// return the address of the slot i of c, i.e. of its payload
+static inline char *ump_slot_data(struct ump_chan_state *c, ump_index_t i)
+{
+  return c->buf + (size_t) i * c->slot_bytes;
+}
+
+// return the control word of the slot i of c
+static inline union ump_header *ump_slot_header(struct ump_chan_state *c,
+    ump_index_t i)
+{
+  return (union ump_header*) (ump_slot_data(c, i) + c->slot_payload);
+}
+
+// write ctrl in the control word of h with a single store: the compiler may otherwise write
+// the epoch bit and the header bits separately, and the receiver would see the new epoch
+// with the old header.
+// The word is accessed as a ump_control_t, for the C++ compilers
+static inline void ump_set_control(union ump_header *h, struct ump_control ctrl)
+{
+  ump_control_t v;
+
+  memcpy(&v, &ctrl, sizeof(v));
+  *(volatile ump_control_word_t*) &h->msg.control = v;
+}
+
+// return the number of slots of a message of len bytes on c
+static inline ump_index_t ump_nb_slots(struct ump_chan_state *c, size_t len)
+{
+  if (len <= c->slot_payload)
+  {
+    return 1;
+  }
+  return (len + c->slot_payload - 1) / c->slot_payload;
+}
+
 /**
- * \brief Determine next position for an outgoing message on a channel, and
- *   advance send pointer.
+ * \brief Determine next position for an outgoing message of n slots on a channel, and
+ *   advance send pointer. The n slots must fit before the end of the ring.
  *
  * \param c     Pointer to UMP channel-state structure.
  * \param ctrl  Pointer to storage for control word for next message, to be filled in
+ * \param n     Number of slots of the message
  *
- * \return Pointer to message if outstanding, or NULL.
+ * \return Index of the first slot of the message.
  */
-static inline struct ump_message *ump_impl_get_next(struct ump_chan_state *c,
-    struct ump_control *ctrl)
+static inline ump_index_t ump_impl_get_next(struct ump_chan_state *c,
+    struct ump_control *ctrl, ump_index_t n)
 {
   // construct header
   ctrl->epoch = c->epoch;
 
-  struct ump_message *msg = &c->buf[c->pos];
+  ump_index_t first = c->pos;
 
   // update pos
-  if (++c->pos == c->bufmsgs)
+  c->pos += n;
+  if (c->pos == c->bufmsgs)
   {
     c->pos = 0;
     c->epoch = !c->epoch;
   }
 
-  return msg;
+  return first;
 }
 
-/// Prepare a "control" word (header for each UMP message fragment)
+/// Prepare a "control" word (header for each UMP message fragment) of a message of n slots
 static inline void ump_control_fill(struct ump_channel *s,
-    struct ump_control *ctrl, int msgtype)
+    struct ump_control *ctrl, int msgtype, ump_index_t n)
 {
-  ctrl->header = ((uintptr_t) msgtype << UMP_INDEX_BITS)
-      | (uintptr_t) s->seq_id;
-  s->last_ack = s->seq_id;
-  s->sent_id++;
+  ctrl->header = (uintptr_t) msgtype << UMP_INDEX_BITS;
+  s->sent_id += n;
 }
 
-/// Process a "control" word
+/// Process a "control" word of a message of n slots
 static inline int ump_control_process(struct ump_channel *s,
-    struct ump_control ctrl)
+    struct ump_control ctrl, ump_index_t n)
 {
-  s->ack_id = ctrl.header & UMP_INDEX_MASK;
-  s->seq_id++;
+  s->seq_id += n;
   return ctrl.header >> UMP_INDEX_BITS;
 }
 
-/// Computes (from seq/ack numbers) whether we can currently send on the channel
-static inline int ump_can_send(struct ump_channel *s)
+/// Computes (from seq/ack numbers) whether we can currently send n slots on the channel
+static inline int ump_can_send(struct ump_channel *s, ump_index_t n)
 {
-  return (ump_index_t) (s->sent_id - s->ack_id) < s->max_send_msgs;
+  return (ump_index_t) (s->sent_id + n - s->ack_id) <= s->max_send_msgs;
 }
 
-// return 1 if an ack is needed (to be sent), 0 otherwise
+// read the acks of remote. Return 1 if there are new ones, 0 otherwise
+static inline int ump_read_remote_cursor(struct ump_channel *s)
+{
+  ump_index_t read = s->remote_cursor->read;
+
+  if (read == s->ack_id)
+  {
+    return 0;
+  }
+  s->ack_id = read;
+  return 1;
+}
+
+// return 1 if an ack is needed (to be published), 0 otherwise
 static inline int ump_send_ack_is_needed(struct ump_channel *s)
 {
-  return (ump_index_t) (s->seq_id - s->last_ack) >= s->max_send_msgs - 1;
+  return (ump_index_t) (s->seq_id - s->last_ack) >= s->ack_window;
 }
 
 /**
- * \brief Return pointer to a message if outstanding on 'c'.
+ * \brief Return the control word of a message if outstanding on 'c'.
  *
  * \param c     Pointer to UMP channel-state structure.
  *
- * \return Pointer to message if outstanding, or NULL.
+ * \return Pointer to the control word of the message if outstanding, or NULL.
  */
-static inline struct ump_message *ump_impl_poll(struct ump_chan_state *c)
+static inline union ump_header *ump_impl_poll(struct ump_chan_state *c)
 {
-  struct ump_control ctrl = c->buf[c->pos].header.control;
+  union ump_header *h = ump_slot_header(c, c->pos);
+  ump_control_t v = *(volatile ump_control_word_t*) &h->msg.control;
+  struct ump_control ctrl;
+
+  memcpy(&ctrl, &v, sizeof(ctrl));
   if (ctrl.epoch == c->epoch)
   {
-    return &c->buf[c->pos];
+    return h;
   }
   else
   {
@@ -225,26 +433,51 @@ static inline struct ump_message *ump_impl_poll(struct ump_chan_state *c)
   }
 }
 
+// returned by ump_impl_recv() when the message does not fit before the end of the ring
+#define UMP_MSG_TOO_LARGE ((union ump_header*) -1)
+
 /**
- * \brief Return pointer to a message if outstanding on 'c' and
- * advance pointer.
+ * \brief Return the control word of a message if outstanding on 'c' and
+ * advance pointer past its slots.
+ * The other end can write the length at any time: it is read once, checked against the
+ * end of the ring, and only this copy must be used.
  *
  * \param c     Pointer to UMP channel-state structure.
+ * \param first Pointer to storage for the index of the first slot of the message
+ * \param len   Pointer to storage for the length of the message, in bytes
+ * \param n     Pointer to storage for the number of slots of the message
  *
- * \return Pointer to message if outstanding, or NULL.
+ * \return Pointer to the control word of the message if outstanding, NULL if there is
+ *   none, or UMP_MSG_TOO_LARGE if the message does not fit before the end of the ring.
  */
-static inline struct ump_message *ump_impl_recv(struct ump_chan_state *c)
+static inline union ump_header *ump_impl_recv(struct ump_chan_state *c,
+    ump_index_t *first, size_t *len, ump_index_t *n)
 {
-  struct ump_message *msg = ump_impl_poll(c);
+  union ump_header *h = ump_impl_poll(c);
+  size_t l;
 
-  if (msg != NULL)
+  if (h != NULL)
   {
-    if (++c->pos == c->bufmsgs)
+    // the length has been written before the control word
+    __asm volatile ("" : : : "memory");
+    l = *(volatile uint32_t*) &h->msg.len;
+
+    // in size_t: ump_nb_slots() returns an ump_index_t, which could wrap around
+    if (l > (size_t) (c->bufmsgs - c->pos) * c->slot_payload)
+    {
+      return UMP_MSG_TOO_LARGE;
+    }
+
+    *first = c->pos;
+    *len = l;
+    *n = ump_nb_slots(c, l);
+    c->pos += *n;
+    if (c->pos >= c->bufmsgs)
     {
       c->pos = 0;
       c->epoch = !c->epoch;
     }
-    return msg;
+    return h;
   }
   else
   {
@@ -260,26 +493,4 @@ static inline int ump_endpoint_can_recv(struct ump_chan_state *chan)
   return ump_impl_poll(chan) != NULL;
 }
 
-/**
- * \brief Retrieve a message from the given UMP channel, if possible
- *
- * Non-blocking, may fail if there are no messages available.
- *
- * Return 0 if there is a message, 1 otherwise
- */
-static inline int ump_endpoint_recv(struct ump_chan_state *chan,
-    volatile struct ump_message **msg)
-{
-  *msg = ump_impl_recv(chan);
-
-  if (*msg != NULL)
-  {
-    return 0;
-  }
-  else
-  {
-    return 1;
-  }
-}
-
 #endif
@@ -0,0 +1,161 @@
+/* Barrelfish communication mechanism - copy microbenchmark
+ *
+ * For each payload size, from 64B to 4MB, prints the time (in cycles per byte) of:
+ *  . the copy of the sender, with memcpy() and with non-temporal stores, each one followed by
+ *    the read of as many bytes of the working set of the sender (WORKING_SET bytes, read in
+ *    a loop): the non-temporal stores do not evict it;
+ *  . the copy of the receiver from a message that is not in its cache, with memcpy() and with
+ *    software prefetching.
+ * The crossover sizes are the values to give to set_copy_thresholds()
+ * (or BFISH_NT_COPY_THRESHOLD and BFISH_PREFETCH_COPY_THRESHOLD), and to the module
+ * parameters nt_copy_threshold and prefetch_copy_threshold of kzimp.
+ *
+ * Usage: ./bfishmprotect_copy_bench [working_set_bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bfishmprotect.h"
+
+#define MIN_SIZE 64
+#define MAX_SIZE (4*1024*1024)
+
+// default size of the working set of the sender
+#define WORKING_SET (512*1024)
+
+// the messages are in a pool larger than the last level cache: the receiver reads them
+// when they are no longer in its cache. Must be a multiple of MAX_SIZE.
+#define POOL_SIZE (64*1024*1024)
+
+// total number of bytes copied for each message size
+#define BYTES_PER_SIZE (64*1024*1024)
+
+#define rdtsc(val) { \
+    unsigned int __a,__d;                                        \
+    asm volatile("rdtsc" : "=a" (__a), "=d" (__d));              \
+    (val) = ((unsigned long)__a) | (((unsigned long)__d)<<32);   \
+}
+
+static char *src, *pool, *ws;
+static size_t ws_size, ws_pos;
+
+// read the next len bytes of the working set of the sender
+static unsigned long touch_working_set(size_t len)
+{
+  unsigned long sum;
+  size_t i;
+
+  sum = 0;
+  for (i = 0; i < len; i += CACHELINE_BYTES)
+  {
+    sum += ws[ws_pos];
+    ws_pos = (ws_pos + CACHELINE_BYTES) % ws_size;
+  }
+  return sum;
+}
+
+// return the number of cycles per byte of the copies of the sender of size bytes,
+// each one followed by the read of size bytes of its working set
+static double bench_sender(size_t size, size_t nt_threshold)
+{
+  unsigned long start, end, n, i, sum;
+
+  set_copy_thresholds(nt_threshold, 0);
+
+  n = BYTES_PER_SIZE / size;
+  sum = 0;
+  rdtsc(start);
+  for (i = 0; i < n; i++)
+  {
+    ump_copy_to_message(pool + (i * size) % POOL_SIZE, src, size);
+    sum += touch_working_set(size);
+  }
+  rdtsc(end);
+
+  // so that the passes are not optimized out
+  if (sum == 1)
+  {
+    printf(" ");
+  }
+
+  return (double) (end - start) / (n * size);
+}
+
+// return the number of cycles per byte of the copies of the receiver of size bytes,
+// from messages of the pool that are not in the cache
+static double bench_receiver(size_t size, size_t prefetch_threshold)
+{
+  unsigned long start, end, n, i, total;
+
+  set_copy_thresholds(0, prefetch_threshold);
+
+  n = BYTES_PER_SIZE / size;
+  total = 0;
+  for (i = 0; i < n; i++)
+  {
+    rdtsc(start);
+    ump_copy_from_message(src, pool + (i * size) % POOL_SIZE, size);
+    rdtsc(end);
+    total += end - start;
+  }
+
+  return (double) total / (n * size);
+}
+
+int main(int argc, char **argv)
+{
+  size_t size, nt_crossover, prefetch_crossover;
+  double memcpy_send, nt_send, memcpy_recv, prefetch_recv;
+
+  ws_size = (argc > 1 ? strtoul(argv[1], NULL, 10) : WORKING_SET);
+  ws_size = (ws_size + CACHELINE_BYTES - 1) / CACHELINE_BYTES * CACHELINE_BYTES;
+  if (ws_size == 0)
+  {
+    ws_size = CACHELINE_BYTES;
+  }
+  ws_pos = 0;
+
+  if (posix_memalign((void**) &src, CACHELINE_BYTES, MAX_SIZE)
+      || posix_memalign((void**) &pool, CACHELINE_BYTES, POOL_SIZE)
+      || posix_memalign((void**) &ws, CACHELINE_BYTES, ws_size))
+  {
+    perror("posix_memalign");
+    return -1;
+  }
+  memset(src, 1, MAX_SIZE);
+  memset(pool, 2, POOL_SIZE);
+  memset(ws, 3, ws_size);
+
+  printf("working set of the sender: %lu bytes\n", (unsigned long) ws_size);
+  printf("size\tmemcpy_send\tnt_send\tmemcpy_recv\tprefetch_recv (cycles/B)\n");
+
+  nt_crossover = 0;
+  prefetch_crossover = 0;
+  for (size = MIN_SIZE; size <= MAX_SIZE; size *= 2)
+  {
+    memcpy_send = bench_sender(size, 0);
+    nt_send = bench_sender(size, 1);
+    memcpy_recv = bench_receiver(size, 0);
+    prefetch_recv = bench_receiver(size, 1);
+
+    printf("%lu\t%.3f\t%.3f\t%.3f\t%.3f\n", (unsigned long) size, memcpy_send,
+        nt_send, memcpy_recv, prefetch_recv);
+
+    if (!nt_crossover && nt_send < memcpy_send)
+    {
+      nt_crossover = size;
+    }
+    if (!prefetch_crossover && prefetch_recv < memcpy_recv)
+    {
+      prefetch_crossover = size;
+    }
+  }
+
+  printf("non-temporal copy crossover: %lu bytes\n", (unsigned long) nt_crossover);
+  printf("prefetching copy crossover: %lu bytes\n", (unsigned long) prefetch_crossover);
+
+  return 0;
+}
@@ -1,12 +1,27 @@
 /* Barrelfish communication mechanism - test */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "bfishmprotect.h"
 
-int main(void)
+// Usage: ./bfishmprotect_get_struct_ump_message_size [message_size]
+// Without argument, the size of the messages is MESSAGE_BYTES, if it is defined at compile time.
+int main(int argc, char **argv)
 {
-   printf("%lu\n", get_ump_message_size());
+  size_t message_size;
+
+#ifdef MESSAGE_BYTES
+  message_size = MESSAGE_BYTES;
+#else
+  message_size = CACHELINE_BYTES;
+#endif
+  if (argc > 1)
+  {
+    message_size = strtoul(argv[1], NULL, 10);
+  }
+
+  printf("%lu\n", get_ump_message_size(message_size));
 
   return 0;
 }
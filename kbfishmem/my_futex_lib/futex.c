@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 
 /* shared memory */
 #include <sys/types.h>
@@ -28,9 +29,13 @@
 
 #undef MY_FUTEX_LIB_DEBUG
 
+// number of futex syscalls made by this process
+unsigned long futex_nb_syscalls = 0;
+
 static int sys_futex(void *addr1, int op, int val1, struct timespec *timeout,
     void *addr2, int val3)
 {
+  futex_nb_syscalls++;
   return syscall(SYS_futex, addr1, op, val1, timeout, addr2, val3);
 }
 
@@ -105,7 +110,8 @@ futex* futex_init(char *p, int i)
 
   if (f)
   {
-    *f = 0;
+    f->seq = 0;
+    f->waiters = 0;
   }
 
   return f;
@@ -122,36 +128,93 @@ int futex_destroy(futex *f)
   return 0;
 }
 
+// sleep until futex_unlock() is called, or at most 1ms
 int futex_lock(futex *f)
 {
   struct timespec to;
+  int v;
+
+  // the caller has not checked anything after futex_lock_prepare(): a wake up can be missed
+  to.tv_sec = 0;
+  to.tv_nsec = 1000000; // timeout is 1ms
 
-  *f = 1;
+  v = futex_lock_prepare(f);
 #ifdef MY_FUTEX_LIB_DEBUG
   printf("Going to sleep\n");
 #endif
+  sys_futex((void*) &f->seq, FUTEX_WAIT, v, &to, NULL, 0);
+  __sync_fetch_and_sub(&f->waiters, 1);
+
+  return 0;
+}
+
+// register as a waiter of f. Return the value to give to futex_lock_commit()
+int futex_lock_prepare(futex *f)
+{
+  int v;
+
+  // it is a full barrier: the waker sees the new count, or the caller sees what has been
+  // done before futex_unlock()
+  __sync_fetch_and_add(&f->waiters, 1);
+
+  // the last wake up is not for us: a new generation starts, that futex_unlock() will wake up
+  v = f->seq;
+  while (v & FUTEX_WOKEN)
+  {
+    __sync_val_compare_and_swap(&f->seq, v, v + 1);
+    v = f->seq;
+  }
+
+  return v;
+}
+
+// sleep until futex_unlock() is called, unless it has been called since
+// futex_lock_prepare() returned v, or at most 1ms
+int futex_lock_commit(futex *f, int v)
+{
+  struct timespec to;
 
+  // no wake up is missed, but a waker can die between its update and futex_unlock(): the
+  // caller checks its condition again at least every 1ms, as with futex_lock()
   to.tv_sec = 0;
   to.tv_nsec = 1000000; // timeout is 1ms
 
-  sys_futex(f, FUTEX_WAIT, 1, &to, NULL, 0);
+#ifdef MY_FUTEX_LIB_DEBUG
+  printf("Going to sleep\n");
+#endif
+
+  // returns at once if seq is no longer v, i.e. if futex_unlock() has been called
+  sys_futex((void*) &f->seq, FUTEX_WAIT, v, &to, NULL, 0);
+  __sync_fetch_and_sub(&f->waiters, 1);
 
   return 0;
 }
 
+// do not sleep after futex_lock_prepare()
+void futex_lock_cancel(futex *f)
+{
+  __sync_fetch_and_sub(&f->waiters, 1);
+}
+
+// wake up the waiters of f, if there are some and if they have not been woken up yet
 int futex_unlock(futex *f)
 {
-  /*
-   * if *f == 1   \
-   *    *f = 0    |- these 2 instructions are atomic
-   *    WAKE
-   */
-  if (cmpxchg(f, 1, 0))
+  int v;
+
+  // what has been done before is visible before the count is read. The cache line of the
+  // futex is not written if there is no waiter
+  __sync_synchronize();
+  if (f->waiters > 0)
   {
+    v = f->seq;
+    if (!(v & FUTEX_WOKEN)
+        && __sync_bool_compare_and_swap(&f->seq, v, v | FUTEX_WOKEN))
+    {
 #ifdef MY_FUTEX_LIB_DEBUG
-    printf("Waking up someone\n");
+      printf("Waking up someone\n");
 #endif
-    sys_futex(f, FUTEX_WAKE, 1, NULL, NULL, 0);
+      sys_futex((void*) &f->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
   }
 
   return 0;
@@ -8,18 +8,54 @@
 #ifndef _MY_FUTEX_LIB_
 #define _MY_FUTEX_LIB_
 
-typedef int futex;
+// A futex counts its waiters: futex_unlock() only reads it, and makes no syscall, when no
+// process sleeps in futex_lock(). It also makes no syscall if it has already woken up the
+// waiters and none of them has come back yet.
+typedef struct
+{
+  volatile int seq; // the futex word: a generation, and FUTEX_WOKEN
+  volatile int waiters; // number of processes that sleep or are going to sleep
+} futex;
+
+// bit of seq set by futex_unlock() when it wakes up the waiters, and cleared by the next
+// waiter, which starts a new generation
+#define FUTEX_WOKEN 1
 
 /********************** Exported interface **********************/
 
+// number of futex syscalls made by this process
+extern unsigned long futex_nb_syscalls;
+
 // return the new futex or NULL if an error has occured
 futex* futex_init(char *p, int i);
 
 // destroy the futex and return 0 if everything is ok
 int futex_destroy(futex *f);
 
+// sleep until futex_unlock() is called, or at most 1ms
 int futex_lock(futex *f);
 
+/*
+ * futex_lock() in 2 steps, to sleep until a condition is true without missing a wake up:
+ *    v = futex_lock_prepare(f);
+ *    if (condition)
+ *       futex_lock_cancel(f);
+ *    else
+ *       futex_lock_commit(f, v);
+ * The waker makes the condition true, then calls futex_unlock(f).
+ */
+
+// register as a waiter of f. Return the value to give to futex_lock_commit()
+int futex_lock_prepare(futex *f);
+
+// sleep until futex_unlock() is called, unless it has been called since
+// futex_lock_prepare() returned v, or at most 1ms
+int futex_lock_commit(futex *f, int v);
+
+// do not sleep after futex_lock_prepare()
+void futex_lock_cancel(futex *f);
+
+// wake up the waiters of f, if there are some
 int futex_unlock(futex *f);
 
 /********************** Assembly code **********************/
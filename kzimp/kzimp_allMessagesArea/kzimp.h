@@ -18,6 +18,12 @@
 #include <linux/wait.h>         /* wait queues */
 #include <linux/list.h>         /* linked list */
 #include <linux/poll.h>         /* poll_table structure */
+#include <linux/uio.h>          /* struct iovec */
+#include <linux/mutex.h>        /* mutex of the control device and of the channels */
+#include <linux/mm.h>           /* vm_area_struct */
+#include <linux/percpu.h>       /* per-CPU statistics */
+#include <linux/debugfs.h>      /* statistics files */
+#include <linux/seq_file.h>     /* statistics files and /proc file */
 
 #include "mem_wrapper.h"
 
@@ -28,10 +34,6 @@
 // Provides the same results whether it is present or not.
 //#define ATOMIC_WAKE_UP
 
-// define CHANNEL_WRITE_IDX_ATOMIC if you want next_write_idx to be an atomic_t
-// which will overflow. The writers will compute the modulo without a lock.
-//#define CHANNEL_WRITE_IDX_ATOMIC
-
 // define USE_CHECKSUM_CODE if you want to execute (parts of) the checksum code
 //#define USE_CHECKSUM_CODE
 
@@ -42,6 +44,146 @@
 // The last modulo is to prevent the padding to add CACHE_LINE_SIZE bytes to the structure
 #define PADDING_SIZE(S) ((CACHE_LINE_SIZE - ((S) % CACHE_LINE_SIZE)) % CACHE_LINE_SIZE)
 
+// round up to a page size
+#define ROUND_UP_PAGE_SIZE(S) ((S) + ((PAGE_SIZE - ((S) % PAGE_SIZE)) % PAGE_SIZE))
+
+// IOCTL commands
+// arg is a unsigned long[3]: user-space address of the message (not used), index of the message
+// in the big messages area of the writer, length (KZIMP_DATA_PATH_WRITER_SPLICE)
+#define KZIMP_IOCTL_SPLICE_WRITE 0x1
+// arg is a unsigned long[2]: a pointer to an array of struct iovec and its number of elements
+#define KZIMP_IOCTL_WRITE_BATCH 0x2
+#define KZIMP_IOCTL_READ_BATCH 0x3
+// number of struct iovec of a KZIMP_IOCTL_READ_BATCH copied on the stack, the others are allocated
+#define KZIMP_FAST_IOVS 8
+// arg is a unsigned long[2]: the wait policy and the max spin time in ns (see below).
+// Only a writer can set the policies of the channel
+#define KZIMP_IOCTL_SET_WAIT_POLICY 0x4
+// arg is a unsigned long[2]: index of the message in the big messages area of the writer, length
+// (KZIMP_DATA_PATH_WRITER_SPLICE)
+#define KZIMP_IOCTL_POOL_WRITE 0x5
+// arg is not used (KZIMP_DATA_PATH_READER_SPLICE)
+#define KZIMP_IOCTL_SPLICE_START_READ 0x7
+#define KZIMP_IOCTL_SPLICE_FINISH_READ 0x8
+// arg is a unsigned long[2]: the overflow policy and the size of the backlog of the readers
+// in bytes (see below). Only a writer can set it
+#define KZIMP_IOCTL_SET_OVERFLOW_POLICY 0x6
+// arg is not used. Returns the number of messages the reader can read without blocking
+#define KZIMP_IOCTL_PENDING 0x9
+// arg is not used. Returns the number of messages lost by the reader at its last gap,
+// i.e. when its last read has returned -EPIPE
+#define KZIMP_IOCTL_GAP 0xA
+// arg is the lane of the next messages of the writer, from 0 (the lowest priority) to the number
+// of lanes of the channel - 1 (see below)
+#define KZIMP_IOCTL_SET_LANE 0xB
+
+// IOCTL commands of the control device
+// arg is a pointer to a struct kzimp_channel_params
+#define KZIMP_IOCTL_CREATE_CHANNEL 0x10
+#define KZIMP_IOCTL_RESIZE_CHANNEL 0x11
+// arg is the id of the channel
+#define KZIMP_IOCTL_DESTROY_CHANNEL 0x12
+
+// Wait policies of the readers and writers of a channel, when the message is not ready
+#define KZIMP_WAIT_BLOCK 0            /* sleep in the wait queue */
+#define KZIMP_WAIT_SPIN_THEN_BLOCK 1  /* spin during the spin budget, then sleep */
+#define KZIMP_WAIT_SPIN 2             /* spin (the writers still have their timeout) */
+
+// The spin budget of a channel whose wait policy is KZIMP_WAIT_SPIN_THEN_BLOCK
+// is twice the average waiting time of its readers, if this average is less than
+// max_spin_ns. Otherwise the waiters sleep immediately.
+// The average is an exponentially weighted moving average, of weight 1/2^KZIMP_WAIT_EWMA_SHIFT
+#define KZIMP_WAIT_EWMA_SHIFT 3
+
+// no time limit for spinning
+#define KZIMP_SPIN_UNBOUNDED (~0ULL)
+
+// Overflow policies of a channel: what a writer does with the readers that have not read the
+// previous message on its position when its timeout expires
+#define KZIMP_OVERFLOW_EVICT 0  /* the late readers are set offline: their next read returns -EBADF */
+#define KZIMP_OVERFLOW_BLOCK 1  /* there is no timeout: the writer waits for the late readers, interruptibly */
+#define KZIMP_OVERFLOW_SPILL 2  /* the messages of the late readers are copied in their backlog, then as KZIMP_OVERFLOW_SKIP */
+#define KZIMP_OVERFLOW_SKIP 3   /* the late readers skip the messages they have not read yet: their next read returns -EPIPE */
+
+// With KZIMP_OVERFLOW_SPILL and KZIMP_OVERFLOW_SKIP the writer moves the read cursor of a late reader
+// to its own ticket, thus the channel must be in KZIMP_MODE_CURSOR. The reader first reads the
+// messages of its backlog (KZIMP_OVERFLOW_SPILL), then its next read returns -EPIPE if some messages
+// could not be copied (the backlog is full, or they were still being written). The number of lost
+// messages is given by KZIMP_IOCTL_GAP. The reader then reads the messages from the ticket of the writer.
+// The backlog of a reader is allocated when it opens the channel, if the policy is KZIMP_OVERFLOW_SPILL.
+// A reader without backlog is handled as with KZIMP_OVERFLOW_SKIP.
+// KZIMP_OVERFLOW_SPILL is not available with KZIMP_DATA_PATH_READER_SPLICE.
+
+// returned by the read paths when the next message of a reader is in its backlog
+#define KZIMP_READ_BACKLOG 1
+
+// Priority lanes: a channel can have up to KZIMP_MAX_LANES lanes. Each lane is a ring of
+// channel_size messages, with its own tickets and read cursors: the messages of a lane never wait
+// for the free positions of another lane. A writer writes in lane 0 until it chooses another lane
+// with KZIMP_IOCTL_SET_LANE. A read, a KZIMP_IOCTL_READ_BATCH or a poll considers the highest lane
+// first: a message of lane l is read before the messages of the lower lanes that are already
+// there, thus a burst of messages in lane 0 does not delay the messages of the higher lanes.
+// The order of the messages is only kept within a lane. The readers of all the lanes of a channel
+// have the same bit, and sleep in the wait queues of lane 0.
+// The lanes are only available with KZIMP_DATA_PATH_COPY and KZIMP_DATA_PATH_ARENA.
+#define KZIMP_MAX_LANES 4
+
+// Channel modes: how the writers know that all the readers have read a message
+#define KZIMP_MODE_BITMAP 0  /* each reader clears its bit in the bitmap of the message */
+#define KZIMP_MODE_CURSOR 1  /* each reader publishes its read cursor on its own cache line */
+
+// NUMA placement of the memory of a channel (its messages area, messages and read cursors).
+// A node id >= 0 places the memory on this node.
+#define KZIMP_NODE_ANY -1      /* the node of the process that (re)creates the channel */
+#define KZIMP_NODE_WRITER -2   /* the node of the first writer */
+#define KZIMP_NODE_READERS -3  /* the node of the majority of the readers, when the first writer arrives */
+
+// Data paths of a channel: how the content of the messages goes from the writers to the readers
+#define KZIMP_DATA_PATH_COPY 0          /* write() and read() copy the messages */
+#define KZIMP_DATA_PATH_WRITER_SPLICE 1 /* the writers fill their mmapped big messages area (no copy when sending) */
+#define KZIMP_DATA_PATH_READER_SPLICE 2 /* the readers read the mmapped messages area (no copy when receiving) */
+#define KZIMP_DATA_PATH_ARENA 3         /* as KZIMP_DATA_PATH_COPY, with the content of the messages allocated by size class */
+
+// KZIMP_DATA_PATH_WRITER_SPLICE: the big messages area of a writer is a pool of channel_size+1
+// slots of max_msg_size bytes rounded up to a page, that the writer mmaps at the offsets (in pages)
+// 0 to channel_size. The state of the slots is an array of channel_size+1 int, that the writer
+// can mmap read-only at the offset channel_size+1. A slot is owned by the writer if its state
+// is 0, and by the channel (its message may not have been read by all the readers) if it is 1.
+// The writer fills a slot it owns and sends it with KZIMP_IOCTL_POOL_WRITE.
+#define KZIMP_POOL_SLOT_FREE 0
+#define KZIMP_POOL_SLOT_BUSY 1
+
+// KZIMP_DATA_PATH_ARENA: the channel has no messages area. When a message is written, its content
+// is taken from the size class of its length: class c has buffers of 2^(KZIMP_ARENA_MIN_SHIFT+c)
+// bytes, carved from chunks of at least KZIMP_ARENA_CHUNK_SIZE bytes. The buffer of a message goes
+// back to its class when the position of the message is reused. The chunks are freed with the
+// channel: the memory of the channel follows the bytes in flight, not channel_size * max_msg_size.
+#define KZIMP_ARENA_MIN_SHIFT 6     /* a cache line */
+#define KZIMP_ARENA_NB_CLASSES 26   /* up to 2GB */
+#define KZIMP_ARENA_CHUNK_SIZE (4 * PAGE_SIZE)
+
+// With KZIMP_DATA_PATH_COPY and KZIMP_DATA_PATH_ARENA, each message descriptor is followed by
+// KZIMP_INLINE_SIZE bytes: the content of a message of at most KZIMP_INLINE_SIZE bytes is
+// stored there, and the readers find it on the cache lines next to the descriptor.
+// A copy channel whose max message size is at most KZIMP_INLINE_SIZE has no messages area.
+#define KZIMP_INLINE_SIZE (2 * CACHE_LINE_SIZE)
+
+// Size of the blocks of a message that a reader prefetches ahead while it copies the
+// current one (see prefetch_copy_threshold): the hardware prefetchers stop at the page boundaries.
+#define KZIMP_PREFETCH_BLOCK PAGE_SIZE
+
+// Number of buckets of the histograms of the latencies of the channels, from the
+// publication of a message to its read. Bucket 0 holds the latencies of 0ns, bucket
+// i > 0 the latencies of [2^(i-1), 2^i[ ns, the last one all the greater latencies.
+#define KZIMP_LATENCY_BUCKETS 32
+
+// Max number of words of the multicast mask of a channel. The max number of readers of a
+// channel is chosen when it is created, up to KZIMP_MAX_READERS.
+// With more than BITS_PER_LONG readers, each message has a second level bitmap of
+// KZIMP_MAX_BITMAP_WORDS words, on its own cache line (see struct kzimp_bitmap).
+#define KZIMP_MAX_BITMAP_WORDS (CACHE_LINE_SIZE / sizeof(unsigned long))
+#define KZIMP_MAX_READERS (KZIMP_MAX_BITMAP_WORDS * BITS_PER_LONG)
+
 // This module takes the following arguments:
 static int nb_max_communication_channels = 4;
 module_param(nb_max_communication_channels, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
@@ -64,18 +206,85 @@ static int default_compute_checksum = 1;
 module_param(default_compute_checksum, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(default_compute_checksum, " By default, for the new channels, do we compute the checksum on messages. If 0 then no; if 1 then yes; if 2 then on header only");
 
+static int default_wait_policy = KZIMP_WAIT_BLOCK;
+module_param(default_wait_policy, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_wait_policy, " The default wait policy of the new channels. If 0 then block; if 1 then spin then block; if 2 then spin");
+
+static unsigned long default_max_spin_ns = 50000;
+module_param(default_max_spin_ns, ulong, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_max_spin_ns, " The default max spin time (in nanoseconds) of the new channels, when the wait policy is spin then block.");
+
+static int default_overflow_policy = KZIMP_OVERFLOW_EVICT;
+module_param(default_overflow_policy, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_overflow_policy, " The default overflow policy of the new channels. If 0 then evict the late readers; if 1 then block; if 2 then spill their messages to their backlog; if 3 then skip their messages. 2 and 3 need the cursor mode");
+
+static unsigned long default_backlog_size = 1 << 20;
+module_param(default_backlog_size, ulong, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_backlog_size, " The default size (in bytes) of the backlog of the readers of the new channels, when the overflow policy is spill.");
+
+static int default_nb_lanes = 1;
+module_param(default_nb_lanes, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_nb_lanes, " The default number of priority lanes of the new copy and arena channels, up to 4. The readers read the messages of the highest lanes first");
+
+static int default_mode = KZIMP_MODE_BITMAP;
+module_param(default_mode, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_mode, " The default mode of the new channels. If 0 then the readers clear a bitmap per message; if 1 then they publish a read cursor");
+
+static int default_max_readers = BITS_PER_LONG;
+module_param(default_max_readers, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_max_readers, " The default max number of readers of the new channels, up to 512. Above 64 the bitmap of the messages has two levels");
+
+static int default_data_path = KZIMP_DATA_PATH_COPY;
+module_param(default_data_path, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_data_path, " The default data path of the new channels. If 0 then copy; if 1 then writer splice (the writers mmap their messages); if 2 then reader splice (the readers mmap the messages); if 3 then copy with the messages allocated by size class");
+
+static int use_huge_pages = 0;
+module_param(use_huge_pages, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(use_huge_pages, " If 1 then the messages areas of the new channels are made of physically contiguous huge pages (2MB), when possible; if 0 then they are allocated with vmalloc");
+
+static int big_msg_pool_size = 4;
+module_param(big_msg_pool_size, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(big_msg_pool_size, " The max number of unused big messages areas that a writer splice channel keeps for its next writers. The other ones are freed");
+
+static int use_inline_messages = 1;
+module_param(use_inline_messages, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(use_inline_messages, " If 1 then the small messages of the new copy and arena channels are stored next to their descriptor; if 0 then they are stored in the messages area or the arena");
+
+static int collect_latencies = 1;
+module_param(collect_latencies, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(collect_latencies, " If 1 then the writers timestamp the messages and the readers fill the latency histograms of the channels; if 0 then they do not");
+
+static int nt_copy_threshold = 4096;
+module_param(nt_copy_threshold, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(nt_copy_threshold, " The writers copy the messages of at least this size (in bytes) with non-temporal stores, when the CPU has them and the checksum is not computed on the whole message, so that they do not fill their cache with data that only the readers read. If 0 then never");
+
+static int prefetch_copy_threshold = 0;
+module_param(prefetch_copy_threshold, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(prefetch_copy_threshold, " The readers copy the messages of at least this size (in bytes) while prefetching their next page. If 0 then never");
+
+static int default_node = KZIMP_NODE_ANY;
+module_param(default_node, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(default_node, " The default NUMA node of the memory of the new channels. If >= 0 then this node; if -1 then any node; if -2 then the node of the first writer; if -3 then the node of the majority of the readers");
+
 // file /dev/<DEVICE_NAME>
 #define DEVICE_NAME "kzimp"
 
+// file /dev/<CTL_DEVICE_NAME>, the control device
+#define CTL_DEVICE_NAME "kzimp_ctl"
+
 /* file /proc/<procfs_name> */
 #define procfs_name "kzimp"
 
+/* directory <debugfs>/<debugfs_name>, with a statistics file per channel */
+#define debugfs_name "kzimp"
+
 // FILE OPERATIONS
 static int kzimp_open(struct inode *, struct file *);
 static int kzimp_release(struct inode *, struct file *);
 static ssize_t kzimp_read(struct file *, char __user *, size_t, loff_t *);
 static ssize_t kzimp_write(struct file *, const char __user *, size_t, loff_t *);
 static unsigned int kzimp_poll(struct file *filp, poll_table *wait);
+static long kzimp_ioctl(struct file *, unsigned int, unsigned long);
 
 // an open file is associated with a set of functions
 static struct file_operations kzimp_fops =
@@ -86,6 +295,115 @@ static struct file_operations kzimp_fops =
     .read = kzimp_read,
     .write = kzimp_write,
     .poll = kzimp_poll,
+    .unlocked_ioctl = kzimp_ioctl,
+};
+
+// FILE OPERATIONS OF THE OTHER DATA PATHS
+// kzimp_open() replaces kzimp_fops by the operations of the data path of the channel
+static ssize_t kzimp_arena_write(struct file *, const char __user *, size_t, loff_t *);
+static ssize_t kzimp_writer_splice_read(struct file *, char __user *, size_t, loff_t *);
+static ssize_t kzimp_writer_splice_write(struct file *, const char __user *, size_t, loff_t *);
+static int kzimp_writer_splice_mmap(struct file *, struct vm_area_struct *);
+static long kzimp_writer_splice_ioctl(struct file *, unsigned int, unsigned long);
+static int kzimp_reader_splice_mmap(struct file *, struct vm_area_struct *);
+static long kzimp_reader_splice_ioctl(struct file *, unsigned int, unsigned long);
+
+static struct file_operations kzimp_arena_fops =
+{
+    .owner = THIS_MODULE,
+    .open = kzimp_open,
+    .release = kzimp_release,
+    .read = kzimp_read,
+    .write = kzimp_arena_write,
+    .poll = kzimp_poll,
+    .unlocked_ioctl = kzimp_ioctl,
+};
+
+static struct file_operations kzimp_writer_splice_fops =
+{
+    .owner = THIS_MODULE,
+    .open = kzimp_open,
+    .release = kzimp_release,
+    .read = kzimp_writer_splice_read,
+    .write = kzimp_writer_splice_write,
+    .poll = kzimp_poll,
+    .mmap = kzimp_writer_splice_mmap,
+    .unlocked_ioctl = kzimp_writer_splice_ioctl,
+};
+
+static struct file_operations kzimp_reader_splice_fops =
+{
+    .owner = THIS_MODULE,
+    .open = kzimp_open,
+    .release = kzimp_release,
+    .read = kzimp_read,
+    .write = kzimp_write,
+    .poll = kzimp_poll,
+    .mmap = kzimp_reader_splice_mmap,
+    .unlocked_ioctl = kzimp_reader_splice_ioctl,
+};
+
+// VMA OPERATIONS
+static int kzimp_writer_splice_vma_fault(struct vm_area_struct *, struct vm_fault *);
+static int kzimp_reader_splice_vma_fault(struct vm_area_struct *, struct vm_fault *);
+
+// operations for mmap on the vmas
+static struct vm_operations_struct kzimp_writer_splice_vm_ops = {
+    .fault = kzimp_writer_splice_vma_fault,
+};
+
+static struct vm_operations_struct kzimp_reader_splice_vm_ops = {
+    .fault = kzimp_reader_splice_vma_fault,
+};
+
+// CONTROL DEVICE OPERATIONS
+static long kzimp_ctl_ioctl(struct file *, unsigned int, unsigned long);
+
+static struct file_operations kzimp_ctl_fops =
+{
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = kzimp_ctl_ioctl,
+};
+
+// STATISTICS FILES OPERATIONS
+static int kzimp_stats_open(struct inode *, struct file *);
+static ssize_t kzimp_stats_write(struct file *, const char __user *, size_t, loff_t *);
+
+static struct file_operations kzimp_stats_fops =
+{
+    .owner = THIS_MODULE,
+    .open = kzimp_stats_open,
+    .read = seq_read,
+    .write = kzimp_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+// /PROC FILE OPERATIONS
+static int kzimp_proc_open(struct inode *, struct file *);
+static ssize_t kzimp_write_proc_file(struct file *, const char __user *, size_t, loff_t *);
+
+static struct file_operations kzimp_proc_fops =
+{
+    .owner = THIS_MODULE,
+    .open = kzimp_proc_open,
+    .read = seq_read,
+    .write = kzimp_write_proc_file,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+// Parameters of a channel, for the ioctls of the control device.
+// It is also defined in the user-space library, libkzimp/kzimp_ctl.h
+struct kzimp_channel_params
+{
+  int chan_id;          /* id of the channel. -1 to create the channel with the first free id */
+  int channel_size;     /* max number of messages in the channel */
+  int max_msg_size;     /* max message size */
+  int compute_checksum; /* do we compute the checksum? 0: no, 1: yes, 2: partial */
+  long timeout_in_ms;   /* writer's timeout in miliseconds */
+  int max_readers;      /* max number of readers. -1 for the default one */
+  int data_path;        /* KZIMP_DATA_PATH_COPY, _WRITER_SPLICE, _READER_SPLICE or _ARENA. -1 for the default one */
 };
 
 #define KZIMP_HEADER_SIZE (sizeof(unsigned long)+sizeof(int)+sizeof(short))
@@ -94,51 +412,169 @@ static struct file_operations kzimp_fops =
 // it must be packed so that we can compute the checksum
 struct kzimp_message
 {
-  unsigned long bitmap; /* the bitmap, alone on  */
+  unsigned long bitmap; /* the bitmap. With more than one bitmap word, bit i is set if word i of the second level is not 0 */
   int len;              /* length of the message */
 
 #ifdef USE_CHECKSUM_CODE
   short checksum;       /* the checksum */
 
   short __p1;           /* to align properly the char* */
+#else
+  int __p1;             /* to align properly the char* and write_seq */
 #endif
 
   char *data;           /* the message content */
+  unsigned long write_seq; /* ticket of the writer allowed to write this message */
 #ifdef ATOMIC_WAKE_UP
   atomic_t waking_up_writer;  /* is there someone waking up the writers? */
 #endif
+  char *area_data;      /* the message content in the messages area. data points to a big messages area instead after a splice write */
+  int *pool_slot;       /* state of the pool slot of the message (KZIMP_IOCTL_POOL_WRITE), NULL otherwise */
+  int arena_class;      /* size class of data (KZIMP_DATA_PATH_ARENA), -1 if data is not in the arena */
+  u64 publish_ns;       /* time of the publication of the message, 0 if collect_latencies is not set */
 
   // padding (to avoid false sharing)
 #ifdef ATOMIC_WAKE_UP
-  char __p2[PADDING_SIZE(KZIMP_HEADER_SIZE + sizeof(short) + sizeof(char*) + sizeof(atomic_t))];
+  char __p2[PADDING_SIZE(KZIMP_HEADER_SIZE + sizeof(short) + sizeof(char*) + sizeof(unsigned long) + sizeof(atomic_t) + sizeof(char*) + sizeof(int*) + sizeof(int) + sizeof(u64))];
 #else
-  char __p2[PADDING_SIZE(KZIMP_HEADER_SIZE + sizeof(short) + sizeof(char*))];
+  char __p2[PADDING_SIZE(KZIMP_HEADER_SIZE + sizeof(short) + sizeof(char*) + sizeof(unsigned long) + sizeof(char*) + sizeof(int*) + sizeof(int) + sizeof(u64))];
 #endif
 }__attribute__((__packed__, __aligned__(CACHE_LINE_SIZE)));
 
+// Second level bitmap of a message, when the channel has more than BITS_PER_LONG readers
+struct kzimp_bitmap
+{
+  unsigned long words[KZIMP_MAX_BITMAP_WORDS]; /* bit i of word w is the bit of the reader w*BITS_PER_LONG+i */
+}__attribute__((__aligned__(CACHE_LINE_SIZE)));
+
+// Read cursor of a reader, alone on its cache line (KZIMP_MODE_CURSOR)
+struct kzimp_cursor
+{
+  unsigned long seq;    /* sequence number (ticket of the writer) of the next message to read */
+}__attribute__((__aligned__(CACHE_LINE_SIZE)));
+
+// Statistics of a channel. Each CPU has its own copy: the writers and readers update
+// the copy of their CPU without any atomic operation, the copies are summed when the
+// statistics are read.
+struct kzimp_stats
+{
+  unsigned long msgs_written;       /* number of published messages, the holes excluded */
+  unsigned long bytes_written;      /* total length of the published messages */
+  unsigned long msgs_read;          /* number of messages read by the readers */
+  unsigned long bytes_read;         /* total length of the read messages */
+  unsigned long writer_waits;       /* number of writes that have found the channel full: they waited or returned -EAGAIN */
+  unsigned long timeouts;           /* number of writer timeouts (see handle_timeout()) */
+  unsigned long readers_offline;    /* number of readers set offline by the timeouts */
+  unsigned long readers_moved;      /* number of times a late reader has been moved by a timeout (KZIMP_OVERFLOW_SPILL, _SKIP) */
+  unsigned long msgs_spilled;       /* number of messages copied in the backlog of the late readers */
+  unsigned long msgs_skipped;       /* number of messages the late readers have lost */
+  unsigned long checksum_failures;  /* number of messages with an incorrect checksum */
+  unsigned long latency[KZIMP_LATENCY_BUCKETS]; /* log2 histogram of the latencies, in ns */
+};
+
+// Wait queue of a reader, alone on its cache line: the writers only wake up the readers
+// that are waiting, and a reader is only woken up by the messages of its channel
+struct kzimp_reader_wq
+{
+  wait_queue_head_t q;
+}__attribute__((__aligned__(CACHE_LINE_SIZE)));
+
+// Backlog of a reader (KZIMP_OVERFLOW_SPILL): a ring of records, each made of a struct
+// kzimp_backlog_record followed by the content of the message. The writers append the
+// records with the move_mutex of the channel, the reader consumes them without lock.
+// head and tail only increase: the offset of a record is its position modulo size.
+struct kzimp_backlog
+{
+  unsigned long head;   /* position of the next appended record */
+  char __p1[CACHE_LINE_SIZE - sizeof(unsigned long)];
+  unsigned long tail;   /* position of the next record the reader consumes */
+  char __p2[CACHE_LINE_SIZE - sizeof(unsigned long)];
+  unsigned long size;   /* size of data, in bytes */
+  char *data;           /* the records */
+}__attribute__((__aligned__(CACHE_LINE_SIZE)));
+
+// Header of a record of a backlog
+struct kzimp_backlog_record
+{
+  unsigned long seq;    /* sequence number (ticket of the writer) of the message */
+  int len;              /* length of the message, 0 for a hole */
+};
+
+// Size class of the arena of a channel (KZIMP_DATA_PATH_ARENA)
+struct kzimp_arena_class
+{
+  spinlock_t lock;      /* protects free */
+  void *free;           /* list of the free buffers of this class, linked by their first word */
+}__attribute__((__aligned__(CACHE_LINE_SIZE)));
+
+// A chunk of memory of the arena of a channel, split in buffers of a size class
+struct kzimp_arena_chunk
+{
+  char *addr;
+  unsigned long len;
+  int vmalloced;        /* 1 if addr has been vmalloc'ed, 0 if it has been kmalloc'ed */
+  struct list_head next;
+};
+
 // kzimp communication channel
 struct kzimp_comm_chan
 {
   int channel_size;                 /* max number of messages in the channel */
   int compute_checksum;             /* do we compute the checksum? 0: no, 1: yes, 2: partial */
-  unsigned long multicast_mask;     /* the multicast mask, used for the bitmap */
-  struct kzimp_message* msgs;       /* the messages of the channel */
-  char *messages_area;              /* pointer to the big allocated area of messages */
+  int mode;                         /* KZIMP_MODE_BITMAP or KZIMP_MODE_CURSOR */
+  int data_path;                    /* KZIMP_DATA_PATH_COPY, _WRITER_SPLICE, _READER_SPLICE or _ARENA */
+  unsigned long multicast_mask[KZIMP_MAX_BITMAP_WORDS]; /* the multicast mask, used for the bitmap. In cursor mode, the set of readers */
+  int max_readers;                  /* max number of readers, i.e. number of bits of the multicast mask */
+  int nb_bitmap_words;              /* number of words of the multicast mask that are used */
+  struct kzimp_bitmap *bitmaps;     /* second level bitmaps of the messages, if nb_bitmap_words > 1 */
+  struct kzimp_cursor *cursors;     /* the read cursors, indexed by the bit of the readers (cursor mode) */
+  unsigned long readers_gen;        /* incremented each time a reader arrives */
+  struct kzimp_message* msgs;       /* the messages of the channel. Use kzimp_msg() to access them */
+  int msg_stride;                   /* bytes between two messages: size of a descriptor and of its inline content */
+  int inline_size;                  /* max size of an inline message content, 0 if there is none */
+  char *messages_area;              /* pointer to the big allocated area of messages. NULL with KZIMP_DATA_PATH_ARENA */
+  unsigned long messages_area_size; /* size of the messages area, in bytes */
+  int huge_pages;                   /* 1 if the messages area is made of huge pages, 0 if it has been vmalloc'ed */
+  int node_policy;                  /* a node id, KZIMP_NODE_ANY, KZIMP_NODE_WRITER or KZIMP_NODE_READERS */
+  int node;                         /* NUMA node of the messages area, -1 if it has not been placed */
   long timeout_in_ms;               /* writer's timeout in miliseconds */
-  wait_queue_head_t rq, wq;         /* the wait queues */
+  wait_queue_head_t wq;             /* the wait queue of the writers */
+  struct kzimp_reader_wq *readers_wq; /* the wait queues of the readers, indexed by their bit */
+  unsigned long waiting_readers[KZIMP_MAX_BITMAP_WORDS]; /* bit i is set if the wait queue of reader i may not be empty */
+
+  int overflow_policy;              /* KZIMP_OVERFLOW_EVICT, _BLOCK, _SPILL or _SKIP */
+  unsigned long backlog_size;       /* size of the backlog of the new readers, in bytes (KZIMP_OVERFLOW_SPILL) */
+
+  int wait_policy;                  /* KZIMP_WAIT_BLOCK, KZIMP_WAIT_SPIN_THEN_BLOCK or KZIMP_WAIT_SPIN */
+  unsigned long max_spin_ns;        /* max spin budget, in nanoseconds */
+  unsigned long spin_budget_ns;     /* current spin budget, in nanoseconds */
+  unsigned long avg_wait_ns;        /* average waiting time of the readers, in nanoseconds */
+  atomic_long_t nb_spins;           /* number of waits that ended while spinning */
+  atomic_long_t nb_sleeps;          /* number of times a reader or writer has slept */
+  atomic_long_t nb_wakeups;         /* number of wake ups of the readers or writers */
+  struct kzimp_stats __percpu *stats; /* the statistics, per CPU */
 
   // these variables are used by the writers only.
-#ifdef CHANNEL_WRITE_IDX_ATOMIC
-  atomic_t next_write_idx;
-#else
-  int next_write_idx;               /* position of the next written message */
-#endif
+  atomic_long_t next_write_idx;     /* next ticket. Position of the next written message modulo channel_size */
   spinlock_t bcl;                   /* the Big Channel Lock :) */
+  struct mutex move_mutex;          /* held by the writer moving the late readers, which cannot leave the channel */
 
   int max_msg_size;                 /* max message size */
+  int max_msg_size_page_rounded;    /* max message size, rounded up to a page: size of a slot of a big messages area */
+  struct list_head writers_big_msg; /* big messages areas of the writers (KZIMP_DATA_PATH_WRITER_SPLICE), protected by bcl */
+  struct big_mem_area_elt **msg_big_areas; /* big messages area of the content of each message, NULL if it is not in one */
+  struct kzimp_arena_class *arena;  /* the KZIMP_ARENA_NB_CLASSES size classes (KZIMP_DATA_PATH_ARENA), NULL otherwise */
+  struct list_head arena_chunks;    /* chunks of the arena, protected by bcl */
+  unsigned long arena_size;         /* size of the chunks of the arena, in bytes */
   int nb_readers;                   /* number of readers */
+  int nb_writers;                   /* number of writers */
   struct list_head readers;         /* List of pointers to the readers' control structure */
+  int nb_lanes;                     /* number of lanes of the channel. 1 for a lane */
+  struct kzimp_comm_chan *lanes[KZIMP_MAX_LANES]; /* the lanes of the channel, lanes[0] is the channel itself */
+  struct kzimp_comm_chan *lane0;    /* lane 0 of the channel this lane belongs to, i.e. the channel of the device */
   int chan_id;                      /* id of this channel */
+  int created;                      /* 1 if the channel exists, 0 if it has been destroyed */
+  int nb_files;                     /* number of open files on this channel */
   struct cdev cdev;                 /* char device structure */
 }__attribute__((__aligned__(CACHE_LINE_SIZE)));
 
@@ -146,23 +582,115 @@ struct kzimp_comm_chan
 struct kzimp_ctrl
 {
   int next_read_idx;               /* index of the next read in the channel */
+  unsigned long next_read_seq;     /* sequence number of the next read: next_read_idx = next_read_seq % channel_size */
+  unsigned long backlog_seq;       /* reader: sequence number of the next message to get from the backlog. It is
+                                      next_read_seq unless a writer has moved the reader (KZIMP_OVERFLOW_SPILL, _SKIP) */
+  struct kzimp_backlog *backlog;   /* reader: its backlog (KZIMP_OVERFLOW_SPILL), NULL otherwise */
+  unsigned long last_gap;          /* reader: number of messages lost at the last gap (see KZIMP_IOCTL_GAP) */
+  unsigned long nb_lost;           /* reader: total number of lost messages */
+  unsigned long min_cursor;        /* writer: min of the read cursors, when it was last computed (cursor mode) */
+  unsigned long min_cursor_gen;    /* writer: readers_gen of the channel when min_cursor was computed */
   int bitmap_bit;                  /* position of the bit in the multicast mask modified by this reader */
   pid_t pid;                       /* pid of this reader */
+  int node;                        /* NUMA node of this process when it has opened the channel */
   int online;                      /* is this reader still active or not? */
+  unsigned long nb_msgs_read;      /* reader: number of read messages */
+  unsigned long nb_bytes_read;     /* reader: total length of the read messages */
+  unsigned long nb_sleeps;         /* reader: number of times it has slept */
+  char *big_msg_area;              /* writer: big messages area, that it mmaps (KZIMP_DATA_PATH_WRITER_SPLICE) */
+  size_t big_msg_area_len;         /* length of the big messages area */
+  int big_msg_slot_size;           /* size of a slot of the big messages area (max message size rounded up to a page) */
+  int big_msg_nb_slots;            /* number of slots of the big messages area (channel_size+1) */
+  int big_msg_area_huge;           /* 1 if the big messages area is made of huge pages, 0 otherwise */
+  int *pool_state;                 /* state of the slots of the big messages area (see KZIMP_IOCTL_POOL_WRITE) */
+  struct big_mem_area_elt *bma;    /* writer: its reference on its big messages area */
+  int nb_lanes;                    /* number of lanes of the channel when the process has opened it */
+  int lane;                        /* writer: lane of its next messages (see KZIMP_IOCTL_SET_LANE) */
+  struct kzimp_ctrl *lanes[KZIMP_MAX_LANES]; /* control structures of the process on each lane, lanes[0] is this one */
   struct list_head next;           /* pointer to the next reader on this channel */
   struct kzimp_comm_chan *channel; /* pointer to the channel */
 }__attribute__((__aligned__(CACHE_LINE_SIZE)));
 
+// A big messages area of a writer. It cannot be freed when the writer closes its file,
+// as some of its messages may not have been read yet: its writer and each message of the
+// channel sent from it hold a reference on it. Once it has no reference, it is given to
+// the next writer that opens the channel, or freed (see kzimp_reclaim_big_msg_areas()).
+struct big_mem_area_elt
+{
+  char *addr;
+  size_t len;
+  int huge;
+  int *pool_state;
+  atomic_t refcount;
+  struct list_head next;
+};
+
 // return 1 if the writer can writeits message, 0 otherwise
 static inline int writer_can_write(unsigned long bitmap)
 {
   return (bitmap == 0);
 }
 
+// return 1 if the writer holding ticket can write in the message m, 0 otherwise:
+// the writer of the previous round on m must have published its message first
+static inline int writer_has_turn(struct kzimp_message *m, unsigned long ticket)
+{
+  return (ACCESS_ONCE(m->write_seq) == ticket);
+}
+
+// return the i-th message of chan
+static inline struct kzimp_message* kzimp_msg(struct kzimp_comm_chan *chan,
+    int i)
+{
+  return (struct kzimp_message*) ((char*) chan->msgs + (unsigned long) i
+      * chan->msg_stride);
+}
+
+// return the index of the message m of chan
+static inline int kzimp_msg_idx(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m)
+{
+  return ((char*) m - (char*) chan->msgs) / chan->msg_stride;
+}
+
+// return the address of the inline content of the message m
+static inline char* kzimp_inline_data(struct kzimp_message *m)
+{
+  return (char*) (m + 1);
+}
+
+// return 1 if the message is a hole left by a writer that has given up its message
+// (it has been interrupted or its buffer was invalid), 0 otherwise
+static inline int kzimp_is_hole(struct kzimp_message *m)
+{
+  return (m->len == 0);
+}
+
+// return 1 if the process that owns ctrl is a reader, 0 otherwise.
+// A writer of a KZIMP_DATA_PATH_WRITER_SPLICE channel has FMODE_READ, in order to mmap.
+static inline int kzimp_is_reader(struct kzimp_ctrl *ctrl)
+{
+  return (ctrl->bitmap_bit >= 0);
+}
+
+// Add v to the counter c of the statistics of chan, on the current CPU.
+// this_cpu_add() cannot be preempted in the middle of the update.
+#define kzimp_stat_add(chan, c, v) this_cpu_add((chan)->stats->c, (v))
+#define kzimp_stat_inc(chan, c) kzimp_stat_add(chan, c, 1)
+
+// return the bucket of the latency histograms for a latency of ns nanoseconds
+static inline int kzimp_latency_bucket(u64 ns)
+{
+  int b;
+
+  b = fls64(ns);
+  return (b < KZIMP_LATENCY_BUCKETS ? b : KZIMP_LATENCY_BUCKETS - 1);
+}
+
 // return 1 if the reader has a message to read, 0 otherwise
 static inline int reader_can_read(unsigned long bitmap, int bit)
 {
-  return (bitmap & (1 << bit));
+  return ((bitmap & (1UL << bit)) != 0);
 }
 
 
@@ -9,6 +9,13 @@
 #include <asm/bitops.h>        /* atomic bitwise ops */
 #include <asm/param.h>         /* HZ value */
 #include <linux/sched.h>       /* TASK_*INTERRUPTIBLE macros */
+#include <net/checksum.h>      /* csum_partial() */
+#include <linux/ktime.h>       /* ktime_get() */
+#include <linux/vmalloc.h>     /* vmalloc_user(), remap_vmalloc_range() */
+#include <linux/prefetch.h>    /* prefetch_range() */
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>    /* boot_cpu_has() */
+#endif
 
 #include "kzimp.h"
 
@@ -22,91 +29,72 @@ static int kzimp_major, kzimp_minor;
 // holds device information
 static dev_t kzimp_dev_t;
 
+// device number and cdev of the control device
+static dev_t kzimp_ctl_dev_t;
+static struct cdev kzimp_ctl_cdev;
+
+// serializes the creation, modification and destruction of the channels
+static DEFINE_MUTEX(kzimp_ctl_mutex);
+
 // pointer to the /proc file
 static struct proc_dir_entry *proc_file;
 
+// debugfs directory of the statistics files
+static struct dentry *debugfs_dir;
+
+// 1 if the CPU has the non-temporal stores of __copy_from_user_nocache() (see nt_copy_threshold)
+static int nt_copy_supported;
+
 // array of communication channels
 static struct kzimp_comm_chan *kzimp_channels;
 
 #ifdef USE_CHECKSUM_CODE
+// Fold the 32-bit partial sum sum into a 16 bit one's complement sum.
+// csum_fold() returns the complemented sum: complement it back.
+static inline short kzimp_csum_fold(__wsum sum)
+{
+  return (short) ~((__force u16) csum_fold(sum));
+}
+
 // Compute the 16 bit one's complement sum of all the 16-bit words in data of size size.
 // Use prev as the initial value of the sum.
 // The same method is used by TCP and UDP to compute the checksum
 // See RFC 793: http://tools.ietf.org/html/rfc793
-// Code from Minix3 (http://www.minix3.org)
+// csum_partial() is the optimized version of the architecture: on x86-64 it adds
+// 64-bit words with carry, and handles the misaligned buffers.
 short oneC_sum(short prev, void *data, size_t size)
 {
-  char *dptr;
-  size_t n;
-  short word;
-  int sum;
-  int swap = 0;
-
-  sum = prev;
-  dptr = data;
-  n = size;
-
-  swap = ((size_t) dptr & 1);
-  if (swap)
-  {
-    sum = ((sum & 0xFF) << 8) | ((sum & 0xFF00) >> 8);
-    if (n > 0)
-    {
-      ((char *) &word)[0] = 0;
-      ((char *) &word)[1] = dptr[0];
-      sum += (int) word;
-      dptr += 1;
-      n -= 1;
-    }
-  }
-
-  while (n >= 8)
-  {
-    sum += (int) ((short *) dptr)[0] + (int) ((short *) dptr)[1]
-                                                              + (int) ((short *) dptr)[2] + (int) ((short *) dptr)[3];
-    dptr += 8;
-    n -= 8;
-  }
-
-  while (n >= 2)
-  {
-    sum += (int) ((short *) dptr)[0];
-    dptr += 2;
-    n -= 2;
-  }
-
-  if (n > 0)
-  {
-    ((char *) &word)[0] = dptr[0];
-    ((char *) &word)[1] = 0;
-    sum += (int) word;
-  }
-
-  sum = (sum & 0xFFFF) + (sum >> 16);
-  if (sum > 0xFFFF)
-    sum++;
-
-  if (swap)
-  {
-    sum = ((sum & 0xFF) << 8) | ((sum & 0xFF00) >> 8);
-  }
-
-  return sum;
+  return kzimp_csum_fold(csum_partial(data, size, (__force __wsum) (u16) prev));
 }
 #endif
 
+// Give the bit bit_pos of the multicast mask of chan to a new reader.
+// seq is the sequence number of the first message the reader will read.
+static void kzimp_set_bitmap_bit(struct kzimp_comm_chan *chan, int bit_pos,
+    unsigned long seq)
+{
+  // in cursor mode the writers must see the cursor of the reader before its bit,
+  // and its bit before the new generation (see kzimp_update_min_cursor())
+  chan->cursors[bit_pos].seq = seq;
+  smp_wmb();
+  set_bit(bit_pos, chan->multicast_mask);
+  smp_wmb();
+  chan->readers_gen++;
+}
+
 // return the bit to modify in the multicast mask for this reader
-// given the communication channel chan or -1 if an error has occured
-static int get_new_bitmap_bit(struct kzimp_comm_chan *chan)
+// given the communication channel chan or -1 if an error has occured.
+// seq is the sequence number of the first message the reader will read.
+static int get_new_bitmap_bit(struct kzimp_comm_chan *chan, unsigned long seq)
 {
   int bit_pos, nr_bits;
 
-  nr_bits = sizeof(chan->multicast_mask) * 8; // sizeof() returns a number of bytes. We want bits.
-  bit_pos = find_first_zero_bit(&chan->multicast_mask, nr_bits);
+  nr_bits = chan->max_readers;
+  bit_pos = find_first_zero_bit(chan->multicast_mask, nr_bits);
 
   if (bit_pos != nr_bits)
   {
-    set_bit(bit_pos, &chan->multicast_mask);
+    kzimp_set_bitmap_bit(chan, bit_pos, seq);
   }
   else
   {
@@ -117,702 +105,5275 @@ static int get_new_bitmap_bit(struct kzimp_comm_chan *chan)
 }
 
 /*
- * kzimp open operation.
+ * Allocate a messages area for the channel, on the NUMA node node (-1 for any node).
+ * If use_huge_pages is set, the area is made of huge pages and no message crosses the
+ * boundary of a huge page. Then each message can be accessed through the kernel linear
+ * mapping, which uses huge TLB entries, rather than through the vmap of the area.
+ * We fall back to vmalloc if a message does not fit in a huge page or if there are not
+ * enough huge pages.
+ * *size is set to the size of the area and *huge to 1 if it is made of huge pages, 0 otherwise.
  * Returns:
- *  . -ENOMEM if the memory allocations fail
- *  . -1 if the maximum number of readers have been reached
- *  . 0 otherwise
+ *  . the address of the area
+ *  . NULL if the allocation has failed
  */
-static int kzimp_open(struct inode *inode, struct file *filp)
+static char* kzimp_alloc_messages_area(struct kzimp_comm_chan *chan, int node,
+    unsigned long *size, int *huge)
 {
-  struct kzimp_comm_chan *chan; /* channel information */
-  struct kzimp_ctrl *ctrl;
+  unsigned long msgs_per_huge_page;
+  char *area;
 
-  chan = container_of(inode->i_cdev, struct kzimp_comm_chan, cdev);
+  *huge = 0;
 
-  ctrl = my_kmalloc(sizeof(*ctrl), GFP_KERNEL);
-  if (unlikely(!ctrl))
+  if (use_huge_pages && chan->data_path == KZIMP_DATA_PATH_READER_SPLICE)
   {
-    printk(KERN_ERR "kzimp: kzimp_ctrl allocation error\n");
-    return -ENOMEM;
-  }
+    // the readers find the i-th message at the offset i*max_msg_size of their mapping
+    *size = (((unsigned long) chan->max_msg_size * (unsigned long) chan->channel_size
+        + HUGE_AREA_SIZE - 1) >> HUGE_AREA_SHIFT) << HUGE_AREA_SHIFT;
 
-  ctrl->pid = current->pid;
-  ctrl->channel = chan;
+    area = huge_area_alloc(*size, node);
+    if (area)
+    {
+      *huge = 1;
+      return area;
+    }
 
-  if (filp->f_mode & FMODE_READ)
+    printk(KERN_WARNING "kzimp: not enough huge pages for the %lu bytes of channel %i, using vmalloc\n", *size, chan->chan_id);
+  }
+  else if (use_huge_pages && chan->max_msg_size <= HUGE_AREA_SIZE)
   {
-    spin_lock(&chan->bcl);
-
-    // we set next_read_idx to the next position where the writer is going to write
-    // so that it gets the next message
-#ifdef CHANNEL_WRITE_IDX_ATOMIC
-    ctrl->next_read_idx = atomic_read(&chan->next_write_idx);
-#else
-    ctrl->next_read_idx = chan->next_write_idx;
-#endif
-    ctrl->bitmap_bit = get_new_bitmap_bit(chan);
-    ctrl->online = 1;
-
-    chan->nb_readers++;
-    list_add_tail(&ctrl->next, &chan->readers);
+    msgs_per_huge_page = HUGE_AREA_SIZE / chan->max_msg_size;
+    *size = ((chan->channel_size + msgs_per_huge_page - 1) / msgs_per_huge_page)
+        << HUGE_AREA_SHIFT;
 
-    spin_unlock(&chan->bcl);
-
-    if (ctrl->bitmap_bit == -1)
+    area = huge_area_alloc(*size, node);
+    if (area)
     {
-      printk(KERN_ERR "Maximum number of readers on the channel %i has been reached: %i\n", chan->chan_id, chan->nb_readers);
-      return -1;
+      *huge = 1;
+      return area;
     }
+
+    printk(KERN_WARNING "kzimp: not enough huge pages for the %lu bytes of channel %i, using vmalloc\n", *size, chan->chan_id);
+  }
+
+  *size = (unsigned long) chan->max_msg_size * (unsigned long) chan->channel_size;
+  if (node >= 0)
+  {
+    area = my_vmalloc_node(*size, node);
   }
   else
   {
-    ctrl->next_read_idx = -1;
-    ctrl->bitmap_bit = -1;
-    ctrl->online = -1;
-    ctrl->next.prev = ctrl->next.next = NULL;
+    area = my_vmalloc(*size);
+  }
+  if (unlikely(!area))
+  {
+    printk(KERN_ERR "kzimp: channel messages allocation of %lu bytes error\n", *size);
   }
 
-  filp->private_data = ctrl;
+  return area;
+}
 
-  return 0;
+static void kzimp_free_messages_area(char *area, unsigned long size, int huge)
+{
+  if (huge)
+  {
+    huge_area_free(area, size);
+  }
+  else
+  {
+    my_vfree(area);
+  }
 }
 
-/*
- * kzimp release operation.
- * Returns:
- *  . 0: it always succeeds
- */
-static int kzimp_release(struct inode *inode, struct file *filp)
+// return the address of the content of the i-th message of the channel
+static char* kzimp_message_data(struct kzimp_comm_chan *chan, int i)
 {
-  int i;
+  unsigned long msgs_per_huge_page, offset;
 
-  struct kzimp_comm_chan *chan; /* channel information */
-  struct kzimp_ctrl *ctrl;
+  // the messages of a reader splice channel are where its readers see them: they may
+  // span two huge pages, hence they are accessed through the virtual mapping of the area
+  if (!chan->huge_pages || chan->data_path == KZIMP_DATA_PATH_READER_SPLICE)
+  {
+    return chan->messages_area + (unsigned long) i
+        * (unsigned long) chan->max_msg_size;
+  }
 
-  ctrl = filp->private_data;
+  msgs_per_huge_page = HUGE_AREA_SIZE / chan->max_msg_size;
+  offset = ((i / msgs_per_huge_page) << HUGE_AREA_SHIFT) + (i
+      % msgs_per_huge_page) * chan->max_msg_size;
 
-  if (filp->f_mode & FMODE_READ)
-  {
-    chan = ctrl->channel;
+  // the address of the message in the linear mapping
+  return (char*) page_address(vmalloc_to_page(chan->messages_area + offset))
+      + (offset & ~PAGE_MASK);
+}
 
-    spin_lock(&chan->bcl);
+// return 1 if the messages area of chan can be moved to another NUMA node, 0 otherwise.
+// It can be moved only if its node policy depends on the writers and readers, and if
+// no message has been written in the channel yet: nobody is accessing it.
+// The readers of a reader splice channel may have mapped it: it is never moved.
+// Called with chan->bcl held.
+static inline int kzimp_can_move_messages_area(struct kzimp_comm_chan *chan)
+{
+  return ((chan->node_policy == KZIMP_NODE_WRITER || chan->node_policy
+      == KZIMP_NODE_READERS) && chan->data_path != KZIMP_DATA_PATH_READER_SPLICE
+      && chan->nb_writers == 0 && atomic_long_read(&chan->next_write_idx) == 0);
+}
 
-    clear_bit(ctrl->bitmap_bit, &(chan->multicast_mask));
+// Return the NUMA node of the majority of the readers of chan, or the
+// current node if there are no readers.
+// The readers are counted per node in a single pass: there can be up to KZIMP_MAX_READERS.
+// Called with chan->bcl held.
+static int kzimp_readers_node(struct kzimp_comm_chan *chan)
+{
+  struct kzimp_ctrl *r;
+  unsigned int *nb_readers, max_n;
+  int node;
 
-    list_del(&ctrl->next);
-    chan->nb_readers--;
+  node = numa_node_id();
 
-    spin_unlock(&chan->bcl);
+  // only a placement hint: without the counters, the current node is used
+  nb_readers = kcalloc(nr_node_ids, sizeof(*nb_readers), GFP_ATOMIC);
+  if (!nb_readers)
+  {
+    return node;
+  }
 
-    for (i = 0; i < chan->channel_size; i++)
+  max_n = 0;
+  list_for_each_entry(r, &chan->readers, next)
+  {
+    if (r->node < 0 || r->node >= nr_node_ids)
+    {
+      continue;
+    }
+
+    if (++nb_readers[r->node] > max_n)
     {
-      clear_bit(ctrl->bitmap_bit, &(chan->msgs[i].bitmap));
+      max_n = nb_readers[r->node];
+      node = r->node;
     }
   }
 
-  my_kfree(ctrl);
+  kfree(nb_readers);
 
-  return 0;
+  return node;
 }
 
 /*
- * kzimp wait for reading
- * Blocking by default. May be non blocking (if O_NONBLOCK is set when calling open()).
- * Returns:
- *  . -EAGAIN if the operations are non-blocking and the call would block.
- *  . -EINTR if the process has been interrupted by a signal while waiting
- *  . 0 otherwise
+ * Add a writer to chan.
+ * If this is the first writer and the node policy of the channel is KZIMP_NODE_WRITER
+ * (resp. KZIMP_NODE_READERS), the messages area (or the arena) is moved to the node of this writer
+ * (resp. of the majority of the readers that have already opened the channel).
+ * The messages and the read cursors are not moved: readers may be waiting on them.
  */
-static ssize_t kzimp_wait_for_reading_if_needed(struct file *filp,
-    struct kzimp_message *m)
+static void kzimp_add_writer(struct kzimp_comm_chan *chan)
 {
-  DEFINE_WAIT(__wait);
-
-  struct kzimp_comm_chan *chan; /* channel information */
-  struct kzimp_ctrl *ctrl;
+  char *area;
+  unsigned long size;
+  int node, huge, i;
 
-  ctrl = filp->private_data;
-  chan = ctrl->channel;
+  spin_lock(&chan->bcl);
 
-  // we do not need this test to be atomic
-  while (!reader_can_read(m->bitmap, ctrl->bitmap_bit))
+  node = -1;
+  if (kzimp_can_move_messages_area(chan))
   {
-    // file is open in no-blocking mode
-    if (filp->f_flags & O_NONBLOCK)
+    node = (chan->node_policy == KZIMP_NODE_WRITER ? numa_node_id()
+        : kzimp_readers_node(chan));
+
+    // the arena is still empty and the inline messages follow the descriptors:
+    // only the content written from now on goes to the new node
+    if (!chan->messages_area)
     {
-      //printk(KERN_WARNING "kzimp: process %i in read returns because of non-blocking ops\n", current->pid);
-      return -EAGAIN;
+      chan->node = node;
     }
+  }
+
+  if (node < 0 || node == chan->node)
+  {
+    chan->nb_writers++;
+    spin_unlock(&chan->bcl);
+    return;
+  }
 
-    prepare_to_wait(&chan->rq, &__wait, TASK_INTERRUPTIBLE);
+  spin_unlock(&chan->bcl);
 
-    if (unlikely(signal_pending(current)))
+  // vmalloc may sleep: allocate the new area without holding the lock
+  area = kzimp_alloc_messages_area(chan, node, &size, &huge);
+
+  spin_lock(&chan->bcl);
+
+  if (area && kzimp_can_move_messages_area(chan) && size
+      == chan->messages_area_size && huge == chan->huge_pages)
+  {
+    swap(chan->messages_area, area);
+    chan->node = node;
+
+    for (i = 0; i < chan->channel_size; i++)
     {
-      printk(KERN_WARNING "kzimp: process %i in read has been interrupted\n", current->pid);
-      return -EINTR;
+      kzimp_msg(chan, i)->data = kzimp_msg(chan, i)->area_data = kzimp_message_data(chan, i);
     }
+  }
+
+  chan->nb_writers++;
+
+  spin_unlock(&chan->bcl);
 
-    // A simple schedule() causes a race condition.
-    // If we check again the condition then there is no problem.
-    // With the schedule_timeout() performance seem to be better.
-    // if (!reader_can_read(m->bitmap, ctrl->bitmap_bit))
-    //   schedule();
-    schedule_timeout(HZ / 100);
+  // free the old area, or the new one if it has not been used
+  if (area)
+  {
+    kzimp_free_messages_area(area, size, huge);
   }
-  finish_wait(&chan->rq, &__wait);
+}
 
-  return 0;
+// return the second level bitmap of the message m (more than one bitmap word)
+static inline unsigned long* kzimp_message_bitmap(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m)
+{
+  return chan->bitmaps[kzimp_msg_idx(chan, m)].words;
 }
 
-#ifdef USE_CHECKSUM_CODE
-/*
- * Verify the checksum.
- * Return 1 if valid, 0 otherwise.
- */
-static int kzimp_verify_checksum(struct kzimp_message *m, size_t count,
-    struct kzimp_comm_chan *chan)
+// Clear the bits mask of the word w of the second level bitmap of the message m.
+// Only the one that clears the last bit of the word clears bit w of m->bitmap:
+// otherwise it could clear it in the next round of the message.
+// Return 1 if the writers may be able to write in m now, 0 otherwise.
+static int kzimp_clear_bitmap_bits(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, int w, unsigned long mask)
 {
-  struct kzimp_message m4chksum;
+  unsigned long *word, old, new;
 
-  // compute checksum if required
-  m4chksum.checksum = 0;
-  if (chan->compute_checksum)
+  word = &kzimp_message_bitmap(chan, m)[w];
+  do
   {
-    // construct the header
-    memset(&m4chksum, 0, KZIMP_HEADER_SIZE);
-    m4chksum.len = count;
-    m4chksum.bitmap = 0;
-    m4chksum.checksum = oneC_sum(0, &m4chksum, KZIMP_HEADER_SIZE);
-
-    if (chan->compute_checksum == 1)
+    old = ACCESS_ONCE(*word);
+    if (!(old & mask))
     {
-      m4chksum.checksum = oneC_sum(m4chksum.checksum, m->data, count);
+      return 0;
     }
-  }
+    new = old & ~mask;
+  } while (cmpxchg(word, old, new) != old);
 
-  if (m4chksum.checksum == m->checksum)
+  if (new != 0)
   {
-    return 1;
+    return 0;
   }
-  else
+
+  clear_bit(w, &m->bitmap);
+  return writer_can_write(m->bitmap);
+}
+
+// Clear the bit of a reader in the bitmap of the message m.
+// Return 1 if the writers may be able to write in m now, 0 otherwise.
+static inline int kzimp_clear_reader_bit(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, int bit)
+{
+  if (likely(chan->nb_bitmap_words == 1))
   {
-    printk(KERN_WARNING "kzimp: Process %i in read has found an incorrect checksum: %hi != %hi\n", current->pid, m4chksum.checksum, m->checksum);
-    return 0;
+    clear_bit(bit, &m->bitmap);
+    return writer_can_write(m->bitmap);
   }
+
+  return kzimp_clear_bitmap_bits(chan, m, BIT_WORD(bit), BIT_MASK(bit));
+}
+
+// a file on chan is closed, or could not be opened
+static void kzimp_put_channel(struct kzimp_comm_chan *chan)
+{
+  spin_lock(&chan->bcl);
+  chan->nb_files--;
+  spin_unlock(&chan->bcl);
+}
+
+// Free the big messages area bma, that nobody uses anymore
+static void kzimp_free_big_msg_area(struct big_mem_area_elt *bma)
+{
+  kzimp_free_messages_area(bma->addr, bma->len, bma->huge);
+  vfree(bma->pool_state);
+  my_kfree(bma);
+}
+
+// Drop a reference on the big messages area bma. It is reclaimed later, by
+// kzimp_reclaim_big_msg_areas(), as this can be called with the lock of the channel held.
+static inline void kzimp_put_big_msg_area(struct big_mem_area_elt *bma)
+{
+  smp_mb__before_atomic_dec(); // the readers have finished to read the area
+  atomic_dec(&bma->refcount);
 }
-#endif
 
 /*
- * finalize the write: unset the bit in the bitmap, wake up the writers, update next_write_idx
+ * Reclaim the big messages areas of chan that have no reference anymore.
+ * If reuse is set, the first one that has the size of the areas of the channel is
+ * returned, with a reference for the calling writer. big_msg_pool_size of the other
+ * ones are kept for the next writers, the other ones are freed.
+ * Returns:
+ *  . the area to reuse, or NULL
  */
-static int finalize_read(struct kzimp_message *m, struct kzimp_ctrl *ctrl,
-    struct kzimp_comm_chan *chan, size_t count)
+static struct big_mem_area_elt* kzimp_reclaim_big_msg_areas(
+    struct kzimp_comm_chan *chan, int reuse)
 {
-  int retval;
+  struct big_mem_area_elt *bma, *tmp, *reused;
+  LIST_HEAD(unused);
+  size_t len;
+  int nb_kept;
 
-  retval = count;
+  // the areas of the writers that were there before a modification of the channel
+  // through /proc have another size: they are freed
+  len = (size_t) chan->max_msg_size_page_rounded * (chan->channel_size + 1);
+  reused = NULL;
+  nb_kept = 0;
 
-  // the timeout at the writer may have expired, and the writer may have started to write
-  // a new message at m
-  if (likely(ctrl->online))
+  spin_lock(&chan->bcl);
+  list_for_each_entry_safe(bma, tmp, &chan->writers_big_msg, next)
   {
-    clear_bit(ctrl->bitmap_bit, &m->bitmap);
-    if (writer_can_write(m->bitmap)
-#ifdef ATOMIC_WAKE_UP
-        && !atomic_cmpxchg(&m->waking_up_writer, 0, 1)
-#endif
-    )
+    // once it is 0, the reference count can no longer increase
+    if (atomic_read(&bma->refcount) != 0)
     {
-      wake_up_interruptible(&chan->wq);
-
-#ifdef ATOMIC_WAKE_UP
-      atomic_set(&m->waking_up_writer, 0);
-#endif
+      continue;
     }
 
-    ctrl->next_read_idx = (ctrl->next_read_idx + 1) % chan->channel_size;
+    if (reuse && !reused && bma->len == len)
+    {
+      atomic_set(&bma->refcount, 1);
+      reused = bma;
+    }
+    else if (nb_kept < big_msg_pool_size && bma->len == len)
+    {
+      nb_kept++;
+    }
+    else
+    {
+      list_move(&bma->next, &unused);
+    }
   }
-  else
+  spin_unlock(&chan->bcl);
+
+  list_for_each_entry_safe(bma, tmp, &unused, next)
   {
-    printk(KERN_WARNING "kzimp: Process %i in read is no longer active\n", current->pid);
-    retval = -EBADF;
+    list_del(&bma->next);
+    kzimp_free_big_msg_area(bma);
   }
 
-  return retval;
+  return reused;
 }
 
 /*
- * kzimp read operation.
- * Blocking by default. May be non blocking (if O_NONBLOCK is set when calling open()).
+ * Give a big messages area to the writer ctrl (KZIMP_DATA_PATH_WRITER_SPLICE).
+ * There is one more message than in the channel, otherwise the writer would be able to send
+ * channel_size messages and reuse the slot of the first message that has not been read yet.
+ * The writer reuses the area of a previous writer if one has no reference anymore:
+ * the memory of the channel does not grow when the writers close and reopen it.
+ * Otherwise the area is allocated on the node of the writer. If use_huge_pages is set,
+ * the area is made of huge pages, which are entirely mapped at mmap time. Otherwise, or if
+ * there are not enough huge pages, the area is vmalloc'ed, and mapped page by page by
+ * kzimp_writer_splice_vma_fault.
  * Returns:
- *  . -EFAULT if the copy to buf has failed
- *  . -EAGAIN if the operations are non-blocking and the call would block.
- *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
- *  . -EIO if the checksum is incorrect
- *  . -EINTR if the process has been interrupted by a signal while waiting
- *  . 0 if there has been an error when reading (count is <= 0)
- *  . The number of read bytes otherwise
+ *  . -ENOMEM if the memory allocations fail
+ *  . 0 otherwise
  */
-static ssize_t kzimp_read
-(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+static int kzimp_alloc_big_msg_area(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
 {
-  int retval;
-  struct kzimp_message *m;
-  DEFINE_WAIT(__wait);
-
-  struct kzimp_comm_chan *chan; /* channel information */
-  struct kzimp_ctrl *ctrl;
-
-  ctrl = filp->private_data;
-  chan = ctrl->channel;
+  struct big_mem_area_elt *bma;
 
-  m = &(chan->msgs[ctrl->next_read_idx]);
+  ctrl->big_msg_slot_size = chan->max_msg_size_page_rounded;
+  ctrl->big_msg_nb_slots = chan->channel_size + 1;
+  ctrl->big_msg_area_len = (unsigned long) ctrl->big_msg_slot_size
+      * (unsigned long) ctrl->big_msg_nb_slots;
 
-  retval = kzimp_wait_for_reading_if_needed(filp, m);
-  if (retval)
+  bma = kzimp_reclaim_big_msg_areas(chan, 1);
+  if (bma)
   {
-    return retval;
+    // its messages have been read: the slots of the pool are free again
+    smp_mb();
+    memset(bma->pool_state, 0, sizeof(*bma->pool_state) * ctrl->big_msg_nb_slots);
+
+    ctrl->big_msg_area = bma->addr;
+    ctrl->big_msg_area_huge = bma->huge;
+    ctrl->pool_state = bma->pool_state;
+    ctrl->bma = bma;
+    return 0;
   }
 
-  // check length
-  count = (m->len < count ? m->len : count);
-
-#ifdef USE_CHECKSUM_CODE
-  if (!kzimp_verify_checksum(m, count, chan))
+  ctrl->big_msg_area_huge = 0;
+  if (use_huge_pages)
   {
-    retval = -EIO;
+    ctrl->big_msg_area = huge_area_alloc(ctrl->big_msg_area_len, ctrl->node);
+    if (ctrl->big_msg_area)
+    {
+      ctrl->big_msg_area_huge = 1;
+    }
+    else
+    {
+      printk(KERN_WARNING "kzimp: not enough huge pages for an area of %lu bytes, using vmalloc\n", (unsigned long) ctrl->big_msg_area_len);
+    }
   }
-#endif
-
-  if (unlikely(copy_to_user(buf, m->data, count)))
+  if (!ctrl->big_msg_area_huge)
   {
-    printk(KERN_ERR "kzimp: copy_to_user failed for process %i in read\n", current->pid);
-    return -EFAULT;
+    ctrl->big_msg_area = my_vmalloc_node(ctrl->big_msg_area_len, ctrl->node);
   }
 
-  retval = finalize_read(m, ctrl, chan, count);
+  // all the slots are owned by the writer (KZIMP_POOL_SLOT_FREE is 0)
+  ctrl->pool_state = vmalloc_user(
+      PAGE_ALIGN(sizeof(*ctrl->pool_state) * ctrl->big_msg_nb_slots));
 
-  return retval;
-}
+  bma = my_kmalloc(sizeof(*bma), GFP_KERNEL);
 
-// When the timeout expires, the writer removes the bits that are at 1 in this bitmap, for all the messages
-// chan is the channel, m is the struct kzimp_message where to write the current message.
-static void handle_timeout(struct kzimp_comm_chan *chan,
-    struct kzimp_message *m)
-{
-  int i;
-  struct list_head *p;
-  struct kzimp_ctrl *ptr;
-  unsigned long tmp;
+  if (unlikely(!ctrl->big_msg_area || !ctrl->pool_state || !bma))
+  {
+    printk(KERN_ERR "kzimp: big messages area allocation of %lu bytes error\n", (unsigned long) ctrl->big_msg_area_len);
+    if (ctrl->big_msg_area)
+    {
+      kzimp_free_messages_area(ctrl->big_msg_area, ctrl->big_msg_area_len,
+          ctrl->big_msg_area_huge);
+    }
+    vfree(ctrl->pool_state);
+    if (bma)
+    {
+      my_kfree(bma);
+    }
+    ctrl->big_msg_area = NULL;
+    ctrl->pool_state = NULL;
+    return -ENOMEM;
+  }
 
-  unsigned long bitmap = m->bitmap;
+  bma->addr = ctrl->big_msg_area;
+  bma->len = ctrl->big_msg_area_len;
+  bma->huge = ctrl->big_msg_area_huge;
+  bma->pool_state = ctrl->pool_state;
+  atomic_set(&bma->refcount, 1);
+  ctrl->bma = bma;
 
   spin_lock(&chan->bcl);
+  list_add_tail(&bma->next, &chan->writers_big_msg);
+  spin_unlock(&chan->bcl);
 
-  // remove the bits from the multicast mask
-  tmp = chan->multicast_mask & ~bitmap;
-  __asm volatile ("" : : : "memory");
-  chan->multicast_mask = tmp; // this operation is atomic
+  return 0;
+}
 
-  // remove the bits from all the messages
-  for (i = 0; i < chan->channel_size; i++)
+// Allocate a backlog of size bytes for a reader, on the node node (KZIMP_OVERFLOW_SPILL).
+// Return the backlog, or NULL if the allocations fail.
+static struct kzimp_backlog* kzimp_alloc_backlog(unsigned long size, int node)
+{
+  struct kzimp_backlog *b;
+
+  b = my_kmalloc_node(sizeof(*b), GFP_KERNEL, node);
+  if (unlikely(!b))
   {
-    // test if bitmap is different from 0, otherwise we may loose a message:
-    // process A                        process B
-    //                      msg.bitmap = 0
-    //   | a = msg.bitmap & ~bitmap        |
-    //   |                                 | msg.bitmap = multicast_mask
-    //   | msg.bitmap = a                  |
-    // The bitmap is now 0 instead of multicast_mask. The message has been lost.
-    if (chan->msgs[i].bitmap != 0)
+    return NULL;
+  }
+
+  b->data = my_vmalloc_node(size, node);
+  if (unlikely(!b->data))
+  {
+    printk(KERN_ERR "kzimp: backlog allocation of %lu bytes error\n", size);
+    my_kfree(b);
+    return NULL;
+  }
+
+  b->head = 0;
+  b->tail = 0;
+  b->size = size;
+
+  return b;
+}
+
+static void kzimp_free_backlog(struct kzimp_backlog *b)
+{
+  my_vfree(b->data);
+  my_kfree(b);
+}
+
+// Copy len bytes of src in the backlog b at position pos, which may wrap around the end
+static void kzimp_backlog_put(struct kzimp_backlog *b, unsigned long pos,
+    const void *src, size_t len)
+{
+  unsigned long off, first;
+
+  off = pos % b->size;
+  first = min((unsigned long) len, b->size - off);
+  memcpy(b->data + off, src, first);
+  memcpy(b->data, (const char*) src + first, len - first);
+}
+
+// Copy len bytes of the backlog b at position pos in dst
+static void kzimp_backlog_get(struct kzimp_backlog *b, unsigned long pos,
+    void *dst, size_t len)
+{
+  unsigned long off, first;
+
+  off = pos % b->size;
+  first = min((unsigned long) len, b->size - off);
+  memcpy(dst, b->data + off, first);
+  memcpy((char*) dst + first, b->data, len - first);
+}
+
+// Copy len bytes of the backlog b at position pos in the user-space buffer buf.
+// Return 0 if the copy has succeeded, -EFAULT otherwise.
+static int kzimp_backlog_copy_to_user(struct kzimp_backlog *b,
+    unsigned long pos, char __user *buf, size_t len)
+{
+  unsigned long off, first;
+
+  off = pos % b->size;
+  first = min((unsigned long) len, b->size - off);
+  if (copy_to_user(buf, b->data + off, first) || copy_to_user(buf + first,
+      b->data, len - first))
+  {
+    return -EFAULT;
+  }
+
+  return 0;
+}
+
+// Allocate the control structure of the process that opens chan, on its node.
+// It is neither a reader nor a writer yet.
+// Return it, or NULL if the allocation has failed.
+static struct kzimp_ctrl* kzimp_alloc_ctrl(struct kzimp_comm_chan *chan)
+{
+  struct kzimp_ctrl *ctrl;
+
+  // the control structure is on the node of the process that uses it
+  ctrl = my_kmalloc_node(sizeof(*ctrl), GFP_KERNEL, numa_node_id());
+  if (unlikely(!ctrl))
+  {
+    printk(KERN_ERR "kzimp: kzimp_ctrl allocation error\n");
+    return NULL;
+  }
+
+  ctrl->pid = current->pid;
+  ctrl->node = numa_node_id();
+  ctrl->channel = chan;
+  ctrl->big_msg_area = NULL;
+  ctrl->big_msg_area_len = 0;
+  ctrl->big_msg_area_huge = 0;
+  ctrl->pool_state = NULL;
+  ctrl->bma = NULL;
+  ctrl->nb_msgs_read = 0;
+  ctrl->nb_bytes_read = 0;
+  ctrl->nb_sleeps = 0;
+  ctrl->backlog = NULL;
+  ctrl->last_gap = 0;
+  ctrl->nb_lost = 0;
+  ctrl->nb_lanes = 1;
+  ctrl->lane = 0;
+  memset(ctrl->lanes, 0, sizeof(ctrl->lanes));
+  ctrl->lanes[0] = ctrl;
+
+  // the writer has to compute the min of the read cursors at its first write
+  ctrl->min_cursor = 0;
+  ctrl->min_cursor_gen = ACCESS_ONCE(chan->readers_gen) - 1;
+
+  ctrl->next_read_idx = -1;
+  ctrl->bitmap_bit = -1;
+  ctrl->online = -1;
+  ctrl->next.prev = ctrl->next.next = NULL;
+
+  return ctrl;
+}
+
+/*
+ * Add the reader ctrl to chan, with the bit bit of the multicast mask, or with the first
+ * free bit if bit is -1.
+ * Returns:
+ *  . -ENOMEM if the backlog of the reader cannot be allocated
+ *  . -1 if the maximum number of readers have been reached, or if bit is not free
+ *  . 0 otherwise
+ */
+static int kzimp_add_reader(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, int bit)
+{
+  // the writers may copy the messages of this reader in its backlog if it is too slow
+  if (ACCESS_ONCE(chan->overflow_policy) == KZIMP_OVERFLOW_SPILL)
+  {
+    ctrl->backlog = kzimp_alloc_backlog(chan->backlog_size, ctrl->node);
+    if (unlikely(!ctrl->backlog))
     {
-      chan->msgs[i].bitmap &= ~bitmap;
+      return -ENOMEM;
     }
   }
 
-  // set the remaining readers on that bitmap to offline
-  list_for_each(p, &chan->readers)
+  spin_lock(&chan->bcl);
+
+  // we set next_read_idx to the next position where the writer is going to write
+  // so that it gets the next message
+  ctrl->next_read_seq = (unsigned long) atomic_long_read(&chan->next_write_idx);
+  ctrl->next_read_idx = ctrl->next_read_seq % chan->channel_size;
+  ctrl->backlog_seq = ctrl->next_read_seq;
+  if (bit == -1)
   {
-    ptr = list_entry(p, struct kzimp_ctrl, next);
-    if (reader_can_read(bitmap, ptr->bitmap_bit))
+    ctrl->bitmap_bit = get_new_bitmap_bit(chan, ctrl->next_read_seq);
+  }
+  else if (bit < chan->max_readers && !test_bit(bit, chan->multicast_mask))
+  {
+    kzimp_set_bitmap_bit(chan, bit, ctrl->next_read_seq);
+    ctrl->bitmap_bit = bit;
+  }
+  ctrl->online = 1;
+
+  if (ctrl->bitmap_bit != -1)
+  {
+    chan->nb_readers++;
+    list_add_tail(&ctrl->next, &chan->readers);
+  }
+
+  spin_unlock(&chan->bcl);
+
+  if (ctrl->bitmap_bit == -1)
+  {
+    printk(KERN_ERR "Maximum number of readers on the channel %i has been reached: %i\n", chan->chan_id, chan->nb_readers);
+    if (ctrl->backlog)
     {
-      ptr->online = 0;
-      printk(KERN_DEBUG "kzimp: Process %i in write. Process %i is offline\n", current->pid, ptr->pid);
+      kzimp_free_backlog(ctrl->backlog);
+      ctrl->backlog = NULL;
     }
+    ctrl->online = -1;
+    return -1;
   }
 
+  return 0;
+}
+
+// Remove the reader ctrl from chan: the writers no longer wait for it
+static void kzimp_remove_reader(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  int i;
+
+  // a writer may be copying the messages of this reader (see kzimp_move_late_readers())
+  mutex_lock(&chan->move_mutex);
+  spin_lock(&chan->bcl);
+
+  clear_bit(ctrl->bitmap_bit, chan->multicast_mask);
+  clear_bit(ctrl->bitmap_bit, chan->waiting_readers);
+
+  list_del(&ctrl->next);
+  chan->nb_readers--;
+
   spin_unlock(&chan->bcl);
+  mutex_unlock(&chan->move_mutex);
+
+  for (i = 0; i < chan->channel_size; i++)
+  {
+    kzimp_clear_reader_bit(chan, kzimp_msg(chan, i), ctrl->bitmap_bit);
+  }
+
+  // the writers may be waiting for this reader
+  smp_mb__after_clear_bit();
+  wake_up(&chan->wq);
+
+  // the writers only use the backlog with move_mutex, while the reader is in the list
+  if (ctrl->backlog)
+  {
+    kzimp_free_backlog(ctrl->backlog);
+    ctrl->backlog = NULL;
+  }
 }
 
-#ifdef CHANNEL_WRITE_IDX_ATOMIC
-static inline int kzimp_modulo(int a, int b)
+// Remove the control structure ctrl of a file opened with the rights f_mode from its
+// channel, and free it
+static void kzimp_release_ctrl(struct kzimp_ctrl *ctrl, fmode_t f_mode)
 {
-  int c;
-  c = a % b;
-  return (c < 0) ? c + b : c;
+  struct kzimp_comm_chan *chan;
+
+  chan = ctrl->channel;
+
+  if (kzimp_is_reader(ctrl))
+  {
+    kzimp_remove_reader(chan, ctrl);
+  }
+
+  if (f_mode & FMODE_WRITE)
+  {
+    spin_lock(&chan->bcl);
+    chan->nb_writers--;
+    spin_unlock(&chan->bcl);
+  }
+
+  // the area is reclaimed now if all its messages have been read, otherwise later
+  if (ctrl->bma)
+  {
+    kzimp_put_big_msg_area(ctrl->bma);
+    kzimp_reclaim_big_msg_areas(chan, 0);
+  }
+
+  my_kfree(ctrl);
 }
-#endif
 
-// Wait for writing if needed.
-// Return 1 if everything is ok, an error otherwise.
-static ssize_t kzimp_wait_for_writing_if_needed(struct file *filp,
-    size_t count, struct kzimp_message **mf)
+// Close the lanes 1 to nb_lanes-1 of the process of ctrl, which has opened its
+// channel with the rights f_mode. The lanes are closed before lane 0: a bit of lane 0
+// is free only when it is free in all the lanes.
+static void kzimp_close_lanes(struct kzimp_ctrl *ctrl, fmode_t f_mode)
 {
-  long to_expired;
-  struct kzimp_message *m;
-  DEFINE_WAIT(__wait);
+  int l;
 
-#ifdef CHANNEL_WRITE_IDX_ATOMIC
-  int next_wr_idx;
-#endif
+  for (l = ctrl->nb_lanes - 1; l > 0; l--)
+  {
+    kzimp_release_ctrl(ctrl->lanes[l], f_mode);
+    ctrl->lanes[l] = NULL;
+  }
+  ctrl->nb_lanes = 1;
+}
+
+/*
+ * Open the lanes 1 to nb_lanes-1 of chan for the process of ctrl, which has opened lane 0
+ * with the rights f_mode: it has the same rights on each lane and, if it is a reader,
+ * the same bit.
+ * Returns:
+ *  . the errors of kzimp_add_reader() or -ENOMEM. The lanes are closed then.
+ *  . 0 otherwise
+ */
+static int kzimp_open_lanes(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, fmode_t f_mode)
+{
+  struct kzimp_ctrl *lane_ctrl;
+  int l, err;
+
+  for (l = 1; l < chan->nb_lanes; l++)
+  {
+    lane_ctrl = kzimp_alloc_ctrl(chan->lanes[l]);
+    if (unlikely(!lane_ctrl))
+    {
+      kzimp_close_lanes(ctrl, f_mode);
+      return -ENOMEM;
+    }
+
+    if (kzimp_is_reader(ctrl))
+    {
+      err = kzimp_add_reader(chan->lanes[l], lane_ctrl, ctrl->bitmap_bit);
+      if (unlikely(err))
+      {
+        my_kfree(lane_ctrl);
+        kzimp_close_lanes(ctrl, f_mode);
+        return err;
+      }
+    }
+
+    if (f_mode & FMODE_WRITE)
+    {
+      kzimp_add_writer(chan->lanes[l]);
+    }
 
+    ctrl->lanes[l] = lane_ctrl;
+    ctrl->nb_lanes = l + 1;
+  }
+
+  return 0;
+}
+
+/*
+ * kzimp open operation.
+ * Returns:
+ *  . -ENODEV if the channel has been destroyed
+ *  . -ENOMEM if the memory allocations fail
+ *  . -1 if the maximum number of readers have been reached
+ *  . 0 otherwise
+ */
+static int kzimp_open(struct inode *inode, struct file *filp)
+{
   struct kzimp_comm_chan *chan; /* channel information */
   struct kzimp_ctrl *ctrl;
+  fmode_t f_mode;
+  int err;
 
-  ctrl = filp->private_data;
-  chan = ctrl->channel;
+  chan = container_of(inode->i_cdev, struct kzimp_comm_chan, cdev);
 
-  // Check the validity of the arguments
-  if (unlikely(count <= 0 || count > chan->max_msg_size))
+  // the channel cannot be destroyed or resized while there are open files on it
+  spin_lock(&chan->bcl);
+  if (unlikely(!chan->created))
   {
-    printk(KERN_ERR "kzimp: count is not valid: %lu (process %i in write on channel %i)\n", (unsigned long)count, current->pid, chan->chan_id);
-    return 0;
+    spin_unlock(&chan->bcl);
+    return -ENODEV;
   }
-
-#ifdef CHANNEL_WRITE_IDX_ATOMIC
-  next_wr_idx = atomic_inc_return(&chan->next_write_idx);
-  next_wr_idx = kzimp_modulo(next_wr_idx-1, chan->channel_size);
-  m = &(chan->msgs[next_wr_idx]);
-#else
-  spin_lock(&chan->bcl);
-  m = &(chan->msgs[chan->next_write_idx]);
-  chan->next_write_idx = (chan->next_write_idx + 1) % chan->channel_size;
+  chan->nb_files++;
   spin_unlock(&chan->bcl);
-#endif
 
-  to_expired = 1;
-  while (!writer_can_write(m->bitmap) && to_expired)
+  ctrl = kzimp_alloc_ctrl(chan);
+  if (unlikely(!ctrl))
   {
-    // file is open in no-blocking mode
-    if (filp->f_flags & O_NONBLOCK)
+    kzimp_put_channel(chan);
+    return -ENOMEM;
+  }
+
+  // the rights before the writer of a KZIMP_DATA_PATH_WRITER_SPLICE channel gets FMODE_READ
+  f_mode = filp->f_mode;
+
+  if (filp->f_mode & FMODE_READ)
+  {
+    err = kzimp_add_reader(chan, ctrl, -1);
+    if (unlikely(err))
     {
-      return -EAGAIN;
+      my_kfree(ctrl);
+      kzimp_put_channel(chan);
+      return err;
     }
+  }
 
-    prepare_to_wait(&chan->wq, &__wait, TASK_INTERRUPTIBLE);
+  if ((filp->f_mode & FMODE_WRITE) && chan->data_path
+      == KZIMP_DATA_PATH_WRITER_SPLICE)
+  {
+    if (unlikely(kzimp_alloc_big_msg_area(chan, ctrl)))
+    {
+      if (kzimp_is_reader(ctrl))
+      {
+        kzimp_remove_reader(chan, ctrl);
+      }
+      my_kfree(ctrl);
+      kzimp_put_channel(chan);
+      return -ENOMEM;
+    }
 
-    if (unlikely(signal_pending(current)))
+    // the writer needs the FMODE_READ right, otherwise it cannot mmap
+    // this is because it needs to mmap with the MAP_SHARED flag.
+    filp->f_mode |= FMODE_READ;
+  }
+
+  if (filp->f_mode & FMODE_WRITE)
+  {
+    kzimp_add_writer(chan);
+  }
+
+  // the number of lanes is not modified while there are open files on the channel
+  if (chan->nb_lanes > 1)
+  {
+    err = kzimp_open_lanes(chan, ctrl, f_mode);
+    if (unlikely(err))
     {
-      printk(KERN_WARNING "kzimp: process %i in write has been interrupted\n", current->pid);
-      return -EINTR;
+      kzimp_release_ctrl(ctrl, f_mode);
+      kzimp_put_channel(chan);
+      return err;
     }
+  }
+
+  // The copy data path keeps kzimp_fops: it pays nothing for the splice ones.
+  // All the operations have the same owner, thus the reference on the module
+  // taken by chrdev_open() remains valid.
+  if (chan->data_path == KZIMP_DATA_PATH_WRITER_SPLICE)
+  {
+    filp->f_op = &kzimp_writer_splice_fops;
+  }
+  else if (chan->data_path == KZIMP_DATA_PATH_READER_SPLICE)
+  {
+    filp->f_op = &kzimp_reader_splice_fops;
+  }
+  else if (chan->data_path == KZIMP_DATA_PATH_ARENA)
+  {
+    filp->f_op = &kzimp_arena_fops;
+  }
+
+  filp->private_data = ctrl;
+
+  return 0;
+}
+
+/*
+ * kzimp release operation.
+ * Returns:
+ *  . 0: it always succeeds
+ */
+static int kzimp_release(struct inode *inode, struct file *filp)
+{
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = filp->private_data;
+  chan = ctrl->channel;
+
+  kzimp_close_lanes(ctrl, filp->f_mode);
+  kzimp_release_ctrl(ctrl, filp->f_mode);
+  kzimp_put_channel(chan);
+
+  return 0;
+}
+
+// current time, in nanoseconds
+static inline u64 kzimp_clock_ns(void)
+{
+  return ktime_to_ns(ktime_get());
+}
+
+// Return the time (in nanoseconds) a waiter on chan can spin before sleeping,
+// according to the wait policy of the channel.
+static inline u64 kzimp_spin_budget(struct kzimp_comm_chan *chan)
+{
+  switch (ACCESS_ONCE(chan->wait_policy))
+  {
+  case KZIMP_WAIT_SPIN:
+    return KZIMP_SPIN_UNBOUNDED;
+
+  case KZIMP_WAIT_SPIN_THEN_BLOCK:
+    return ACCESS_ONCE(chan->spin_budget_ns);
+
+  default:
+    return 0;
+  }
+}
+
+// Spin while cond is false, during at most budget_ns nanoseconds.
+// Stops as soon as a signal is pending. Gives the CPU back to the scheduler if needed.
+// Evaluates to 1 if cond is true, 0 otherwise.
+// cpu_relax() is a compiler barrier: cond is read again at each iteration.
+#define kzimp_spin_while_not(cond, budget_ns)                  \
+({                                                            \
+  int __ok = 0;                                               \
+  u64 __budget = (budget_ns);                                 \
+  u64 __start;                                                \
+                                                              \
+  if (__budget > 0)                                           \
+  {                                                           \
+    __start = kzimp_clock_ns();                               \
+    for (;;)                                                  \
+    {                                                         \
+      if (cond)                                               \
+      {                                                       \
+        __ok = 1;                                             \
+        break;                                                \
+      }                                                       \
+      if (signal_pending(current)                             \
+          || kzimp_clock_ns() - __start >= __budget)          \
+      {                                                       \
+        break;                                                \
+      }                                                       \
+      cond_resched();                                         \
+      cpu_relax();                                            \
+    }                                                         \
+  }                                                           \
+  __ok;                                                       \
+})
+
+// Adapt the spin budget of chan to the time wait_ns a reader has waited for a message.
+// The average is not updated atomically: it is only a hint.
+static void kzimp_update_spin_budget(struct kzimp_comm_chan *chan, u64 wait_ns)
+{
+  unsigned long avg;
+
+  if (ACCESS_ONCE(chan->wait_policy) != KZIMP_WAIT_SPIN_THEN_BLOCK)
+  {
+    return;
+  }
+
+  avg = ACCESS_ONCE(chan->avg_wait_ns);
+  avg = avg - (avg >> KZIMP_WAIT_EWMA_SHIFT) + (wait_ns >> KZIMP_WAIT_EWMA_SHIFT);
+  chan->avg_wait_ns = avg;
+
+  // spinning is worth it only if the messages arrive before the end of the budget
+  chan->spin_budget_ns = (avg <= chan->max_spin_ns ? min(2 * avg, chan->max_spin_ns) : 0);
+}
+
+// Set the wait policy of chan.
+// Return -EINVAL if wait_policy is not valid, 0 otherwise.
+static int kzimp_set_wait_policy(struct kzimp_comm_chan *chan, int wait_policy,
+    unsigned long max_spin_ns)
+{
+  int l;
+
+  if (wait_policy < KZIMP_WAIT_BLOCK || wait_policy > KZIMP_WAIT_SPIN)
+  {
+    printk(KERN_WARNING "kzimp: wait policy not valid: %i\n", wait_policy);
+    return -EINVAL;
+  }
+
+  chan->max_spin_ns = max_spin_ns;
+  chan->spin_budget_ns = max_spin_ns;
+  chan->avg_wait_ns = 0;
+  chan->wait_policy = wait_policy;
+
+  // the writers of the lanes wait as those of lane 0
+  for (l = 1; l < chan->nb_lanes; l++)
+  {
+    kzimp_set_wait_policy(chan->lanes[l], wait_policy, max_spin_ns);
+  }
+
+  return 0;
+}
+
+// Set the overflow policy of chan. The backlog size is the one of the readers that
+// open the channel from now on (KZIMP_OVERFLOW_SPILL).
+// Return -EINVAL if overflow_policy is not valid for this channel, 0 otherwise.
+static int kzimp_set_overflow_policy(struct kzimp_comm_chan *chan,
+    int overflow_policy, unsigned long backlog_size)
+{
+  int l;
+
+  if (overflow_policy < KZIMP_OVERFLOW_EVICT || overflow_policy
+      > KZIMP_OVERFLOW_SKIP)
+  {
+    printk(KERN_WARNING "kzimp: overflow policy not valid: %i\n", overflow_policy);
+    return -EINVAL;
+  }
+
+  // the writers move the read cursors of the late readers
+  if ((overflow_policy == KZIMP_OVERFLOW_SPILL || overflow_policy
+      == KZIMP_OVERFLOW_SKIP) && chan->mode != KZIMP_MODE_CURSOR)
+  {
+    printk(KERN_WARNING "kzimp: overflow policy %i of channel %i needs the cursor mode\n", overflow_policy, chan->chan_id);
+    return -EINVAL;
+  }
+
+  // the readers read the messages in place, they cannot read the backlog
+  if (overflow_policy == KZIMP_OVERFLOW_SPILL && (chan->data_path
+      == KZIMP_DATA_PATH_READER_SPLICE || backlog_size == 0))
+  {
+    printk(KERN_WARNING "kzimp: overflow policy %i of channel %i needs a backlog\n", overflow_policy, chan->chan_id);
+    return -EINVAL;
+  }
+
+  chan->backlog_size = backlog_size;
+  chan->overflow_policy = overflow_policy;
+
+  for (l = 1; l < chan->nb_lanes; l++)
+  {
+    kzimp_set_overflow_policy(chan->lanes[l], overflow_policy, backlog_size);
+  }
+
+  return 0;
+}
+
+// Wake up the writers sleeping on the channel, if any.
+// clear_bit() does not imply a barrier: smp_mb__after_clear_bit() orders the update of the
+// bitmap with the test of the wait queue. A writer checks the bitmap again once it is in the
+// wait queue, thus it either sees the new bitmap or is woken up.
+static inline void kzimp_wake_up_writers(struct kzimp_comm_chan *chan)
+{
+  smp_mb__after_clear_bit();
+  if (waitqueue_active(&chan->wq))
+  {
+    // not wake_up_interruptible(): an interrupted writer keeps waiting in
+    // TASK_UNINTERRUPTIBLE until it can give up its slot
+    wake_up(&chan->wq);
+    atomic_long_inc(&chan->nb_wakeups);
+  }
+}
+
+// return the wait queue of the reader ctrl
+static inline wait_queue_head_t* kzimp_reader_wq(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  return &chan->readers_wq[ctrl->bitmap_bit].q;
+}
+
+// The reader ctrl is in its wait queue (it sleeps in read or it polls the channel):
+// tell it to the writers.
+// The reader checks the bitmap after having set its bit, thus it either sees the new
+// message or the writer sees its bit (see kzimp_wake_up_readers()).
+static inline void kzimp_reader_may_sleep(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  if (!test_bit(ctrl->bitmap_bit, chan->waiting_readers))
+  {
+    smp_mb(); // the writers must find us in the wait queue if they see the bit
+    set_bit(ctrl->bitmap_bit, chan->waiting_readers);
+  }
+  smp_mb(); // the bit must be visible before we look at the bitmap
+}
+
+// The reader ctrl has left its wait queue: clear its bit if nobody else is in the
+// queue. A poll() or epoll on the file of the reader may still be in it.
+// The bit is cleared under the lock of the queue, that poll_wait() takes before the
+// reader sets its bit again in kzimp_poll().
+static inline void kzimp_reader_awake(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  wait_queue_head_t *q;
+  unsigned long flags;
+
+  q = kzimp_reader_wq(chan, ctrl);
+  spin_lock_irqsave(&q->lock, flags);
+  if (list_empty(&q->task_list))
+  {
+    clear_bit(ctrl->bitmap_bit, chan->waiting_readers);
+  }
+  spin_unlock_irqrestore(&q->lock, flags);
+}
+
+// Wake up the readers sleeping on the channel or polling it, if any: only the readers
+// that are in their wait queue are woken up, each in its own queue.
+// Must be called after kzimp_pass_turn(), whose smp_mb() orders the store of the bitmap
+// with the test of the waiting readers (see kzimp_reader_may_sleep()).
+// The readers of a lane wait in lane 0, whose wait queues are shared by all the lanes.
+static inline void kzimp_wake_up_readers(struct kzimp_comm_chan *chan)
+{
+  wait_queue_head_t *q;
+  unsigned long waiting;
+  int w, bit;
+
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    waiting = ACCESS_ONCE(chan->lane0->waiting_readers[w]);
+    while (waiting)
+    {
+      bit = __ffs(waiting);
+      waiting &= waiting - 1;
+
+      // the key lets epoll ignore the wake up of the files that wait for POLLOUT only
+      q = &chan->readers_wq[w * BITS_PER_LONG + bit].q;
+      if (waitqueue_active(q))
+      {
+        wake_up_interruptible_poll(q, POLLIN | POLLRDNORM);
+        atomic_long_inc(&chan->nb_wakeups);
+      }
+    }
+  }
+}
+
+// return 1 if the reader ctrl can read the message m, of sequence number seq, 0 otherwise
+static inline int kzimp_reader_can_read(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct kzimp_message *m, unsigned long seq)
+{
+  if (chan->mode == KZIMP_MODE_CURSOR)
+  {
+    // the writer of ticket seq has given the message to the writer of the next round
+    return (ACCESS_ONCE(m->write_seq) == seq + chan->channel_size);
+  }
+
+  if (likely(chan->nb_bitmap_words == 1))
+  {
+    return reader_can_read(m->bitmap, ctrl->bitmap_bit);
+  }
+
+  // the second level is valid once the bit of its word is set in the first one
+  if (!reader_can_read(m->bitmap, BIT_WORD(ctrl->bitmap_bit)))
+  {
+    return 0;
+  }
+  smp_rmb();
+  return test_bit(ctrl->bitmap_bit, kzimp_message_bitmap(chan, m));
+}
+
+// Publish the read cursor of the reader ctrl (cursor mode), whose value was old.
+// After a timeout, a writer may have moved the cursor (KZIMP_OVERFLOW_SPILL, _SKIP): it is
+// only modified if it is still old, so that it never goes back.
+// Return 1 if the cursor has been published, 0 if a writer has moved it.
+static inline int kzimp_publish_cursor(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, unsigned long old)
+{
+  int published;
+
+  smp_mb(); // the writers must not modify the messages before we have read them
+  published = (cmpxchg(&chan->cursors[ctrl->bitmap_bit].seq, old,
+      ctrl->next_read_seq) == old);
+  smp_mb(); // the cursor must be visible before we look at the wait queue of the writers
+
+  return published;
+}
+
+// return 1 if a writer has moved the read cursor of the reader ctrl after a timeout
+// (KZIMP_OVERFLOW_SPILL, _SKIP), 0 otherwise
+static inline int kzimp_reader_moved(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  return (chan->mode == KZIMP_MODE_CURSOR && ACCESS_ONCE(
+      chan->cursors[ctrl->bitmap_bit].seq) != ctrl->next_read_seq);
+}
+
+// The reader ctrl has read the message m. Move to the next message.
+// Return 1 if the writers may be able to write in m now, 0 otherwise,
+// -ESTALE if a writer has moved the reader in the meantime: m may have been overwritten.
+static inline int kzimp_release_message(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct kzimp_message *m)
+{
+  ctrl->next_read_seq++;
+
+  if (chan->mode == KZIMP_MODE_CURSOR)
+  {
+    // only the writers know if the other readers have read m
+    if (unlikely(!kzimp_publish_cursor(chan, ctrl, ctrl->next_read_seq - 1)))
+    {
+      ctrl->next_read_seq--;
+      return -ESTALE;
+    }
+    ctrl->next_read_idx = (ctrl->next_read_idx + 1) % chan->channel_size;
+    ctrl->backlog_seq = ctrl->next_read_seq;
+    return 1;
+  }
+
+  ctrl->next_read_idx = (ctrl->next_read_idx + 1) % chan->channel_size;
+  ctrl->backlog_seq = ctrl->next_read_seq;
+
+  return kzimp_clear_reader_bit(chan, m, ctrl->bitmap_bit);
+}
+
+// Remove the record rec, at the tail of the backlog b
+static inline void kzimp_backlog_pop(struct kzimp_backlog *b,
+    struct kzimp_backlog_record *rec)
+{
+  smp_mb(); // the writers must not overwrite the record before we have read it
+  b->tail += sizeof(*rec) + rec->len;
+}
+
+// Drop the holes at the head of the backlog b of the reader ctrl.
+// Return 1 if the next record is the message backlog_seq of the reader (in *rec), 0 otherwise.
+// *next is set to the sequence number of the next record if it is before next_read_seq,
+// to next_read_seq otherwise.
+static int kzimp_backlog_next(struct kzimp_ctrl *ctrl,
+    struct kzimp_backlog *b, struct kzimp_backlog_record *rec,
+    unsigned long *next)
+{
+  *next = ctrl->next_read_seq;
+  if (!b)
+  {
+    return 0;
+  }
+
+  while (b->tail != ACCESS_ONCE(b->head))
+  {
+    smp_rmb(); // read the record after head
+    kzimp_backlog_get(b, b->tail, rec, sizeof(*rec));
+
+    // the records of a writer that has not moved the reader yet are not for now
+    if ((long) (rec->seq - ctrl->next_read_seq) >= 0)
+    {
+      return 0;
+    }
+
+    if (rec->seq == ctrl->backlog_seq && rec->len == 0)
+    {
+      kzimp_backlog_pop(b, rec);
+      ctrl->backlog_seq++;
+      continue;
+    }
+
+    *next = rec->seq;
+    return (rec->seq == ctrl->backlog_seq);
+  }
+
+  return 0;
+}
+
+/*
+ * Bring the reader ctrl to its read cursor if a writer has moved it after a timeout
+ * (KZIMP_OVERFLOW_SPILL, _SKIP). The messages before the cursor that the reader has not read
+ * are in its backlog or are lost.
+ * Returns:
+ *  . 0 if the next message of the reader is in the channel
+ *  . KZIMP_READ_BACKLOG if it is in its backlog
+ *  . -EPIPE if the reader has lost messages. KZIMP_IOCTL_GAP returns their number.
+ */
+static int kzimp_reader_catch_up(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  struct kzimp_backlog_record rec;
+  unsigned long cursor, next;
+
+  if (likely(!kzimp_reader_moved(chan, ctrl) && ctrl->backlog_seq
+      == ctrl->next_read_seq))
+  {
+    return 0;
+  }
+
+  // the cursor is before the reader while a writer copies its messages (see kzimp_move_reader())
+  cursor = ACCESS_ONCE(chan->cursors[ctrl->bitmap_bit].seq);
+  while ((long) (cursor - ctrl->next_read_seq) < 0)
+  {
+    cond_resched();
+    cpu_relax();
+    cursor = ACCESS_ONCE(chan->cursors[ctrl->bitmap_bit].seq);
+  }
+
+  if (cursor != ctrl->next_read_seq)
+  {
+    smp_rmb(); // the writer has filled the backlog before moving the cursor
+    ctrl->next_read_seq = cursor;
+    ctrl->next_read_idx = cursor % chan->channel_size;
+  }
+
+  if (kzimp_backlog_next(ctrl, ctrl->backlog, &rec, &next))
+  {
+    return KZIMP_READ_BACKLOG;
+  }
+
+  if (next == ctrl->backlog_seq)
+  {
+    return 0;
+  }
+
+  // the messages from backlog_seq to next have not been copied in the backlog
+  ctrl->last_gap = next - ctrl->backlog_seq;
+  ctrl->nb_lost += ctrl->last_gap;
+  ctrl->backlog_seq = next;
+
+  return -EPIPE;
+}
+
+// Read the next message of the backlog of the reader ctrl, when kzimp_reader_catch_up()
+// has returned KZIMP_READ_BACKLOG.
+// Return the number of read bytes, or -EFAULT if the copy to buf has failed.
+static ssize_t kzimp_read_backlog(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, char __user *buf, size_t count)
+{
+  struct kzimp_backlog *b;
+  struct kzimp_backlog_record rec;
+
+  b = ctrl->backlog;
+  kzimp_backlog_get(b, b->tail, &rec, sizeof(rec));
+
+  // check length
+  count = (rec.len < count ? rec.len : count);
+
+  if (unlikely(kzimp_backlog_copy_to_user(b, b->tail + sizeof(rec), buf, count)))
+  {
+    printk(KERN_ERR "kzimp: copy_to_user failed for process %i in read\n", current->pid);
+    return -EFAULT;
+  }
+
+  kzimp_backlog_pop(b, &rec);
+  ctrl->backlog_seq++;
+
+  kzimp_stat_inc(chan, msgs_read);
+  kzimp_stat_add(chan, bytes_read, rec.len);
+  ctrl->nb_msgs_read++;
+  ctrl->nb_bytes_read += rec.len;
+
+  return count;
+}
+
+/*
+ * kzimp wait for reading: the reader ctrl waits until it can read the message m.
+ * Blocking, unless nonblock is set (O_NONBLOCK is set when calling open(), or the reader
+ * looks at a lane).
+ * Before sleeping, the reader spins according to the wait policy of the channel.
+ * Returns:
+ *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
+ *  . 0 otherwise
+ */
+static ssize_t kzimp_wait_for_reading_if_needed(struct kzimp_ctrl *ctrl,
+    int nonblock, struct kzimp_message *m)
+{
+  ssize_t retval;
+  u64 wait_start;
+  wait_queue_head_t *q;
+  int queued;
+  DEFINE_WAIT(__wait);
+
+  struct kzimp_comm_chan *chan; /* channel information */
+
+  chan = ctrl->channel;
+
+  retval = 0;
+  wait_start = 0;
+  queued = 0;
+
+  if (!kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq) && !nonblock)
+  {
+    wait_start = kzimp_clock_ns();
+
+    if (kzimp_spin_while_not(kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq)
+        || !ctrl->online || kzimp_reader_moved(chan, ctrl), kzimp_spin_budget(chan)))
+    {
+      atomic_long_inc(&chan->nb_spins);
+    }
+  }
+
+  q = kzimp_reader_wq(chan, ctrl);
+
+  // we do not need this test to be atomic.
+  // A writer that moves the reader wakes it up: its next message is elsewhere.
+  while (!kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq)
+      && !kzimp_reader_moved(chan, ctrl))
+  {
+    // file is open in no-blocking mode
+    if (nonblock)
+    {
+      //printk(KERN_WARNING "kzimp: process %i in read returns because of non-blocking ops\n", current->pid);
+      retval = -EAGAIN;
+      break;
+    }
+
+    // the writer has removed this reader after a timeout
+    if (unlikely(!ctrl->online))
+    {
+      retval = -EBADF;
+      break;
+    }
+
+    prepare_to_wait(q, &__wait, TASK_INTERRUPTIBLE);
+    kzimp_reader_may_sleep(chan, ctrl);
+    queued = 1;
+
+    if (unlikely(signal_pending(current)))
+    {
+      printk(KERN_WARNING "kzimp: process %i in read has been interrupted\n", current->pid);
+      retval = -EINTR;
+      break;
+    }
+
+    // We are in the wait queue: check the condition again before sleeping, so that
+    // a message published before prepare_to_wait() is not missed.
+    // The writer only wakes us up if our bit is set (see kzimp_wake_up_readers()).
+    if (!kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq) && ctrl->online
+        && !kzimp_reader_moved(chan, ctrl))
+    {
+      atomic_long_inc(&chan->nb_sleeps);
+      ctrl->nb_sleeps++;
+      schedule();
+    }
+  }
+  finish_wait(q, &__wait);
+  if (queued)
+  {
+    kzimp_reader_awake(chan, ctrl);
+  }
+
+  if (wait_start && !retval)
+  {
+    kzimp_update_spin_budget(chan, kzimp_clock_ns() - wait_start);
+  }
+
+  return retval;
+}
+
+#ifdef USE_CHECKSUM_CODE
+/*
+ * Verify the checksum.
+ * Return 1 if valid, 0 otherwise.
+ */
+static int kzimp_verify_checksum(struct kzimp_message *m, size_t count,
+    struct kzimp_comm_chan *chan)
+{
+  struct kzimp_message m4chksum;
+
+  // compute checksum if required
+  m4chksum.checksum = 0;
+  if (chan->compute_checksum)
+  {
+    // construct the header
+    memset(&m4chksum, 0, KZIMP_HEADER_SIZE);
+    m4chksum.len = count;
+    m4chksum.bitmap = 0;
+    m4chksum.checksum = oneC_sum(0, &m4chksum, KZIMP_HEADER_SIZE);
+
+    if (chan->compute_checksum == 1)
+    {
+      m4chksum.checksum = oneC_sum(m4chksum.checksum, m->data, count);
+    }
+  }
+
+  if (m4chksum.checksum == m->checksum)
+  {
+    return 1;
+  }
+  else
+  {
+    printk(KERN_WARNING "kzimp: Process %i in read has found an incorrect checksum: %hi != %hi\n", current->pid, m4chksum.checksum, m->checksum);
+    kzimp_stat_inc(chan, checksum_failures);
+    return 0;
+  }
+}
+#endif
+
+// Account the read of the message m by the reader ctrl, at time now (0 if the
+// latencies are not collected). Must be called before the release of m: the writers
+// may modify it after.
+static inline void kzimp_account_read(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct kzimp_message *m, u64 now)
+{
+  u64 published;
+
+  kzimp_stat_inc(chan, msgs_read);
+  kzimp_stat_add(chan, bytes_read, m->len);
+  ctrl->nb_msgs_read++;
+  ctrl->nb_bytes_read += m->len;
+
+  published = m->publish_ns;
+  if (now && published)
+  {
+    kzimp_stat_inc(chan, latency[kzimp_latency_bucket(now > published ? now - published : 0)]);
+  }
+}
+
+/*
+ * finalize the read: unset the bit in the bitmap (or publish the read cursor),
+ * wake up the writers, update next_read_idx
+ * Returns:
+ *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
+ *  . -ESTALE if a writer has moved this reader after a timeout: m may have been overwritten
+ *    while it was read (KZIMP_OVERFLOW_SPILL, _SKIP)
+ *  . count otherwise
+ */
+static int finalize_read(struct kzimp_message *m, struct kzimp_ctrl *ctrl,
+    struct kzimp_comm_chan *chan, size_t count)
+{
+  int retval, wake_up_writers;
+
+  retval = count;
+
+  // the timeout at the writer may have expired, and the writer may have started to write
+  // a new message at m
+  if (likely(ctrl->online))
+  {
+    if (unlikely(kzimp_reader_moved(chan, ctrl)))
+    {
+      return -ESTALE;
+    }
+
+    if (count > 0)
+    {
+      kzimp_account_read(chan, ctrl, m, (collect_latencies ? kzimp_clock_ns() : 0));
+    }
+
+    wake_up_writers = kzimp_release_message(chan, ctrl, m);
+    if (unlikely(wake_up_writers < 0))
+    {
+      return wake_up_writers;
+    }
+
+    if (wake_up_writers
+#ifdef ATOMIC_WAKE_UP
+        && !atomic_cmpxchg(&m->waking_up_writer, 0, 1)
+#endif
+    )
+    {
+      kzimp_wake_up_writers(chan);
+
+#ifdef ATOMIC_WAKE_UP
+      atomic_set(&m->waking_up_writer, 0);
+#endif
+    }
+  }
+  else
+  {
+    printk(KERN_WARNING "kzimp: Process %i in read is no longer active\n", current->pid);
+    retval = -EBADF;
+  }
+
+  return retval;
+}
+
+/*
+ * finalize the read of the nb messages starting at next_read_idx: unset the bit in their
+ * bitmap (or publish the read cursor once), and wake up the writers only once.
+ * Returns:
+ *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
+ *  . -ESTALE if a writer has moved this reader after a timeout: the messages may have been
+ *    overwritten while they were read (KZIMP_OVERFLOW_SPILL, _SKIP)
+ *  . 0 otherwise
+ */
+static int finalize_read_batch(struct kzimp_ctrl *ctrl,
+    struct kzimp_comm_chan *chan, int nb)
+{
+  int i, wake_up_writers;
+  struct kzimp_message *m;
+  u64 now;
+
+  if (unlikely(!ctrl->online))
+  {
+    printk(KERN_WARNING "kzimp: Process %i in read is no longer active\n", current->pid);
+    return -EBADF;
+  }
+
+  if (unlikely(kzimp_reader_moved(chan, ctrl)))
+  {
+    return -ESTALE;
+  }
+
+  now = (collect_latencies ? kzimp_clock_ns() : 0);
+
+  wake_up_writers = 0;
+  for (i = 0; i < nb; i++)
+  {
+    m = kzimp_msg(chan, ctrl->next_read_idx);
+
+    if (!kzimp_is_hole(m))
+    {
+      kzimp_account_read(chan, ctrl, m, now);
+    }
+
+    if (chan->mode == KZIMP_MODE_BITMAP)
+    {
+      wake_up_writers |= kzimp_clear_reader_bit(chan, m, ctrl->bitmap_bit);
+    }
+
+    ctrl->next_read_seq++;
+    ctrl->next_read_idx = (ctrl->next_read_idx + 1) % chan->channel_size;
+  }
+
+  if (chan->mode == KZIMP_MODE_CURSOR)
+  {
+    if (unlikely(!kzimp_publish_cursor(chan, ctrl, ctrl->next_read_seq - nb)))
+    {
+      ctrl->next_read_seq -= nb;
+      ctrl->next_read_idx = ctrl->next_read_seq % chan->channel_size;
+      return -ESTALE;
+    }
+    wake_up_writers = 1;
+  }
+  ctrl->backlog_seq = ctrl->next_read_seq;
+
+  if (wake_up_writers)
+  {
+    kzimp_wake_up_writers(chan);
+  }
+
+  return 0;
+}
+
+/*
+ * Wait for the next message the reader ctrl can read, skipping the holes.
+ * If nonblock is set, returns -EAGAIN instead of waiting.
+ * Returns:
+ *  . the errors of kzimp_wait_for_reading_if_needed() and finalize_read()
+ *  . -EPIPE if the reader has lost messages after a timeout (KZIMP_OVERFLOW_SPILL, _SKIP)
+ *  . KZIMP_READ_BACKLOG if the next message is in the backlog of the reader
+ *  . 0 otherwise, and the message is in *mf
+ */
+static ssize_t kzimp_wait_for_next_message(struct kzimp_ctrl *ctrl,
+    int nonblock, struct kzimp_message **mf)
+{
+  int retval;
+  struct kzimp_message *m;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+
+  chan = ctrl->channel;
+
+  for (;;)
+  {
+    retval = kzimp_reader_catch_up(chan, ctrl);
+    if (unlikely(retval))
+    {
+      return retval;
+    }
+
+    m = kzimp_msg(chan, ctrl->next_read_idx);
+
+    retval = kzimp_wait_for_reading_if_needed(ctrl, nonblock, m);
+    if (retval)
+    {
+      return retval;
+    }
+
+    // a writer has moved the reader while it was waiting
+    if (unlikely(kzimp_reader_moved(chan, ctrl)))
+    {
+      continue;
+    }
+
+    smp_rmb(); // read the message after its bitmap
+    if (likely(!kzimp_is_hole(m)))
+    {
+      break;
+    }
+
+    retval = finalize_read(m, ctrl, chan, 0);
+    if (unlikely(retval < 0 && retval != -ESTALE))
+    {
+      return retval;
+    }
+  }
+
+  *mf = m;
+
+  return 0;
+}
+
+// Copy the len bytes of the message data src in the user-space buffer buf.
+// From prefetch_copy_threshold bytes, the next block of the message is prefetched
+// while the current one is copied.
+// Return 0 if the copy has succeeded, -EFAULT otherwise.
+static inline int kzimp_copy_to_user(char __user *buf, const char *src,
+    size_t len)
+{
+  size_t off, block;
+
+  if (prefetch_copy_threshold <= 0 || len < prefetch_copy_threshold)
+  {
+    // copy_to_user returns the number of bytes left to copy
+    return (copy_to_user(buf, src, len) ? -EFAULT : 0);
+  }
+
+  for (off = 0; off < len; off += block)
+  {
+    block = min(len - off, (size_t) KZIMP_PREFETCH_BLOCK);
+    if (off + block < len)
+    {
+      prefetch_range((void*) (src + off + block), min(len - off - block,
+          (size_t) KZIMP_PREFETCH_BLOCK));
+    }
+
+    if (copy_to_user(buf + off, src + off, block))
+    {
+      return -EFAULT;
+    }
+  }
+
+  return 0;
+}
+
+// Read the next message of the reader ctrl in buf, of size count.
+// If nonblock is set, returns -EAGAIN instead of waiting.
+// Return the return values of kzimp_read().
+static ssize_t kzimp_read_lane(struct kzimp_ctrl *ctrl, int nonblock,
+    char __user *buf, size_t count)
+{
+  int retval;
+  size_t len;
+  struct kzimp_message *m;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+
+  chan = ctrl->channel;
+
+  // the message is read again if a writer has moved the reader in the meantime
+  do
+  {
+    retval = kzimp_wait_for_next_message(ctrl, nonblock, &m);
+    if (unlikely(retval == KZIMP_READ_BACKLOG))
+    {
+      return kzimp_read_backlog(chan, ctrl, buf, count);
+    }
+    if (retval)
+    {
+      return retval;
+    }
+
+    // check length
+    len = (m->len < count ? m->len : count);
+
+#ifdef USE_CHECKSUM_CODE
+    if (!kzimp_verify_checksum(m, len, chan))
+    {
+      retval = -EIO;
+    }
+#endif
+
+    if (unlikely(kzimp_copy_to_user(buf, m->data, len)))
+    {
+      printk(KERN_ERR "kzimp: copy_to_user failed for process %i in read\n", current->pid);
+      return -EFAULT;
+    }
+
+    retval = finalize_read(m, ctrl, chan, len);
+  } while (unlikely(retval == -ESTALE));
+
+  return retval;
+}
+
+// Return 1 if the reader ctrl has to look at its lanes again: one of them has a message
+// or a hole to read, its next read returns a message of its backlog or -EPIPE, or the
+// reader is no longer online on it. Return 0 otherwise.
+static int kzimp_lanes_ready(struct kzimp_ctrl *ctrl)
+{
+  struct kzimp_comm_chan *lane;
+  struct kzimp_ctrl *lane_ctrl;
+  int l;
+
+  for (l = ctrl->nb_lanes - 1; l >= 0; l--)
+  {
+    lane_ctrl = ctrl->lanes[l];
+    lane = lane_ctrl->channel;
+
+    if (!lane_ctrl->online || kzimp_reader_moved(lane, lane_ctrl)
+        || lane_ctrl->backlog_seq != lane_ctrl->next_read_seq
+        || kzimp_reader_can_read(lane, lane_ctrl, kzimp_msg(lane,
+            lane_ctrl->next_read_idx), lane_ctrl->next_read_seq))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * The reader ctrl, which has nothing to read on any of its lanes, waits until one of
+ * them is ready (see kzimp_lanes_ready()). It sleeps in its wait queue of lane 0, where
+ * the writers of all the lanes wake it up.
+ * Blocking, unless nonblock is set.
+ * Before sleeping, the reader spins according to the wait policy of lane 0.
+ * Returns:
+ *  . -EAGAIN if nonblock is set and the call would block.
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . -EBADF if this reader is no longer online on one of the lanes
+ *  . 0 otherwise
+ */
+static int kzimp_wait_for_lanes(struct kzimp_ctrl *ctrl, int nonblock)
+{
+  int l, retval, queued;
+  u64 wait_start;
+  wait_queue_head_t *q;
+  DEFINE_WAIT(__wait);
+
+  struct kzimp_comm_chan *chan; /* lane 0 */
+
+  chan = ctrl->channel;
+
+  // a lane that is not online returns -EAGAIN when there is nothing to read on it
+  for (l = 0; l < ctrl->nb_lanes; l++)
+  {
+    if (unlikely(!ctrl->lanes[l]->online))
+    {
+      return -EBADF;
+    }
+  }
+
+  if (nonblock)
+  {
+    return (kzimp_lanes_ready(ctrl) ? 0 : -EAGAIN);
+  }
+
+  retval = 0;
+  queued = 0;
+  wait_start = kzimp_clock_ns();
+
+  if (kzimp_spin_while_not(kzimp_lanes_ready(ctrl), kzimp_spin_budget(chan)))
+  {
+    atomic_long_inc(&chan->nb_spins);
+  }
+
+  q = kzimp_reader_wq(chan, ctrl);
+
+  while (!kzimp_lanes_ready(ctrl))
+  {
+    prepare_to_wait(q, &__wait, TASK_INTERRUPTIBLE);
+    kzimp_reader_may_sleep(chan, ctrl);
+    queued = 1;
+
+    if (unlikely(signal_pending(current)))
+    {
+      printk(KERN_WARNING "kzimp: process %i in read has been interrupted\n", current->pid);
+      retval = -EINTR;
+      break;
+    }
+
+    // check the lanes again once in the wait queue (see kzimp_wait_for_reading_if_needed())
+    if (!kzimp_lanes_ready(ctrl))
+    {
+      atomic_long_inc(&chan->nb_sleeps);
+      ctrl->nb_sleeps++;
+      schedule();
+    }
+  }
+  finish_wait(q, &__wait);
+  if (queued)
+  {
+    kzimp_reader_awake(chan, ctrl);
+  }
+
+  if (!retval)
+  {
+    kzimp_update_spin_budget(chan, kzimp_clock_ns() - wait_start);
+  }
+
+  return retval;
+}
+
+// The lane l of the reader ctrl has returned retval. Return it: the gap of the lane,
+// if any, is the one of the reader (see KZIMP_IOCTL_GAP).
+static inline long kzimp_lane_result(struct kzimp_ctrl *ctrl, int l,
+    long retval)
+{
+  if (unlikely(retval == -EPIPE && l > 0))
+  {
+    ctrl->last_gap = ctrl->lanes[l]->last_gap;
+    ctrl->nb_lost += ctrl->last_gap;
+  }
+
+  return retval;
+}
+
+/*
+ * kzimp read operation.
+ * Blocking by default. May be non blocking (if O_NONBLOCK is set when calling open()).
+ * With several lanes, the message is the next one of the highest lane that has one.
+ * Returns:
+ *  . -EFAULT if the copy to buf has failed
+ *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
+ *  . -EIO if the checksum is incorrect
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . -EPIPE if the reader has lost messages after a timeout (KZIMP_OVERFLOW_SPILL, _SKIP).
+ *    KZIMP_IOCTL_GAP returns their number, and the next read returns the next message.
+ *  . 0 if there has been an error when reading (count is <= 0)
+ *  . The number of read bytes otherwise
+ */
+static ssize_t kzimp_read
+(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+  ssize_t retval;
+  int l, nonblock;
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = filp->private_data;
+  nonblock = filp->f_flags & O_NONBLOCK;
+
+  if (likely(ctrl->nb_lanes == 1))
+  {
+    return kzimp_read_lane(ctrl, nonblock, buf, count);
+  }
+
+  // the reader only looks at each lane: it waits for all of them at once
+  for (;;)
+  {
+    for (l = ctrl->nb_lanes - 1; l >= 0; l--)
+    {
+      retval = kzimp_read_lane(ctrl->lanes[l], 1, buf, count);
+      if (retval != -EAGAIN)
+      {
+        return kzimp_lane_result(ctrl, l, retval);
+      }
+    }
+
+    retval = kzimp_wait_for_lanes(ctrl, nonblock);
+    if (retval)
+    {
+      return retval;
+    }
+  }
+}
+
+// Return the minimum of the read cursors of the readers of chan (cursor mode).
+// The writer keeps it in its control structure ctrl. It remains valid until a new reader
+// arrives (chan->readers_gen changes then): the cursors only increase, and the readers
+// that leave the channel can only increase the minimum.
+// ticket is the ticket of the writer: it is the minimum if there are no readers.
+static unsigned long kzimp_update_min_cursor(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, unsigned long ticket)
+{
+  int w, bit;
+  unsigned long mask, min, cursor;
+
+  ctrl->min_cursor_gen = ACCESS_ONCE(chan->readers_gen);
+  smp_rmb(); // read the readers after their generation
+
+  min = ticket;
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    mask = ACCESS_ONCE(chan->multicast_mask[w]);
+    while (mask)
+    {
+      bit = __ffs(mask);
+      mask &= mask - 1;
+
+      cursor = ACCESS_ONCE(chan->cursors[w * BITS_PER_LONG + bit].seq);
+      if ((long) (cursor - min) < 0)
+      {
+        min = cursor;
+      }
+    }
+  }
+
+  smp_mb(); // write the message after having read the cursors (see kzimp_publish_cursor())
+  ctrl->min_cursor = min;
+
+  return min;
+}
+
+// return 1 if the writer ctrl, holding ticket, can write in the message m, 0 otherwise:
+// all the readers must have read the message of the previous round on m.
+static inline int kzimp_writer_can_write(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct kzimp_message *m, unsigned long ticket)
+{
+  if (chan->mode == KZIMP_MODE_CURSOR)
+  {
+    // compute the minimum again only if the last one is not enough
+    if (ctrl->min_cursor_gen != ACCESS_ONCE(chan->readers_gen)
+        || (long) (ticket - ctrl->min_cursor) >= chan->channel_size)
+    {
+      kzimp_update_min_cursor(chan, ctrl, ticket);
+    }
+    return ((long) (ticket - ctrl->min_cursor) < chan->channel_size);
+  }
+
+  return writer_can_write(m->bitmap);
+}
+
+// Compute in bitmap (of KZIMP_MAX_BITMAP_WORDS words) the readers that have not read yet
+// the message of the previous round on m. ticket is the ticket of the writer of m.
+static void kzimp_late_readers(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, unsigned long ticket, unsigned long *bitmap)
+{
+  int w, bit;
+  unsigned long mask;
+
+  memset(bitmap, 0, sizeof(*bitmap) * KZIMP_MAX_BITMAP_WORDS);
+
+  if (chan->mode == KZIMP_MODE_BITMAP)
+  {
+    if (likely(chan->nb_bitmap_words == 1))
+    {
+      bitmap[0] = m->bitmap;
+    }
+    else
+    {
+      for (w = 0; w < chan->nb_bitmap_words; w++)
+      {
+        bitmap[w] = ACCESS_ONCE(kzimp_message_bitmap(chan, m)[w]);
+      }
+    }
+    return;
+  }
+
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    mask = ACCESS_ONCE(chan->multicast_mask[w]);
+    while (mask)
+    {
+      bit = __ffs(mask);
+      mask &= mask - 1;
+
+      if ((long) (ticket - ACCESS_ONCE(chan->cursors[w * BITS_PER_LONG + bit].seq)) >= chan->channel_size)
+      {
+        bitmap[w] |= (1UL << bit);
+      }
+    }
+  }
+}
+
+// When the timeout expires, the writer removes the bits that are at 1 in this bitmap, for all the messages
+// chan is the channel, m is the struct kzimp_message where to write the current message.
+// ticket is the ticket of the writer.
+// With KZIMP_OVERFLOW_SPILL and KZIMP_OVERFLOW_SKIP the late readers are moved instead.
+static void handle_timeout(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, unsigned long ticket)
+{
+  int i, w, policy;
+  struct list_head *p;
+  struct kzimp_ctrl *ptr;
+  unsigned long tmp;
+  unsigned long bitmap[KZIMP_MAX_BITMAP_WORDS];
+
+  kzimp_late_readers(chan, m, ticket, bitmap);
+
+  kzimp_stat_inc(chan, timeouts);
+
+  policy = ACCESS_ONCE(chan->overflow_policy);
+  if (policy == KZIMP_OVERFLOW_SPILL || policy == KZIMP_OVERFLOW_SKIP)
+  {
+    kzimp_move_late_readers(chan, ticket, bitmap);
+    return;
+  }
+
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    kzimp_stat_add(chan, readers_offline, hweight_long(bitmap[w]));
+  }
+
+  spin_lock(&chan->bcl);
+
+  // remove the bits from the multicast mask
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    tmp = chan->multicast_mask[w] & ~bitmap[w];
+    __asm volatile ("" : : : "memory");
+    chan->multicast_mask[w] = tmp; // this operation is atomic
+  }
+
+  // remove the bits from all the messages
+  for (i = 0; i < chan->channel_size; i++)
+  {
+    if (chan->nb_bitmap_words > 1)
+    {
+      // the second level is modified atomically
+      for (w = 0; w < chan->nb_bitmap_words; w++)
+      {
+        if (bitmap[w])
+        {
+          kzimp_clear_bitmap_bits(chan, kzimp_msg(chan, i), w, bitmap[w]);
+        }
+      }
+      continue;
+    }
+
+    // test if bitmap is different from 0, otherwise we may loose a message:
+    // process A                        process B
+    //                      msg.bitmap = 0
+    //   | a = msg.bitmap & ~bitmap        |
+    //   |                                 | msg.bitmap = multicast_mask
+    //   | msg.bitmap = a                  |
+    // The bitmap is now 0 instead of multicast_mask. The message has been lost.
+    if (kzimp_msg(chan, i)->bitmap != 0)
+    {
+      kzimp_msg(chan, i)->bitmap &= ~bitmap[0];
+    }
+  }
+
+  // set the remaining readers on that bitmap to offline
+  list_for_each(p, &chan->readers)
+  {
+    ptr = list_entry(p, struct kzimp_ctrl, next);
+    if (test_bit(ptr->bitmap_bit, bitmap))
+    {
+      ptr->online = 0;
+      printk(KERN_DEBUG "kzimp: Process %i in write. Process %i is offline\n", current->pid, ptr->pid);
+    }
+  }
+
+  spin_unlock(&chan->bcl);
+
+  // wake up the readers that are now offline
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    while (bitmap[w])
+    {
+      i = w * BITS_PER_LONG + __ffs(bitmap[w]);
+      bitmap[w] &= bitmap[w] - 1;
+
+      wake_up_interruptible_poll(&chan->readers_wq[i].q, POLLHUP);
+    }
+  }
+}
+
+// Copy the messages of the late reader ctrl from seq to ticket (excluded) in its backlog,
+// in order, as long as they have been published and they fit in it.
+// Must be called with move_mutex held, while the cursor of the reader is frozen: the
+// writers cannot overwrite these messages, thus they are copied without the channel lock.
+// Return the sequence number of the first message that has not been copied.
+static unsigned long kzimp_spill_messages(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, unsigned long seq, unsigned long ticket)
+{
+  struct kzimp_backlog *b;
+  struct kzimp_backlog_record rec;
+  struct kzimp_message *m;
+  unsigned long head, len;
+
+  b = ctrl->backlog;
+  if (!b)
+  {
+    return seq;
+  }
+
+  head = b->head;
+  for (; seq != ticket; seq++)
+  {
+    // the writer of seq may not have published it yet
+    m = kzimp_msg(chan, seq % chan->channel_size);
+    if (ACCESS_ONCE(m->write_seq) != seq + chan->channel_size)
+    {
+      break;
+    }
+    smp_rmb(); // read the message after write_seq
+
+    rec.seq = seq;
+    rec.len = m->len;
+    len = sizeof(rec) + rec.len;
+    if (b->size - (head - ACCESS_ONCE(b->tail)) < len)
+    {
+      break;
+    }
+
+    kzimp_backlog_put(b, head, &rec, sizeof(rec));
+    kzimp_backlog_put(b, head + sizeof(rec), m->data, rec.len);
+    head += len;
+
+    // up to channel_size messages of max_msg_size bytes
+    cond_resched();
+  }
+
+  smp_wmb(); // the reader must see the records before head
+  b->head = head;
+
+  return seq;
+}
+
+// Move the read cursor of the late reader ctrl to ticket, the ticket of the writer
+// (KZIMP_OVERFLOW_SPILL, _SKIP). Its messages from its cursor to ticket are first copied in
+// its backlog, as long as they fit. The reader reads them, then gets -EPIPE for the others.
+// Must be called with move_mutex held, without the channel lock.
+// Return 1 if the reader has been moved, 0 if it is no longer late.
+static int kzimp_move_reader(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, unsigned long ticket)
+{
+  unsigned long *cursor, c, spilled;
+
+  cursor = &chan->cursors[ctrl->bitmap_bit].seq;
+
+  // Freeze the cursor one message before the reader: the reader cannot publish it anymore
+  // (see kzimp_publish_cursor()), and the writers cannot overwrite its messages while we
+  // copy them.
+  do
+  {
+    c = ACCESS_ONCE(*cursor);
+    if ((long) (ticket - c) < chan->channel_size)
+    {
+      // the reader has read the message since kzimp_late_readers()
+      return 0;
+    }
+  } while (cmpxchg(cursor, c, c - 1) != c);
+
+  spilled = kzimp_spill_messages(chan, ctrl, c, ticket) - c;
+
+  kzimp_stat_inc(chan, readers_moved);
+  kzimp_stat_add(chan, msgs_spilled, spilled);
+  kzimp_stat_add(chan, msgs_skipped, ticket - c - spilled);
+
+  smp_wmb(); // the reader must see its backlog before its new cursor
+  ACCESS_ONCE(*cursor) = ticket;
+
+  return 1;
+}
+
+// When the timeout expires with KZIMP_OVERFLOW_SPILL or _SKIP, the writer moves the late
+// readers of bitmap to its ticket instead of setting them offline, and wakes them up.
+static void kzimp_move_late_readers(struct kzimp_comm_chan *chan,
+    unsigned long ticket, unsigned long *bitmap)
+{
+  int i, w, moved;
+  struct list_head *p;
+  struct kzimp_ctrl *ptr;
+
+  // Only one writer moves readers at a time, and the readers cannot leave the list
+  // meanwhile (see kzimp_remove_reader()): the lock is released while the messages
+  // are copied. The new readers are added at the end of the list, with the lock.
+  mutex_lock(&chan->move_mutex);
+  spin_lock(&chan->bcl);
+
+  list_for_each(p, &chan->readers)
+  {
+    ptr = list_entry(p, struct kzimp_ctrl, next);
+    if (!test_bit(ptr->bitmap_bit, bitmap))
+    {
+      continue;
+    }
+
+    spin_unlock(&chan->bcl);
+    moved = kzimp_move_reader(chan, ptr, ticket);
+    spin_lock(&chan->bcl);
+
+    if (!moved)
+    {
+      clear_bit(ptr->bitmap_bit, bitmap);
+    }
+  }
+
+  spin_unlock(&chan->bcl);
+  mutex_unlock(&chan->move_mutex);
+
+  // the moved readers read their backlog or the messages after ticket
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    while (bitmap[w])
+    {
+      i = w * BITS_PER_LONG + __ffs(bitmap[w]);
+      bitmap[w] &= bitmap[w] - 1;
+
+      wake_up_interruptible_poll(&chan->readers_wq[i].q, POLLIN | POLLRDNORM);
+    }
+  }
+}
+
+// Wait until the writer of the previous round on m has published its message.
+// The wait is not interruptible: the previous writer publishes its message (or a hole)
+// at the latest when its timeout expires. With KZIMP_OVERFLOW_BLOCK, where there is no
+// timeout, a writer only takes a ticket once its message can be written
+// (see kzimp_wait_for_ticket()).
+static void kzimp_wait_for_turn(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, unsigned long ticket)
+{
+  DEFINE_WAIT(__wait);
+
+  while (!writer_has_turn(m, ticket))
+  {
+    prepare_to_wait(&chan->wq, &__wait, TASK_UNINTERRUPTIBLE);
+
+    if (!writer_has_turn(m, ticket))
+    {
+      schedule();
+    }
+  }
+  finish_wait(&chan->wq, &__wait);
+
+  smp_rmb(); // read the bitmap after write_seq
+}
+
+// Give the message m to the writer of the next round on it, and wake it up if it is waiting.
+static inline void kzimp_pass_turn(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m)
+{
+  smp_wmb(); // the next writer must see the new bitmap
+  m->write_seq += chan->channel_size;
+
+  smp_mb(); // write_seq must be visible before we look at the wait queue
+  if (waitqueue_active(&chan->wq))
+  {
+    wake_up(&chan->wq);
+  }
+}
+
+// Take a ticket only if its message can be written right now.
+// Return 1 if it is the case (the message is in *mf), 0 otherwise.
+static int kzimp_try_take_ticket(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct kzimp_message **mf)
+{
+  unsigned long ticket;
+  struct kzimp_message *m;
+
+  do
+  {
+    ticket = atomic_long_read(&chan->next_write_idx);
+    m = kzimp_msg(chan, ticket % chan->channel_size);
+
+    if (!writer_has_turn(m, ticket))
+    {
+      return 0;
+    }
+    smp_rmb();
+    if (!kzimp_writer_can_write(chan, ctrl, m, ticket))
+    {
+      return 0;
+    }
+  } while (atomic_long_cmpxchg(&chan->next_write_idx, ticket, ticket + 1) != ticket);
+
+  *mf = m;
+
+  return 1;
+}
+
+// Copy the count bytes of the user-space buffer buf in dst with non-temporal stores:
+// the writer does not fill its cache with a message that only the readers read.
+// Return 0 if the copy has succeeded, -EFAULT otherwise.
+static inline int kzimp_nt_copy_from_user(void *dst, const char __user *buf,
+    size_t count)
+{
+#ifdef CONFIG_X86
+  unsigned long left;
+
+  // __copy_from_user_nocache() does not check the user-space buffer
+  if (unlikely(!access_ok(VERIFY_READ, buf, count)))
+  {
+    return -EFAULT;
+  }
+
+  left = __copy_from_user_nocache(dst, buf, count);
+
+  // the non-temporal stores are weakly ordered: they must be visible before the message is published
+  wmb();
+
+  return (left ? -EFAULT : 0);
+#else
+  return (copy_from_user(dst, buf, count) ? -EFAULT : 0);
+#endif
+}
+
+// Copy the count bytes of the user-space buffer buf in the message m.
+// If the checksum is computed on the whole message, the sum of the data is computed
+// during the copy, thus the data is read only once. It is kept in m->checksum until
+// the message is published (see kzimp_publish_message()).
+// Otherwise, the messages of at least nt_copy_threshold bytes are copied with non-temporal stores.
+// Return 0 if the copy has succeeded, -EFAULT otherwise.
+static inline int kzimp_copy_from_user(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, const char __user *buf, size_t count)
+{
+#ifdef USE_CHECKSUM_CODE
+  int err;
+  __wsum sum;
+
+  if (chan->compute_checksum == 1)
+  {
+    err = 0;
+    sum = csum_and_copy_from_user(buf, m->data, count, 0, &err);
+    m->checksum = kzimp_csum_fold(sum);
+    return (err ? -EFAULT : 0);
+  }
+#endif
+
+  if (nt_copy_supported && nt_copy_threshold > 0 && count >= nt_copy_threshold)
+  {
+    return kzimp_nt_copy_from_user(m->data, buf, count);
+  }
+
+  // copy_from_user returns the number of bytes left to copy
+  return (copy_from_user(m->data, buf, count) ? -EFAULT : 0);
+}
+
+// set the two levels of the bitmap of the message m (more than one bitmap word)
+static void kzimp_publish_bitmap(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m)
+{
+  int w;
+  unsigned long *words, bitmap;
+
+  words = kzimp_message_bitmap(chan, m);
+  bitmap = 0;
+  for (w = 0; w < chan->nb_bitmap_words; w++)
+  {
+    words[w] = ACCESS_ONCE(chan->multicast_mask[w]);
+    if (words[w])
+    {
+      bitmap |= (1UL << w);
+    }
+  }
+
+  smp_wmb(); // the readers must see the second level before the first one
+  m->bitmap = bitmap;
+}
+
+// publish the message, without waking up the readers.
+// If count is 0 then the writer gives up the message: it publishes a hole that the readers skip.
+static void kzimp_publish_message(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, size_t count)
+{
+#ifdef USE_CHECKSUM_CODE
+  short data_sum;
+#endif
+
+  m->len = count;
+  m->publish_ns = 0;
+  if (count > 0)
+  {
+    kzimp_stat_inc(chan, msgs_written);
+    kzimp_stat_add(chan, bytes_written, count);
+    if (collect_latencies)
+    {
+      m->publish_ns = kzimp_clock_ns();
+    }
+  }
+
+#ifdef USE_CHECKSUM_CODE
+  // compute checksum if required.
+  // The sum of the data has been computed by kzimp_copy_from_user()
+  data_sum = (chan->compute_checksum == 1 && count > 0 ? m->checksum : 0);
+  m->checksum = 0;
+  if (chan->compute_checksum)
+  {
+    m->checksum = oneC_sum(data_sum, m, KZIMP_HEADER_SIZE);
+  }
+#endif
+
+  smp_wmb(); // the readers must see the message before the bitmap
+  if (chan->mode == KZIMP_MODE_BITMAP)
+  {
+    if (likely(chan->nb_bitmap_words == 1))
+    {
+      m->bitmap = chan->multicast_mask[0];
+    }
+    else
+    {
+      kzimp_publish_bitmap(chan, m);
+    }
+  }
+
+  kzimp_pass_turn(chan, m);
+}
+
+// finalize the write: publish the message and wake up the readers.
+// If count is 0 then the writer gives up the message: it publishes a hole that the readers skip.
+static void kzimp_finalize_write(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, size_t count)
+{
+  kzimp_publish_message(chan, m, count);
+
+  // wake up sleeping readers
+  kzimp_wake_up_readers(chan);
+}
+
+// return the control structure of the writer of filp on the lane of its next messages
+static inline struct kzimp_ctrl* kzimp_writer_lane(struct file *filp)
+{
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = filp->private_data;
+  return ctrl->lanes[ctrl->lane];
+}
+
+// Wait until the writer ctrl can take a ticket whose message can be written right now
+// (KZIMP_OVERFLOW_BLOCK). Nothing bounds the wait for the late readers, thus the writer
+// holds no ticket while it waits: it can be interrupted, and the writers of the next rounds
+// never wait for it. The writers are not served in order.
+// Return 1 if the writer has a ticket (its message is in *mf), -EINTR if it has been
+// interrupted.
+static ssize_t kzimp_wait_for_ticket(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct kzimp_message **mf)
+{
+  DEFINE_WAIT(__wait);
+
+  if (kzimp_try_take_ticket(chan, ctrl, mf))
+  {
+    return 1;
+  }
+
+  kzimp_stat_inc(chan, writer_waits);
+
+  if (kzimp_spin_while_not(kzimp_try_take_ticket(chan, ctrl, mf), kzimp_spin_budget(chan)))
+  {
+    atomic_long_inc(&chan->nb_spins);
+    return 1;
+  }
+
+  while (1)
+  {
+    prepare_to_wait(&chan->wq, &__wait, TASK_INTERRUPTIBLE);
+
+    if (unlikely(signal_pending(current)))
+    {
+      finish_wait(&chan->wq, &__wait);
+      printk(KERN_WARNING "kzimp: process %i in write has been interrupted\n", current->pid);
+      return -EINTR;
+    }
+
+    // check the condition again once in the wait queue: the readers wake up the writers when
+    // they release a message (see kzimp_wake_up_writers()), the writers when they pass the turn
+    if (kzimp_try_take_ticket(chan, ctrl, mf))
+    {
+      break;
+    }
+
+    atomic_long_inc(&chan->nb_sleeps);
+    schedule();
+  }
+  finish_wait(&chan->wq, &__wait);
+
+  return 1;
+}
+
+// Wait for writing if needed.
+// Return 1 if everything is ok, an error otherwise.
+// The writers take a ticket with an atomic increment. The ticket gives the position of
+// the message (ticket % channel_size) and orders the writers of the different rounds
+// on the same message, thus there cannot be 2 writers on the same message.
+// Once a writer has a ticket it must publish something in the message (see
+// kzimp_finalize_write), otherwise the writers of the next rounds would wait forever.
+// If the process is interrupted after having taken its ticket, it waits until it can
+// publish a hole in the message (the readers skip it) and then returns -EINTR.
+// Before sleeping, the writer spins according to the wait policy of the channel.
+// It spins at most during its timeout.
+// With KZIMP_OVERFLOW_BLOCK there is no timeout: the writer waits for the late readers before
+// it takes its ticket (see kzimp_wait_for_ticket()).
+// The message is written in the current lane of the writer (see kzimp_writer_lane()).
+static ssize_t kzimp_wait_for_writing_if_needed(struct file *filp,
+    size_t count, struct kzimp_message **mf)
+{
+  long to_expired;
+  u64 spin_ns, timeout_ns;
+  int interrupted;
+  unsigned long ticket;
+  struct kzimp_message *m;
+  DEFINE_WAIT(__wait);
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = kzimp_writer_lane(filp);
+  chan = ctrl->channel;
+
+  // Check the validity of the arguments
+  if (unlikely(count <= 0 || count > chan->max_msg_size))
+  {
+    printk(KERN_ERR "kzimp: count is not valid: %lu (process %i in write on channel %i)\n", (unsigned long)count, current->pid, chan->chan_id);
+    return 0;
+  }
+
+  // file is open in no-blocking mode: take a ticket only if its message can be written now
+  if (filp->f_flags & O_NONBLOCK)
+  {
+    if (kzimp_try_take_ticket(chan, ctrl, mf))
+    {
+      return 1;
+    }
+
+    kzimp_stat_inc(chan, writer_waits);
+    return -EAGAIN;
+  }
+
+  if (unlikely(signal_pending(current)))
+  {
+    printk(KERN_WARNING "kzimp: process %i in write has been interrupted\n", current->pid);
+    return -EINTR;
+  }
+
+  if (ACCESS_ONCE(chan->overflow_policy) == KZIMP_OVERFLOW_BLOCK)
+  {
+    return kzimp_wait_for_ticket(chan, ctrl, mf);
+  }
+
+  ticket = atomic_long_inc_return(&chan->next_write_idx) - 1;
+  m = kzimp_msg(chan, ticket % chan->channel_size);
+
+  kzimp_wait_for_turn(chan, m, ticket);
+
+  interrupted = 0;
+  to_expired = 1;
+
+  if (!kzimp_writer_can_write(chan, ctrl, m, ticket))
+  {
+    kzimp_stat_inc(chan, writer_waits);
+
+    timeout_ns = (u64) chan->timeout_in_ms * NSEC_PER_MSEC;
+    spin_ns = min(kzimp_spin_budget(chan), timeout_ns);
+
+    if (kzimp_spin_while_not(kzimp_writer_can_write(chan, ctrl, m, ticket), spin_ns))
+    {
+      atomic_long_inc(&chan->nb_spins);
+    }
+    else if (spin_ns == timeout_ns && !signal_pending(current))
+    {
+      // the writer has spun during its whole timeout
+      to_expired = 0;
+    }
+  }
+
+  while (!kzimp_writer_can_write(chan, ctrl, m, ticket) && to_expired)
+  {
+    prepare_to_wait(&chan->wq, &__wait,
+        (interrupted ? TASK_UNINTERRUPTIBLE : TASK_INTERRUPTIBLE));
+
+    if (unlikely(!interrupted && signal_pending(current)))
+    {
+      printk(KERN_WARNING "kzimp: process %i in write has been interrupted\n", current->pid);
+      interrupted = 1;
+      continue;
+    }
+
+    // check the condition again once in the wait queue (see kzimp_wake_up_writers())
+    if (!kzimp_writer_can_write(chan, ctrl, m, ticket))
+    {
+      atomic_long_inc(&chan->nb_sleeps);
+      to_expired = schedule_timeout(chan->timeout_in_ms * HZ / 1000);
+    }
+  }
+  finish_wait(&chan->wq, &__wait);
+
+  if (unlikely(!to_expired))
+  {
+    printk(KERN_DEBUG "kzimp: timer has expired for process %i in write\n", current->pid);
+    handle_timeout(chan, m, ticket);
+  }
+
+  if (unlikely(interrupted))
+  {
+    kzimp_finalize_write(chan, m, 0);
+    return -EINTR;
+  }
+
+  *mf = m;
+
+  return 1;
+}
+
+// Copy the user-space buffer buf of count bytes in the message m, then publish it.
+// Return count if everything is ok, -EFAULT otherwise.
+static inline ssize_t kzimp_copy_and_publish(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, const char __user *buf, size_t count)
+{
+  if (unlikely(kzimp_copy_from_user(chan, m, buf, count)))
+  {
+    printk(KERN_ERR "kzimp: copy_from_user failed for process %i in write\n", current->pid);
+    kzimp_finalize_write(chan, m, 0);
+    return -EFAULT;
+  }
+
+  kzimp_finalize_write(chan, m, count);
+
+  return count;
+}
+
+// Set the content of the message m to its inline bytes if count bytes fit in them,
+// to its part of the messages area otherwise.
+// Called by the writer that has the turn on m.
+static inline void kzimp_set_message_data(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, size_t count)
+{
+  m->data = (count <= chan->inline_size ? kzimp_inline_data(m) : m->area_data);
+}
+
+// return the size class of the arena for a message of count bytes (count > 0)
+static inline int kzimp_arena_class_of(size_t count)
+{
+  if (count <= (1UL << KZIMP_ARENA_MIN_SHIFT))
+  {
+    return 0;
+  }
+
+  return fls_long(count - 1) - KZIMP_ARENA_MIN_SHIFT;
+}
+
+/*
+ * Add a chunk of buffers of the size class c to the arena of chan.
+ * Called without any lock held: the allocation may sleep.
+ * Returns:
+ *  . -ENOMEM if the allocation has failed
+ *  . 0 otherwise
+ */
+static int kzimp_arena_grow(struct kzimp_comm_chan *chan, int c)
+{
+  struct kzimp_arena_chunk *chunk;
+  struct kzimp_arena_class *cls;
+  unsigned long size, offset;
+
+  size = 1UL << (KZIMP_ARENA_MIN_SHIFT + c);
+
+  chunk = my_kmalloc_node(sizeof(*chunk), GFP_KERNEL, chan->node);
+  if (unlikely(!chunk))
+  {
+    return -ENOMEM;
+  }
+
+  // the small chunks are kmalloc'ed: they are in the linear mapping
+  chunk->len = max(size, (unsigned long) KZIMP_ARENA_CHUNK_SIZE);
+  chunk->vmalloced = (chunk->len > KZIMP_ARENA_CHUNK_SIZE);
+  if (!chunk->vmalloced)
+  {
+    chunk->addr = my_kmalloc_node(chunk->len, GFP_KERNEL, chan->node);
+  }
+  else if (chan->node >= 0)
+  {
+    chunk->addr = my_vmalloc_node(chunk->len, chan->node);
+  }
+  else
+  {
+    chunk->addr = my_vmalloc(chunk->len);
+  }
+  if (unlikely(!chunk->addr))
+  {
+    printk(KERN_ERR "kzimp: arena allocation of %lu bytes error on channel %i\n", chunk->len, chan->chan_id);
+    my_kfree(chunk);
+    return -ENOMEM;
+  }
+
+  // link the buffers of the chunk
+  for (offset = 0; offset + size < chunk->len; offset += size)
+  {
+    *(void**) (chunk->addr + offset) = chunk->addr + offset + size;
+  }
+
+  cls = &chan->arena[c];
+  spin_lock(&cls->lock);
+  *(void**) (chunk->addr + offset) = cls->free;
+  cls->free = chunk->addr;
+  spin_unlock(&cls->lock);
+
+  spin_lock(&chan->bcl);
+  list_add(&chunk->next, &chan->arena_chunks);
+  chan->arena_size += chunk->len;
+  spin_unlock(&chan->bcl);
+
+  return 0;
+}
+
+// Give the buffer of the previous message of m back to its size class.
+// Called by the writer that has the turn on m: all the readers have read it.
+static inline void kzimp_arena_free(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m)
+{
+  struct kzimp_arena_class *cls;
+
+  if (m->arena_class < 0)
+  {
+    return;
+  }
+
+  cls = &chan->arena[m->arena_class];
+  spin_lock(&cls->lock);
+  *(void**) m->data = cls->free;
+  cls->free = m->data;
+  spin_unlock(&cls->lock);
+
+  m->data = NULL;
+  m->arena_class = -1;
+}
+
+/*
+ * Set the content of the message m to its inline bytes if count bytes fit in them,
+ * to a buffer of the arena of chan that can hold count bytes otherwise (count > 0).
+ * The buffer of the previous message of m is kept if it has the right size class,
+ * otherwise it goes back to the arena.
+ * Called by the writer that has the turn on m.
+ * Returns:
+ *  . -ENOMEM if the arena cannot grow
+ *  . 0 otherwise
+ */
+static int kzimp_arena_prepare(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m, size_t count)
+{
+  struct kzimp_arena_class *cls;
+  void *buf;
+  int c;
+
+  if (count <= chan->inline_size)
+  {
+    kzimp_arena_free(chan, m);
+    m->data = kzimp_inline_data(m);
+    return 0;
+  }
+
+  c = kzimp_arena_class_of(count);
+  if (likely(m->arena_class == c))
+  {
+    return 0;
+  }
+
+  kzimp_arena_free(chan, m);
+
+  cls = &chan->arena[c];
+  for (;;)
+  {
+    spin_lock(&cls->lock);
+    buf = cls->free;
+    if (likely(buf))
+    {
+      cls->free = *(void**) buf;
+    }
+    spin_unlock(&cls->lock);
+
+    if (likely(buf))
+    {
+      break;
+    }
+
+    if (unlikely(kzimp_arena_grow(chan, c)))
+    {
+      return -ENOMEM;
+    }
+  }
+
+  m->data = buf;
+  m->arena_class = c;
+
+  return 0;
+}
+
+/*
+ * kzimp write operation.
+ * Blocking call.
+ * Sleeps until it can write the message in the current lane of the writer.
+ * Returns:
+ *  . 0 if the size of the user-level buffer is less or equal than 0 or greater than the maximal message size
+ *  . -EFAULT if the buffer *buf is not valid
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . The number of written bytes otherwise
+ */
+static ssize_t kzimp_write
+(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+  struct kzimp_message *m;
+  ssize_t ret;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = kzimp_writer_lane(filp);
+  chan = ctrl->channel;
+
+  ret = kzimp_wait_for_writing_if_needed(filp, count, &m);
+  if (unlikely(ret != 1))
+  {
+    return ret;
+  }
+
+  kzimp_set_message_data(chan, m, count);
+
+  return kzimp_copy_and_publish(chan, m, buf, count);
+}
+
+/*
+ * kzimp write operation of an arena channel: the message is copied in a buffer
+ * of the arena of the channel.
+ * Returns:
+ *  . -ENOMEM if the buffer cannot be allocated
+ *  . the return value of kzimp_write() otherwise
+ */
+static ssize_t kzimp_arena_write(struct file *filp, const char __user *buf,
+    size_t count, loff_t *f_pos)
+{
+  struct kzimp_message *m;
+  ssize_t ret;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = kzimp_writer_lane(filp);
+  chan = ctrl->channel;
+
+  ret = kzimp_wait_for_writing_if_needed(filp, count, &m);
+  if (unlikely(ret != 1))
+  {
+    return ret;
+  }
+
+  if (unlikely(kzimp_arena_prepare(chan, m, count)))
+  {
+    kzimp_finalize_write(chan, m, 0);
+    return -ENOMEM;
+  }
+
+  return kzimp_copy_and_publish(chan, m, buf, count);
+}
+
+// Return the poll mask of the reader ctrl on its lane (or channel), after having
+// skipped the holes at its position.
+static unsigned int kzimp_poll_lane(struct kzimp_ctrl *ctrl)
+{
+  unsigned int mask = 0;
+  struct kzimp_message *m;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+
+  chan = ctrl->channel;
+
+  // the next read returns a message of the backlog, or -EPIPE
+  if (unlikely(kzimp_reader_moved(chan, ctrl) || ctrl->backlog_seq
+      != ctrl->next_read_seq))
+  {
+    return POLLIN | POLLRDNORM;
+  }
+
+  m = kzimp_msg(chan, ctrl->next_read_idx);
+  while (kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq))
+  {
+    smp_rmb();
+    if (likely(!kzimp_is_hole(m)))
+    {
+      mask |= POLLIN | POLLRDNORM;
+      break;
+    }
+
+    // skip the hole, otherwise a read after the poll could block
+    if (finalize_read(m, ctrl, chan, 0) < 0)
+    {
+      break;
+    }
+    m = kzimp_msg(chan, ctrl->next_read_idx);
+  }
+  if (!ctrl->online)
+  {
+    mask |= POLLHUP; // kind of end-of-file
+  }
+
+  return mask;
+}
+
+// Called by select(), poll() and epoll() syscalls.
+// pre-condition: must be called by a reader. The call returns POLLERR
+// for a writer.
+// The reader waits in its wait queue of lane 0 for the messages of all the lanes.
+static unsigned int kzimp_poll(struct file *filp, poll_table *wait)
+{
+  unsigned int mask = 0;
+  int l;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = filp->private_data;
+  chan = ctrl->channel;
+
+  if (unlikely(!kzimp_is_reader(ctrl)))
+  {
+    return POLLERR;
+  }
+
+  // The writers wake up the queue at each new message, thus an edge-triggered epoll
+  // (EPOLLET) reports the channel again when a message arrives after epoll_wait() has
+  // returned, even if the previous ones have not been read yet. The reader gets the
+  // number of messages it can read at once with KZIMP_IOCTL_PENDING.
+  poll_wait(filp, kzimp_reader_wq(chan, ctrl), wait);
+  kzimp_reader_may_sleep(chan, ctrl);
+
+  for (l = ctrl->nb_lanes - 1; l >= 0; l--)
+  {
+    mask |= kzimp_poll_lane(ctrl->lanes[l]);
+  }
+
+  return mask;
+}
+
+/*
+ * Write the nb_iov messages described by the array of struct iovec uiov,
+ * waking up the readers only once. They are written in the current lane of the writer.
+ * Returns:
+ *  . the number of written messages. It is less than nb_iov if an error has
+ *    occurred after the first message
+ *  . the errors of kzimp_write() or kzimp_arena_write() if no message has been written
+ */
+static long kzimp_write_batch(struct file *filp, struct iovec __user *uiov,
+    unsigned long nb_iov)
+{
+  struct kzimp_message *m;
+  struct iovec iov;
+  unsigned long nb;
+  ssize_t ret;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = kzimp_writer_lane(filp);
+  chan = ctrl->channel;
+
+  ret = 0;
+  for (nb = 0; nb < nb_iov; nb++)
+  {
+    if (unlikely(copy_from_user(&iov, &uiov[nb], sizeof(iov))))
+    {
+      ret = -EFAULT;
+      break;
+    }
+
+    if (unlikely(iov.iov_len <= 0 || iov.iov_len > chan->max_msg_size))
+    {
+      printk(KERN_ERR "kzimp: count is not valid: %lu (process %i in write on channel %i)\n", (unsigned long)iov.iov_len, current->pid, chan->chan_id);
+      ret = 0;
+      break;
+    }
+
+    if (!kzimp_try_take_ticket(chan, ctrl, &m))
+    {
+      // we may sleep: the readers must not wait for the messages already published
+      if (nb > 0)
+      {
+        kzimp_wake_up_readers(chan);
+      }
+
+      ret = kzimp_wait_for_writing_if_needed(filp, iov.iov_len, &m);
+      if (unlikely(ret != 1))
+      {
+        break;
+      }
+    }
+
+    if (chan->data_path != KZIMP_DATA_PATH_ARENA)
+    {
+      kzimp_set_message_data(chan, m, iov.iov_len);
+    }
+    else if (unlikely(kzimp_arena_prepare(chan, m, iov.iov_len)))
+    {
+      kzimp_finalize_write(chan, m, 0);
+      ret = -ENOMEM;
+      break;
+    }
+
+    if (unlikely(kzimp_copy_from_user(chan, m, iov.iov_base, iov.iov_len)))
+    {
+      printk(KERN_ERR "kzimp: copy_from_user failed for process %i in write\n", current->pid);
+      kzimp_finalize_write(chan, m, 0);
+      ret = -EFAULT;
+      break;
+    }
+
+    kzimp_publish_message(chan, m, iov.iov_len);
+  }
+
+  if (nb > 0)
+  {
+    // wake up sleeping readers
+    kzimp_wake_up_readers(chan);
+    return nb;
+  }
+
+  return ret;
+}
+
+/*
+ * Read up to nb_iov messages of the backlog of the reader in the buffers described by
+ * the array of struct iovec uiov, when kzimp_reader_catch_up() has returned KZIMP_READ_BACKLOG.
+ * The batch stops before a gap: the next read returns -EPIPE.
+ * Returns:
+ *  . the number of read messages
+ *  . -EFAULT if no message has been read
+ */
+static long kzimp_read_backlog_batch(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl, struct iovec __user *uiov, unsigned long nb_iov)
+{
+  struct kzimp_backlog_record rec;
+  struct iovec iov;
+  unsigned long nb, next;
+  ssize_t r;
+
+  nb = 0;
+  do
+  {
+    if (unlikely(copy_from_user(&iov, &uiov[nb], sizeof(iov))))
+    {
+      break;
+    }
+
+    r = kzimp_read_backlog(chan, ctrl, iov.iov_base, iov.iov_len);
+    if (unlikely(r < 0 || put_user(r, &uiov[nb].iov_len)))
+    {
+      break;
+    }
+
+    nb++;
+  } while (nb < nb_iov && kzimp_backlog_next(ctrl, ctrl->backlog, &rec, &next));
+
+  return (nb > 0 ? nb : -EFAULT);
+}
+
+/*
+ * Read up to nb_iov messages of the reader ctrl in the buffers described by the array of
+ * struct iovec uiov. Waits for the first message only, unless nonblock is set, then reads
+ * the messages that are ready.
+ * The array is copied once: if a writer moves the reader during the batch, the batch is read
+ * again with the sizes of the buffers of the caller. The lengths of the messages are written
+ * in iov_len once the batch is final.
+ * Returns the return values of kzimp_read_batch(), or -ENOMEM.
+ */
+static long kzimp_read_batch_lane(struct kzimp_ctrl *ctrl, int nonblock,
+    struct iovec __user *uiov, unsigned long nb_iov)
+{
+  int idx, nb_slots, err;
+  long retval;
+  struct kzimp_message *m;
+  struct iovec fast_iov[KZIMP_FAST_IOVS], *iov;
+  size_t fast_lens[KZIMP_FAST_IOVS], *lens;
+  unsigned long nb, i;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+
+  chan = ctrl->channel;
+
+  // we cannot read more than channel_size messages: the next ones are not finalized yet
+  nb_iov = min(nb_iov, (unsigned long) chan->channel_size);
+
+  iov = fast_iov;
+  lens = fast_lens;
+  if (nb_iov > KZIMP_FAST_IOVS)
+  {
+    iov = my_kmalloc(nb_iov * (sizeof(*iov) + sizeof(*lens)), GFP_KERNEL);
+    if (unlikely(!iov))
+    {
+      return -ENOMEM;
+    }
+    lens = (size_t*) (iov + nb_iov);
+  }
+
+  if (unlikely(copy_from_user(iov, uiov, nb_iov * sizeof(*iov))))
+  {
+    retval = -EFAULT;
+    goto out;
+  }
+
+again:
+  retval = kzimp_wait_for_next_message(ctrl, nonblock, &m);
+  if (unlikely(retval == KZIMP_READ_BACKLOG))
+  {
+    retval = kzimp_read_backlog_batch(chan, ctrl, uiov, nb_iov);
+    goto out;
+  }
+  if (retval)
+  {
+    goto out;
+  }
+
+  idx = ctrl->next_read_idx;
+  nb_slots = 0;
+  nb = 0;
+  while (nb < nb_iov && nb_slots < chan->channel_size)
+  {
+    m = kzimp_msg(chan, idx);
+    if (!kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq + nb_slots))
+    {
+      break;
+    }
+
+    smp_rmb(); // read the message after its bitmap
+    if (likely(!kzimp_is_hole(m)))
+    {
+      // check length
+      lens[nb] = (m->len < iov[nb].iov_len ? m->len : iov[nb].iov_len);
+
+#ifdef USE_CHECKSUM_CODE
+      if (!kzimp_verify_checksum(m, lens[nb], chan))
+      {
+        // the error is returned by the next call if messages have already been read
+        if (nb == 0)
+        {
+          retval = -EIO;
+          nb_slots++;
+        }
+        break;
+      }
+#endif
+
+      if (unlikely(kzimp_copy_to_user(iov[nb].iov_base, m->data, lens[nb])))
+      {
+        printk(KERN_ERR "kzimp: copy_to_user failed for process %i in read\n", current->pid);
+        retval = -EFAULT;
+        break;
+      }
+
+      nb++;
+    }
+
+    nb_slots++;
+    idx = (idx + 1) % chan->channel_size;
+  }
+
+  if (nb_slots > 0)
+  {
+    err = finalize_read_batch(ctrl, chan, nb_slots);
+    if (unlikely(err == -ESTALE))
+    {
+      // a writer has moved the reader: the messages may have been overwritten
+      goto again;
+    }
+    if (unlikely(err))
+    {
+      retval = err;
+      goto out;
+    }
+  }
+
+  // the messages are consumed, even if their length cannot be written
+  for (i = 0; i < nb; i++)
+  {
+    if (unlikely(put_user(lens[i], &uiov[i].iov_len)))
+    {
+      retval = -EFAULT;
+      goto out;
+    }
+  }
+
+  if (nb > 0)
+  {
+    retval = nb;
+  }
+
+out:
+  if (iov != fast_iov)
+  {
+    my_kfree(iov);
+  }
+
+  return retval;
+}
+
+/*
+ * Read up to nb_iov messages in the buffers described by the array of struct iovec uiov.
+ * Waits for the first message only, then reads the messages that are ready.
+ * With several lanes, the messages of the highest lanes come first. The batch stops before
+ * a lane whose next read returns a message of the backlog or -EPIPE, if it has messages.
+ * The length of each read message is stored in the iov_len field of its struct iovec.
+ * Returns:
+ *  . the number of read messages
+ *  . the errors of kzimp_read() if no message has been read
+ */
+static long kzimp_read_batch(struct file *filp, struct iovec __user *uiov,
+    unsigned long nb_iov)
+{
+  struct kzimp_ctrl *ctrl, *lane_ctrl;
+  unsigned long nb;
+  int l, nonblock;
+  long retval;
+
+  ctrl = filp->private_data;
+  nonblock = filp->f_flags & O_NONBLOCK;
+
+  if (unlikely(nb_iov == 0))
+  {
+    return 0;
+  }
+
+  if (likely(ctrl->nb_lanes == 1))
+  {
+    return kzimp_read_batch_lane(ctrl, nonblock, uiov, nb_iov);
+  }
+
+  for (;;)
+  {
+    nb = 0;
+    for (l = ctrl->nb_lanes - 1; l >= 0 && nb < nb_iov; l--)
+    {
+      lane_ctrl = ctrl->lanes[l];
+
+      // the gap would be lost: the reader gets it at its next call
+      if (nb > 0 && (kzimp_reader_moved(lane_ctrl->channel, lane_ctrl)
+          || lane_ctrl->backlog_seq != lane_ctrl->next_read_seq))
+      {
+        break;
+      }
+
+      retval = kzimp_read_batch_lane(lane_ctrl, 1, uiov + nb, nb_iov - nb);
+      if (retval == -EAGAIN)
+      {
+        continue;
+      }
+      if (retval < 0)
+      {
+        return (nb > 0 ? nb : kzimp_lane_result(ctrl, l, retval));
+      }
+
+      nb += retval;
+    }
+
+    if (nb > 0)
+    {
+      return nb;
+    }
+
+    retval = kzimp_wait_for_lanes(ctrl, nonblock);
+    if (retval)
+    {
+      return retval;
+    }
+  }
+}
+
+/*
+ * Count the messages the reader ctrl can read without blocking, the holes excluded.
+ * The messages are not read: the count is only a hint for the reader, e.g. for the
+ * size of its next batch.
+ * Returns:
+ *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
+ *  . the number of messages otherwise
+ */
+static long kzimp_pending_messages(struct kzimp_comm_chan *chan,
+    struct kzimp_ctrl *ctrl)
+{
+  struct kzimp_message *m;
+  unsigned long seq;
+  long nb;
+  int idx;
+
+  if (unlikely(!ctrl->online))
+  {
+    return -EBADF;
+  }
+
+  // a writer has moved the reader: the next read does not block, it returns a message
+  // of the backlog or -EPIPE
+  if (unlikely(kzimp_reader_moved(chan, ctrl) || ctrl->backlog_seq
+      != ctrl->next_read_seq))
+  {
+    return 1;
+  }
+
+  nb = 0;
+  idx = ctrl->next_read_idx;
+  for (seq = ctrl->next_read_seq; seq - ctrl->next_read_seq
+      < chan->channel_size; seq++)
+  {
+    m = kzimp_msg(chan, idx);
+    if (!kzimp_reader_can_read(chan, ctrl, m, seq))
+    {
+      break;
+    }
+
+    smp_rmb(); // read the length after the bitmap
+    if (!kzimp_is_hole(m))
+    {
+      nb++;
+    }
+
+    idx = (idx + 1) % chan->channel_size;
+  }
+
+  return nb;
+}
+
+/*
+ * kzimp IOCTL
+ * cmd can be:
+ *  . KZIMP_IOCTL_WRITE_BATCH to write several messages at once
+ *  . KZIMP_IOCTL_READ_BATCH to read several messages at once
+ *  . KZIMP_IOCTL_SET_WAIT_POLICY to set the wait policy of the channel (writers only)
+ *  . KZIMP_IOCTL_SET_OVERFLOW_POLICY to set the overflow policy of the channel (writers only)
+ *  . KZIMP_IOCTL_PENDING to get the number of messages the reader can read without blocking
+ *  . KZIMP_IOCTL_GAP to get the number of messages lost by the reader at its last gap
+ *  . KZIMP_IOCTL_SET_LANE to choose the lane of the next messages of the writer
+ * Return:
+ *  . -EACCES if the process has not the rights to perform the requested action
+ *  . -EFAULT if arg is not valid
+ *  . -EINVAL bad ioctl command, wait policy, overflow policy or lane
+ *  . the return value of kzimp_write_batch(), kzimp_read_batch() or
+ *    kzimp_pending_messages() otherwise
+ */
+static long kzimp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+  long retval, nb;
+  unsigned long kzimp_ioctl_args[2];
+  struct kzimp_ctrl *ctrl;
+  int l;
+
+  ctrl = filp->private_data;
+
+  // arg is not used
+  if (cmd == KZIMP_IOCTL_PENDING)
+  {
+    if (!kzimp_is_reader(ctrl))
+    {
+      return -EACCES;
+    }
+
+    retval = 0;
+    for (l = 0; l < ctrl->nb_lanes; l++)
+    {
+      nb = kzimp_pending_messages(ctrl->lanes[l]->channel, ctrl->lanes[l]);
+      if (unlikely(nb < 0))
+      {
+        return nb;
+      }
+      retval += nb;
+    }
+
+    return retval;
+  }
+
+  // arg is the lane
+  if (cmd == KZIMP_IOCTL_SET_LANE)
+  {
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+      return -EACCES;
+    }
+
+    if (arg >= ctrl->nb_lanes)
+    {
+      printk(KERN_WARNING "kzimp: lane not valid: %lu (channel %i has %i lanes)\n", arg, ctrl->channel->chan_id, ctrl->nb_lanes);
+      return -EINVAL;
+    }
+
+    ctrl->lane = arg;
+    return 0;
+  }
+
+  // arg is not used
+  if (cmd == KZIMP_IOCTL_GAP)
+  {
+    if (!kzimp_is_reader(ctrl))
+    {
+      return -EACCES;
+    }
+
+    return ctrl->last_gap;
+  }
+
+  // arg is a unsigned long[2]. It contains:
+  //  -for the batches: the user-space address of the array of struct iovec
+  //   and the number of elements in this array
+  //  -for the wait policy: the wait policy and the max spin time in ns
+  //  -for the overflow policy: the overflow policy and the backlog size in bytes
+  if (unlikely(copy_from_user(kzimp_ioctl_args, (void __user *) arg, sizeof(kzimp_ioctl_args))))
+  {
+    return -EFAULT;
+  }
+
+  switch (cmd)
+  {
+  case KZIMP_IOCTL_WRITE_BATCH:
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+      retval = -EACCES;
+      break;
+    }
+
+    retval = kzimp_write_batch(filp, (struct iovec __user *) kzimp_ioctl_args[0], kzimp_ioctl_args[1]);
+    break;
+
+  case KZIMP_IOCTL_READ_BATCH:
+    if (!kzimp_is_reader(filp->private_data))
+    {
+      retval = -EACCES;
+      break;
+    }
+
+    retval = kzimp_read_batch(filp, (struct iovec __user *) kzimp_ioctl_args[0], kzimp_ioctl_args[1]);
+    break;
+
+  // the policies are those of the whole channel: only its writers can change them, as the
+  // control device. The policy is checked before it is narrowed to an int
+  case KZIMP_IOCTL_SET_WAIT_POLICY:
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+      retval = -EACCES;
+      break;
+    }
+
+    if (kzimp_ioctl_args[0] > KZIMP_WAIT_SPIN)
+    {
+      printk(KERN_WARNING "kzimp: wait policy not valid: %lu\n", kzimp_ioctl_args[0]);
+      retval = -EINVAL;
+      break;
+    }
+
+    retval = kzimp_set_wait_policy(ctrl->channel, kzimp_ioctl_args[0], kzimp_ioctl_args[1]);
+    break;
+
+  case KZIMP_IOCTL_SET_OVERFLOW_POLICY:
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+      retval = -EACCES;
+      break;
+    }
+
+    if (kzimp_ioctl_args[0] > KZIMP_OVERFLOW_SKIP)
+    {
+      printk(KERN_WARNING "kzimp: overflow policy not valid: %lu\n", kzimp_ioctl_args[0]);
+      retval = -EINVAL;
+      break;
+    }
+
+    retval = kzimp_set_overflow_policy(ctrl->channel, kzimp_ioctl_args[0], kzimp_ioctl_args[1]);
+    break;
+
+  default:
+    retval = -EINVAL;
+    break;
+  }
+
+  return retval;
+}
+
+/*
+ * kzimp read operation of a writer splice channel: its writers have FMODE_READ.
+ * Returns:
+ *  . -EBADF if the process is not a reader
+ *  . the return value of kzimp_read() otherwise
+ */
+static ssize_t kzimp_writer_splice_read(struct file *filp, char __user *buf,
+    size_t count, loff_t *f_pos)
+{
+  if (unlikely(!kzimp_is_reader(filp->private_data)))
+  {
+    return -EBADF;
+  }
+
+  return kzimp_read(filp, buf, count, f_pos);
+}
+
+// Give the pool slot of the previous message of m back to its writer, if it has one.
+// It is called by the writer that has the turn on m, once all the readers have read
+// the previous message or have been removed after a timeout.
+static inline void kzimp_release_pool_slot(struct kzimp_message *m)
+{
+  int *slot;
+
+  slot = m->pool_slot;
+  if (slot)
+  {
+    m->pool_slot = NULL;
+    smp_mb(); // the readers have finished to read the slot
+    ACCESS_ONCE(*slot) = KZIMP_POOL_SLOT_FREE;
+  }
+}
+
+// Drop the reference of the previous message of m on its big messages area, if it has one.
+// It is called by the writer that has the turn on m, as kzimp_release_pool_slot().
+static inline void kzimp_release_msg_big_area(struct kzimp_comm_chan *chan,
+    struct kzimp_message *m)
+{
+  struct big_mem_area_elt **bma;
+
+  // the channel may have been modified through /proc while the writer was there
+  if (unlikely(!chan->msg_big_areas))
+  {
+    return;
+  }
+
+  bma = &chan->msg_big_areas[kzimp_msg_idx(chan, m)];
+  if (*bma)
+  {
+    kzimp_put_big_msg_area(*bma);
+    *bma = NULL;
+  }
+}
+
+/*
+ * kzimp write operation of a writer splice channel: the message is copied in the messages
+ * area of the channel, as in kzimp_write(). The previous message at its position may
+ * have been sent from a big messages area.
+ * Returns:
+ *  . the return value of kzimp_write()
+ */
+static ssize_t kzimp_writer_splice_write(struct file *filp,
+    const char __user *buf, size_t count, loff_t *f_pos)
+{
+  struct kzimp_message *m;
+  ssize_t ret;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = filp->private_data;
+  chan = ctrl->channel;
+
+  ret = kzimp_wait_for_writing_if_needed(filp, count, &m);
+  if (unlikely(ret != 1))
+  {
+    return ret;
+  }
+
+  kzimp_release_pool_slot(m);
+  kzimp_release_msg_big_area(chan, m);
+  m->data = m->area_data;
+
+  return kzimp_copy_and_publish(chan, m, buf, count);
+}
+
+/*
+ * Send the count bytes of the slot index of the big messages area of the writer:
+ * the readers copy the message directly from this slot.
+ * Without pool, the writer uses its channel_size+1 slots in a round robin fashion: a slot
+ * can be reused once channel_size other messages have been sent.
+ * With pool, the slot is lent to kzimp: its state is KZIMP_POOL_SLOT_BUSY until the
+ * position of the message in the channel is reused, i.e. once all the readers have read it.
+ * The writer must not modify a busy slot. Nothing is remapped, hence mmap_sem is not taken.
+ * Returns:
+ *  . 0 if count is less or equal than 0 or greater than the maximal message size
+ *  . -EINVAL if index is not valid
+ *  . -EBUSY if the slot is still lent to kzimp (pool only)
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . count otherwise
+ */
+static long kzimp_splice_write(struct file *filp, unsigned long index,
+    size_t count, int pool)
+{
+  long retval;
+  struct kzimp_message *m;
+
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+
+  ctrl = filp->private_data;
+  chan = ctrl->channel;
+
+  if (unlikely(index >= ctrl->big_msg_nb_slots))
+  {
+    printk(KERN_ERR "kzimp: index is not valid: %lu >= %i (process %i in splice write on channel %i)\n", index, ctrl->big_msg_nb_slots, current->pid, chan->chan_id);
+    return -EINVAL;
+  }
+
+  if (unlikely(count > ctrl->big_msg_slot_size))
+  {
+    printk(KERN_ERR "kzimp: count is not valid: %lu (process %i in splice write on channel %i)\n", (unsigned long)count, current->pid, chan->chan_id);
+    return 0;
+  }
+
+  if (pool && ACCESS_ONCE(ctrl->pool_state[index]) != KZIMP_POOL_SLOT_FREE)
+  {
+    return -EBUSY;
+  }
+
+  retval = kzimp_wait_for_writing_if_needed(filp, count, &m);
+  if (unlikely(retval != 1))
+  {
+    return retval;
+  }
+
+  kzimp_release_pool_slot(m);
+  kzimp_release_msg_big_area(chan, m);
+  m->data = ctrl->big_msg_area + index * ctrl->big_msg_slot_size;
+  // the area is not reclaimed until the position of the message is reused
+  if (likely(chan->msg_big_areas))
+  {
+    atomic_inc(&ctrl->bma->refcount);
+    chan->msg_big_areas[kzimp_msg_idx(chan, m)] = ctrl->bma;
+  }
+  if (pool)
+  {
+    ACCESS_ONCE(ctrl->pool_state[index]) = KZIMP_POOL_SLOT_BUSY;
+    m->pool_slot = &ctrl->pool_state[index];
+  }
+
+#ifdef USE_CHECKSUM_CODE
+  // kzimp_publish_message() expects the sum of the data in m->checksum
+  if (chan->compute_checksum == 1)
+  {
+    m->checksum = oneC_sum(0, m->data, count);
+  }
+#endif
+
+  kzimp_finalize_write(chan, m, count);
+
+  return count;
+}
+
+/*
+ * kzimp IOCTL of a writer splice channel
+ * cmd can be:
+ *  . KZIMP_IOCTL_SPLICE_WRITE or KZIMP_IOCTL_POOL_WRITE to send a message of the big messages area
+ *  . the commands of kzimp_ioctl(), except KZIMP_IOCTL_WRITE_BATCH: use write() to copy the messages
+ * Return:
+ *  . -EACCES if the process has not the rights to perform the requested action
+ *  . -EFAULT if arg is not valid
+ *  . -EINVAL bad ioctl command
+ *  . the return value of kzimp_splice_write() or kzimp_ioctl() otherwise
+ */
+static long kzimp_writer_splice_ioctl(struct file *filp, unsigned int cmd,
+    unsigned long arg)
+{
+  long retval;
+  unsigned long kzimp_addr_struct[3];
+
+  switch (cmd)
+  {
+  case KZIMP_IOCTL_SPLICE_WRITE:
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+      retval = -EACCES;
+      break;
+    }
+
+    // arg is a unsigned long[3]. It contains:
+    //  -arg[0]: user-space address of the message (not used)
+    //  -arg[1]: index of this message in the big messages area
+    //  -arg[2]: length
+    if (unlikely(copy_from_user(kzimp_addr_struct, (void __user *) arg, sizeof(unsigned long) * 3)))
+    {
+      retval = -EFAULT;
+      break;
+    }
+
+    retval = kzimp_splice_write(filp, kzimp_addr_struct[1], kzimp_addr_struct[2], 0);
+    break;
+
+  case KZIMP_IOCTL_POOL_WRITE:
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+      retval = -EACCES;
+      break;
+    }
+
+    // arg is a unsigned long[2]. It contains:
+    //  -arg[0]: index of the pool slot in the big messages area
+    //  -arg[1]: length
+    if (unlikely(copy_from_user(kzimp_addr_struct, (void __user *) arg, sizeof(unsigned long) * 2)))
+    {
+      retval = -EFAULT;
+      break;
+    }
+
+    retval = kzimp_splice_write(filp, kzimp_addr_struct[0], kzimp_addr_struct[1], 1);
+    break;
+
+  case KZIMP_IOCTL_WRITE_BATCH:
+    retval = -EINVAL;
+    break;
+
+  default:
+    retval = kzimp_ioctl(filp, cmd, arg);
+    break;
+  }
+
+  return retval;
+}
+
+/*
+ * Map the state of the pool slots of the writer ctrl, read-only: only kzimp modifies it.
+ * Returns:
+ *  . -EACCES if the process asks for a writable mapping
+ *  . -EINVAL if the length is not valid
+ *  . 0 otherwise.
+ */
+static int kzimp_mmap_pool_state(struct kzimp_ctrl *ctrl,
+    struct vm_area_struct *vma)
+{
+  if (unlikely(vma->vm_flags & VM_WRITE))
+  {
+    printk(KERN_ERR "kzimp: process %i in mmap does not have the rights for the requested credentials\n", current->pid);
+    return -EACCES;
+  }
+
+  if (vma->vm_end - vma->vm_start > PAGE_ALIGN(sizeof(*ctrl->pool_state)
+      * ctrl->big_msg_nb_slots))
+  {
+    printk(KERN_DEBUG "Request size too big: %lu\n", vma->vm_end - vma->vm_start);
+    return -EINVAL;
+  }
+
+  // no mprotect() can make it writable later
+  vma->vm_flags &= ~VM_MAYWRITE;
+
+  return remap_vmalloc_range(vma, ctrl->pool_state, 0);
+}
+
+/*
+ * kzimp mmap operation of a writer splice channel.
+ * The offset (in pages) is the index of the slot of the big messages area of the writer
+ * to map, or the number of slots to map the state of the pool.
+ * Returns:
+ *  . -EACCES if the process is not a writer or has not the credentials for the requested permission.
+ *  . -EINVAL if the offset or the length are not valid
+ *  . -EAGAIN or -ENOMEM if the mapping of an area made of huge pages has failed
+ *  . 0 otherwise.
+ */
+static int kzimp_writer_splice_mmap(struct file *filp,
+    struct vm_area_struct *vma)
+{
+  struct kzimp_ctrl *ctrl;
+  int err;
+
+  ctrl = filp->private_data;
+
+  if (unlikely(!ctrl->big_msg_area))
+  {
+    printk(KERN_ERR "kzimp: process %i in mmap is not a writer\n", current->pid);
+    return -EACCES;
+  }
+
+  if (vma->vm_pgoff == ctrl->big_msg_nb_slots)
+  {
+    return kzimp_mmap_pool_state(ctrl, vma);
+  }
+
+  if (vma->vm_end - vma->vm_start > ctrl->big_msg_slot_size)
+  {
+    printk(KERN_DEBUG "Request size too big: %lu > %i\n", vma->vm_end - vma->vm_start, ctrl->big_msg_slot_size);
+    return -EINVAL;
+  }
+
+  if (vma->vm_pgoff > ctrl->big_msg_nb_slots)
+  {
+    printk(KERN_ERR "Invalid offset: %lu > %i\n", vma->vm_pgoff, ctrl->big_msg_nb_slots);
+    return -EINVAL;
+  }
+
+  if (unlikely(!(vma->vm_flags & VM_WRITE) || !(vma->vm_flags & VM_READ)))
+  {
+    printk(KERN_ERR "kzimp: process %i in mmap does not have the rights for the requested credentials\n", current->pid);
+    return -EACCES;
+  }
+
+  // a big messages area made of huge pages is mapped now, with a few calls to remap_pfn_range.
+  // Otherwise don't do anything here: fault handles the page faults and the mapping
+  if (ctrl->big_msg_area_huge)
+  {
+    err = huge_area_mmap(vma, ctrl->big_msg_area, vma->vm_pgoff
+        * ctrl->big_msg_slot_size, vma->vm_end - vma->vm_start);
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  vma->vm_ops = &kzimp_writer_splice_vm_ops;
+  vma->vm_flags |= VM_RESERVED; // do not attempt to swap out the vma
+  vma->vm_flags |= VM_CAN_NONLINEAR; // Has ->fault & does nonlinear pages
+  vma->vm_private_data = ctrl; // pointer to the control structure
+
+  return 0;
+}
+
+static int kzimp_writer_splice_vma_fault(struct vm_area_struct *vma,
+    struct vm_fault *vmf)
+{
+  struct kzimp_ctrl *ctrl;
+  struct page *peyj;
+  unsigned long msg_offset, offset;
+
+  ctrl = vma->vm_private_data;
+
+  // vma->vm_pgoff is the index of the slot
+  // vmf->pgoff - vma->vm_pgoff is the offset inside this slot
+  msg_offset = vma->vm_pgoff * ctrl->big_msg_slot_size;
+  offset = (vmf->pgoff - vma->vm_pgoff) * PAGE_SIZE;
+
+  peyj = vmalloc_to_page(
+      (const void*) &(ctrl->big_msg_area[msg_offset + offset]));
+
+  get_page(peyj);
+  vmf->page = peyj;
+
+  return 0;
+}
+
+/*
+ * kzimp mmap operation of a reader splice channel: the reader maps the messages area
+ * of the channel, read-only. The i-th message is at the offset i*max_msg_size.
+ * Returns:
+ *  . -EACCES if the process is not a reader or has not the credentials for the requested permission.
+ *  . -EINVAL if the offset or the length are not valid
+ *  . -EAGAIN or -ENOMEM if the mapping of an area made of huge pages has failed
+ *  . 0 otherwise.
+ */
+static int kzimp_reader_splice_mmap(struct file *filp,
+    struct vm_area_struct *vma)
+{
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+  int err;
+
+  ctrl = filp->private_data;
+  chan = ctrl->channel;
+
+  if (unlikely(!kzimp_is_reader(ctrl) || !(vma->vm_flags & VM_READ)
+      || (vma->vm_flags & VM_WRITE)))
+  {
+    printk(KERN_ERR "kzimp: process %i in mmap does not have the rights for the requested credentials\n", current->pid);
+    return -EACCES;
+  }
+
+  // Check the requested size: if greater than the messages area size then return -EINVAL.
+  if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start
+      > ROUND_UP_PAGE_SIZE(chan->messages_area_size))
+  {
+    printk(KERN_DEBUG "Invalid request: offset %lu, size %lu > %lu\n", vma->vm_pgoff, vma->vm_end - vma->vm_start, chan->messages_area_size);
+    return -EINVAL;
+  }
+
+  // no mprotect() can make it writable later
+  vma->vm_flags &= ~VM_MAYWRITE;
+
+  // a messages area made of huge pages is mapped now, with a few calls to remap_pfn_range.
+  // Otherwise don't do anything here: fault handles the page faults and the mapping
+  if (chan->huge_pages)
+  {
+    err = huge_area_mmap(vma, chan->messages_area, 0, vma->vm_end
+        - vma->vm_start);
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  vma->vm_ops = &kzimp_reader_splice_vm_ops;
+  vma->vm_flags |= VM_RESERVED; // do not attempt to swap out the vma
+  vma->vm_flags |= VM_CAN_NONLINEAR; // Has ->fault & does nonlinear pages
+  vma->vm_private_data = ctrl; // pointer to the control structure
+
+  return 0;
+}
+
+static int kzimp_reader_splice_vma_fault(struct vm_area_struct *vma,
+    struct vm_fault *vmf)
+{
+  struct kzimp_ctrl *ctrl;
+  struct page *peyj;
+  unsigned long offset;
+
+  ctrl = vma->vm_private_data;
+
+  offset = (vmf->pgoff - vma->vm_pgoff) * PAGE_SIZE;
+
+  peyj = vmalloc_to_page(
+      (const void*) &(ctrl->channel->messages_area[offset]));
+
+  get_page(peyj);
+  vmf->page = peyj;
+
+  return 0;
+}
+
+/*
+ * kzimp IOCTL of a reader splice channel
+ * cmd can be:
+ *  . KZIMP_IOCTL_SPLICE_START_READ if the reader wants to get a message
+ *  . KZIMP_IOCTL_SPLICE_FINISH_READ once the message has been read
+ *  . the commands of kzimp_ioctl()
+ * Return:
+ *  . -EACCES if the process is not a reader
+ *  . -EINVAL if there is no message to finish
+ *  . -EAGAIN if the operations are non-blocking and the call would block.
+ *  . -EBADF if this reader is no longer online (because the writer has experienced a timeout)
+ *  . -EPIPE if messages have been skipped since the last read (see KZIMP_IOCTL_GAP)
+ *  . -ESTALE if the reader has been moved by a writer before KZIMP_IOCTL_SPLICE_FINISH_READ:
+ *    the message may have been overwritten and has to be read again
+ *  . -EIO if the checksum is incorrect
+ *  . -EINTR if the process has been interrupted by a signal while waiting
+ *  . the index of the message in the mmapped messages area, for KZIMP_IOCTL_SPLICE_START_READ
+ *  . the length of the message, for KZIMP_IOCTL_SPLICE_FINISH_READ
+ *  . the return value of kzimp_ioctl() for the other commands
+ */
+static long kzimp_reader_splice_ioctl(struct file *filp, unsigned int cmd,
+    unsigned long arg)
+{
+  struct kzimp_comm_chan *chan; /* channel information */
+  struct kzimp_ctrl *ctrl;
+  struct kzimp_message *m;
+  long retval;
+
+  ctrl = filp->private_data;
+  chan = ctrl->channel;
+
+  if ((cmd == KZIMP_IOCTL_SPLICE_START_READ || cmd
+      == KZIMP_IOCTL_SPLICE_FINISH_READ) && !kzimp_is_reader(ctrl))
+  {
+    return -EACCES;
+  }
+
+  switch (cmd)
+  {
+  case KZIMP_IOCTL_SPLICE_START_READ:
+    retval = kzimp_wait_for_next_message(ctrl, filp->f_flags & O_NONBLOCK, &m);
+    if (retval)
+    {
+      break;
+    }
+
+#ifdef USE_CHECKSUM_CODE
+    if (!kzimp_verify_checksum(m, m->len, chan))
+    {
+      retval = -EIO;
+      break;
+    }
+#endif
+
+    retval = ctrl->next_read_idx;
+    break;
+
+  case KZIMP_IOCTL_SPLICE_FINISH_READ:
+    m = kzimp_msg(chan, ctrl->next_read_idx);
+    if (!kzimp_reader_can_read(chan, ctrl, m, ctrl->next_read_seq))
+    {
+      retval = -EINVAL;
+      break;
+    }
+
+    retval = finalize_read(m, ctrl, chan, m->len);
+    break;
+
+  default:
+    retval = kzimp_ioctl(filp, cmd, arg);
+    break;
+  }
+
+  return retval;
+}
+
+static int kzimp_init_channel(struct kzimp_comm_chan *channel, int chan_id,
+    int max_msg_size, int channel_size, long to, int compute_checksum,
+    int mode, int node_policy, int max_readers, int data_path, int nb_lanes,
+    int init_lock);
+
+/*
+ * Initialize the lane l of channel, which has just been initialized, with the same parameters.
+ * The structure of the lane is allocated if it does not exist yet. Otherwise writers may still
+ * be on the lane: as for lane 0, its lock is initialized only if init_lock is set.
+ * Returns:
+ *  . -ENOMEM if the memory allocations fail
+ *  . 0 otherwise
+ */
+static int kzimp_init_lane(struct kzimp_comm_chan *channel, int l,
+    int init_lock)
+{
+  struct kzimp_comm_chan *lane;
+
+  lane = channel->lanes[l];
+  if (!lane)
+  {
+    lane = my_kmalloc_node(sizeof(*lane), GFP_KERNEL | __GFP_ZERO, channel->node);
+    if (unlikely(!lane))
+    {
+      printk(KERN_ERR "kzimp: lane %i of channel %i allocation error\n", l, channel->chan_id);
+      return -ENOMEM;
+    }
+
+    INIT_LIST_HEAD(&lane->writers_big_msg);
+    INIT_LIST_HEAD(&lane->arena_chunks);
+    lane->lanes[0] = lane;
+    lane->lane0 = channel;
+    channel->lanes[l] = lane;
+    init_lock = 1;
+  }
+
+  return kzimp_init_channel(lane, channel->chan_id, channel->max_msg_size,
+      channel->channel_size, channel->timeout_in_ms, channel->compute_checksum,
+      channel->mode, channel->node_policy, channel->max_readers,
+      channel->data_path, 1, init_lock);
+}
+
+static int kzimp_init_channel(struct kzimp_comm_chan *channel, int chan_id,
+    int max_msg_size, int channel_size, long to, int compute_checksum,
+    int mode, int node_policy, int max_readers, int data_path, int nb_lanes,
+    int init_lock)
+{
+  struct kzimp_message *m;
+  int i, err;
+  unsigned long size;
+
+  if (max_readers <= 0 || max_readers > KZIMP_MAX_READERS)
+  {
+    printk(KERN_ERR "kzimp: max number of readers of channel %i not valid: %i\n", chan_id, max_readers);
+    return -EINVAL;
+  }
+
+  if (data_path < KZIMP_DATA_PATH_COPY || data_path > KZIMP_DATA_PATH_ARENA)
+  {
+    printk(KERN_ERR "kzimp: data path of channel %i not valid: %i\n", chan_id, data_path);
+    return -EINVAL;
+  }
+
+  if (nb_lanes <= 0 || nb_lanes > KZIMP_MAX_LANES)
+  {
+    printk(KERN_ERR "kzimp: number of lanes of channel %i not valid: %i\n", chan_id, nb_lanes);
+    return -EINVAL;
+  }
+
+  // the splice data paths give the position of the messages to the processes
+  if (nb_lanes > 1 && data_path != KZIMP_DATA_PATH_COPY && data_path
+      != KZIMP_DATA_PATH_ARENA)
+  {
+    printk(KERN_WARNING "kzimp: the data path %i of channel %i has no lanes\n", data_path, chan_id);
+    nb_lanes = 1;
+  }
+
+  // the lanes are initialized at the end, with the parameters of the channel
+  channel->nb_lanes = 1;
+  channel->chan_id = chan_id;
+  channel->max_msg_size = max_msg_size;
+  channel->max_msg_size_page_rounded = ROUND_UP_PAGE_SIZE(max_msg_size);
+  channel->data_path = data_path;
+  channel->channel_size = channel_size;
+  channel->compute_checksum = compute_checksum;
+  channel->mode = mode;
+  channel->timeout_in_ms = to;
+  memset(channel->multicast_mask, 0, sizeof(channel->multicast_mask));
+  channel->max_readers = max_readers;
+  channel->nb_bitmap_words = BITS_TO_LONGS(max_readers);
+  channel->readers_gen = 0;
+  channel->nb_readers = 0;
+  if (init_lock)
+  {
+    // the writers are still there when the channel is modified
+    channel->nb_writers = 0;
+  }
+  atomic_long_set(&channel->next_write_idx, 0);
+  atomic_long_set(&channel->nb_spins, 0);
+  atomic_long_set(&channel->nb_sleeps, 0);
+  atomic_long_set(&channel->nb_wakeups, 0);
+  init_waitqueue_head(&channel->wq);
+  memset(channel->waiting_readers, 0, sizeof(channel->waiting_readers));
+  INIT_LIST_HEAD(&channel->readers);
+
+  if (kzimp_set_wait_policy(channel, default_wait_policy, default_max_spin_ns))
+  {
+    kzimp_set_wait_policy(channel, KZIMP_WAIT_BLOCK, default_max_spin_ns);
+  }
+
+  if (kzimp_set_overflow_policy(channel, default_overflow_policy, default_backlog_size))
+  {
+    kzimp_set_overflow_policy(channel, KZIMP_OVERFLOW_EVICT, default_backlog_size);
+  }
+
+  if (node_policy >= 0 && !node_online(node_policy))
+  {
+    printk(KERN_WARNING "kzimp: node %i of channel %i is not online, using any node\n", node_policy, chan_id);
+    node_policy = KZIMP_NODE_ANY;
+  }
+  channel->node_policy = node_policy;
+  channel->node = (node_policy >= 0 ? node_policy : -1);
+
+  channel->inline_size = 0;
+  if (use_inline_messages && (data_path == KZIMP_DATA_PATH_COPY || data_path
+      == KZIMP_DATA_PATH_ARENA))
+  {
+    channel->inline_size = KZIMP_INLINE_SIZE;
+  }
+  channel->msg_stride = sizeof(*channel->msgs) + channel->inline_size;
+
+  if (data_path != KZIMP_DATA_PATH_ARENA && channel->max_msg_size
+      <= channel->inline_size)
+  {
+    // every message is inline
+    channel->messages_area = NULL;
+    channel->messages_area_size = 0;
+    channel->huge_pages = 0;
+  }
+  else if (data_path == KZIMP_DATA_PATH_ARENA)
+  {
+    // the content of the messages is allocated when they are written
+    channel->messages_area = NULL;
+    channel->messages_area_size = 0;
+    channel->huge_pages = 0;
+
+    size = sizeof(*channel->arena) * KZIMP_ARENA_NB_CLASSES;
+    channel->arena = my_kmalloc_node(size, GFP_KERNEL, channel->node);
+    if (unlikely(!channel->arena))
+    {
+      printk(KERN_ERR "kzimp: channel arena allocation of %lu bytes error\n", size);
+      return -ENOMEM;
+    }
+
+    for (i = 0; i < KZIMP_ARENA_NB_CLASSES; i++)
+    {
+      spin_lock_init(&channel->arena[i].lock);
+      channel->arena[i].free = NULL;
+    }
+    channel->arena_size = 0;
+  }
+  else
+  {
+    channel->messages_area = kzimp_alloc_messages_area(channel, channel->node,
+        &channel->messages_area_size, &channel->huge_pages);
+    if (unlikely(!channel->messages_area))
+    {
+      return -ENOMEM;
+    }
+  }
+
+  size = (unsigned long) channel->msg_stride * channel->channel_size;
+  channel->msgs = my_kmalloc_node(size, GFP_KERNEL, channel->node);
+  if (unlikely(!channel->msgs))
+  {
+    printk(KERN_ERR "kzimp: channel messages allocation of %lu bytes error\n", size);
+    return -ENOMEM;
+  }
+
+  size = sizeof(*channel->cursors) * channel->max_readers;
+  channel->cursors = my_kmalloc_node(size, GFP_KERNEL, channel->node);
+  if (unlikely(!channel->cursors))
+  {
+    printk(KERN_ERR "kzimp: channel cursors allocation of %lu bytes error\n", size);
+    return -ENOMEM;
+  }
+
+  channel->stats = alloc_percpu(struct kzimp_stats);
+  if (unlikely(!channel->stats))
+  {
+    printk(KERN_ERR "kzimp: channel statistics allocation error\n");
+    return -ENOMEM;
+  }
+
+  // the readers of a lane wait in lane 0
+  if (channel->lane0 != channel)
+  {
+    channel->readers_wq = channel->lane0->readers_wq;
+  }
+  else
+  {
+    size = sizeof(*channel->readers_wq) * channel->max_readers;
+    channel->readers_wq = my_kmalloc_node(size, GFP_KERNEL, channel->node);
+    if (unlikely(!channel->readers_wq))
+    {
+      printk(KERN_ERR "kzimp: channel readers wait queues allocation of %lu bytes error\n", size);
+      return -ENOMEM;
+    }
+    for (i = 0; i < channel->max_readers; i++)
+    {
+      init_waitqueue_head(&channel->readers_wq[i].q);
+    }
+  }
+
+  // the writers reclaim their big messages areas once no message points to them
+  channel->msg_big_areas = NULL;
+  if (data_path == KZIMP_DATA_PATH_WRITER_SPLICE)
+  {
+    size = sizeof(*channel->msg_big_areas) * channel->channel_size;
+    channel->msg_big_areas = my_kmalloc_node(size, GFP_KERNEL | __GFP_ZERO,
+        channel->node);
+    if (unlikely(!channel->msg_big_areas))
+    {
+      printk(KERN_ERR "kzimp: channel big messages areas allocation of %lu bytes error\n", size);
+      return -ENOMEM;
+    }
+  }
+
+  // up to BITS_PER_LONG readers, the bitmap of a message is only m->bitmap
+  channel->bitmaps = NULL;
+  if (channel->nb_bitmap_words > 1)
+  {
+    size = sizeof(*channel->bitmaps) * channel->channel_size;
+    channel->bitmaps = my_kmalloc_node(size, GFP_KERNEL | __GFP_ZERO, channel->node);
+    if (unlikely(!channel->bitmaps))
+    {
+      printk(KERN_ERR "kzimp: channel bitmaps allocation of %lu bytes error\n", size);
+      return -ENOMEM;
+    }
+  }
+
+  for (i = 0; i < channel->channel_size; i++)
+  {
+    m = kzimp_msg(channel, i);
+    if (channel->messages_area)
+    {
+      m->data = m->area_data = kzimp_message_data(channel, i);
+    }
+    else
+    {
+      m->data = m->area_data = (channel->inline_size ? kzimp_inline_data(m) : NULL);
+    }
+    m->pool_slot = NULL;
+    m->arena_class = -1;
+    m->bitmap = 0;
+    m->len = 0;
+    m->write_seq = i;
+#ifdef ATOMIC_WAKE_UP
+    atomic_set(&m->waking_up_writer, 0);
+#endif
+  }
+
+  if (init_lock)
+  {
+    spin_lock_init(&channel->bcl);
+    mutex_init(&channel->move_mutex);
+  }
+
+  for (i = 1; i < nb_lanes; i++)
+  {
+    err = kzimp_init_lane(channel, i, init_lock);
+    if (unlikely(err))
+    {
+      return err;
+    }
+    channel->nb_lanes = i + 1;
+  }
+
+  return 0;
+}
+
+// Print in sf the memory footprint of chan, in bytes: its messages (with their second
+// level bitmaps and the read cursors), its messages area, its arena and the part of the
+// arena that holds messages, the big messages areas of its writers and the backlogs of its readers.
+// Each column is the sum of the lanes of the channel.
+// The part of the arena in use is approximate: the writers may be modifying it.
+static void kzimp_show_footprint(struct seq_file *sf, struct kzimp_comm_chan *chan)
+{
+  struct kzimp_comm_chan *lane;
+  struct big_mem_area_elt *bma;
+  struct kzimp_ctrl *ctrl;
+  unsigned long messages, area, arena, in_use, big, backlogs;
+  int i, c, l;
+
+  // the wait queues of the readers are shared by the lanes
+  messages = sizeof(*chan->readers_wq) * chan->max_readers;
+  area = arena = in_use = big = backlogs = 0;
+
+  for (l = 0; l < chan->nb_lanes; l++)
+  {
+    lane = chan->lanes[l];
+
+    messages += (unsigned long) lane->msg_stride * lane->channel_size
+        + sizeof(*lane->cursors) * lane->max_readers;
+    if (lane->bitmaps)
+    {
+      messages += sizeof(*lane->bitmaps) * lane->channel_size;
+    }
+    if (lane->msg_big_areas)
+    {
+      messages += sizeof(*lane->msg_big_areas) * lane->channel_size;
+    }
+    area += lane->messages_area_size;
+    arena += lane->arena_size;
+
+    if (lane->arena)
+    {
+      for (i = 0; i < lane->channel_size; i++)
+      {
+        c = ACCESS_ONCE(kzimp_msg(lane, i)->arena_class);
+        if (c >= 0)
+        {
+          in_use += 1UL << (KZIMP_ARENA_MIN_SHIFT + c);
+        }
+      }
+    }
+
+    spin_lock(&lane->bcl);
+    list_for_each_entry(bma, &lane->writers_big_msg, next)
+    {
+      big += bma->len;
+    }
+    list_for_each_entry(ctrl, &lane->readers, next)
+    {
+      if (ctrl->backlog)
+      {
+        backlogs += sizeof(*ctrl->backlog) + ctrl->backlog->size;
+      }
+    }
+    spin_unlock(&lane->bcl);
+  }
+
+  seq_printf(sf, "%i\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", chan->chan_id,
+      messages, area, arena, in_use, big, backlogs, messages + area + arena + big
+          + backlogs);
+}
+
+// Add the statistics of the CPUs for the lane lane to total
+static void kzimp_add_lane_stats(struct kzimp_comm_chan *lane,
+    struct kzimp_stats *total)
+{
+  unsigned long *counters, *sum;
+  int cpu, i;
+
+  // struct kzimp_stats is only made of unsigned long counters
+  sum = (unsigned long*) total;
+  for_each_possible_cpu(cpu)
+  {
+    counters = (unsigned long*) per_cpu_ptr(lane->stats, cpu);
+    for (i = 0; i < sizeof(*total) / sizeof(unsigned long); i++)
+    {
+      sum[i] += counters[i];
+    }
+  }
+}
+
+// Sum the statistics of the CPUs and of the lanes for chan in total
+static void kzimp_sum_stats(struct kzimp_comm_chan *chan,
+    struct kzimp_stats *total)
+{
+  int l;
+
+  memset(total, 0, sizeof(*total));
+
+  for (l = 0; l < chan->nb_lanes; l++)
+  {
+    kzimp_add_lane_stats(chan->lanes[l], total);
+  }
+}
+
+// called when reading file /proc/<procfs_name>
+// A seq_file: the tables of the channels do not fit in a page
+static int kzimp_proc_show(struct seq_file *sf, void *v)
+{
+  struct kzimp_stats stats;
+  int i;
+
+  seq_printf(sf, "kzimp %s @ %s\n\n", __DATE__, __TIME__);
+  seq_printf(sf, "nb_max_communication_channels = %i\n",
+      nb_max_communication_channels);
+  seq_printf(sf, "default_channel_size = %i\n",
+      default_channel_size);
+  seq_printf(sf, "default_max_msg_size = %i\n",
+      default_max_msg_size);
+  seq_printf(sf, "default_timeout_in_ms = %li\n",
+      default_timeout_in_ms);
+  seq_printf(sf, "default_compute_checksum = %i\n",
+      default_compute_checksum);
+  seq_printf(sf, "default_wait_policy = %i\n",
+      default_wait_policy);
+  seq_printf(sf, "default_max_spin_ns = %lu\n",
+      default_max_spin_ns);
+  seq_printf(sf, "default_overflow_policy = %i\n",
+      default_overflow_policy);
+  seq_printf(sf, "default_backlog_size = %lu\n",
+      default_backlog_size);
+  seq_printf(sf, "default_nb_lanes = %i\n",
+      default_nb_lanes);
+  seq_printf(sf, "default_mode = %i\n",
+      default_mode);
+  seq_printf(sf, "use_huge_pages = %i\n",
+      use_huge_pages);
+  seq_printf(sf, "big_msg_pool_size = %i\n",
+      big_msg_pool_size);
+  seq_printf(sf, "use_inline_messages = %i\n",
+      use_inline_messages);
+  seq_printf(sf, "nt_copy_threshold = %i (%s)\n",
+      nt_copy_threshold, (nt_copy_supported ? "supported" : "not supported"));
+  seq_printf(sf, "prefetch_copy_threshold = %i\n",
+      prefetch_copy_threshold);
+  seq_printf(sf, "default_node = %i\n",
+      default_node);
+  seq_printf(sf, "default_max_readers = %i\n",
+      default_max_readers);
+  seq_printf(sf, "default_data_path = %i\n\n",
+      default_data_path);
+
+  // the channels cannot be destroyed or modified while we read them
+  mutex_lock(&kzimp_ctl_mutex);
+
+  seq_printf(sf, "chan_id\tchan_size\tmax_msg_size\tmulticast_mask\tnb_receivers\ttimeout_in_ms\tcompute_checksum\tmode\thuge_pages\tnode_policy\tnode\tmax_readers\tdata_path\tnb_lanes\n");
+  for (i = 0; i < nb_max_communication_channels; i++)
+  {
+    if (!kzimp_channels[i].created)
+    {
+      continue;
+    }
+
+    seq_printf(sf, "%i\t%i\t%i\t",
+        kzimp_channels[i].chan_id, kzimp_channels[i].channel_size,
+        kzimp_channels[i].max_msg_size);
+    seq_bitmap(sf, kzimp_channels[i].multicast_mask,
+        kzimp_channels[i].max_readers);
+    seq_printf(sf, "\t%i\t%li\t%i\t%i\t%i\t%i\t%i\t%i\t%i\t%i\n",
+        kzimp_channels[i].nb_readers, kzimp_channels[i].timeout_in_ms,
+        kzimp_channels[i].compute_checksum, kzimp_channels[i].mode,
+        kzimp_channels[i].huge_pages, kzimp_channels[i].node_policy,
+        kzimp_channels[i].node, kzimp_channels[i].max_readers,
+        kzimp_channels[i].data_path, kzimp_channels[i].nb_lanes);
+  }
+
+  seq_printf(sf, "\nchan_id\twait_policy\tmax_spin_ns\tspin_budget_ns\tnb_spins\tnb_sleeps\tnb_wakeups\n");
+  for (i = 0; i < nb_max_communication_channels; i++)
+  {
+    if (!kzimp_channels[i].created)
+    {
+      continue;
+    }
+
+    seq_printf(sf, "%i\t%i\t%lu\t%lu\t%li\t%li\t%li\n",
+        kzimp_channels[i].chan_id, kzimp_channels[i].wait_policy,
+        kzimp_channels[i].max_spin_ns, kzimp_channels[i].spin_budget_ns,
+        atomic_long_read(&kzimp_channels[i].nb_spins),
+        atomic_long_read(&kzimp_channels[i].nb_sleeps),
+        atomic_long_read(&kzimp_channels[i].nb_wakeups));
+  }
+
+  seq_printf(sf, "\nchan_id\toverflow_policy\tbacklog_size\treaders_moved\tmsgs_spilled\tmsgs_skipped\n");
+  for (i = 0; i < nb_max_communication_channels; i++)
+  {
+    if (!kzimp_channels[i].created || !kzimp_channels[i].stats)
+    {
+      continue;
+    }
+
+    kzimp_sum_stats(&kzimp_channels[i], &stats);
+    seq_printf(sf, "%i\t%i\t%lu\t%lu\t%lu\t%lu\n",
+        kzimp_channels[i].chan_id, kzimp_channels[i].overflow_policy,
+        kzimp_channels[i].backlog_size, stats.readers_moved,
+        stats.msgs_spilled, stats.msgs_skipped);
+  }
+
+  seq_printf(sf, "\nchan_id\tmessages\tmessages_area\tarena\tarena_in_use\tbig_msg_areas\tbacklogs\ttotal\n");
+  for (i = 0; i < nb_max_communication_channels; i++)
+  {
+    if (!kzimp_channels[i].created)
+    {
+      continue;
+    }
+
+    kzimp_show_footprint(sf, &kzimp_channels[i]);
+  }
+
+  seq_printf(sf, "\nchan_id\tmsgs_written\tmsgs_read\twriter_waits\ttimeouts\treaders_offline\tchecksum_failures\n");
+  for (i = 0; i < nb_max_communication_channels; i++)
+  {
+    if (!kzimp_channels[i].created || !kzimp_channels[i].stats)
+    {
+      continue;
+    }
+
+    kzimp_sum_stats(&kzimp_channels[i], &stats);
+    seq_printf(sf, "%i\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+        kzimp_channels[i].chan_id, stats.msgs_written, stats.msgs_read,
+        stats.writer_waits, stats.timeouts, stats.readers_offline,
+        stats.checksum_failures);
+  }
+  seq_printf(sf, "(more statistics in <debugfs>/%s/channel<chan_id>)\n", debugfs_name);
+
+#ifndef USE_CHECKSUM_CODE
+  seq_printf(sf, "!!! THE CODE THAT USES THE CHECKSUM IS NOT EXECUTED !!!\n");
+#endif
+
+  mutex_unlock(&kzimp_ctl_mutex);
+
+  return 0;
+}
+
+static int kzimp_proc_open(struct inode *inode, struct file *filp)
+{
+  return single_open(filp, kzimp_proc_show, NULL);
+}
+
+// Print the statistics of the channel of the statistics file sf: the counters of the
+// channel, those of its readers, and the histogram of the latencies.
+static int kzimp_stats_show(struct seq_file *sf, void *v)
+{
+  struct kzimp_comm_chan *chan;
+  struct kzimp_stats stats, lane_stats;
+  struct list_head *p;
+  struct kzimp_ctrl *ctrl;
+  int i, l;
+
+  chan = sf->private;
+
+  // the channel cannot be destroyed while we read it
+  mutex_lock(&kzimp_ctl_mutex);
+
+  if (!chan->created || !chan->stats)
+  {
+    mutex_unlock(&kzimp_ctl_mutex);
+    seq_printf(sf, "channel %i does not exist\n", (int) (chan - kzimp_channels));
+    return 0;
+  }
+
+  kzimp_sum_stats(chan, &stats);
+
+  seq_printf(sf, "chan_id %i\n", chan->chan_id);
+  seq_printf(sf, "msgs_written %lu\n", stats.msgs_written);
+  seq_printf(sf, "bytes_written %lu\n", stats.bytes_written);
+  seq_printf(sf, "msgs_read %lu\n", stats.msgs_read);
+  seq_printf(sf, "bytes_read %lu\n", stats.bytes_read);
+  seq_printf(sf, "writer_waits %lu\n", stats.writer_waits);
+  seq_printf(sf, "timeouts %lu\n", stats.timeouts);
+  seq_printf(sf, "readers_offline %lu\n", stats.readers_offline);
+  seq_printf(sf, "readers_moved %lu\n", stats.readers_moved);
+  seq_printf(sf, "msgs_spilled %lu\n", stats.msgs_spilled);
+  seq_printf(sf, "msgs_skipped %lu\n", stats.msgs_skipped);
+  seq_printf(sf, "checksum_failures %lu\n", stats.checksum_failures);
+
+  if (chan->nb_lanes > 1)
+  {
+    seq_printf(sf, "\nlane\tmsgs_written\tmsgs_read\twriter_waits\ttimeouts\n");
+    for (l = 0; l < chan->nb_lanes; l++)
+    {
+      memset(&lane_stats, 0, sizeof(lane_stats));
+      kzimp_add_lane_stats(chan->lanes[l], &lane_stats);
+      seq_printf(sf, "%i\t%lu\t%lu\t%lu\t%lu\n", l, lane_stats.msgs_written,
+          lane_stats.msgs_read, lane_stats.writer_waits, lane_stats.timeouts);
+    }
+  }
+
+  // a reader has one line per lane
+  seq_printf(sf, "\npid\tlane\tbit\tonline\tmsgs_read\tbytes_read\tsleeps\tlost\n");
+  for (l = 0; l < chan->nb_lanes; l++)
+  {
+    spin_lock(&chan->lanes[l]->bcl);
+    list_for_each(p, &chan->lanes[l]->readers)
+    {
+      ctrl = list_entry(p, struct kzimp_ctrl, next);
+      seq_printf(sf, "%i\t%i\t%i\t%i\t%lu\t%lu\t%lu\t%lu\n", ctrl->pid, l,
+          ctrl->bitmap_bit, ctrl->online, ctrl->nb_msgs_read,
+          ctrl->nb_bytes_read, ctrl->nb_sleeps, ctrl->nb_lost);
+    }
+    spin_unlock(&chan->lanes[l]->bcl);
+  }
+
+  // bucket i > 0 holds the latencies of [2^(i-1), 2^i[ ns
+  seq_printf(sf, "\nbucket\tmin_latency_ns\tnb_msgs\n");
+  for (i = 0; i < KZIMP_LATENCY_BUCKETS; i++)
+  {
+    seq_printf(sf, "%i\t%llu\t%lu\n", i, (i > 0 ? 1ULL << (i - 1) : 0ULL),
+        stats.latency[i]);
+  }
+
+  mutex_unlock(&kzimp_ctl_mutex);
+
+  return 0;
+}
+
+static int kzimp_stats_open(struct inode *inode, struct file *filp)
+{
+  return single_open(filp, kzimp_stats_show, inode->i_private);
+}
+
+/*
+ * Writing anything in the statistics file of a channel resets its statistics.
+ * The counters that the writers and readers update during the reset may not be reset.
+ * Returns:
+ *  . count: it always succeeds
+ */
+static ssize_t kzimp_stats_write(struct file *filp, const char __user *buf,
+    size_t count, loff_t *f_pos)
+{
+  struct kzimp_comm_chan *chan, *lane;
+  struct list_head *p;
+  struct kzimp_ctrl *ctrl;
+  int cpu, l;
+
+  chan = ((struct seq_file*) filp->private_data)->private;
+
+  mutex_lock(&kzimp_ctl_mutex);
+
+  if (chan->created && chan->stats)
+  {
+    for (l = 0; l < chan->nb_lanes; l++)
+    {
+      lane = chan->lanes[l];
+
+      for_each_possible_cpu(cpu)
+      {
+        memset(per_cpu_ptr(lane->stats, cpu), 0, sizeof(struct kzimp_stats));
+      }
+
+      spin_lock(&lane->bcl);
+      list_for_each(p, &lane->readers)
+      {
+        ctrl = list_entry(p, struct kzimp_ctrl, next);
+        ctrl->nb_msgs_read = 0;
+        ctrl->nb_bytes_read = 0;
+        ctrl->nb_sleeps = 0;
+        ctrl->nb_lost = 0;
+      }
+      spin_unlock(&lane->bcl);
+    }
+  }
+
+  mutex_unlock(&kzimp_ctl_mutex);
+
+  return count;
+}
+
+// The channel can be freed twice (e.g. destroyed, then at module exit),
+// or after a failed initialization
+static void kzimp_free_channel(struct kzimp_comm_chan *chan)
+{
+  struct kzimp_arena_chunk *chunk, *tmp;
+  int i;
+
+  // the structures of the lanes are kept (see kzimp_free_lanes())
+  for (i = 1; i < KZIMP_MAX_LANES; i++)
+  {
+    if (chan->lanes[i])
+    {
+      kzimp_free_channel(chan->lanes[i]);
+    }
+  }
+
+  if (chan->msgs)
+  {
+    // the writers get back the pool slots and the big messages areas of the messages
+    // that disappear
+    for (i = 0; i < chan->channel_size; i++)
+    {
+      kzimp_release_pool_slot(kzimp_msg(chan, i));
+      kzimp_release_msg_big_area(chan, kzimp_msg(chan, i));
+    }
+  }
+  if (chan->msg_big_areas)
+  {
+    my_kfree(chan->msg_big_areas);
+    chan->msg_big_areas = NULL;
+  }
+
+  if (chan->messages_area)
+  {
+    kzimp_free_messages_area(chan->messages_area, chan->messages_area_size,
+        chan->huge_pages);
+    chan->messages_area = NULL;
+  }
+  if (chan->arena)
+  {
+    list_for_each_entry_safe(chunk, tmp, &chan->arena_chunks, next)
+    {
+      list_del(&chunk->next);
+      if (chunk->vmalloced)
+      {
+        my_vfree(chunk->addr);
+      }
+      else
+      {
+        my_kfree(chunk->addr);
+      }
+      my_kfree(chunk);
+    }
+    chan->arena_size = 0;
+
+    my_kfree(chan->arena);
+    chan->arena = NULL;
+  }
+  if (chan->msgs)
+  {
+    my_kfree(chan->msgs);
+    chan->msgs = NULL;
+  }
+  if (chan->cursors)
+  {
+    my_kfree(chan->cursors);
+    chan->cursors = NULL;
+  }
+  if (chan->readers_wq)
+  {
+    if (chan->lane0 == chan)
+    {
+      my_kfree(chan->readers_wq);
+    }
+    chan->readers_wq = NULL;
+  }
+  if (chan->stats)
+  {
+    free_percpu(chan->stats);
+    chan->stats = NULL;
+  }
+  if (chan->bitmaps)
+  {
+    my_kfree(chan->bitmaps);
+    chan->bitmaps = NULL;
+  }
+}
+
+// Free the big messages areas of the writers of chan, once nobody can map them.
+// They are kept when the channel is modified through /proc, as writers may still be there.
+static void kzimp_free_big_msg_areas(struct kzimp_comm_chan *chan)
+{
+  struct big_mem_area_elt *bma, *tmp;
+
+  list_for_each_entry_safe(bma, tmp, &chan->writers_big_msg, next)
+  {
+    list_del(&bma->next);
+    kzimp_free_big_msg_area(bma);
+  }
+}
+
+// Free the lanes of chan, once nobody uses them.
+// They are kept when the channel is modified through /proc, as writers may still be there.
+static void kzimp_free_lanes(struct kzimp_comm_chan *chan)
+{
+  int l;
+
+  for (l = 1; l < KZIMP_MAX_LANES; l++)
+  {
+    if (chan->lanes[l])
+    {
+      kzimp_free_channel(chan->lanes[l]);
+      my_kfree(chan->lanes[l]);
+      chan->lanes[l] = NULL;
+    }
+  }
+  chan->nb_lanes = 1;
+}
+
+static int kzimp_check_channel_params(struct kzimp_channel_params *params,
+    int keep);
+static long kzimp_rebuild_channel(struct kzimp_channel_params *params,
+    int mode, int node_policy, int nb_lanes);
+
+// called when writing to file /proc/<procfs_name>
+// The format is "chan_id channel_size max_msg_size timeout_in_ms compute_checksum [wait_policy max_spin_ns [mode [node [max_readers [data_path [overflow_policy backlog_size [nb_lanes]]]]]]]".
+// The wait policy and the overflow policy are optional. They can be modified even if the channel is open.
+// The mode, the node, the max number of readers, the data path and the number of lanes are optional.
+// As the other parameters, they are modified only if there are no open files on the channel:
+// the channel is rebuilt as with KZIMP_IOCTL_RESIZE_CHANNEL.
+// The node is a node id, or KZIMP_NODE_ANY, KZIMP_NODE_WRITER or KZIMP_NODE_READERS.
+static ssize_t kzimp_write_proc_file(struct file *file, const char __user *buffer,
+    size_t count, loff_t *f_pos)
+{
+  struct kzimp_channel_params params;
+  struct kzimp_comm_chan *chan;
+  long err;
+  int len, nb_args;
+  int chan_id, max_msg_size, channel_size, compute_checksum, wait_policy, mode,
+      node_policy, max_readers, data_path, overflow_policy, nb_lanes;
+  unsigned long max_spin_ns, backlog_size;
+  long to;
+  char* kbuff;
+
+  len = count;
+
+  kbuff = (char*) my_kmalloc(sizeof(char) * len, GFP_KERNEL);
+
+  if (copy_from_user(kbuff, buffer, len))
+  {
+    my_kfree(kbuff);
+    return -EFAULT;
+  }
+
+  kbuff[len - 1] = '\0';
+
+  nb_args = sscanf(kbuff, "%i %i %i %li %i %i %lu %i %i %i %i %i %lu %i", &chan_id,
+      &channel_size, &max_msg_size, &to, &compute_checksum, &wait_policy,
+      &max_spin_ns, &mode, &node_policy, &max_readers, &data_path,
+      &overflow_policy, &backlog_size, &nb_lanes);
+
+  my_kfree(kbuff);
+
+  if (chan_id < 0 || chan_id >= nb_max_communication_channels)
+  {
+    // channel id not valid
+    printk(KERN_WARNING "kzimp: channel id not valid: %i <= %i < %i", 0, chan_id, nb_max_communication_channels);
+    return len;
+  }
+
+  if (channel_size < 0)
+  {
+    // channel size not valid
+    printk(KERN_WARNING "kzimp: channel size not valid: %i < %i", channel_size, 0);
+    return len;
+  }
+
+  if (max_msg_size <= 0)
+  {
+    // max message size not valid
+    printk(KERN_WARNING "kzimp: max message size not valid: %i <= %i", max_msg_size, 0);
+    return len;
+  }
+
+  if (to <= 0)
+  {
+    // timeout not valid
+    printk(KERN_WARNING "kzimp: timeout not valid: %li <= %i", to, 0);
+    return len;
+  }
+
+  if (nb_args >= 8 && mode != KZIMP_MODE_BITMAP && mode != KZIMP_MODE_CURSOR)
+  {
+    // mode not valid
+    printk(KERN_WARNING "kzimp: mode not valid: %i", mode);
+    return len;
+  }
+
+  if (nb_args >= 9 && node_policy < KZIMP_NODE_READERS)
+  {
+    // node not valid
+    printk(KERN_WARNING "kzimp: node not valid: %i", node_policy);
+    return len;
+  }
 
-    to_expired = schedule_timeout(chan->timeout_in_ms * HZ / 1000);
+  if (nb_args >= 10 && (max_readers <= 0 || max_readers > KZIMP_MAX_READERS))
+  {
+    // max number of readers not valid
+    printk(KERN_WARNING "kzimp: max number of readers not valid: %i <= %i <= %lu", 1, max_readers, KZIMP_MAX_READERS);
+    return len;
   }
-  finish_wait(&chan->wq, &__wait);
 
-  if (unlikely(!to_expired))
+  if (nb_args >= 11 && (data_path < KZIMP_DATA_PATH_COPY || data_path > KZIMP_DATA_PATH_ARENA))
   {
-    printk(KERN_DEBUG "kzimp: timer has expired for process %i in write\n", current->pid);
-    handle_timeout(chan, m);
+    // data path not valid
+    printk(KERN_WARNING "kzimp: data path not valid: %i", data_path);
+    return len;
   }
 
-  *mf = m;
+  if (nb_args >= 14 && (nb_lanes <= 0 || nb_lanes > KZIMP_MAX_LANES))
+  {
+    // number of lanes not valid
+    printk(KERN_WARNING "kzimp: number of lanes not valid: %i <= %i <= %i", 1, nb_lanes, KZIMP_MAX_LANES);
+    return len;
+  }
 
-  return 1;
-}
+  params.chan_id = chan_id;
+  params.channel_size = channel_size;
+  params.max_msg_size = max_msg_size;
+  params.compute_checksum = compute_checksum;
+  params.timeout_in_ms = to;
+  params.max_readers = (nb_args >= 10 ? max_readers : -1);
+  params.data_path = (nb_args >= 11 ? data_path : -1);
 
-// finalize the write
-static void kzimp_finalize_write(struct kzimp_comm_chan *chan,
-    struct kzimp_message *m, size_t count)
-{
-  m->len = count;
+  if (kzimp_check_channel_params(&params, 0))
+  {
+    printk(KERN_WARNING "kzimp: parameters of channel %i not valid", chan_id);
+    return len;
+  }
 
-#ifdef USE_CHECKSUM_CODE
-  // compute checksum if required
-  m->checksum = 0;
-  if (chan->compute_checksum)
+  mutex_lock(&kzimp_ctl_mutex);
+
+  chan = &kzimp_channels[chan_id];
+
+  // same path as KZIMP_IOCTL_RESIZE_CHANNEL: the channel is rebuilt only if it is not open
+  err = kzimp_rebuild_channel(&params, (nb_args >= 8 ? mode : chan->mode),
+      (nb_args >= 9 ? node_policy : chan->node_policy),
+      (nb_args >= 14 ? nb_lanes : chan->nb_lanes));
+  if (err == -EBUSY)
   {
-    m->checksum = oneC_sum(0, m, KZIMP_HEADER_SIZE);
+    printk(KERN_WARNING "kzimp: channel %i is open, its parameters are kept", chan_id);
+  }
+  else if (unlikely(err < 0))
+  {
+    printk(KERN_WARNING "kzimp: Error %i at initialization of channel %i", err, chan_id);
+  }
 
-    if (chan->compute_checksum == 1)
+  // the policies can be modified while the channel is open
+  if (err >= 0 || err == -EBUSY)
+  {
+    if (nb_args >= 7)
+    {
+      kzimp_set_wait_policy(chan, wait_policy, max_spin_ns);
+    }
+    if (nb_args >= 13)
     {
-      m->checksum = oneC_sum(m->checksum, m->data, count);
+      kzimp_set_overflow_policy(chan, overflow_policy, backlog_size);
     }
   }
-#endif
 
-  m->bitmap = chan->multicast_mask;
+  mutex_unlock(&kzimp_ctl_mutex);
 
-  // wake up sleeping readers
-  wake_up_interruptible(&chan->rq);
+  return len;
 }
 
 /*
- * kzimp write operation.
- * Blocking call.
- * Sleeps until it can write the message.
- * FIXME: if there are more writers than the number of messages in the channel, there can be
- * FIXME: 2 writers on the same message. We assume the channel size is less than the number of writers.
- * FIXME: To fix that we can add a counter.
+ * Check the parameters of a channel given to the control device.
+ * If keep is set, -1 is valid and means that the current value is kept.
+ * -1 is always valid for the max number of readers and the data path (the default ones at creation).
  * Returns:
- *  . 0 if the size of the user-level buffer is less or equal than 0 or greater than the maximal message size
- *  . -EFAULT if the buffer *buf is not valid
- *  . -EINTR if the process has been interrupted by a signal while waiting
- *  . -EAGAIN if the operations are non-blocking and the call would block.
- *  . The number of written bytes otherwise
+ *  . -EINVAL if a parameter is not valid
+ *  . 0 otherwise
  */
-static ssize_t kzimp_write
-(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+static int kzimp_check_channel_params(struct kzimp_channel_params *params,
+    int keep)
 {
-  struct kzimp_message *m;
-  ssize_t ret;
-
-  struct kzimp_comm_chan *chan; /* channel information */
-  struct kzimp_ctrl *ctrl;
-
-  ctrl = filp->private_data;
-  chan = ctrl->channel;
-
-  ret = kzimp_wait_for_writing_if_needed(filp, count, &m);
-  if (unlikely(ret != 1))
-  {
-    return ret;
-  }
-
-  // copy_from_user returns the number of bytes left to copy
-  if (unlikely(copy_from_user(m->data, buf, count)))
+  if ((params->channel_size <= 0 && !(keep && params->channel_size == -1))
+      || (params->max_msg_size <= 0 && !(keep && params->max_msg_size == -1))
+      || (params->timeout_in_ms <= 0 && !(keep && params->timeout_in_ms == -1))
+      || ((params->compute_checksum < 0 || params->compute_checksum > 2)
+          && !(keep && params->compute_checksum == -1))
+      || ((params->max_readers <= 0 || params->max_readers > KZIMP_MAX_READERS)
+          && params->max_readers != -1)
+      || ((params->data_path < KZIMP_DATA_PATH_COPY
+          || params->data_path > KZIMP_DATA_PATH_ARENA)
+          && params->data_path != -1))
   {
-    printk(KERN_ERR "kzimp: copy_from_user failed for process %i in write\n", current->pid);
-    return -EFAULT;
+    return -EINVAL;
   }
 
-  kzimp_finalize_write(chan, m, count);
-
-  return count;
+  return 0;
 }
 
-// Called by select(), poll() and epoll() syscalls.
-// pre-condition: must be called by a reader. The call does not work
-// (and does not have sense) for a writer.
-static unsigned int kzimp_poll(struct file *filp, poll_table *wait)
+/*
+ * Take channel chan_id out of the channels that can be opened, so that
+ * it can be destroyed or resized.
+ * Must be called with kzimp_ctl_mutex held.
+ * Returns:
+ *  . -EINVAL if chan_id is not valid
+ *  . -ENODEV if the channel does not exist
+ *  . -EBUSY if the channel is opened
+ *  . 0 otherwise
+ */
+static int kzimp_take_channel(int chan_id)
 {
-  unsigned int mask = 0;
-  struct kzimp_message *m;
-
-  struct kzimp_comm_chan *chan; /* channel information */
-  struct kzimp_ctrl *ctrl;
+  struct kzimp_comm_chan *chan;
+  int err = 0;
 
-  ctrl = filp->private_data;
-  chan = ctrl->channel;
+  if (chan_id < 0 || chan_id >= nb_max_communication_channels)
+  {
+    return -EINVAL;
+  }
 
-  poll_wait(filp, &chan->rq, wait);
+  chan = &kzimp_channels[chan_id];
 
-  m = &(chan->msgs[ctrl->next_read_idx]);
-  if (reader_can_read(m->bitmap, ctrl->bitmap_bit))
+  spin_lock(&chan->bcl);
+  if (!chan->created)
   {
-    mask |= POLLIN | POLLRDNORM;
+    err = -ENODEV;
   }
-  if (!ctrl->online)
+  else if (chan->nb_files > 0)
   {
-    mask |= POLLHUP; // kind of end-of-file
+    err = -EBUSY;
+  }
+  else
+  {
+    chan->created = 0;
   }
+  spin_unlock(&chan->bcl);
 
-  return mask;
+  return err;
 }
 
-static int kzimp_init_channel(struct kzimp_comm_chan *channel, int chan_id,
-    int max_msg_size, int channel_size, long to, int compute_checksum,
-    int init_lock)
+/*
+ * Create a channel. If params->chan_id is -1, the first free id is used.
+ * Must be called with kzimp_ctl_mutex held.
+ * Returns:
+ *  . -EINVAL if a parameter is not valid
+ *  . -EEXIST if the channel already exists
+ *  . -ENOSPC if there is no free channel
+ *  . -ENOMEM if the memory allocations fail
+ *  . the id of the channel otherwise
+ */
+static long kzimp_create_channel(struct kzimp_channel_params *params)
 {
-  int i;
-  char *addr;
-  unsigned long size;
+  struct kzimp_comm_chan *chan;
+  int chan_id, err;
 
-  channel->chan_id = chan_id;
-  channel->max_msg_size = max_msg_size;
-  channel->channel_size = channel_size;
-  channel->compute_checksum = compute_checksum;
-  channel->timeout_in_ms = to;
-  channel->multicast_mask = 0;
-  channel->nb_readers = 0;
-#ifdef CHANNEL_WRITE_IDX_ATOMIC
-  atomic_set(&channel->next_write_idx, 0);
-#else
-  channel->next_write_idx = 0;
-#endif
-  init_waitqueue_head(&channel->rq);
-  init_waitqueue_head(&channel->wq);
-  INIT_LIST_HEAD(&channel->readers);
+  if (kzimp_check_channel_params(params, 0))
+  {
+    return -EINVAL;
+  }
 
-  size = (unsigned long) channel->max_msg_size
-      * (unsigned long) channel->channel_size;
-  channel->messages_area = my_vmalloc(size);
-  if (unlikely(!channel->messages_area))
+  chan_id = params->chan_id;
+  if (chan_id == -1)
   {
-    printk(KERN_ERR "kzimp: channel messages allocation of %lu bytes error\n", size);
-    return -ENOMEM;
+    for (chan_id = 0; chan_id < nb_max_communication_channels; chan_id++)
+    {
+      if (!kzimp_channels[chan_id].created)
+      {
+        break;
+      }
+    }
+
+    if (chan_id == nb_max_communication_channels)
+    {
+      return -ENOSPC;
+    }
+  }
+  else if (chan_id < 0 || chan_id >= nb_max_communication_channels)
+  {
+    return -EINVAL;
   }
 
-  size = sizeof(*channel->msgs) * channel->channel_size;
-  channel->msgs = my_kmalloc(size, GFP_KERNEL);
-  if (unlikely(!channel->msgs))
+  chan = &kzimp_channels[chan_id];
+  if (chan->created)
   {
-    printk(KERN_ERR "kzimp: channel messages allocation of %lu bytes error\n", size);
-    return -ENOMEM;
+    return -EEXIST;
   }
 
-  addr = channel->messages_area;
-  for (i = 0; i < channel->channel_size; i++)
+  if (params->max_readers == -1)
   {
-    channel->msgs[i].data = addr;
-    channel->msgs[i].bitmap = 0;
-#ifdef ATOMIC_WAKE_UP
-    atomic_set(&channel->msgs[i].waking_up_writer, 0);
-#endif
-    addr += channel->max_msg_size;
+    params->max_readers = default_max_readers;
+  }
+  if (params->data_path == -1)
+  {
+    params->data_path = default_data_path;
   }
 
-  if (init_lock)
+  // the channel cannot be opened: we can initialize it without its lock
+  err = kzimp_init_channel(chan, chan_id, params->max_msg_size,
+      params->channel_size, params->timeout_in_ms, params->compute_checksum,
+      default_mode, default_node, params->max_readers, params->data_path,
+      default_nb_lanes, 0);
+  if (unlikely(err))
   {
-    spin_lock_init(&channel->bcl);
+    kzimp_free_channel(chan);
+    return err;
   }
 
-  return 0;
+  spin_lock(&chan->bcl);
+  chan->created = 1;
+  spin_unlock(&chan->bcl);
+
+  return chan_id;
 }
 
-// called when reading file /proc/<procfs_name>
-static int kzimp_read_proc_file(char *page, char **start, off_t off, int count,
-    int *eof, void *data)
+/*
+ * Rebuild channel params->chan_id with the parameters of params, the mode, the node policy
+ * and the number of lanes. The parameters of params that are -1 are not modified, nor the
+ * wait policy and the overflow policy of the channel.
+ * The channel cannot be opened meanwhile (see kzimp_take_channel()): it is freed and
+ * initialized again without its lock, and no writer can use its messages.
+ * Must be called with kzimp_ctl_mutex held.
+ * Returns:
+ *  . -EINVAL if the channel id is not valid
+ *  . -ENODEV if the channel does not exist
+ *  . -EBUSY if the channel is opened
+ *  . -ENOMEM if the memory allocations fail. The channel is then destroyed.
+ *  . the id of the channel otherwise
+ */
+static long kzimp_rebuild_channel(struct kzimp_channel_params *params,
+    int mode, int node_policy, int nb_lanes)
 {
-  int i;
-  int len;
+  struct kzimp_comm_chan *chan;
+  int err, wait_policy, overflow_policy;
+  unsigned long max_spin_ns, backlog_size;
 
-  len = sprintf(page, "kzimp %s @ %s\n\n", __DATE__, __TIME__);
-  len += sprintf(page + len, "nb_max_communication_channels = %i\n",
-      nb_max_communication_channels);
-  len += sprintf(page + len, "default_channel_size = %i\n",
-      default_channel_size);
-  len += sprintf(page + len, "default_max_msg_size = %i\n",
-      default_max_msg_size);
-  len += sprintf(page + len, "default_timeout_in_ms = %li\n",
-      default_timeout_in_ms);
-  len += sprintf(page + len, "default_compute_checksum = %i\n\n",
-      default_compute_checksum);
+  err = kzimp_take_channel(params->chan_id);
+  if (err)
+  {
+    return err;
+  }
 
-  len
-  += sprintf(
-      page + len,
-      "chan_id\tchan_size\tmax_msg_size\tmulticast_mask\tnb_receivers\ttimeout_in_ms\tcompute_checksum\n");
-  for (i = 0; i < nb_max_communication_channels; i++)
+  chan = &kzimp_channels[params->chan_id];
+
+  if (params->channel_size == -1)
   {
-    len += sprintf(page + len, "%i\t%i\t%i\t%lx\t%i\t%li\t%i\n",
-        kzimp_channels[i].chan_id, kzimp_channels[i].channel_size,
-        kzimp_channels[i].max_msg_size, kzimp_channels[i].multicast_mask,
-        kzimp_channels[i].nb_readers, kzimp_channels[i].timeout_in_ms,
-        kzimp_channels[i].compute_checksum);
+    params->channel_size = chan->channel_size;
+  }
+  if (params->max_msg_size == -1)
+  {
+    params->max_msg_size = chan->max_msg_size;
+  }
+  if (params->timeout_in_ms == -1)
+  {
+    params->timeout_in_ms = chan->timeout_in_ms;
   }
+  if (params->compute_checksum == -1)
+  {
+    params->compute_checksum = chan->compute_checksum;
+  }
+  if (params->max_readers == -1)
+  {
+    params->max_readers = chan->max_readers;
+  }
+  if (params->data_path == -1)
+  {
+    params->data_path = chan->data_path;
+  }
+  wait_policy = chan->wait_policy;
+  max_spin_ns = chan->max_spin_ns;
+  overflow_policy = chan->overflow_policy;
+  backlog_size = chan->backlog_size;
+
+  kzimp_free_channel(chan);
+  kzimp_free_big_msg_areas(chan);
+  kzimp_free_lanes(chan);
+  err = kzimp_init_channel(chan, params->chan_id, params->max_msg_size,
+      params->channel_size, params->timeout_in_ms, params->compute_checksum,
+      mode, node_policy, params->max_readers, params->data_path, nb_lanes, 0);
+  if (unlikely(err))
+  {
+    printk(KERN_ERR "kzimp: Error %i at resize of channel %i, the channel is destroyed\n", err, params->chan_id);
+    kzimp_free_channel(chan);
+    return err;
+  }
+  kzimp_set_wait_policy(chan, wait_policy, max_spin_ns);
+  // not valid anymore if the channel now uses the reader splice data path: the default is kept
+  kzimp_set_overflow_policy(chan, overflow_policy, backlog_size);
 
-#ifndef USE_CHECKSUM_CODE
-  len += sprintf(page + len, "!!! THE CODE THAT USES THE CHECKSUM IS NOT EXECUTED !!!\n");
-#endif
+  spin_lock(&chan->bcl);
+  chan->created = 1;
+  spin_unlock(&chan->bcl);
 
-  return len;
+  return params->chan_id;
 }
 
-static void kzimp_free_channel(struct kzimp_comm_chan *chan)
+/*
+ * Resize channel params->chan_id. The parameters that are -1 are not modified,
+ * nor the mode, node, wait policy, overflow policy and number of lanes of the channel.
+ * Must be called with kzimp_ctl_mutex held.
+ * Returns:
+ *  . -EINVAL if a parameter is not valid
+ *  . the return values of kzimp_rebuild_channel() otherwise
+ */
+static long kzimp_resize_channel(struct kzimp_channel_params *params)
 {
-  my_vfree(chan->messages_area);
-  my_kfree(chan->msgs);
-}
+  struct kzimp_comm_chan *chan;
 
-// called when writing to file /proc/<procfs_name>
-static int kzimp_write_proc_file(struct file *file, const char *buffer,
-    unsigned long count, void *data)
-{
-  int err = 0;
-  int len;
-  int chan_id, max_msg_size, channel_size, compute_checksum;
-  long to;
-  char* kbuff;
+  if (kzimp_check_channel_params(params, 1)
+      || params->chan_id < 0 || params->chan_id >= nb_max_communication_channels)
+  {
+    return -EINVAL;
+  }
 
-  len = count;
+  chan = &kzimp_channels[params->chan_id];
+  return kzimp_rebuild_channel(params, chan->mode, chan->node_policy,
+      chan->nb_lanes);
+}
 
-  kbuff = (char*) my_kmalloc(sizeof(char) * len, GFP_KERNEL);
+/*
+ * Destroy channel chan_id. Its device file can no longer be opened.
+ * Must be called with kzimp_ctl_mutex held.
+ * Returns:
+ *  . -EINVAL if chan_id is not valid
+ *  . -ENODEV if the channel does not exist
+ *  . -EBUSY if the channel is opened
+ *  . the id of the channel otherwise
+ */
+static long kzimp_destroy_channel(int chan_id)
+{
+  int err;
 
-  if (copy_from_user(kbuff, buffer, len))
+  err = kzimp_take_channel(chan_id);
+  if (err)
   {
-    my_kfree(kbuff);
-    return -EFAULT;
+    return err;
   }
 
-  kbuff[len - 1] = '\0';
+  kzimp_free_channel(&kzimp_channels[chan_id]);
+  kzimp_free_big_msg_areas(&kzimp_channels[chan_id]);
+  kzimp_free_lanes(&kzimp_channels[chan_id]);
 
-  sscanf(kbuff, "%i %i %i %li %i", &chan_id, &channel_size, &max_msg_size, &to,
-      &compute_checksum);
+  return chan_id;
+}
 
-  my_kfree(kbuff);
+/*
+ * ioctl of the control device: create, resize or destroy a channel.
+ * Returns:
+ *  . -EFAULT if the parameters cannot be copied from user space
+ *  . -EINVAL if the command is not valid
+ *  . the error of the command, or the id of the channel, otherwise
+ */
+static long kzimp_ctl_ioctl(struct file *filp, unsigned int cmd,
+    unsigned long arg)
+{
+  struct kzimp_channel_params params;
+  long retval;
 
-  if (chan_id < 0 || chan_id >= nb_max_communication_channels)
+  if (cmd == KZIMP_IOCTL_CREATE_CHANNEL || cmd == KZIMP_IOCTL_RESIZE_CHANNEL)
   {
-    // channel id not valid
-    printk(KERN_WARNING "kzimp: channel id not valid: %i <= %i < %i", 0, chan_id, nb_max_communication_channels);
-    return len;
+    if (copy_from_user(&params, (void __user *) arg, sizeof(params)))
+    {
+      return -EFAULT;
+    }
   }
 
-  if (channel_size < 0)
-  {
-    // channel size not valid
-    printk(KERN_WARNING "kzimp: channel size not valid: %i < %i", channel_size, 0);
-    return len;
-  }
+  mutex_lock(&kzimp_ctl_mutex);
 
-  if (max_msg_size <= 0)
+  switch (cmd)
   {
-    // max message size not valid
-    printk(KERN_WARNING "kzimp: max message size not valid: %i <= %i", max_msg_size, 0);
-    return len;
-  }
+  case KZIMP_IOCTL_CREATE_CHANNEL:
+    retval = kzimp_create_channel(&params);
+    break;
 
-  if (to <= 0)
-  {
-    // timeout not valid
-    printk(KERN_WARNING "kzimp: timeout not valid: %li <= %i", to, 0);
-    return len;
-  }
+  case KZIMP_IOCTL_RESIZE_CHANNEL:
+    retval = kzimp_resize_channel(&params);
+    break;
 
-  spin_lock(&kzimp_channels[chan_id].bcl);
+  case KZIMP_IOCTL_DESTROY_CHANNEL:
+    retval = kzimp_destroy_channel((int) arg);
+    break;
 
-  // we can modify the channel only if there are no readers on it
-  if (kzimp_channels[chan_id].nb_readers == 0)
-  {
-    kzimp_free_channel(&kzimp_channels[chan_id]);
-    err = kzimp_init_channel(&kzimp_channels[chan_id], chan_id, max_msg_size,
-        channel_size, to, compute_checksum, 0);
+  default:
+    retval = -EINVAL;
+    break;
   }
 
-  spin_unlock(&kzimp_channels[chan_id].bcl);
-
-  if (unlikely(err))
-  {
-    printk  (KERN_WARNING "kzimp: Error %i at initialization of channel %i", err, chan_id);
-  }
+  mutex_unlock(&kzimp_ctl_mutex);
 
-  return len;
+  return retval;
 }
 
 static int kzimp_init_cdev(struct kzimp_comm_chan *channel, int i)
 {
   int err, devno;
 
+  INIT_LIST_HEAD(&channel->writers_big_msg);
+  INIT_LIST_HEAD(&channel->arena_chunks);
+  channel->lanes[0] = channel;
+  channel->lane0 = channel;
+
   err = kzimp_init_channel(channel, i, default_max_msg_size,
-      default_channel_size, default_timeout_in_ms, default_compute_checksum, 1);
+      default_channel_size, default_timeout_in_ms, default_compute_checksum,
+      default_mode, default_node, default_max_readers, default_data_path,
+      default_nb_lanes, 1);
   if (unlikely(err))
   {
     printk(KERN_ERR "kzimp: Error %i at initialization of channel %i", err, i);
     return -1;
   }
+  channel->created = 1;
+  channel->nb_files = 0;
 
   devno = MKDEV(kzimp_major, kzimp_minor + i);
 
@@ -839,6 +5400,7 @@ static int __init kzimp_start(void)
 {
   int i;
   int result;
+  char stats_name[32];
 
   // ADDING THE DEVICE FILES
   result = alloc_chrdev_region(&kzimp_dev_t, kzimp_minor, nb_max_communication_channels, DEVICE_NAME);
@@ -850,13 +5412,18 @@ static int __init kzimp_start(void)
     return result;
   }
 
-  kzimp_channels = my_kmalloc(nb_max_communication_channels * sizeof(struct kzimp_comm_chan), GFP_KERNEL);
+  kzimp_channels = my_kmalloc(nb_max_communication_channels * sizeof(struct kzimp_comm_chan), GFP_KERNEL | __GFP_ZERO);
   if (unlikely(!kzimp_channels))
   {
     printk(KERN_ERR "kzimp: channels allocation error\n");
     return -ENOMEM;
   }
 
+#ifdef CONFIG_X86
+  // __copy_from_user_nocache() uses movnti
+  nt_copy_supported = boot_cpu_has(X86_FEATURE_XMM2);
+#endif
+
   for (i=0; i<nb_max_communication_channels; i++)
   {
     result = kzimp_init_cdev(&kzimp_channels[i], i);
@@ -867,16 +5434,50 @@ static int __init kzimp_start(void)
     }
   }
 
+  // ADDING THE CONTROL DEVICE FILE
+  result = alloc_chrdev_region(&kzimp_ctl_dev_t, 0, 1, CTL_DEVICE_NAME);
+  if (unlikely(result < 0))
+  {
+    printk(KERN_ERR "kzimp: can't get major of the control device\n");
+    return result;
+  }
+
+  cdev_init(&kzimp_ctl_cdev, &kzimp_ctl_fops);
+  kzimp_ctl_cdev.owner = THIS_MODULE;
+
+  result = cdev_add(&kzimp_ctl_cdev, kzimp_ctl_dev_t, 1);
+  if (unlikely(result))
+  {
+    printk(KERN_ERR "kzimp: Error %d adding %s", result, CTL_DEVICE_NAME);
+    return -1;
+  }
+
   // CREATE /PROC FILE
-  proc_file = create_proc_entry(procfs_name, 0444, NULL);
+  proc_file = proc_create(procfs_name, 0444, NULL, &kzimp_proc_fops);
   if (unlikely(!proc_file))
   {
     remove_proc_entry(procfs_name, NULL);
     printk (KERN_ERR "kzimp: creation of /proc/%s file failed\n", procfs_name);
     return -1;
   }
-  proc_file->read_proc = kzimp_read_proc_file;
-  proc_file->write_proc = kzimp_write_proc_file;
+
+  // CREATE THE DEBUGFS FILES
+  // the statistics are optional: the module works without them
+  debugfs_dir = debugfs_create_dir(debugfs_name, NULL);
+  if (IS_ERR_OR_NULL(debugfs_dir))
+  {
+    printk(KERN_WARNING "kzimp: creation of the debugfs directory %s failed\n", debugfs_name);
+    debugfs_dir = NULL;
+  }
+  else
+  {
+    for (i = 0; i < nb_max_communication_channels; i++)
+    {
+      snprintf(stats_name, sizeof(stats_name), "channel%i", i);
+      debugfs_create_file(stats_name, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH,
+          debugfs_dir, &kzimp_channels[i], &kzimp_stats_fops);
+    }
+  }
 
   return 0;
 }
@@ -886,10 +5487,19 @@ static void __exit kzimp_end(void)
 {
   int i;
 
+  // remove the statistics files: nobody reads the channels after that
+  debugfs_remove_recursive(debugfs_dir);
+
+  // delete the control device
+  cdev_del(&kzimp_ctl_cdev);
+  unregister_chrdev_region(kzimp_ctl_dev_t, 1);
+
   // delete channels
   for (i=0; i<nb_max_communication_channels; i++)
   {
     kzimp_free_channel(&kzimp_channels[i]);
+    kzimp_free_big_msg_areas(&kzimp_channels[i]);
+    kzimp_free_lanes(&kzimp_channels[i]);
     kzimp_del_cdev(&kzimp_channels[i]);
   }
   my_kfree(kzimp_channels);
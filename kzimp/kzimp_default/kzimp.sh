@@ -56,6 +56,20 @@ while [ $i -lt ${NB_FILES} ]; do
 done
 }
 
+# the control device, to create and destroy the channels, if the module has one
+function create_ctl_file {
+CTL_MAJOR=`awk "\\$2==\"${DEVICE}_ctl\" {print \\$1}" /proc/devices`
+
+if [ -n "$CTL_MAJOR" ]; then
+   file=/dev/${DEVICE}_ctl
+
+   $SUDO mknod ${file} c $CTL_MAJOR 0
+   $SUDO chown $OWNER ${file}
+   $SUDO chgrp $GROUP ${file}
+   $SUDO chmod $MODE ${file}
+fi
+}
+
 function remove_files {
 $SUDO rm -f /dev/${DEVICE}*
 }
@@ -71,6 +85,7 @@ if [ $? -eq 0 ]; then
    if [ $# -eq 1 ]; then
       nb_max_communication_channels=$(echo $OPTIONS | sed 's/.*nb_max_communication_channels=\([[:digit:]]\+\).*/\1/' 2> /dev/null)
       create_files ${nb_max_communication_channels}
+      create_ctl_file
    fi
 
    device_specific_post_load
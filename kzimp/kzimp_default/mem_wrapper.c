@@ -106,6 +106,24 @@ void* mem_wrapper_kmalloc(size_t size, gfp_t flags, const char *file, int line)
    return ptr;
 }
 
+void* mem_wrapper_kmalloc_node(size_t size, gfp_t flags, int node, const char *file, int line)
+{
+   void *ptr;
+
+   spin_lock(&mem_ptr_lock);
+
+   ptr = kmalloc_node(size, flags, node);
+   if (ptr)
+   {
+      ptr_add(ptr, size);
+      mem_count_update(ptr, MEM_WRAP_MALLOC, size);
+   }
+
+   spin_unlock(&mem_ptr_lock);
+
+   return ptr;
+}
+
 void mem_wrapper_kfree(const void *ptr, const char *file, int line)
 {
    struct mem_node *node;
@@ -151,3 +169,139 @@ void mem_wrapper_stats(void)
 }
 
 #endif
+
+
+/*
+ * Allocate an area of size bytes (rounded up to HUGE_AREA_SIZE) made of huge pages,
+ * on the NUMA node node (-1 for the current node).
+ * Returns the address of the area in the kernel or NULL if there are not
+ * enough physically contiguous pages.
+ */
+void* huge_area_alloc(size_t size, int node)
+{
+  struct page **pages, *huge_page;
+  unsigned long nb_huge_pages, nb_pages, i, j;
+  void *area;
+
+  nb_huge_pages = (size + HUGE_AREA_SIZE - 1) >> HUGE_AREA_SHIFT;
+  nb_pages = nb_huge_pages << HUGE_AREA_ORDER;
+
+  pages = vmalloc(nb_pages * sizeof(*pages));
+  if (!pages)
+  {
+    return NULL;
+  }
+
+  for (i = 0; i < nb_huge_pages; i++)
+  {
+    huge_page = alloc_pages_node(node, GFP_KERNEL | __GFP_COMP | __GFP_NOWARN,
+        HUGE_AREA_ORDER);
+    if (!huge_page)
+    {
+      break;
+    }
+
+    for (j = 0; j < (1UL << HUGE_AREA_ORDER); j++)
+    {
+      pages[(i << HUGE_AREA_ORDER) + j] = huge_page + j;
+    }
+  }
+
+  area = NULL;
+  if (i == nb_huge_pages)
+  {
+    area = vmap(pages, nb_pages, VM_MAP, PAGE_KERNEL);
+  }
+
+  if (!area)
+  {
+    while (i-- > 0)
+    {
+      __free_pages(pages[i << HUGE_AREA_ORDER], HUGE_AREA_ORDER);
+    }
+  }
+
+  vfree(pages);
+
+  return area;
+}
+
+/*
+ * Free the area of size bytes allocated with huge_area_alloc()
+ */
+void huge_area_free(void *area, size_t size)
+{
+  struct page **huge_pages;
+  unsigned long nb_huge_pages, i;
+
+  if (!area)
+  {
+    return;
+  }
+
+  nb_huge_pages = (size + HUGE_AREA_SIZE - 1) >> HUGE_AREA_SHIFT;
+
+  huge_pages = kmalloc(nb_huge_pages * sizeof(*huge_pages), GFP_KERNEL);
+  if (!huge_pages)
+  {
+    printk(KERN_ERR "kzimp: cannot free the huge pages of the area %p\n", area);
+    vunmap(area);
+    return;
+  }
+
+  // get the huge pages before unmapping the area
+  for (i = 0; i < nb_huge_pages; i++)
+  {
+    huge_pages[i] = vmalloc_to_page(area + (i << HUGE_AREA_SHIFT));
+  }
+
+  vunmap(area);
+
+  for (i = 0; i < nb_huge_pages; i++)
+  {
+    __free_pages(huge_pages[i], HUGE_AREA_ORDER);
+  }
+
+  kfree(huge_pages);
+}
+
+/*
+ * Map in vma, from vma->vm_start, the size bytes at offset in the area allocated
+ * with huge_area_alloc(). offset must be a multiple of PAGE_SIZE and the mapping
+ * must not go beyond the area.
+ * All the pages are mapped now, one huge page at a time, rather than page by page
+ * when the process faults on them.
+ * Returns:
+ *  . -EAGAIN or -ENOMEM if remap_pfn_range() has failed
+ *  . 0 otherwise
+ */
+int huge_area_mmap(struct vm_area_struct *vma, char *area, unsigned long offset,
+    unsigned long size)
+{
+  unsigned long uaddr, len;
+  int err;
+
+  uaddr = vma->vm_start;
+  while (size > 0)
+  {
+    // the pages are physically contiguous up to the end of the current huge page
+    len = HUGE_AREA_SIZE - (offset & (HUGE_AREA_SIZE - 1));
+    if (len > size)
+    {
+      len = size;
+    }
+
+    err = remap_pfn_range(vma, uaddr, page_to_pfn(vmalloc_to_page(area + offset)),
+        len, vma->vm_page_prot);
+    if (err)
+    {
+      return err;
+    }
+
+    uaddr += len;
+    offset += len;
+    size -= len;
+  }
+
+  return 0;
+}
@@ -7,6 +7,7 @@
 
 #include <linux/slab.h>         /* kmalloc */
 #include <linux/vmalloc.h>      /* vmalloc */
+#include <linux/mm.h>           /* alloc_pages, remap_pfn_range */
 
 
 #ifdef MEMORY_WRAPPING
@@ -14,15 +15,18 @@
 #warning "Memory wrapper enabled"
 
 #define my_kmalloc(size, flags) mem_wrapper_kmalloc(size, flags, __FILE__, __LINE__)
+#define my_kmalloc_node(size, flags, node) mem_wrapper_kmalloc_node(size, flags, node, __FILE__, __LINE__)
 #define my_kfree(ptr) mem_wrapper_kfree(ptr, __FILE__, __LINE__)
 #define my_memory_stats() mem_wrapper_stats()
 
 //fixme: we do not take them into account in our wrapper
 #warning "There is no wrapper for vmalloc and vfree"
 #define my_vmalloc(size) vmalloc(size)
+#define my_vmalloc_node(size, node) vmalloc_node(size, node)
 #define my_vfree(ptr) vfree(ptr)
 
 void* mem_wrapper_kmalloc(size_t size, gfp_t flags, const char *file, int line);
+void* mem_wrapper_kmalloc_node(size_t size, gfp_t flags, int node, const char *file, int line);
 void mem_wrapper_kfree(const void *ptr, const char *file, int line);
 void mem_wrapper_stats(void);
 
@@ -31,11 +35,25 @@ void mem_wrapper_stats(void);
 #warning "No Memory wrapper" 
 
 #define my_kmalloc(size, flags) kmalloc(size, flags)
+#define my_kmalloc_node(size, flags, node) kmalloc_node(size, flags, node)
 #define my_kfree(ptr) kfree(ptr)
 #define my_vmalloc(size) vmalloc(size)
+#define my_vmalloc_node(size, node) vmalloc_node(size, node)
 #define my_vfree(ptr) vfree(ptr)
 #define my_memory_stats() do {} while(0);
 
 #endif
 
+// Memory areas made of physically contiguous huge pages of HUGE_AREA_SIZE bytes.
+// The huge pages are mapped contiguously in the kernel with vmap(), so that such an area
+// can be used like an area allocated with vmalloc().
+#define HUGE_AREA_SHIFT PMD_SHIFT  /* 2MB on x86-64 */
+#define HUGE_AREA_SIZE (1UL << HUGE_AREA_SHIFT)
+#define HUGE_AREA_ORDER (HUGE_AREA_SHIFT - PAGE_SHIFT)
+
+void* huge_area_alloc(size_t size, int node);
+void huge_area_free(void *area, size_t size);
+int huge_area_mmap(struct vm_area_struct *vma, char *area, unsigned long offset,
+    unsigned long size);
+
 #endif
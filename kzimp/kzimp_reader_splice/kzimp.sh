@@ -1 +0,0 @@
-../kzimp_default/kzimp.sh
\ No newline at end of file
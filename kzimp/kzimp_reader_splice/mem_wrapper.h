@@ -1 +0,0 @@
-../kzimp_default/mem_wrapper.h
\ No newline at end of file
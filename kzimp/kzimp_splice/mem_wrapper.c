@@ -1 +0,0 @@
-../kzimp_default/mem_wrapper.c
\ No newline at end of file
@@ -0,0 +1,149 @@
+/*
+ * Print the statistics of a kzimp channel (kzimp_allMessagesArea), read from its
+ * file in debugfs, with the percentiles of the latencies from the publication of
+ * the messages to their read.
+ * debugfs must be mounted, usually with mount -t debugfs none /sys/kernel/debug
+ *
+ * Compile with: gcc -Wall -o kzimp_stats kzimp_stats.c
+ * Usage: ./kzimp_stats [-r] <chan_id> [debugfs_dir]
+ *   -r resets the statistics of the channel instead of printing them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_DEBUGFS_DIR "/sys/kernel/debug"
+
+// Must be KZIMP_LATENCY_BUCKETS, in kzimp.h
+#define NB_BUCKETS 32
+
+static unsigned long long min_latency[NB_BUCKETS];
+static unsigned long nb_msgs[NB_BUCKETS];
+
+// print the upper bound of the latency of percentile p of the total messages
+static void print_percentile(double p, unsigned long total)
+{
+  unsigned long n;
+  int i;
+
+  n = 0;
+  for (i = 0; i < NB_BUCKETS; i++)
+  {
+    n += nb_msgs[i];
+    if (n >= p * total)
+    {
+      break;
+    }
+  }
+
+  if (i >= NB_BUCKETS - 1)
+  {
+    printf("p%g\t>= %llu ns\n", p * 100, min_latency[NB_BUCKETS - 1]);
+  }
+  else
+  {
+    printf("p%g\t< %llu ns\n", p * 100, (i == 0 ? 1ULL : min_latency[i] * 2));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  char filename[256];
+  char line[256];
+  const char *dir;
+  unsigned long total, max;
+  int reset, chan_id, i, b, in_histogram, bar;
+  FILE *f;
+
+  reset = (argc > 1 && !strcmp(argv[1], "-r"));
+  if (argc < 2 + reset)
+  {
+    printf("Usage: %s [-r] <chan_id> [debugfs_dir]\n", argv[0]);
+    return 0;
+  }
+
+  chan_id = atoi(argv[1 + reset]);
+  dir = (argc > 2 + reset ? argv[2 + reset] : DEFAULT_DEBUGFS_DIR);
+  snprintf(filename, sizeof(filename), "%s/kzimp/channel%i", dir, chan_id);
+
+  if (reset)
+  {
+    f = fopen(filename, "w");
+    if (!f || fputs("0\n", f) < 0 || fclose(f))
+    {
+      perror(filename);
+      return -1;
+    }
+    printf("Statistics of channel %i reset\n", chan_id);
+    return 0;
+  }
+
+  f = fopen(filename, "r");
+  if (!f)
+  {
+    perror(filename);
+    return -1;
+  }
+
+  // print the counters, keep the histogram
+  in_histogram = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (!strncmp(line, "bucket", 6))
+    {
+      in_histogram = 1;
+      continue;
+    }
+
+    if (!in_histogram)
+    {
+      fputs(line, stdout);
+      continue;
+    }
+
+    if (sscanf(line, "%i", &b) == 1 && b >= 0 && b < NB_BUCKETS)
+    {
+      sscanf(line, "%i %llu %lu", &b, &min_latency[b], &nb_msgs[b]);
+    }
+  }
+  fclose(f);
+
+  total = 0;
+  max = 0;
+  for (i = 0; i < NB_BUCKETS; i++)
+  {
+    total += nb_msgs[i];
+    max = (nb_msgs[i] > max ? nb_msgs[i] : max);
+  }
+
+  if (total == 0)
+  {
+    printf("no latency (is collect_latencies set?)\n");
+    return 0;
+  }
+
+  printf("latency_ns\tnb_msgs\n");
+  for (i = 0; i < NB_BUCKETS; i++)
+  {
+    if (nb_msgs[i] == 0)
+    {
+      continue;
+    }
+
+    printf(">= %llu\t%lu\t", min_latency[i], nb_msgs[i]);
+    for (bar = 0; bar < (int) (nb_msgs[i] * 50 / max); bar++)
+    {
+      putchar('#');
+    }
+    putchar('\n');
+  }
+
+  printf("\n");
+  print_percentile(0.5, total);
+  print_percentile(0.99, total);
+  print_percentile(0.999, total);
+
+  return 0;
+}
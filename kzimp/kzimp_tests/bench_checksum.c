@@ -0,0 +1,235 @@
+/* Compare the old checksum of kzimp (oneC_sum(), from Minix3) with a checksum that
+ * adds 64-bit words with carry, as csum_partial() does on x86-64.
+ * csum_partial() is not available in user space: csum64() is a C version of the same algorithm.
+ * For each message size, from 64B to 1MB, prints the time (in cycles per byte) of each
+ * routine and checks that csum64() gives the same sum as a 16-bit words reference.
+ *
+ * gcc -O2 -Wall -o bench_checksum bench_checksum.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_SIZE 64
+#define MAX_SIZE (1024*1024)
+
+// total number of bytes summed for each message size
+#define BYTES_PER_SIZE (256*1024*1024)
+
+#define rdtsc(val) { \
+    unsigned int __a,__d;                                        \
+    asm volatile("rdtsc" : "=a" (__a), "=d" (__d));              \
+    (val) = ((unsigned long)__a) | (((unsigned long)__d)<<32);   \
+}
+
+// The checksum used by kzimp until now
+short oneC_sum(short prev, void *data, size_t size)
+{
+  char *dptr;
+  size_t n;
+  short word;
+  int sum;
+  int swap = 0;
+
+  sum = prev;
+  dptr = data;
+  n = size;
+
+  swap = ((size_t) dptr & 1);
+  if (swap)
+  {
+    sum = ((sum & 0xFF) << 8) | ((sum & 0xFF00) >> 8);
+    if (n > 0)
+    {
+      ((char *) &word)[0] = 0;
+      ((char *) &word)[1] = dptr[0];
+      sum += (int) word;
+      dptr += 1;
+      n -= 1;
+    }
+  }
+
+  while (n >= 8)
+  {
+    sum += (int) ((short *) dptr)[0] + (int) ((short *) dptr)[1]
+                                                              + (int) ((short *) dptr)[2] + (int) ((short *) dptr)[3];
+    dptr += 8;
+    n -= 8;
+  }
+
+  while (n >= 2)
+  {
+    sum += (int) ((short *) dptr)[0];
+    dptr += 2;
+    n -= 2;
+  }
+
+  if (n > 0)
+  {
+    ((char *) &word)[0] = dptr[0];
+    ((char *) &word)[1] = 0;
+    sum += (int) word;
+  }
+
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  if (sum > 0xFFFF)
+    sum++;
+
+  if (swap)
+  {
+    sum = ((sum & 0xFF) << 8) | ((sum & 0xFF00) >> 8);
+  }
+
+  return sum;
+}
+
+// fold a 64-bit one's complement sum into 16 bits
+static inline uint16_t fold64(uint64_t sum)
+{
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return sum;
+}
+
+// add b to a, with end-around carry
+static inline uint64_t add64(uint64_t a, uint64_t b)
+{
+  a += b;
+  return a + (a < b);
+}
+
+// 16 bit one's complement sum of data, computed on 64-bit words.
+// data is assumed to be 8-bytes aligned (the kzimp messages are).
+uint16_t csum64(uint16_t prev, void *data, size_t size)
+{
+  uint64_t sum, w;
+  unsigned char *dptr;
+  size_t n;
+
+  sum = prev;
+  dptr = data;
+  n = size;
+
+  while (n >= 32)
+  {
+    sum = add64(sum, ((uint64_t *) dptr)[0]);
+    sum = add64(sum, ((uint64_t *) dptr)[1]);
+    sum = add64(sum, ((uint64_t *) dptr)[2]);
+    sum = add64(sum, ((uint64_t *) dptr)[3]);
+    dptr += 32;
+    n -= 32;
+  }
+
+  while (n >= 8)
+  {
+    sum = add64(sum, *(uint64_t *) dptr);
+    dptr += 8;
+    n -= 8;
+  }
+
+  if (n > 0)
+  {
+    w = 0;
+    memcpy(&w, dptr, n);
+    sum = add64(sum, w);
+  }
+
+  return fold64(sum);
+}
+
+// reference: 16 bit one's complement sum of the 16-bit words of data
+uint16_t csum16_ref(uint16_t prev, void *data, size_t size)
+{
+  uint64_t sum;
+  unsigned char *dptr;
+  size_t i;
+
+  sum = prev;
+  dptr = data;
+
+  for (i = 0; i + 1 < size; i += 2)
+  {
+    sum += dptr[i] | (dptr[i + 1] << 8);
+  }
+  if (i < size)
+  {
+    sum += dptr[i];
+  }
+
+  while (sum >> 16)
+  {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+
+  return sum;
+}
+
+int main(void)
+{
+  char *buf;
+  size_t size, i;
+  long it, nb_it;
+  uint64_t start, stop, cycles_old, cycles_new;
+  volatile int sink;
+  int nb_errors;
+
+  if (posix_memalign((void**) &buf, 64, MAX_SIZE))
+  {
+    perror("posix_memalign");
+    return -1;
+  }
+
+  srand(42);
+  for (i = 0; i < MAX_SIZE; i++)
+  {
+    buf[i] = rand();
+  }
+
+  nb_errors = 0;
+  printf("size\toneC_sum (cycles/B)\tcsum64 (cycles/B)\tspeedup\n");
+
+  for (size = MIN_SIZE; size <= MAX_SIZE; size *= 2)
+  {
+    // odd sizes must give the same sum too
+    if (csum64(0, buf, size) != csum16_ref(0, buf, size)
+        || csum64(0, buf, size - 1) != csum16_ref(0, buf, size - 1))
+    {
+      printf("Error: csum64 and the reference differ for size %lu\n", (unsigned long) size);
+      nb_errors++;
+    }
+
+    nb_it = BYTES_PER_SIZE / size;
+
+    rdtsc(start);
+    for (it = 0; it < nb_it; it++)
+    {
+      sink = oneC_sum(it, buf, size);
+    }
+    rdtsc(stop);
+    cycles_old = stop - start;
+
+    rdtsc(start);
+    for (it = 0; it < nb_it; it++)
+    {
+      sink = csum64(it, buf, size);
+    }
+    rdtsc(stop);
+    cycles_new = stop - start;
+
+    printf("%lu\t%f\t%f\t%f\n", (unsigned long) size,
+        (double) cycles_old / (nb_it * size),
+        (double) cycles_new / (nb_it * size),
+        (double) cycles_old / cycles_new);
+  }
+
+  (void) sink;
+  free(buf);
+
+  printf("Bench has finished with %i errors\n", nb_errors);
+
+  return 0;
+}
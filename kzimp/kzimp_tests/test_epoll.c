@@ -0,0 +1,167 @@
+/* 1 writer per channel and 1 reader on NB_CHANNELS channels, with an edge-triggered epoll.
+ * The reader only reads the messages announced by KZIMP_IOCTL_PENDING, then waits
+ * in epoll_wait() again: it must receive all the messages of each writer, in order,
+ * without ever blocking in read().
+ * The module must have at least NB_CHANNELS channels.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KZIMP_IOCTL_PENDING 0x9
+
+#define NB_CHANNELS 4
+#define NB_MSG_PER_WRITER 100000
+
+void do_reader(int *fd)
+{
+  int i, n, nb, r, v, nb_errors, nb_waits;
+  int next_seq[NB_CHANNELS];
+  int pending[NB_CHANNELS];
+  struct epoll_event ev, events[NB_CHANNELS];
+  int epfd;
+
+  nb_errors = 0;
+  nb_waits = 0;
+  memset(next_seq, 0, sizeof(next_seq));
+  memset(pending, 0, sizeof(pending));
+
+  epfd = epoll_create(NB_CHANNELS);
+  for (i = 0; i < NB_CHANNELS; i++)
+  {
+    // a read that would block is an error
+    fcntl(fd[i], F_SETFL, O_NONBLOCK);
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u32 = i;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd[i], &ev) < 0)
+    {
+      perror("epoll_ctl error");
+      return;
+    }
+  }
+
+  n = 0;
+  while (n < NB_CHANNELS * NB_MSG_PER_WRITER)
+  {
+    nb = epoll_wait(epfd, events, NB_CHANNELS, 10000);
+    nb_waits++;
+    if (nb <= 0)
+    {
+      printf("Error: epoll_wait returns %i after %i messages\n", nb, n);
+      nb_errors++;
+      break;
+    }
+
+    for (i = 0; i < nb; i++)
+    {
+      r = ioctl(fd[events[i].data.u32], KZIMP_IOCTL_PENDING);
+      if (r < 0)
+      {
+        perror("ioctl error");
+        nb_errors++;
+        continue;
+      }
+      pending[events[i].data.u32] = r;
+    }
+
+    // read all the messages announced by the channels
+    for (i = 0; i < NB_CHANNELS; i++)
+    {
+      while (pending[i] > 0)
+      {
+        r = read(fd[i], (void*) &v, sizeof(v));
+        if (r != sizeof(v))
+        {
+          perror("read error");
+          nb_errors++;
+          break;
+        }
+
+        if (v != next_seq[i])
+        {
+          printf("Error: received message %i from channel %i instead of %i\n", v, i, next_seq[i]);
+          nb_errors++;
+        }
+        next_seq[i] = v + 1;
+        pending[i]--;
+        n++;
+      }
+    }
+  }
+
+  close(epfd);
+
+  printf("Reader has finished with %i errors, %i epoll_wait for %i messages\n",
+      nb_errors, nb_waits, n);
+}
+
+void do_writer(int id)
+{
+  int fd, i;
+  char chaname[50];
+
+  snprintf(chaname, 50, "/dev/kzimp%i", id);
+  fd = open(chaname, O_WRONLY);
+
+  for (i = 0; i < NB_MSG_PER_WRITER; i++)
+  {
+    if (write(fd, (void*) &i, sizeof(i)) != sizeof(i))
+    {
+      perror("write error");
+      break;
+    }
+  }
+
+  close(fd);
+}
+
+int main(void)
+{
+  int i, j;
+  int fd[NB_CHANNELS];
+  char chaname[50];
+
+  // open before creating the writers, so that the reader does not miss any message
+  for (i = 0; i < NB_CHANNELS; i++)
+  {
+    snprintf(chaname, 50, "/dev/kzimp%i", i);
+    fd[i] = open(chaname, O_RDONLY);
+    if (fd[i] < 0)
+    {
+      printf("Error while opening channel %i\n", i);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < NB_CHANNELS; i++)
+  {
+    if (!fork())
+    {
+      for (j = 0; j < NB_CHANNELS; j++)
+      {
+        close(fd[j]);
+      }
+      do_writer(i);
+      return 0;
+    }
+  }
+
+  do_reader(fd);
+
+  for (i = 0; i < NB_CHANNELS; i++)
+  {
+    close(fd[i]);
+    wait(NULL);
+  }
+
+  return 0;
+}
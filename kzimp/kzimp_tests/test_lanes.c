@@ -0,0 +1,129 @@
+/* 1 writer and 1 reader on channel 0, which has 2 lanes.
+ * The writer sends NB_MSG data messages on lane 0, then a control message on lane 1.
+ * The reader does not read until the writer has finished: its first read must return
+ * the control message, then the data messages, in order.
+ * Channel 0 must have 2 lanes and at least NB_MSG + 1 messages, e.g.:
+ *   echo "0 100 64 1000 0 0 0 0 -1 64 0 0 1048576 2" > /proc/kzimp
+ *
+ * Usage: ./test_lanes
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define KZIMP_IOCTL_SET_LANE 0xB
+
+#define NB_MSG 50
+
+// value of the control message
+#define CONTROL_MSG -1
+
+void do_reader(int fd)
+{
+  int r, v, i, nb_errors;
+
+  nb_errors = 0;
+
+  r = read(fd, (void*) &v, sizeof(v));
+  if (r != sizeof(v))
+  {
+    perror("read error");
+    return;
+  }
+  if (v != CONTROL_MSG)
+  {
+    printf("Error: received message %i before the control message\n", v);
+    nb_errors++;
+  }
+
+  for (i = 0; i < NB_MSG; i++)
+  {
+    r = read(fd, (void*) &v, sizeof(v));
+    if (r != sizeof(v))
+    {
+      perror("read error");
+      nb_errors++;
+      break;
+    }
+
+    if (v != i)
+    {
+      printf("Error: received message %i instead of %i\n", v, i);
+      nb_errors++;
+    }
+  }
+
+  printf("Reader has finished with %i errors\n", nb_errors);
+}
+
+void do_writer(int fd)
+{
+  int i;
+
+  for (i = 0; i < NB_MSG; i++)
+  {
+    if (write(fd, (void*) &i, sizeof(i)) != sizeof(i))
+    {
+      perror("write error");
+      return;
+    }
+  }
+
+  if (ioctl(fd, KZIMP_IOCTL_SET_LANE, 1) < 0)
+  {
+    perror("Error while setting the lane (does channel 0 have 2 lanes?)");
+    return;
+  }
+
+  i = CONTROL_MSG;
+  if (write(fd, (void*) &i, sizeof(i)) != sizeof(i))
+  {
+    perror("write error");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int wfd, rfd;
+
+  wfd = open("/dev/kzimp0", O_WRONLY);
+  if (wfd < 0)
+  {
+    printf("Error while opening channel 0\n");
+    return -1;
+  }
+
+  // open before creating the writer, so that the reader does not miss any message
+  rfd = open("/dev/kzimp0", O_RDONLY);
+  if (rfd < 0)
+  {
+    printf("Error while opening channel 0\n");
+    return -1;
+  }
+
+  if (!fork())
+  {
+    close(rfd);
+    do_writer(wfd);
+    close(wfd);
+    return 0;
+  }
+  close(wfd);
+
+  // the control message is sent after the data messages
+  wait(NULL);
+
+  do_reader(rfd);
+
+  close(rfd);
+
+  return 0;
+}
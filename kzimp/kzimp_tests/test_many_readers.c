@@ -0,0 +1,88 @@
+/* 1 writer and more than 64 readers on the same channel.
+ * Each reader checks that it receives all the messages, in order.
+ * The module must be loaded with default_max_readers >= NB_READERS,
+ * so that the messages of the channel have a second level bitmap.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NB_READERS 100
+#define NB_MSG 100000
+
+void do_reader(int id, int fd)
+{
+  int i, r, m, nb_errors;
+
+  nb_errors = 0;
+
+  for (i = 0; i < NB_MSG; i++)
+  {
+    r = read(fd, (void*) &m, sizeof(m));
+    if (r != sizeof(m))
+    {
+      perror("read error");
+      nb_errors++;
+      break;
+    }
+
+    if (m != i)
+    {
+      printf("Error: reader %i received message %i instead of %i\n", id, m, i);
+      nb_errors++;
+      break;
+    }
+  }
+
+  printf("Reader %i has finished with %i errors\n", id, nb_errors);
+}
+
+int main(void)
+{
+  int i, fd, m;
+
+  for (i = 0; i < NB_READERS; i++)
+  {
+    // open before creating the writer, so that the reader does not miss any message
+    fd = open("/dev/kzimp0", O_RDONLY);
+    if (fd < 0)
+    {
+      printf("Cannot open reader %i: is default_max_readers >= %i?\n", i, NB_READERS);
+      return -1;
+    }
+
+    if (!fork())
+    {
+      do_reader(i, fd);
+      close(fd);
+      return 0;
+    }
+
+    close(fd);
+  }
+
+  fd = open("/dev/kzimp0", O_WRONLY);
+
+  for (m = 0; m < NB_MSG; m++)
+  {
+    if (write(fd, (void*) &m, sizeof(m)) != sizeof(m))
+    {
+      perror("write error");
+      break;
+    }
+  }
+
+  close(fd);
+
+  for (i = 0; i < NB_READERS; i++)
+  {
+    wait(NULL);
+  }
+
+  return 0;
+}
@@ -0,0 +1,317 @@
+/* Several writers (more than the channel size) and 1 reader on the same channel.
+ * Before the writers took a ticket, 2 writers could write the same message.
+ * The reader checks that it receives all the messages of each writer, in order.
+ * The channel size must be less than NB_WRITERS (it is 10 by default).
+ *
+ * With -m the test runs on a user-space model of the ring instead of /dev/kzimp0, thus
+ * without the module: the writers are threads that take a ticket with a fetch-and-add,
+ * wait for their turn on the message (write_seq) and for the reader (cursor mode), then
+ * publish the message and pass the turn to the writer of the next round. Some writers
+ * give up their message and publish a hole, which the reader skips.
+ *
+ * Usage: ./test_multi_writers [-m]
+ * Compile with -lpthread. The test returns EXIT_FAILURE if the reader finds errors.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define NB_WRITERS 16
+#define NB_MSG_PER_WRITER 100000
+
+// size of the ring of the model, less than NB_WRITERS
+#define MODEL_CHANNEL_SIZE 10
+
+// with the model, writer w gives up its messages i such that i % HOLE_PERIOD == w % HOLE_PERIOD
+#define HOLE_PERIOD 7
+
+// a ticket taken twice or a message overwritten before it is read blocks the model forever:
+// SIGALRM kills the test after this time, in seconds
+#define MODEL_TIMEOUT 60
+
+struct msg
+{
+  int writer;
+  int seq;
+};
+
+// a message of the model
+struct model_msg
+{
+  volatile unsigned long write_seq; /* ticket of the writer that has the turn, + MODEL_CHANNEL_SIZE once published */
+  int len;                          /* 0 for a hole */
+  struct msg m;
+};
+
+static struct model_msg model_ring[MODEL_CHANNEL_SIZE];
+static unsigned long model_next_write_idx;  /* next ticket */
+static volatile unsigned long model_cursor; /* next message read by the reader */
+
+// 1 if the test runs on the model
+static int use_model = 0;
+
+// return 1 if writer gives up its message seq, 0 otherwise
+static int is_given_up(int writer, int seq)
+{
+  return (use_model && seq % HOLE_PERIOD == writer % HOLE_PERIOD);
+}
+
+// return the next message of writer from seq that it does not give up
+static int next_sent_seq(int writer, int seq)
+{
+  while (seq < NB_MSG_PER_WRITER && is_given_up(writer, seq))
+  {
+    seq++;
+  }
+  return seq;
+}
+
+// Check that m is the next message of its writer.
+// Return 1 if it is the case, 0 otherwise.
+static int check_msg(int *next_seq, struct msg *m)
+{
+  if (m->writer < 0 || m->writer >= NB_WRITERS || m->seq != next_seq[m->writer])
+  {
+    printf("Error: received message %i from writer %i\n", m->seq, m->writer);
+    return 0;
+  }
+
+  next_seq[m->writer] = next_sent_seq(m->writer, m->seq + 1);
+  return 1;
+}
+
+// Check that all the messages have been received.
+// Return the number of errors.
+static int check_all_received(int *next_seq)
+{
+  int i, nb_errors;
+
+  nb_errors = 0;
+  for (i = 0; i < NB_WRITERS; i++)
+  {
+    if (next_seq[i] != NB_MSG_PER_WRITER)
+    {
+      printf("Error: received messages from writer %i until %i instead of %i\n",
+          i, next_seq[i], NB_MSG_PER_WRITER);
+      nb_errors++;
+    }
+  }
+
+  return nb_errors;
+}
+
+// return the number of errors
+int do_reader(int fd)
+{
+  int i, r, nb_errors;
+  int next_seq[NB_WRITERS];
+  struct msg m;
+
+  nb_errors = 0;
+  memset(next_seq, 0, sizeof(next_seq));
+
+  for (i = 0; i < NB_WRITERS * NB_MSG_PER_WRITER; i++)
+  {
+    r = read(fd, (void*) &m, sizeof(m));
+    if (r != sizeof(m))
+    {
+      perror("read error");
+      nb_errors++;
+      break;
+    }
+
+    if (!check_msg(next_seq, &m))
+    {
+      nb_errors++;
+    }
+  }
+
+  nb_errors += check_all_received(next_seq);
+
+  printf("Reader has finished with %i errors\n", nb_errors);
+
+  return nb_errors;
+}
+
+void do_writer(int id)
+{
+  int fd, i;
+  struct msg m;
+
+  fd = open("/dev/kzimp0", O_WRONLY);
+
+  m.writer = id;
+  for (i = 0; i < NB_MSG_PER_WRITER; i++)
+  {
+    m.seq = i;
+    if (write(fd, (void*) &m, sizeof(m)) != sizeof(m))
+    {
+      perror("write error");
+      break;
+    }
+  }
+
+  close(fd);
+}
+
+// A writer of the model: the same steps as kzimp_wait_for_writing_if_needed() then
+// kzimp_finalize_write() in cursor mode, without the timeout
+void* model_writer(void *arg)
+{
+  int id, i;
+  unsigned long ticket;
+  struct model_msg *mm;
+
+  id = (int) (long) arg;
+
+  for (i = 0; i < NB_MSG_PER_WRITER; i++)
+  {
+    ticket = __sync_fetch_and_add(&model_next_write_idx, 1);
+    mm = &model_ring[ticket % MODEL_CHANNEL_SIZE];
+
+    // writer_has_turn(): the writer of the previous round has published its message
+    while (mm->write_seq != ticket)
+    {
+      sched_yield();
+    }
+
+    // kzimp_writer_can_write(): the reader has read the message of the previous round
+    while (ticket - model_cursor >= MODEL_CHANNEL_SIZE)
+    {
+      sched_yield();
+    }
+    __sync_synchronize();
+
+    if (is_given_up(id, i))
+    {
+      mm->len = 0;
+    }
+    else
+    {
+      mm->m.writer = id;
+      mm->m.seq = i;
+      mm->len = sizeof(mm->m);
+    }
+
+    // kzimp_pass_turn(): the message is visible before write_seq
+    __sync_synchronize();
+    mm->write_seq = ticket + MODEL_CHANNEL_SIZE;
+  }
+
+  return NULL;
+}
+
+// The reader of the model reads the messages in the order of the tickets and skips the holes.
+// Return the number of errors.
+int do_model_reader(void)
+{
+  int i, nb_errors;
+  int next_seq[NB_WRITERS];
+  unsigned long seq;
+  struct model_msg *mm;
+  struct msg m;
+
+  nb_errors = 0;
+  for (i = 0; i < NB_WRITERS; i++)
+  {
+    next_seq[i] = next_sent_seq(i, 0);
+  }
+
+  for (seq = 0; seq < NB_WRITERS * NB_MSG_PER_WRITER; seq++)
+  {
+    mm = &model_ring[seq % MODEL_CHANNEL_SIZE];
+    while (mm->write_seq != seq + MODEL_CHANNEL_SIZE)
+    {
+      sched_yield();
+    }
+    __sync_synchronize();
+
+    if (mm->len > 0)
+    {
+      m = mm->m;
+      if (!check_msg(next_seq, &m))
+      {
+        nb_errors++;
+      }
+    }
+
+    // the writer of the next round on mm can overwrite it
+    __sync_synchronize();
+    model_cursor = seq + 1;
+  }
+
+  nb_errors += check_all_received(next_seq);
+
+  printf("Reader of the model has finished with %i errors\n", nb_errors);
+
+  return nb_errors;
+}
+
+int run_model(void)
+{
+  int i, nb_errors;
+  pthread_t writers[NB_WRITERS];
+
+  use_model = 1;
+  alarm(MODEL_TIMEOUT);
+
+  for (i = 0; i < MODEL_CHANNEL_SIZE; i++)
+  {
+    model_ring[i].write_seq = i;
+  }
+
+  for (i = 0; i < NB_WRITERS; i++)
+  {
+    pthread_create(&writers[i], NULL, model_writer, (void*) (long) i);
+  }
+
+  nb_errors = do_model_reader();
+
+  for (i = 0; i < NB_WRITERS; i++)
+  {
+    pthread_join(writers[i], NULL);
+  }
+
+  return nb_errors;
+}
+
+int main(int argc, char **argv)
+{
+  int i, fd, nb_errors;
+
+  if (argc > 1 && !strcmp(argv[1], "-m"))
+  {
+    return (run_model() > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
+  // open before creating the writers, so that the reader does not miss any message
+  fd = open("/dev/kzimp0", O_RDONLY);
+
+  for (i = 0; i < NB_WRITERS; i++)
+  {
+    if (!fork())
+    {
+      close(fd);
+      do_writer(i);
+      return 0;
+    }
+  }
+
+  nb_errors = do_reader(fd);
+  close(fd);
+
+  for (i = 0; i < NB_WRITERS; i++)
+  {
+    wait(NULL);
+  }
+
+  return (nb_errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,150 @@
+/* 1 writer and 1 slow reader on channel 0, with the overflow policy given in argument.
+ * The reader does not read until the writer has finished: the writer experiences
+ * timeouts and moves the reader instead of waiting for it.
+ * With KZIMP_OVERFLOW_SPILL, the reader must receive all the messages, in order, as long
+ * as they fit in its backlog. With KZIMP_OVERFLOW_SKIP, or when the backlog is full, read()
+ * fails with EPIPE and KZIMP_IOCTL_GAP gives the number of messages lost: the next
+ * message must be the one after the gap.
+ * Channel 0 must be in cursor mode, with a small timeout, e.g.:
+ *   echo "0 10 64 10 0 0 0 1" > /proc/kzimp
+ *
+ * Usage: ./test_overflow <overflow_policy (2: spill, 3: skip)> [backlog_size]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define KZIMP_IOCTL_SET_OVERFLOW_POLICY 0x6
+#define KZIMP_IOCTL_GAP 0xA
+
+#define KZIMP_OVERFLOW_SPILL 2
+#define KZIMP_OVERFLOW_SKIP 3
+
+#define NB_MSG 1000
+
+void do_reader(int fd)
+{
+  int r, v, next_seq, nb_errors, nb_gaps, nb_lost, nb_msgs;
+
+  nb_errors = 0;
+  nb_gaps = 0;
+  nb_lost = 0;
+  nb_msgs = 0;
+  next_seq = 0;
+
+  // the writer has finished: the last message is NB_MSG - 1
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  while (next_seq < NB_MSG)
+  {
+    r = read(fd, (void*) &v, sizeof(v));
+    if (r < 0 && errno == EPIPE)
+    {
+      r = ioctl(fd, KZIMP_IOCTL_GAP);
+      if (r <= 0)
+      {
+        printf("Error: gap of %i messages after message %i\n", r, next_seq - 1);
+        nb_errors++;
+        break;
+      }
+      next_seq += r;
+      nb_lost += r;
+      nb_gaps++;
+      continue;
+    }
+    else if (r != sizeof(v))
+    {
+      perror("read error");
+      nb_errors++;
+      break;
+    }
+
+    if (v != next_seq)
+    {
+      printf("Error: received message %i instead of %i\n", v, next_seq);
+      nb_errors++;
+    }
+    next_seq = v + 1;
+    nb_msgs++;
+  }
+
+  printf("Reader has finished with %i errors: %i messages read, %i lost in %i gaps\n",
+      nb_errors, nb_msgs, nb_lost, nb_gaps);
+}
+
+void do_writer(int fd)
+{
+  int i;
+
+  for (i = 0; i < NB_MSG; i++)
+  {
+    if (write(fd, (void*) &i, sizeof(i)) != sizeof(i))
+    {
+      perror("write error");
+      break;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long args[2];
+  int wfd, rfd;
+
+  if (argc < 2)
+  {
+    printf("Usage: %s <overflow_policy (%i: spill, %i: skip)> [backlog_size]\n",
+        argv[0], KZIMP_OVERFLOW_SPILL, KZIMP_OVERFLOW_SKIP);
+    return 0;
+  }
+
+  args[0] = atoi(argv[1]);
+  args[1] = (argc > 2 ? strtoul(argv[2], NULL, 10) : 1 << 20);
+
+  wfd = open("/dev/kzimp0", O_WRONLY);
+  if (wfd < 0)
+  {
+    printf("Error while opening channel 0\n");
+    return -1;
+  }
+
+  // before the reader opens the channel: its backlog is allocated at open
+  if (ioctl(wfd, KZIMP_IOCTL_SET_OVERFLOW_POLICY, args) < 0)
+  {
+    perror("Error while setting the overflow policy (is channel 0 in cursor mode?)");
+    return -1;
+  }
+
+  // open before creating the writer, so that the reader does not miss any message
+  rfd = open("/dev/kzimp0", O_RDONLY);
+  if (rfd < 0)
+  {
+    printf("Error while opening channel 0\n");
+    return -1;
+  }
+
+  if (!fork())
+  {
+    close(rfd);
+    do_writer(wfd);
+    close(wfd);
+    return 0;
+  }
+  close(wfd);
+
+  // the reader is late
+  wait(NULL);
+
+  do_reader(rfd);
+
+  close(rfd);
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+/* Reconnect storm on channel 0, which must have the writer splice data path
+ * (e.g. load kzimp with default_data_path=1).
+ * A writer opens the channel, sends a message from its big messages area and closes the
+ * channel, NB_RECONNECTS times, while 1 reader reads the messages.
+ * The big messages areas of the writers are reused or freed once their messages have been
+ * read: the size of the big messages areas of the channel, in /proc/kzimp, must be the same
+ * after WARMUP reconnections and at the end.
+ *
+ * Usage: ./test_reconnect [nb_reconnects]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KZIMP_IOCTL_SPLICE_WRITE 0x1
+
+#define MSG_SIZE 64
+
+#define NB_RECONNECTS 10000
+
+// once the channel and the pool of unused areas are full of areas of previous writers
+#define WARMUP 1000
+
+#define PROC_LINE_SIZE 1024
+
+// return the size of the big messages areas of channel 0, or -1 on error
+long big_msg_areas_size(void)
+{
+  char line[PROC_LINE_SIZE];
+  long chan_id, messages, area, arena, in_use, big;
+  int in_footprint;
+  FILE *f;
+
+  f = fopen("/proc/kzimp", "r");
+  if (!f)
+  {
+    perror("Error while opening /proc/kzimp");
+    return -1;
+  }
+
+  // the footprint table starts with the header of its big_msg_areas column
+  in_footprint = 0;
+  big = -1;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (strstr(line, "big_msg_areas"))
+    {
+      in_footprint = 1;
+    }
+    else if (in_footprint && sscanf(line, "%li %li %li %li %li %li", &chan_id,
+        &messages, &area, &arena, &in_use, &big) == 6 && chan_id == 0)
+    {
+      break;
+    }
+  }
+
+  fclose(f);
+
+  return big;
+}
+
+// open channel 0, send a message from the big messages area and close the channel
+int reconnect(int i)
+{
+  unsigned long args[3];
+  char *msg;
+  int fd;
+
+  fd = open("/dev/kzimp0", O_WRONLY);
+  if (fd < 0)
+  {
+    perror("Error while opening channel 0");
+    return -1;
+  }
+
+  msg = mmap(NULL, MSG_SIZE, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+  if (msg == (void*) -1)
+  {
+    perror("mmap failed");
+    close(fd);
+    return -1;
+  }
+
+  memcpy(msg, &i, sizeof(i));
+
+  //  -arg[0]: user-space address of the message
+  //  -arg[1]: offset in the big memory area
+  //  -arg[2]: length
+  args[0] = (unsigned long) msg;
+  args[1] = 0;
+  args[2] = MSG_SIZE;
+  if (ioctl(fd, KZIMP_IOCTL_SPLICE_WRITE, args) != MSG_SIZE)
+  {
+    perror("splice write error");
+  }
+
+  munmap(msg, MSG_SIZE);
+  close(fd);
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char buf[MSG_SIZE];
+  long warm_size, end_size;
+  int rfd, i, v, n, nb_errors;
+
+  n = (argc > 1 ? atoi(argv[1]) : NB_RECONNECTS);
+
+  // we need a reader, otherwise the multicast mask is at 0
+  rfd = open("/dev/kzimp0", O_RDONLY);
+  if (rfd < 0)
+  {
+    perror("Error while opening channel 0");
+    return -1;
+  }
+
+  nb_errors = 0;
+  warm_size = -1;
+  for (i = 0; i < n; i++)
+  {
+    if (reconnect(i))
+    {
+      nb_errors++;
+      break;
+    }
+
+    if (read(rfd, buf, sizeof(buf)) != MSG_SIZE)
+    {
+      perror("read error");
+      nb_errors++;
+      break;
+    }
+    memcpy(&v, buf, sizeof(v));
+    if (v != i)
+    {
+      printf("Error: received message %i instead of %i\n", v, i);
+      nb_errors++;
+    }
+
+    if (i == WARMUP)
+    {
+      warm_size = big_msg_areas_size();
+    }
+  }
+
+  end_size = big_msg_areas_size();
+  printf("big messages areas: %li bytes after %i reconnections, %li bytes after %i\n",
+      warm_size, WARMUP, end_size, i);
+  if (warm_size >= 0 && end_size != warm_size)
+  {
+    printf("Error: the big messages areas have grown\n");
+    nb_errors++;
+  }
+
+  printf("Test has finished with %i errors\n", nb_errors);
+
+  close(rfd);
+
+  return 0;
+}
@@ -9,6 +9,7 @@
 
 #include <sys/uio.h>
 
+// The channel must have the writer splice data path (e.g. load kzimp with default_data_path=1)
 #define MAX_MSG_SIZE 10240
 #define CHAN_SIZE (1+1)
 #define NB_MSG 10
@@ -0,0 +1,74 @@
+/*
+ * Small library to create, resize and destroy the kzimp channels,
+ * with the ioctls of the control device of kzimp (kzimp_allMessagesArea).
+ * It can be compiled with a C or a C++ compiler.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kzimp_ctl.h"
+
+// send the command cmd with argument arg to the control device.
+// Return the result of the ioctl, or -1 if an error has occured (errno is set)
+static int kzimp_ctl(unsigned int cmd, unsigned long arg)
+{
+  int fd, r, err;
+
+  fd = open(KZIMP_CTL_DEV_FILE, O_RDWR);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  r = ioctl(fd, cmd, arg);
+
+  // close() must not overwrite the error of ioctl()
+  err = errno;
+  close(fd);
+  errno = err;
+
+  return r;
+}
+
+int kzimp_create_channel(int chan_id, int channel_size, int max_msg_size,
+    long timeout_in_ms, int compute_checksum, int max_readers, int data_path)
+{
+  struct kzimp_channel_params params;
+
+  params.chan_id = chan_id;
+  params.channel_size = channel_size;
+  params.max_msg_size = max_msg_size;
+  params.timeout_in_ms = timeout_in_ms;
+  params.compute_checksum = compute_checksum;
+  params.max_readers = max_readers;
+  params.data_path = data_path;
+
+  return kzimp_ctl(KZIMP_IOCTL_CREATE_CHANNEL, (unsigned long) &params);
+}
+
+int kzimp_resize_channel(int chan_id, int channel_size, int max_msg_size,
+    long timeout_in_ms, int compute_checksum, int max_readers, int data_path)
+{
+  struct kzimp_channel_params params;
+
+  params.chan_id = chan_id;
+  params.channel_size = channel_size;
+  params.max_msg_size = max_msg_size;
+  params.timeout_in_ms = timeout_in_ms;
+  params.compute_checksum = compute_checksum;
+  params.max_readers = max_readers;
+  params.data_path = data_path;
+
+  return kzimp_ctl(KZIMP_IOCTL_RESIZE_CHANNEL, (unsigned long) &params);
+}
+
+int kzimp_destroy_channel(int chan_id)
+{
+  return kzimp_ctl(KZIMP_IOCTL_DESTROY_CHANNEL, (unsigned long) chan_id);
+}
@@ -0,0 +1,65 @@
+/*
+ * Small library to create, resize and destroy the kzimp channels,
+ * with the ioctls of the control device of kzimp (kzimp_allMessagesArea).
+ * It can be compiled with a C or a C++ compiler.
+ */
+
+#ifndef _KZIMP_CTL_LIB_
+#define _KZIMP_CTL_LIB_
+
+#define KZIMP_CTL_DEV_FILE "/dev/kzimp_ctl"
+
+// IOCTL commands of the control device. They are also defined in kzimp.h
+// arg is a pointer to a struct kzimp_channel_params
+#define KZIMP_IOCTL_CREATE_CHANNEL 0x10
+#define KZIMP_IOCTL_RESIZE_CHANNEL 0x11
+// arg is the id of the channel
+#define KZIMP_IOCTL_DESTROY_CHANNEL 0x12
+
+// Data paths of a channel. They are also defined in kzimp.h
+#define KZIMP_DATA_PATH_COPY 0          /* the messages are copied by write() and read() */
+#define KZIMP_DATA_PATH_WRITER_SPLICE 1 /* the writers mmap their messages (KZIMP_IOCTL_SPLICE_WRITE, KZIMP_IOCTL_POOL_WRITE) */
+#define KZIMP_DATA_PATH_READER_SPLICE 2 /* the readers mmap the messages (KZIMP_IOCTL_SPLICE_START_READ, _FINISH_READ) */
+#define KZIMP_DATA_PATH_ARENA 3         /* as KZIMP_DATA_PATH_COPY, the memory of the channel follows the bytes in flight */
+
+// Parameters of a channel. It is also defined in kzimp.h
+struct kzimp_channel_params
+{
+  int chan_id;          /* id of the channel. -1 to create the channel with the first free id */
+  int channel_size;     /* max number of messages in the channel */
+  int max_msg_size;     /* max message size */
+  int compute_checksum; /* do we compute the checksum? 0: no, 1: yes, 2: partial */
+  long timeout_in_ms;   /* writer's timeout in miliseconds */
+  int max_readers;      /* max number of readers. -1 for the default one */
+  int data_path;        /* KZIMP_DATA_PATH_COPY, _WRITER_SPLICE, _READER_SPLICE or _ARENA. -1 for the default one */
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/********************** Exported interface **********************/
+
+// Create the channel chan_id, or the first free channel if chan_id is -1.
+// Its device file is /dev/kzimp<id>. If max_readers (resp. data_path) is -1, the channel
+// has the default max number of readers (resp. data path) of the module.
+// Return the id of the channel or -1 if an error has occured (errno is set)
+int kzimp_create_channel(int chan_id, int channel_size, int max_msg_size,
+    long timeout_in_ms, int compute_checksum, int max_readers, int data_path);
+
+// Resize the channel chan_id, which must not be opened.
+// A parameter that is -1 is not modified.
+// Return the id of the channel or -1 if an error has occured (errno is set)
+int kzimp_resize_channel(int chan_id, int channel_size, int max_msg_size,
+    long timeout_in_ms, int compute_checksum, int max_readers, int data_path);
+
+// Destroy the channel chan_id, which must not be opened.
+// Return the id of the channel or -1 if an error has occured (errno is set)
+int kzimp_destroy_channel(int chan_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
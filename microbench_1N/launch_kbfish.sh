@@ -5,22 +5,24 @@
 #  $2: message size in B
 #  $3: duration of the experiment in seconds
 #  $4: max nb of messages in the circular buffer
+#  $5 (optional): mmap, to send and receive the messages in user space with libkbfish
 
 
 KBFISH_DIR="../kbfish"
 
 # get arguments
-if [ $# -eq 4 ]; then
+if [ $# -eq 4 ] || [ $# -eq 5 ]; then
    NB_CONSUMERS=$1
    MSG_SIZE=$2
    DURATION_XP=$3
    MAX_NB_MSG=$4
+   MODE=$5
 else
-   echo "Usage: ./$(basename $0) <nb_consumers> <message_size_in_B> <xp_duration_in_sec> <max_nb_messages_in_circular_buffer>"
+   echo "Usage: ./$(basename $0) <nb_consumers> <message_size_in_B> <xp_duration_in_sec> <max_nb_messages_in_circular_buffer> [mmap]"
    exit 0
 fi
 
-OUTPUT_DIR="microbench_kbfish_${NB_CONSUMERS}consumers_${DURATION_XP}sec_${MSG_SIZE}B_${MAX_NB_MSG}messages_in_buffer"
+OUTPUT_DIR="microbench_kbfish${MODE:+_$MODE}_${NB_CONSUMERS}consumers_${DURATION_XP}sec_${MSG_SIZE}B_${MAX_NB_MSG}messages_in_buffer"
 
 if [ -d $OUTPUT_DIR ]; then
    echo KZIMP ${NB_CONSUMERS} consumers, ${DURATION_XP} sec, ${MSG_SIZE}B ${MAX_NB_MSG} msg in channel already done
@@ -40,7 +42,6 @@ fi
 
 #compile and load module
 cd $KBFISH_DIR
-echo "-DMESSAGE_BYTES=${REAL_MSG_SIZE}" > KBFISH_PROPERTIES
 make
 ./kbfish.sh unload
 ./kbfish.sh load nb_max_communication_channels=${NB_CONSUMERS} default_channel_size=${MAX_NB_MSG} default_max_msg_size=${REAL_MSG_SIZE} 
@@ -52,7 +53,11 @@ cd -
 
 # launch XP
 #./get_memory_usage.sh  $MEMORY_DIR &
-echo "" > KBFISH_PROPERTIES
+if [ "$MODE" == "mmap" ]; then
+   echo "-DKBFISH_MMAP" > KBFISH_PROPERTIES
+else
+   echo "" > KBFISH_PROPERTIES
+fi
 make kbfish_microbench
 timelimit -p -s 9 -t $((${DURATION_XP}+30)) ./bin/kbfish_microbench -r $NB_CONSUMERS -s $MSG_SIZE -t $DURATION_XP
 
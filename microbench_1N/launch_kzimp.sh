@@ -11,11 +11,45 @@ KZIMP_DIR="../kzimp/kzimp_allMessagesArea"
 
 
 # Do we compute the checksum?
-COMPUTE_CHKSUM=1
+# Can be set from the environment (see launch_xp_kzimp_copy.sh).
+COMPUTE_CHKSUM=${COMPUTE_CHKSUM:-1}
 
 # Writer's timeout
 KZIMP_TIMEOUT=60000
 
+# Wait policy of the readers and writers: 0 to block, 1 to spin then block, 2 to spin.
+# MAX_SPIN_NS is the max spin time when spinning then blocking.
+WAIT_POLICY=0
+MAX_SPIN_NS=50000
+
+# Channel mode: 0 if the readers clear a bitmap per message, 1 if they publish a read cursor.
+# Can be set from the environment (see launch_xp_kzimp_modes.sh).
+KZIMP_MODE=${KZIMP_MODE:-0}
+
+# Number of messages sent/received per system call (batch ioctls).
+# Set it to 1 to use write() and read().
+BATCH_SIZE=1
+
+# Set it to 1 to have the p50/p99 latency (in usec) of the messages in the consumers statistics.
+# The messages must be at least 9B long.
+LATENCY_MEASUREMENT=0
+
+# Set it to 1 to resize the channel with the control device (/dev/kzimp_ctl) instead of
+# reloading the module before each experiment. The module is loaded if it is not already.
+KZIMP_CTL=${KZIMP_CTL:-0}
+
+# Set it to 1 (KZIMP_IOCTL_SPLICE_WRITE) or 2 (KZIMP_IOCTL_POOL_WRITE) to have the producer write
+# its messages in its mapped big messages area instead of calling write(): the channel then
+# has the writer splice data path.
+# Can be set from the environment (see launch_xp_kzimp_zero_copy.sh).
+KZIMP_ZERO_COPY=${KZIMP_ZERO_COPY:-0}
+
+# The producer copies the messages of at least NT_COPY_THRESHOLD bytes with non-temporal stores,
+# the consumers copy the messages of at least PREFETCH_COPY_THRESHOLD bytes with prefetching.
+# 0 to never use them. Can be set from the environment (see launch_xp_kzimp_copy.sh).
+NT_COPY_THRESHOLD=${NT_COPY_THRESHOLD:-4096}
+PREFETCH_COPY_THRESHOLD=${PREFETCH_COPY_THRESHOLD:-0}
+
 
 # get arguments
 if [ $# -eq 4 ]; then
@@ -28,7 +62,36 @@ else
    exit 0
 fi
 
+if [ $KZIMP_ZERO_COPY -ne 0 ]; then
+   DATA_PATH=1
+else
+   DATA_PATH=0
+fi
+
+# a channel has 64 readers by default: above, its messages have a second level bitmap
+MAX_READERS=$(( ${NB_CONSUMERS} > 64 ? ${NB_CONSUMERS} : 64 ))
+
 OUTPUT_DIR="microbench_kzimp_${NB_CONSUMERS}consumers_${DURATION_XP}sec_${MSG_SIZE}B_${MAX_NB_MSG}messages_in_buffer"
+if [ $BATCH_SIZE -gt 1 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_batch${BATCH_SIZE}"
+fi
+if [ $WAIT_POLICY -ne 0 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_wait${WAIT_POLICY}"
+fi
+if [ $KZIMP_MODE -eq 1 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_cursor"
+fi
+if [ $KZIMP_ZERO_COPY -eq 1 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_splice"
+elif [ $KZIMP_ZERO_COPY -eq 2 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_pool"
+fi
+if [ $COMPUTE_CHKSUM -ne 1 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_chksum${COMPUTE_CHKSUM}"
+fi
+if [ $NT_COPY_THRESHOLD -ne 4096 ] || [ $PREFETCH_COPY_THRESHOLD -ne 0 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_nt${NT_COPY_THRESHOLD}_prefetch${PREFETCH_COPY_THRESHOLD}"
+fi
 
 if [ -d $OUTPUT_DIR ]; then
    echo KZIMP ${NB_CONSUMERS} consumers, ${DURATION_XP} sec, ${MSG_SIZE}B ${MAX_NB_MSG} msg in channel already done
@@ -42,23 +105,43 @@ fi
 #compile and load module
 cd $KZIMP_DIR
 make
-./kzimp.sh unload
-./kzimp.sh load nb_max_communication_channels=1 default_channel_size=${MAX_NB_MSG} default_max_msg_size=${MSG_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM}
-if [ $? -eq 1 ]; then
-   echo "An error has occured when loading kzimp. Aborting the experiment $OUTPUT_DIR"
-   exit 0
+if [ $KZIMP_CTL -eq 1 ] && [ -e /dev/kzimp_ctl ]; then
+   echo "kzimp already loaded, the channel will be resized"
+   echo ${NT_COPY_THRESHOLD} > /sys/module/kzimp/parameters/nt_copy_threshold
+   echo ${PREFETCH_COPY_THRESHOLD} > /sys/module/kzimp/parameters/prefetch_copy_threshold
+else
+   ./kzimp.sh unload
+   ./kzimp.sh load nb_max_communication_channels=1 default_channel_size=${MAX_NB_MSG} default_max_msg_size=${MSG_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM} default_wait_policy=${WAIT_POLICY} default_max_spin_ns=${MAX_SPIN_NS} default_mode=${KZIMP_MODE} default_max_readers=${MAX_READERS} default_data_path=${DATA_PATH} nt_copy_threshold=${NT_COPY_THRESHOLD} prefetch_copy_threshold=${PREFETCH_COPY_THRESHOLD}
+   if [ $? -eq 1 ]; then
+      echo "An error has occured when loading kzimp. Aborting the experiment $OUTPUT_DIR"
+      exit 0
+   fi
 fi
 cd -
 
 # launch XP
 #./get_memory_usage.sh  $MEMORY_DIR &
 echo "" > KZIMP_PROPERTIES
+if [ $BATCH_SIZE -gt 1 ]; then
+   echo "-DKZIMP_BATCH_SIZE=${BATCH_SIZE}" >> KZIMP_PROPERTIES
+fi
+if [ $LATENCY_MEASUREMENT -eq 1 ]; then
+   echo "-DLATENCY_MEASUREMENT" >> KZIMP_PROPERTIES
+fi
+if [ $KZIMP_CTL -eq 1 ]; then
+   echo "-DKZIMP_CHANNEL_SIZE=${MAX_NB_MSG}" >> KZIMP_PROPERTIES
+fi
+if [ $KZIMP_ZERO_COPY -ne 0 ]; then
+   echo "-DKZIMP_ZERO_COPY=${KZIMP_ZERO_COPY} -DKZIMP_CHANNEL_SLOTS=$((${MAX_NB_MSG}+1))" >> KZIMP_PROPERTIES
+fi
 make kzimp_microbench
 timelimit -p -s 9 -t $((${DURATION_XP}+30)) ./bin/kzimp_microbench -r $NB_CONSUMERS -s $MSG_SIZE -t $DURATION_XP
 
 ./stop_all.sh
 sleep 1
-cd $KZIMP_DIR; ./kzimp.sh unload; cd -
+if [ $KZIMP_CTL -ne 1 ]; then
+   cd $KZIMP_DIR; ./kzimp.sh unload; cd -
+fi
 
 # save files
 mkdir $OUTPUT_DIR
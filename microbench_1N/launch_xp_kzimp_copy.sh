@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# Find the crossover message size of the non-temporal copy of the producer and of the
+# prefetching copy of the consumers of kzimp: each copy is used for all the messages (threshold 1)
+# or never (threshold 0), from 1KB to 1MB.
+# ../kbfishmem/bfishmprotect/bfishmprotect_copy_bench gives the same crossovers in user space.
+# The checksum is not computed: the producer would compute it while copying the messages.
+
+
+NUM_CONSUMERS_ARRAY=( 1 4 16 )
+MSG_SIZE_ARRAY=( 1024 4096 16384 65536 262144 1048576 )
+NT_COPY_THRESHOLD_ARRAY=( 0 1 )
+PREFETCH_COPY_THRESHOLD_ARRAY=( 0 1 )
+NUM_MSG_CHANNEL=100
+XP_DURATION=$((2*60)) # 2 minutes
+
+for num_consumers in ${NUM_CONSUMERS_ARRAY[@]}; do
+
+   for msg_size in ${MSG_SIZE_ARRAY[@]}; do
+
+      for nt in ${NT_COPY_THRESHOLD_ARRAY[@]}; do
+
+         for prefetch in ${PREFETCH_COPY_THRESHOLD_ARRAY[@]}; do
+
+            echo "===== $(date) $num_consumers consumers, ${XP_DURATION} secondes, msg size is ${msg_size}B, $NUM_MSG_CHANNEL messages in channel, nt copy threshold $nt, prefetch copy threshold $prefetch ====="
+            COMPUTE_CHKSUM=0 NT_COPY_THRESHOLD=$nt PREFETCH_COPY_THRESHOLD=$prefetch ./launch_kzimp.sh $num_consumers $msg_size ${XP_DURATION} $NUM_MSG_CHANNEL
+
+         done
+
+      done
+
+   done
+
+done
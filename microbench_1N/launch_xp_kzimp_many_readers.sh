@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# kzimp with more than 64 consumers: the messages then have a second level bitmap.
+# Compare with the single word bitmap (up to 64 consumers) and with the cursor mode.
+# The machine must have at least as many cores as consumers + 1.
+
+
+NUM_CONSUMERS_ARRAY=( 16 32 48 63 64 65 80 96 112 127 128 160 192 255 )
+MSG_SIZE_ARRAY=( 64 1024 )
+KZIMP_MODE_ARRAY=( 0 1 )
+NUM_MSG_CHANNEL=500
+XP_DURATION=$((2*60)) # 2 minutes
+
+NB_CORES=$(grep -c ^processor /proc/cpuinfo)
+
+for num_consumers in ${NUM_CONSUMERS_ARRAY[@]}; do
+
+   if [ $num_consumers -ge $NB_CORES ]; then
+      echo "===== $num_consumers consumers: not enough cores ($NB_CORES) ====="
+      continue
+   fi
+
+   for msg_size in ${MSG_SIZE_ARRAY[@]}; do
+
+      for mode in ${KZIMP_MODE_ARRAY[@]}; do
+
+         echo "===== $(date) $num_consumers consumers, ${XP_DURATION} secondes, msg size is ${msg_size}B, $NUM_MSG_CHANNEL messages in channel, mode $mode ====="
+         KZIMP_MODE=$mode ./launch_kzimp.sh $num_consumers $msg_size ${XP_DURATION} $NUM_MSG_CHANNEL
+
+      done
+
+   done
+
+done
@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Compare the bitmap mode (0) and the cursor mode (1) of kzimp, from 1 to N consumers
+
+
+NUM_CONSUMERS_ARRAY=( 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 )
+MSG_SIZE_ARRAY=( 64 1024 )
+KZIMP_MODE_ARRAY=( 0 1 )
+NUM_MSG_CHANNEL=500
+XP_DURATION=$((2*60)) # 2 minutes
+
+for num_consumers in ${NUM_CONSUMERS_ARRAY[@]}; do
+
+   for msg_size in ${MSG_SIZE_ARRAY[@]}; do
+
+      for mode in ${KZIMP_MODE_ARRAY[@]}; do
+
+         echo "===== $(date) $num_consumers consumers, ${XP_DURATION} secondes, msg size is ${msg_size}B, $NUM_MSG_CHANNEL messages in channel, mode $mode ====="
+         KZIMP_MODE=$mode ./launch_kzimp.sh $num_consumers $msg_size ${XP_DURATION} $NUM_MSG_CHANNEL
+
+      done
+
+   done
+
+done
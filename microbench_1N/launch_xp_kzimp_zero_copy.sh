@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Compare write() (0), KZIMP_IOCTL_SPLICE_WRITE (1) and KZIMP_IOCTL_POOL_WRITE (2) for big messages
+
+
+NUM_CONSUMERS_ARRAY=( 1 2 4 8 16 23 )
+MSG_SIZE_ARRAY=( 4096 16384 65536 262144 1048576 )
+KZIMP_ZERO_COPY_ARRAY=( 0 1 2 )
+NUM_MSG_CHANNEL=10
+XP_DURATION=$((2*60)) # 2 minutes
+
+for num_consumers in ${NUM_CONSUMERS_ARRAY[@]}; do
+
+   for msg_size in ${MSG_SIZE_ARRAY[@]}; do
+
+      for zero_copy in ${KZIMP_ZERO_COPY_ARRAY[@]}; do
+
+         echo "===== $(date) $num_consumers consumers, ${XP_DURATION} secondes, msg size is ${msg_size}B, $NUM_MSG_CHANNEL messages in channel, zero copy $zero_copy ====="
+         KZIMP_ZERO_COPY=$zero_copy ./launch_kzimp.sh $num_consumers $msg_size ${XP_DURATION} $NUM_MSG_CHANNEL
+
+      done
+
+   done
+
+done
@@ -18,6 +18,19 @@ COMPUTE_CHKSUM=1
 # Writer's timeout
 KZIMP_TIMEOUT=60000
 
+# Are the messages areas made of huge pages? 0 or 1
+# Run the experiment with 0 and 1 to compare the TLB misses (see tlb_misses_total.log)
+USE_HUGE_PAGES=${USE_HUGE_PAGES:-0}
+
+# NUMA node of the memory of the channel: a node id, -1 for any node,
+# -2 for the node of the writer, -3 for the node of the majority of the readers.
+# Run the experiment with different values to compare the CPUDRAM_TO_NODE* counters
+# of the profiler (see cpudram_to_node_total.log)
+KZIMP_NODE=${KZIMP_NODE:--1}
+
+# TLB miss events (AMD family 10h): L1 DTLB miss and L2 DTLB hit, L1 and L2 DTLB miss
+TLB_EVENTS="-e L1_DTLB_MISS_L2_DTLB_HIT 0x00400745 0 0 -e L2_DTLB_MISS 0x00400746 0 0"
+
 
 # get arguments
 if [ $# -eq 4 ]; then
@@ -31,6 +44,17 @@ else
 fi
 
 OUTPUT_DIR="microbench_kzimp_${NB_CONSUMERS}consumers_${DURATION_XP}sec_${MSG_SIZE}B_${MAX_NB_MSG}messages_in_buffer"
+if [ $USE_HUGE_PAGES -eq 1 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_hugepages"
+fi
+if [ $KZIMP_NODE -ne -1 ]; then
+   OUTPUT_DIR="${OUTPUT_DIR}_node${KZIMP_NODE}"
+fi
+
+# print the total number of events per event of a log file of the profiler, over all the cores
+function sum_profiler_events {
+   awk '/^#Event [0-9]/ { name[$2+0]=$3 } !/^#/ { sum[$1]+=$4 } END { for (e in sum) print name[e]"\t"sum[e] }' $1
+}
 
 if [ -d $OUTPUT_DIR ]; then
    echo KZIMP ${NB_CONSUMERS} consumers, ${DURATION_XP} sec, ${MSG_SIZE}B ${MAX_NB_MSG} msg in channel already done
@@ -45,7 +69,7 @@ fi
 cd $KZIMP_DIR
 make
 ./kzimp.sh unload
-./kzimp.sh load nb_max_communication_channels=1 default_channel_size=${MAX_NB_MSG} default_max_msg_size=${MSG_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM}
+./kzimp.sh load nb_max_communication_channels=1 default_channel_size=${MAX_NB_MSG} default_max_msg_size=${MSG_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM} use_huge_pages=${USE_HUGE_PAGES} default_node=${KZIMP_NODE}
 if [ $? -eq 1 ]; then
    echo "An error has occured when loading kzimp. Aborting the experiment $OUTPUT_DIR"
    exit 0
@@ -61,6 +85,8 @@ make kzimp_microbench
 sleep 5
 
 sudo $PROFDIR/profiler-sampling &
+sudo $PROFDIR/profiler $TLB_EVENTS > tlb_misses.log &
+sudo $PROFDIR/profiler > cpudram_to_node.log &
 
 sleep $DURATION_XP
 sudo pkill profiler
@@ -73,6 +99,10 @@ sleep 30
 mkdir $OUTPUT_DIR
 #mv $MEMORY_DIR $OUTPUT_DIR/
 mv statistics*.log $OUTPUT_DIR/
+mv tlb_misses.log cpudram_to_node.log $OUTPUT_DIR/
+
+sum_profiler_events $OUTPUT_DIR/tlb_misses.log > $OUTPUT_DIR/tlb_misses_total.log
+sum_profiler_events $OUTPUT_DIR/cpudram_to_node.log > $OUTPUT_DIR/cpudram_to_node_total.log
 
 sudo chown bft:bft /tmp/perf.data.*
 
@@ -40,7 +40,6 @@ fi
 
 #compile and load module
 cd $KBFISH_DIR
-echo "-DMESSAGE_BYTES=${REAL_MSG_SIZE}" > KBFISH_PROPERTIES
 make
 ./kbfish.sh unload
 ./kbfish.sh load nb_max_communication_channels=${NB_CONSUMERS} default_channel_size=${MAX_NB_MSG} default_max_msg_size=${REAL_MSG_SIZE} 
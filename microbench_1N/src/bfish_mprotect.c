@@ -9,6 +9,7 @@
 #include <strings.h>
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "ipc_interface.h"
@@ -44,6 +45,43 @@ static uint64_t nb_cycles_first_recv;
 static struct ump_channel *conn; // conn[i] = the connection the producer uses to communicate with core i+1
 static struct ump_channel consumer_connection; // this consumer's connection
 
+#ifdef SYSCALLS_MEASUREMENT
+// the futex syscalls, to sleep or to wake up the other end
+uint64_t nb_syscalls_send;
+uint64_t nb_syscalls_recv;
+uint64_t nb_syscalls_first_recv;
+#endif
+
+// Define LATENCY_MEASUREMENT if you want the consumers to measure the latency of the messages.
+// The producer writes the time at which it sends the message (in cycles) after the message id,
+// thus the messages must be at least MIN_MSG_SIZE + sizeof(uint64_t) bytes long.
+// The TSCs of the cores are assumed to be synchronized.
+#ifdef LATENCY_MEASUREMENT
+// write the current time in the message msg of size msg_size
+static inline void set_send_time(char *msg, int msg_size)
+{
+  uint64_t now;
+
+  if (msg_size >= MIN_MSG_SIZE + sizeof(now))
+  {
+    rdtsc(now);
+    memcpy(msg + MIN_MSG_SIZE, &now, sizeof(now));
+  }
+}
+
+// add the latency of the message msg of size msg_size to the latencies
+static inline void add_latency(char *msg, int msg_size)
+{
+  uint64_t now, sent;
+
+  if (msg_size >= MIN_MSG_SIZE + sizeof(now))
+  {
+    rdtsc(now);
+    memcpy(&sent, msg + MIN_MSG_SIZE, sizeof(sent));
+    latencies[nb_latencies++ % LATENCY_MAX_SAMPLES] = now - sent;
+  }
+}
+#endif
 
 // Initialize resources for both the producer and the consumers
 // First initialization function called
@@ -61,6 +99,12 @@ void IPC_initialize(int _nb_receivers, int _request_size)
   nb_cycles_recv = 0;
   nb_cycles_first_recv = 0;
 
+#ifdef SYSCALLS_MEASUREMENT
+  nb_syscalls_send = 0;
+  nb_syscalls_recv = 0;
+  nb_syscalls_first_recv = 0;
+#endif
+
   char chaname[256];
   int i;
   for (i = 0; i < nb_receivers; i++)
@@ -184,6 +228,10 @@ void IPC_sendToAll(int msg_size, char msg_id)
 
   for (i = 0; i < nb_receivers; i++)
   {
+#ifdef LATENCY_MEASUREMENT
+    set_send_time(msg, msg_size);
+#endif
+
     // writing the content
     rdtsc(cycle_start);
     send_msg(&conn[i], msg, msg_size);
@@ -192,6 +240,10 @@ void IPC_sendToAll(int msg_size, char msg_id)
     nb_cycles_send += cycle_stop - cycle_start;
   }
 
+#ifdef SYSCALLS_MEASUREMENT
+  nb_syscalls_send = futex_nb_syscalls;
+#endif
+
   free(msg);
 }
 
@@ -233,6 +285,19 @@ int IPC_receive(int msg_size, char *msg_id)
   recv_size = recv_msg(&consumer_connection, msg, msg_size);
   rdtsc(cycle_stop);
 
+#ifdef LATENCY_MEASUREMENT
+  add_latency(msg, recv_size);
+#endif
+
+#ifdef SYSCALLS_MEASUREMENT
+  nb_syscalls_recv = futex_nb_syscalls;
+  // the first message may have made no syscall
+  if (nb_cycles_first_recv == 0)
+  {
+    nb_syscalls_first_recv = nb_syscalls_recv;
+  }
+#endif
+
   nb_cycles_recv += cycle_stop - cycle_start;
   if (nb_cycles_first_recv == 0)
   {
@@ -9,6 +9,16 @@
 #define CACHE_LINE_SIZE 64
 #define GET_MALLOC_SIZE(a) ((a) >= (CACHE_LINE_SIZE) ? (a) : (CACHE_LINE_SIZE))
 
+/* max number of latencies kept by a consumer when LATENCY_MEASUREMENT is defined */
+#define LATENCY_MAX_SAMPLES (1024*1024)
+
+#ifdef LATENCY_MEASUREMENT
+/* latencies of the last LATENCY_MAX_SAMPLES received messages, in cycles, and their number.
+ * Defined in microbench.c, filled by the communication mechanisms that measure them. */
+extern uint64_t latencies[LATENCY_MAX_SAMPLES];
+extern uint64_t nb_latencies;
+#endif
+
 // Initialize resources for both the producer and the consumers
 // First initialization function called
 void IPC_initialize(int _nb_receivers, int _request_size);
@@ -1,6 +1,10 @@
 /* This file is part of multicore_replication_microbench.
  *
  * Communication mechanism: Barrelfish message-passing, kernel implementation
+ *
+ * With -DKBFISH_MMAP the areas of the channels are mmap'ed and the messages are sent and
+ * received in user space, with libkbfish: the kernel is only entered when the other end
+ * sleeps. Otherwise every message is a write() and a read() on /dev/kbfish<i>.
  */
 
 #include <stdio.h>
@@ -13,6 +17,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef KBFISH_MMAP
+#include "../../kbfish/libkbfish/kbfish_ump.h"
+#endif
+
 #include "ipc_interface.h"
 #include "time.h"
 
@@ -34,8 +42,19 @@ static uint64_t nb_cycles_send;
 static uint64_t nb_cycles_recv;
 static uint64_t nb_cycles_first_recv;
 
+#ifdef SYSCALLS_MEASUREMENT
+uint64_t nb_syscalls_send;
+uint64_t nb_syscalls_recv;
+uint64_t nb_syscalls_first_recv;
+#endif
+
+#ifdef KBFISH_MMAP
+static struct kbfish_ump *conn; // conn[i] = the connection the producer uses to communicate with core i+1
+static struct kbfish_ump consumer_connection; // this consumer's connection
+#else
 static int *conn; // conn[i] = the connection the producer uses to communicate with core i+1
 static int consumer_connection; // this consumer's connection
+#endif
 
 // open wrapper which handles the errors
 int Open(const char* pathname, int flags)
@@ -139,6 +158,21 @@ ssize_t Read(int fd, void *buf, size_t count)
   return r;
 }
 
+#ifdef KBFISH_MMAP
+// kbfish_ump_open wrapper which handles the errors
+void Kbfish_ump_open(struct kbfish_ump *chan, const char *pathname,
+    int is_receiver)
+{
+  if (kbfish_ump_open(chan, pathname, is_receiver) == -1)
+  {
+    perror(">>> Error while opening and mapping channel\n");
+    printf("Node %i experiences an error at %i when opening file %s\n",
+        core_id, __LINE__, pathname);
+    exit(-1);
+  }
+}
+#endif
+
 // Initialize resources for both the producer and the consumers
 // First initialization function called
 void IPC_initialize(int _nb_receivers, int _request_size)
@@ -154,6 +188,12 @@ void IPC_initialize(int _nb_receivers, int _request_size)
   nb_cycles_send = 0;
   nb_cycles_recv = 0;
   nb_cycles_first_recv = 0;
+
+#ifdef SYSCALLS_MEASUREMENT
+  nb_syscalls_send = 0;
+  nb_syscalls_recv = 0;
+  nb_syscalls_first_recv = 0;
+#endif
 }
 
 // Initialize resources for the producer
@@ -166,7 +206,7 @@ void IPC_initialize_producer(int _core_id)
   // ensure that the receivers have opened the file
   sleep(2);
 
-  conn = (int*) malloc(sizeof(*conn) * nb_receivers);
+  conn = (typeof(conn)) malloc(sizeof(*conn) * nb_receivers);
   if (!conn)
   {
     perror("Connections allocation error");
@@ -177,7 +217,11 @@ void IPC_initialize_producer(int _core_id)
   for (i = 0; i < nb_receivers; i++)
   {
     snprintf(chaname, 256, "%s%i", KBFISH_CHAR_DEV_FILE, i);
+#ifdef KBFISH_MMAP
+    Kbfish_ump_open(&conn[i], chaname, 0);
+#else
     conn[i] = Open(chaname, O_RDWR);
+#endif
   }
 }
 
@@ -190,7 +234,11 @@ void IPC_initialize_consumer(int _core_id)
 
   conn = NULL;
   snprintf(chaname, 256, "%s%i", KBFISH_CHAR_DEV_FILE, core_id - 1);
+#ifdef KBFISH_MMAP
+  Kbfish_ump_open(&consumer_connection, chaname, 1);
+#else
   consumer_connection = Open(chaname, O_RDWR | O_CREAT);
+#endif
 }
 
 // Clean ressources created for both the producer and the consumer.
@@ -206,7 +254,11 @@ void IPC_clean_producer(void)
 
   for (i = 0; i < nb_receivers; i++)
   {
+#ifdef KBFISH_MMAP
+    kbfish_ump_close(&conn[i]);
+#else
     close(conn[i]);
+#endif
   }
 
   free(conn);
@@ -215,7 +267,11 @@ void IPC_clean_producer(void)
 // Clean ressources created for the consumer.
 void IPC_clean_consumer(void)
 {
+#ifdef KBFISH_MMAP
+  kbfish_ump_close(&consumer_connection);
+#else
   close(consumer_connection);
+#endif
 }
 
 // Return the number of cycles spent in the send() operation
@@ -266,12 +322,33 @@ void IPC_sendToAll(int msg_size, char msg_id)
   {
     // writing the content
     rdtsc(cycle_start);
+#ifdef KBFISH_MMAP
+    if (kbfish_ump_send(&conn[i], msg, msg_size) == -1)
+    {
+      perror("Error in kbfish_ump_send");
+      exit(-1);
+    }
+#else
     Write(conn[i], msg, msg_size);
+#endif
     rdtsc(cycle_stop);
 
+#if defined(SYSCALLS_MEASUREMENT) && !defined(KBFISH_MMAP)
+    nb_syscalls_send++;
+#endif
+
     nb_cycles_send += cycle_stop - cycle_start;
   }
 
+#if defined(SYSCALLS_MEASUREMENT) && defined(KBFISH_MMAP)
+  // the ioctls made by libkbfish, to sleep or to wake up the consumers
+  nb_syscalls_send = 0;
+  for (i = 0; i < nb_receivers; i++)
+  {
+    nb_syscalls_send += conn[i].nb_syscalls;
+  }
+#endif
+
   free(msg);
 }
 
@@ -302,9 +379,32 @@ int IPC_receive(int msg_size, char *msg_id)
   uint64_t cycle_start, cycle_stop;
 
   rdtsc(cycle_start);
+#ifdef KBFISH_MMAP
+  recv_size = kbfish_ump_recv(&consumer_connection, msg, msg_size);
+  if (recv_size == -1)
+  {
+    perror("Error in kbfish_ump_recv");
+    exit(-1);
+  }
+#else
   recv_size = Read(consumer_connection, msg, msg_size);
+#endif
   rdtsc(cycle_stop);
 
+#ifdef SYSCALLS_MEASUREMENT
+#ifdef KBFISH_MMAP
+  // the ioctls made by libkbfish, to sleep or to wake up the producer
+  nb_syscalls_recv = consumer_connection.nb_syscalls;
+#else
+  nb_syscalls_recv++;
+#endif
+  // the first message may have made no syscall
+  if (nb_cycles_first_recv == 0)
+  {
+    nb_syscalls_first_recv = nb_syscalls_recv;
+  }
+#endif
+
   nb_cycles_recv += cycle_stop - cycle_start;
   if (nb_cycles_first_recv == 0)
   {
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <strings.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +17,21 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef KZIMP_BATCH_SIZE
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef KZIMP_ZERO_COPY
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sched.h>
+#endif
+
+#ifdef KZIMP_CHANNEL_SIZE
+#include "../../kzimp/libkzimp/kzimp_ctl.h"
+#endif
+
 #include "ipc_interface.h"
 #include "time.h"
 
@@ -29,6 +45,34 @@
 #define FAULTY_RECEIVER
 #undef FAULTY_RECEIVER
 
+// Define KZIMP_BATCH_SIZE if you want to send and receive the messages by batches of
+// KZIMP_BATCH_SIZE messages, with the KZIMP_IOCTL_WRITE_BATCH and KZIMP_IOCTL_READ_BATCH ioctls
+
+#ifdef KZIMP_BATCH_SIZE
+#define KZIMP_IOCTL_WRITE_BATCH 0x2
+#define KZIMP_IOCTL_READ_BATCH 0x3
+#endif
+
+// Define KZIMP_ZERO_COPY (on a writer splice channel) if you want the producer to write the messages
+// directly in its big messages area, which it has mapped, and to send them with an ioctl:
+//  . 1 for KZIMP_IOCTL_SPLICE_WRITE: the slots are reused in a round robin fashion;
+//  . 2 for KZIMP_IOCTL_POOL_WRITE: a slot is reused once kzimp has given it back.
+// KZIMP_CHANNEL_SLOTS is the number of slots of the area, i.e. the channel size + 1.
+
+#ifdef KZIMP_ZERO_COPY
+#ifdef KZIMP_BATCH_SIZE
+#error "KZIMP_ZERO_COPY and KZIMP_BATCH_SIZE cannot be used together"
+#endif
+#ifndef KZIMP_CHANNEL_SLOTS
+#error "KZIMP_ZERO_COPY needs KZIMP_CHANNEL_SLOTS"
+#endif
+
+#define KZIMP_IOCTL_SPLICE_WRITE 0x1
+#define KZIMP_IOCTL_POOL_WRITE 0x5
+
+#define KZIMP_POOL_SLOT_FREE 0
+#endif
+
 /********** All the variables needed by kzimp **********/
 
 // port used by the producer
@@ -45,8 +89,54 @@ static uint64_t nb_cycles_send;
 static uint64_t nb_cycles_recv;
 static uint64_t nb_cycles_first_recv;
 
+#ifdef KZIMP_BATCH_SIZE
+static char *batch_msgs; // the messages of the batch, request_size bytes each
+static struct iovec batch_iov[KZIMP_BATCH_SIZE];
+static int batch_nb_msg; // number of messages in the batch
+static int batch_next_msg; // consumer: next message of the batch to return
+#endif
+
+#ifdef KZIMP_ZERO_COPY
+static char *zero_copy_slots[KZIMP_CHANNEL_SLOTS]; // the mapped slots of the big messages area
+#if KZIMP_ZERO_COPY == 2
+static volatile int *zero_copy_pool_state; // state of the slots, given back by kzimp
+#endif
+static int zero_copy_next_slot;
+#endif
+
 #define MIN(a, b) ((a < b) ? a : b)
 
+// Define LATENCY_MEASUREMENT if you want the consumers to measure the latency of the messages.
+// The producer writes the time at which it sends the message (in cycles) after the message id,
+// thus the messages must be at least MIN_MSG_SIZE + sizeof(uint64_t) bytes long.
+// The TSCs of the cores are assumed to be synchronized.
+#ifdef LATENCY_MEASUREMENT
+// write the current time in the message msg of size msg_size
+static inline void set_send_time(char *msg, int msg_size)
+{
+  uint64_t now;
+
+  if (msg_size >= MIN_MSG_SIZE + sizeof(now))
+  {
+    rdtsc(now);
+    memcpy(msg + MIN_MSG_SIZE, &now, sizeof(now));
+  }
+}
+
+// add the latency of the message msg of size msg_size to the latencies
+static inline void add_latency(char *msg, int msg_size)
+{
+  uint64_t now, sent;
+
+  if (msg_size >= MIN_MSG_SIZE + sizeof(now))
+  {
+    rdtsc(now);
+    memcpy(&sent, msg + MIN_MSG_SIZE, sizeof(sent));
+    latencies[nb_latencies++ % LATENCY_MAX_SAMPLES] = now - sent;
+  }
+}
+#endif
+
 // Initialize resources for both the producer and the consumers
 // First initialization function called
 void IPC_initialize(int _nb_receivers, int _request_size)
@@ -62,8 +152,185 @@ void IPC_initialize(int _nb_receivers, int _request_size)
   nb_cycles_send = 0;
   nb_cycles_recv = 0;
   nb_cycles_first_recv = 0;
+
+#ifdef KZIMP_CHANNEL_SIZE
+  // resize the channel for this bench, without reloading the module.
+  // The other parameters of the channel are not modified.
+#ifdef KZIMP_ZERO_COPY
+  if (kzimp_resize_channel(0, KZIMP_CHANNEL_SIZE, request_size, -1, -1, nb_receivers,
+      KZIMP_DATA_PATH_WRITER_SPLICE) < 0)
+#else
+  if (kzimp_resize_channel(0, KZIMP_CHANNEL_SIZE, request_size, -1, -1, nb_receivers,
+      KZIMP_DATA_PATH_COPY) < 0)
+#endif
+  {
+    perror("kzimp_resize_channel");
+    exit(-1);
+  }
+#endif
+}
+
+#ifdef KZIMP_BATCH_SIZE
+// allocate the messages of the batch
+static void init_batch(void)
+{
+  int i;
+
+  batch_msgs = (char*) malloc(
+      GET_MALLOC_SIZE(sizeof(char) * request_size * KZIMP_BATCH_SIZE));
+  if (!batch_msgs)
+  {
+    perror("Batch allocation error! ");
+    exit(errno);
+  }
+  bzero(batch_msgs, request_size * KZIMP_BATCH_SIZE);
+
+  for (i = 0; i < KZIMP_BATCH_SIZE; i++)
+  {
+    batch_iov[i].iov_base = batch_msgs + i * request_size;
+    batch_iov[i].iov_len = request_size;
+  }
+
+  batch_nb_msg = 0;
+  batch_next_msg = 0;
+}
+
+// send the messages of the batch with a single call
+static void send_batch(void)
+{
+  int r, nb_sent;
+  unsigned long kzimp_batch_struct[2];
+
+  nb_sent = 0;
+  while (nb_sent < batch_nb_msg)
+  {
+    kzimp_batch_struct[0] = (unsigned long) &batch_iov[nb_sent];
+    kzimp_batch_struct[1] = batch_nb_msg - nb_sent;
+
+    r = ioctl(fd, KZIMP_IOCTL_WRITE_BATCH, kzimp_batch_struct);
+    if (r <= 0)
+    {
+      perror("Error in ioctl");
+      printf("Node %i: write batch error @ %s:%i. Aborting.\n", core_id,
+          __FILE__, __LINE__);
+      exit(-1);
+    }
+
+    nb_sent += r;
+  }
+
+  batch_nb_msg = 0;
 }
 
+// receive a new batch of messages with a single call
+static void recv_batch(void)
+{
+  int i, r;
+  unsigned long kzimp_batch_struct[2];
+
+  for (i = 0; i < KZIMP_BATCH_SIZE; i++)
+  {
+    batch_iov[i].iov_len = request_size;
+  }
+
+  kzimp_batch_struct[0] = (unsigned long) batch_iov;
+  kzimp_batch_struct[1] = KZIMP_BATCH_SIZE;
+
+  r = ioctl(fd, KZIMP_IOCTL_READ_BATCH, kzimp_batch_struct);
+  if (r <= 0)
+  {
+    perror("Error in ioctl");
+    printf("Node %i: read batch error @ %s:%i. Aborting.\n", core_id,
+        __FILE__, __LINE__);
+    exit(-1);
+  }
+
+  batch_nb_msg = r;
+  batch_next_msg = 0;
+}
+#endif
+
+#ifdef KZIMP_ZERO_COPY
+// map the slots of the big messages area of the producer
+static void init_zero_copy(void)
+{
+  int i;
+  long page_size;
+  size_t slot_size;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  slot_size = (request_size + page_size - 1) / page_size * page_size;
+
+  for (i = 0; i < KZIMP_CHANNEL_SLOTS; i++)
+  {
+    zero_copy_slots[i] = (char*) mmap(NULL, slot_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, i * page_size);
+    if (zero_copy_slots[i] == MAP_FAILED)
+    {
+      perror("mmap of a message slot");
+      exit(-1);
+    }
+
+    // fetch the pages now
+    bzero(zero_copy_slots[i], request_size);
+  }
+
+#if KZIMP_ZERO_COPY == 2
+  zero_copy_pool_state = (volatile int*) mmap(NULL, sizeof(int)
+      * KZIMP_CHANNEL_SLOTS, PROT_READ, MAP_SHARED, fd, KZIMP_CHANNEL_SLOTS
+      * page_size);
+  if (zero_copy_pool_state == MAP_FAILED)
+  {
+    perror("mmap of the pool state");
+    exit(-1);
+  }
+#endif
+
+  zero_copy_next_slot = 0;
+}
+
+// return the slot in which the next message will be written
+static char* zero_copy_get_slot(void)
+{
+#if KZIMP_ZERO_COPY == 2
+  // the slot is still read by some consumers
+  while (zero_copy_pool_state[zero_copy_next_slot] != KZIMP_POOL_SLOT_FREE)
+  {
+    sched_yield();
+  }
+#endif
+
+  return zero_copy_slots[zero_copy_next_slot];
+}
+
+// send the message of size msg_size in the current slot
+static int zero_copy_send(int msg_size)
+{
+  int r;
+
+#if KZIMP_ZERO_COPY == 2
+  unsigned long kzimp_addr_struct[2];
+
+  kzimp_addr_struct[0] = zero_copy_next_slot;
+  kzimp_addr_struct[1] = msg_size;
+
+  r = ioctl(fd, KZIMP_IOCTL_POOL_WRITE, kzimp_addr_struct);
+#else
+  unsigned long kzimp_addr_struct[3];
+
+  kzimp_addr_struct[0] = (unsigned long) zero_copy_slots[zero_copy_next_slot];
+  kzimp_addr_struct[1] = zero_copy_next_slot;
+  kzimp_addr_struct[2] = msg_size;
+
+  r = ioctl(fd, KZIMP_IOCTL_SPLICE_WRITE, kzimp_addr_struct);
+#endif
+
+  zero_copy_next_slot = (zero_copy_next_slot + 1) % KZIMP_CHANNEL_SLOTS;
+
+  return r;
+}
+#endif
+
 // Initialize resources for the producer
 void IPC_initialize_producer(int _core_id)
 {
@@ -77,6 +344,14 @@ void IPC_initialize_producer(int _core_id)
   {
     printf(">>> Error while opening channel\n");
   }
+
+#ifdef KZIMP_BATCH_SIZE
+  init_batch();
+#endif
+
+#ifdef KZIMP_ZERO_COPY
+  init_zero_copy();
+#endif
 }
 
 // Initialize resources for the consumers
@@ -98,6 +373,10 @@ void IPC_initialize_consumer(int _core_id)
   {
     printf("<<< Error while opening channel\n");
   }
+
+#ifdef KZIMP_BATCH_SIZE
+  init_batch();
+#endif
 }
 
 // Clean ressources created for both the producer and the consumer.
@@ -109,12 +388,21 @@ void IPC_clean(void)
 // Clean ressources created for the producer.
 void IPC_clean_producer(void)
 {
+#ifdef KZIMP_BATCH_SIZE
+  send_batch();
+  free(batch_msgs);
+#endif
+
   close(fd);
 }
 
 // Clean ressources created for the consumer.
 void IPC_clean_consumer(void)
 {
+#ifdef KZIMP_BATCH_SIZE
+  free(batch_msgs);
+#endif
+
   close(fd);
 }
 
@@ -130,8 +418,12 @@ uint64_t get_cycles_recv()
   return nb_cycles_recv - nb_cycles_first_recv;
 }
 
+#ifdef KZIMP_BATCH_SIZE
+
 // Send a message to all the cores
 // The message id will be msg_id
+// The message is added to the batch, which is sent when it is full.
+// The last message (of id -2) is sent immediately.
 void IPC_sendToAll(int msg_size, char msg_id)
 {
 #ifdef COMPUTE_CYCLES
@@ -145,6 +437,115 @@ void IPC_sendToAll(int msg_size, char msg_id)
     msg_size = MIN_MSG_SIZE;
   }
 
+  msg = (char*) batch_iov[batch_nb_msg].iov_base;
+  msg[0] = msg_id;
+  batch_iov[batch_nb_msg].iov_len = MIN(msg_size, request_size);
+#ifdef LATENCY_MEASUREMENT
+  set_send_time(msg, batch_iov[batch_nb_msg].iov_len);
+#endif
+  batch_nb_msg++;
+
+#ifdef DEBUG
+  printf(
+      "[producer %i] going to send message %i of size %i to %i recipients\n",
+      core_id, msg[0], msg_size, nb_receivers);
+#endif
+
+  if (batch_nb_msg == KZIMP_BATCH_SIZE || msg_id == -2)
+  {
+#ifdef COMPUTE_CYCLES
+    rdtsc(cycle_start);
+#endif
+
+    send_batch();
+
+#ifdef COMPUTE_CYCLES
+    rdtsc(cycle_stop);
+    nb_cycles_send += cycle_stop - cycle_start;
+#endif
+  }
+}
+
+// Get a message for this core
+// return the size of the message if it is valid, 0 otherwise
+// Place in *msg_id the id of this message
+// The message comes from the current batch. A new batch is received when it is empty.
+int IPC_receive(int msg_size, char *msg_id)
+{
+  char *msg;
+  int recv_size;
+
+  if (msg_size < MIN_MSG_SIZE)
+  {
+    msg_size = MIN_MSG_SIZE;
+  }
+
+  if (batch_next_msg == batch_nb_msg)
+  {
+#ifdef COMPUTE_CYCLES
+    uint64_t cycle_start, cycle_stop;
+    rdtsc(cycle_start);
+#endif
+
+    recv_batch();
+
+#ifdef COMPUTE_CYCLES
+    rdtsc(cycle_stop);
+    nb_cycles_recv += cycle_stop - cycle_start;
+
+    if (nb_cycles_first_recv == 0)
+    {
+      nb_cycles_first_recv = nb_cycles_recv;
+    }
+#endif
+  }
+
+  msg = (char*) batch_iov[batch_next_msg].iov_base;
+  recv_size = batch_iov[batch_next_msg].iov_len;
+  batch_next_msg++;
+
+  *msg_id = msg[0];
+
+#ifdef LATENCY_MEASUREMENT
+  add_latency(msg, recv_size);
+#endif
+
+#ifdef DEBUG
+  printf("[consumer %i] received message %i of size %i, should be %i\n",
+      core_id, *msg_id, recv_size, msg_size);
+#endif
+
+  if (recv_size == msg_size)
+  {
+    return msg_size;
+  }
+  else
+  {
+    return 0;
+  }
+}
+
+#else
+
+// Send a message to all the cores
+// The message id will be msg_id
+void IPC_sendToAll(int msg_size, char msg_id)
+{
+#ifdef COMPUTE_CYCLES
+  uint64_t cycle_start, cycle_stop;
+#endif
+
+  char *msg;
+
+  if (msg_size < MIN_MSG_SIZE)
+  {
+    msg_size = MIN_MSG_SIZE;
+  }
+
+#ifdef KZIMP_ZERO_COPY
+  msg_size = MIN(msg_size, request_size);
+  msg = zero_copy_get_slot();
+#else
   msg = (char*) malloc(GET_MALLOC_SIZE(sizeof(char) * msg_size));
   if (!msg)
   {
@@ -155,6 +556,7 @@ void IPC_sendToAll(int msg_size, char msg_id)
   // malloc is lazy: the pages may not be really allocated yet.
   // We force the allocation and the fetch of the pages with bzero
   bzero(msg, msg_size);
+#endif
 
   msg[0] = msg_id;
 
@@ -164,11 +566,19 @@ void IPC_sendToAll(int msg_size, char msg_id)
       core_id, msg[0], msg_size, nb_receivers);
 #endif
 
+#ifdef LATENCY_MEASUREMENT
+  set_send_time(msg, msg_size);
+#endif
+
 #ifdef COMPUTE_CYCLES
   rdtsc(cycle_start);
 #endif
 
+#ifdef KZIMP_ZERO_COPY
+  int r = zero_copy_send(msg_size);
+#else
   int r = write(fd, msg, msg_size);
+#endif
   if (r == -1)
   {
     switch (errno)
@@ -206,7 +616,9 @@ void IPC_sendToAll(int msg_size, char msg_id)
   nb_cycles_send += cycle_stop - cycle_start;
 #endif
 
+#ifndef KZIMP_ZERO_COPY
   free(msg);
+#endif
 }
 
 // Get a message for this core
@@ -309,6 +721,13 @@ int IPC_receive(int msg_size, char *msg_id)
 
   *msg_id = msg[0];
 
+#ifdef LATENCY_MEASUREMENT
+  if (recv_size > 0)
+  {
+    add_latency(msg, recv_size);
+  }
+#endif
+
 #ifdef COMPUTE_CYCLES
   if (nb_cycles_first_recv == 0)
   {
@@ -332,3 +751,5 @@ int IPC_receive(int msg_size, char *msg_id)
     return 0;
   }
 }
+
+#endif
@@ -56,6 +56,31 @@ extern uint64_t nb_syscalls_recv;
 extern uint64_t nb_syscalls_first_recv;
 #endif
 
+#ifdef LATENCY_MEASUREMENT
+// latencies of the last LATENCY_MAX_SAMPLES received messages, in cycles.
+// They stay empty with the communication mechanisms that do not measure them.
+uint64_t latencies[LATENCY_MAX_SAMPLES];
+uint64_t nb_latencies;
+
+static int compare_latencies(const void *a, const void *b)
+{
+  uint64_t la = *(const uint64_t*) a;
+  uint64_t lb = *(const uint64_t*) b;
+
+  return (la > lb) - (la < lb);
+}
+
+// return the p-th percentile of the nb sorted latencies, in usec
+static double get_latency_percentile(uint64_t nb, int p)
+{
+  if (nb == 0)
+  {
+    return 0;
+  }
+  return (double) latencies[(nb - 1) * p / 100] / (double) get_clock_mhz();
+}
+#endif
+
 // return the throughput, in MB/s
 double do_producer(void)
 {
@@ -335,6 +360,13 @@ int main(int argc, char **argv)
         (unsigned long) nb_syscalls_send, (unsigned long) (nb_syscalls_recv-nb_syscalls_first_recv));
 #endif
 
+#ifdef LATENCY_MEASUREMENT
+    uint64_t nb_samples = (nb_latencies < LATENCY_MAX_SAMPLES ? nb_latencies : LATENCY_MAX_SAMPLES);
+    qsort(latencies, nb_samples, sizeof(*latencies), compare_latencies);
+    fprintf(F, "latency_p50= %f\nlatency_p99= %f\n",
+        get_latency_percentile(nb_samples, 50), get_latency_percentile(nb_samples, 99));
+#endif
+
     fclose(F);
 
     IPC_clean_consumer();
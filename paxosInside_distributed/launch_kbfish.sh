@@ -48,7 +48,6 @@ rm -f /tmp/paxosInside_client_*_finished
 # compile and load module
 NB_MAX_CHANNELS=8
 cd $KBFISH_DIR
-echo "-DMESSAGE_BYTES=${MSG_SIZE}" > KBFISH_PROPERTIES
 make
 ./kbfish.sh unload
 ./kbfish.sh load nb_max_communication_channels=${NB_MAX_CHANNELS} default_channel_size=${MAX_NB_MSG} default_max_msg_size=${MSG_SIZE} 
@@ -14,8 +14,19 @@ CONFIG_FILE=config
 PROFDIR=../profiler
 
 KZIMP_DIR="../kzimp/kzimp_allMessagesArea"
-#KZIMP_DIR="../kzimp/kzimp_splice"
-#KZIMP_DIR="../kzimp/kzimp_reader_splice"
+
+# Data path of the channels: 0 to copy the messages, 1 for writer splice
+# (no copy when sending), 2 for reader splice (no copy when receiving)
+DATA_PATH=0
+
+# Set it to 1 to store the messages of at most 128B next to their descriptor in the
+# channel (copy data path only), 0 to always store them in the messages area
+INLINE_MESSAGES=${INLINE_MESSAGES:-1}
+if [ $INLINE_MESSAGES -eq 1 ]; then
+   INLINE_SUFFIX=
+else
+   INLINE_SUFFIX=_noinline
+fi
 
 # Do we compute the checksum?
 COMPUTE_CHKSUM=0
@@ -27,6 +38,17 @@ KZIMP_TIMEOUT=60000
 # set it to 1 if you want 1 channel per learner, 0 otherwise.
 ONE_CHANNEL_PER_LEARNER=0
 
+# Number of messages sent/received per system call (batch ioctls of kzimp).
+# Set it to 1 to use write() and read().
+BATCH_SIZE=1
+
+# Set it to 1 to resize the channels at initialization with the control device of
+# kzimp: the channels of the leader get LEADER_CHANNEL_SIZE messages,
+# the multicast channel keeps the channel size given as argument.
+# With the writer splice data path, LEADER_CHANNEL_SIZE must be the channel size given as argument.
+KZIMP_CTL=0
+LEADER_CHANNEL_SIZE=1000
+
 
 if [ $# -eq 6 ]; then
    NB_PAXOS_NODES=$1
@@ -78,7 +100,7 @@ fi
 cd $KZIMP_DIR
 make
 ./kzimp.sh unload
-./kzimp.sh load nb_max_communication_channels=${NB_MAX_CHANNELS} default_channel_size=${MSG_CHANNEL} default_max_msg_size=${MESSAGE_MAX_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM}
+./kzimp.sh load nb_max_communication_channels=${NB_MAX_CHANNELS} default_channel_size=${MSG_CHANNEL} default_max_msg_size=${MESSAGE_MAX_SIZE} default_timeout_in_ms=${KZIMP_TIMEOUT} default_compute_checksum=${COMPUTE_CHKSUM} default_data_path=${DATA_PATH} use_inline_messages=${INLINE_MESSAGES}
 if [ $? -eq 1 ]; then
    echo "An error has occured when loading kzimp. Aborting the experiment"
    exit 0
@@ -91,12 +113,18 @@ echo "-DMESSAGE_MAX_SIZE=${MESSAGE_MAX_SIZE}" > KZIMP_PROPERTIES
 if [ $ONE_CHANNEL_PER_LEARNER -eq 1 ]; then
    echo "-DONE_CHANNEL_PER_LEARNER" >> KZIMP_PROPERTIES
 fi
-if [ $KZIMP_DIR = "../kzimp/kzimp_splice" ]; then
+if [ $DATA_PATH -eq 1 ]; then
    echo "-DKZIMP_SPLICE -DCHANNEL_SIZE=$((${MSG_CHANNEL}+1))" >> KZIMP_PROPERTIES
 fi
-if [ $KZIMP_DIR = "../kzimp/kzimp_reader_splice" ]; then
+if [ $DATA_PATH -eq 2 ]; then
    echo "-DKZIMP_READ_SPLICE -DCHANNEL_SIZE=${MSG_CHANNEL}" >> KZIMP_PROPERTIES
 fi
+if [ $BATCH_SIZE -gt 1 ]; then
+   echo "-DKZIMP_BATCH_SIZE=${BATCH_SIZE}" >> KZIMP_PROPERTIES
+fi
+if [ $KZIMP_CTL -eq 1 ]; then
+   echo "-DKZIMP_CTL -DKZIMP_LEADER_CHANNEL_SIZE=${LEADER_CHANNEL_SIZE} -DKZIMP_MULTICAST_CHANNEL_SIZE=${MSG_CHANNEL}" >> KZIMP_PROPERTIES
+fi
 make kzimp_paxosInside
 
 #####################################
@@ -159,7 +187,7 @@ if [ "$PROFILER" = "profile" ]; then
 sudo pkill profiler
 sudo chown bft:bft /tmp/perf.data.*
 
-OUTPUT_DIR=kzimp_profiling_${NB_PAXOS_NODES}nodes_2clients_${NB_ITER}iter_${MESSAGE_MAX_SIZE}B_${LEADER_ACCEPTOR}_${MSG_CHANNEL}channelSize
+OUTPUT_DIR=kzimp_profiling_${NB_PAXOS_NODES}nodes_2clients_${NB_ITER}iter_${MESSAGE_MAX_SIZE}B_${LEADER_ACCEPTOR}_${MSG_CHANNEL}channelSize${INLINE_SUFFIX}
 mkdir $OUTPUT_DIR
 
 for e in 0 1 2; do
@@ -183,4 +211,4 @@ fi
 ./stop_all.sh
 sleep 1  # needed otherwise there is still a kzimp process and the module cannot be unloaded
 cd $KZIMP_DIR; ./kzimp.sh unload; cd -
-mv results.txt kzimp_${NB_PAXOS_NODES}nodes_2clients_${NB_ITER}iter_${MESSAGE_MAX_SIZE}B_${LEADER_ACCEPTOR}_${MSG_CHANNEL}channelSize.txt
+mv results.txt kzimp_${NB_PAXOS_NODES}nodes_2clients_${NB_ITER}iter_${MESSAGE_MAX_SIZE}B_${LEADER_ACCEPTOR}_${MSG_CHANNEL}channelSize${INLINE_SUFFIX}.txt
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Compare the cache misses of PaxosInside over kzimp with and without the
+# inline messages, for the message sizes that fit in the message descriptors.
+# The CACHE_MISSES event (event 2) of the profiler is sampled every
+# CACHE_MISSES_PERIOD misses, on all the cores.
+
+NB_PAXOS_NODES=5
+NB_ITER=1000000
+LEADER_ACCEPTOR=same_proc
+CHANNEL_SIZE=500
+MSG_SIZE_ARRAY=( 64 128 )
+
+# must be the sampling period of CACHE_MISSES in ../profiler/profiler-sampling.c
+CACHE_MISSES_PERIOD=10000
+
+for msg_size in ${MSG_SIZE_ARRAY[@]}; do
+for inline in 0 1; do
+   INLINE_MESSAGES=$inline ./launch_kzimp.sh $NB_PAXOS_NODES $NB_ITER $LEADER_ACCEPTOR $msg_size $CHANNEL_SIZE profile
+done
+done
+
+echo -e "msg_size\tinline\tcache_misses\tcache_misses_per_request"
+for msg_size in ${MSG_SIZE_ARRAY[@]}; do
+for inline in 0 1; do
+   if [ $inline -eq 1 ]; then
+      INLINE_SUFFIX=
+   else
+      INLINE_SUFFIX=_noinline
+   fi
+   LOG=kzimp_profiling_${NB_PAXOS_NODES}nodes_2clients_${NB_ITER}iter_${msg_size}B_${LEADER_ACCEPTOR}_${CHANNEL_SIZE}channelSize${INLINE_SUFFIX}/perf_everyone_event_2.log
+
+   # sum of the samples of all the cores
+   SAMPLES=$(grep "^#TOTAL SAMPLES OF EVT 2 " $LOG | sed 's/^#TOTAL SAMPLES OF EVT 2 //' | awk '{ s = 0; for (i = 1; i <= NF; i++) s += $i; print s }')
+   echo -e "${msg_size}\t${inline}\t$((${SAMPLES}*${CACHE_MISSES_PERIOD}))\t$(echo "scale=2; ${SAMPLES}*${CACHE_MISSES_PERIOD}/${NB_ITER}" | bc)"
+done
+done
@@ -36,8 +36,8 @@ static struct ump_channel leader_to_acceptor; // connection between leader and a
 static struct ump_channel *acceptor_to_learners; // connection between the acceptor and learner i
 static struct ump_channel *learners_to_clients; // connection between the learner i and the client 0
 
-// round-robin recv for client 0
-static int rr;
+// the learners_to_clients channels, on which client 0 receives
+static struct ump_recv_set learners_set;
 
 
 // Initialize resources for both the node and the clients
@@ -49,14 +49,26 @@ void IPC_initialize(int _nb_nodes, int _nb_clients)
   nb_learners = nb_paxos_nodes - 2;
   total_nb_nodes = nb_paxos_nodes + nb_clients;
 
-  rr = 0;
-
   char chaname[256];
   for (int i = 0; i < nb_learners * 2 + 1 + 1; i++)
   {
     snprintf(chaname, 256, "%s%i", KBFISH_MEM_CHAR_DEV_FILE, i);
     create_channel(chaname, i);
   }
+
+  // client 0 waits for the messages of all the learners at once
+  snprintf(chaname, 256, "%s%i", KBFISH_MEM_CHAR_DEV_FILE, 2 + nb_learners);
+  if (create_recv_set(chaname, 0))
+  {
+    exit(-1);
+  }
+  for (int i = 0; i < nb_learners; i++)
+  {
+    if (add_channel_to_recv_set(i + 2 + nb_learners, 0) < 0)
+    {
+      exit(-1);
+    }
+  }
 }
 
 static void init_node(int _node_id)
@@ -119,6 +131,15 @@ static void init_node(int _node_id)
       learners_to_clients[i] = open_channel(chaname, i + 2 + nb_learners,
           NB_MESSAGES, MESSAGE_BYTES, 1);
     }
+
+    open_recv_set(&learners_set, 0);
+    for (i = 0; i < nb_learners; i++)
+    {
+      if (recv_set_add_channel(&learners_set, &learners_to_clients[i]))
+      {
+        exit(-1);
+      }
+    }
   }
   else if (node_id > nb_paxos_nodes) // client 1
   {
@@ -180,6 +201,8 @@ void IPC_clean(void)
   {
     destroy_channel(i);
   }
+
+  destroy_recv_set(0);
 }
 
 static void clean_node(void)
@@ -293,21 +316,13 @@ size_t IPC_receive(void *msg, size_t length)
   }
   else if (node_id == nb_paxos_nodes) // client 0
   {
+    // the learners with messages are served in a round-robin order
+    struct ump_channel* rc;
+    recv_size = recv_msg_from_set(&learners_set, (char*) msg, length, &rc);
+
 #ifdef DEBUG
-    printf("Receiving from %i\n", rr);
+    printf("Received from %i\n", rc->mprotectfile_nb);
 #endif
-
-    recv_size = recv_msg(&learners_to_clients[rr], (char*) msg, length);
-    if (++rr == nb_learners)
-    {
-      rr = 0;
-    }
-
-    // old code with select
-    // the call is blocking because of the 3rd argument equal to 0
-    //struct ump_channel* rc;
-    //rc = bfish_mprotect_select(learners_to_clients, nb_learners, 0);
-    //recv_size = recv_msg(rc, (char*) msg, length);
   }
   else if (node_id > nb_paxos_nodes) // client 1
   {
@@ -12,14 +12,23 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/ioctl.h>
 
 #if defined(KZIMP_SPLICE) || defined(KZIMP_READ_SPLICE)
 #include <sys/mman.h>
-#include <sys/ioctl.h>
 #endif
 
 #ifdef ONE_CHANNEL_PER_LEARNER
-#include <time.h>
+#include <sys/epoll.h>
+#endif
+
+#ifdef KZIMP_BATCH_SIZE
+#include <string.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef KZIMP_CTL
+#include "../../../kzimp/libkzimp/kzimp_ctl.h"
 #endif
 
 #include "ipc_interface.h"
@@ -30,21 +39,45 @@
 
 // Define MESSAGE_MAX_SIZE as the max size of a message in the channel
 // Define ONE_CHANNEL_PER_LEARNER if you want to run the version with 1 channel per learner i -> client 0
-// Define KZIMP_SPLICE if you want to use the splice version of kzimp (no copy when sending)
+// Define KZIMP_SPLICE if the channels have the writer splice data path of kzimp (no copy when sending)
 // If KZIMP_SPLICE is defined, you also have to define CHANNEL_SIZE
-// Define KZIMP_READ_SPLICE if you want to use the reader_splice version of kzimp (no copy when receiving)
+// Define KZIMP_READ_SPLICE if the channels have the reader splice data path of kzimp (no copy when receiving)
 // Note that it does not work with ONE_CHANNEL_PER_LEARNER.
 // You also need to define CHANNEL_SIZE
+// Define KZIMP_BATCH_SIZE if you want to receive up to KZIMP_BATCH_SIZE messages per system call
+// and to send the messages by batches of (up to) KZIMP_BATCH_SIZE messages.
+// The messages to send are buffered until the batch is full or the node is going to
+// receive a new batch (it may block).
+// Note that it does not work with KZIMP_SPLICE, KZIMP_READ_SPLICE and ONE_CHANNEL_PER_LEARNER.
 
 
+// Define KZIMP_CTL if you want to resize the channels with the control device of kzimp
+// at initialization. The channels of the leader (client -> leader and leader -> acceptor)
+// have KZIMP_LEADER_CHANNEL_SIZE messages, the multicast channel (acceptor -> learners)
+// has KZIMP_MULTICAST_CHANNEL_SIZE messages. Their data path is set according to
+// KZIMP_SPLICE and KZIMP_READ_SPLICE.
+
+#if defined(KZIMP_CTL) && (!defined(KZIMP_LEADER_CHANNEL_SIZE) || !defined(KZIMP_MULTICAST_CHANNEL_SIZE))
+#error "KZIMP_CTL must come with KZIMP_LEADER_CHANNEL_SIZE and KZIMP_MULTICAST_CHANNEL_SIZE"
+#endif
+
 #if (defined(KZIMP_SPLICE) || defined(KZIMP_READ_SPLICE)) && !defined(CHANNEL_SIZE)
 #error "KZIMP_(READ_)SPLICE must come with CHANNEL_SIZE"
 #endif
 
+// the writers use the CHANNEL_SIZE slots of their big messages area in a round robin fashion
+#if defined(KZIMP_SPLICE) && defined(KZIMP_CTL) && (KZIMP_LEADER_CHANNEL_SIZE + 1 != CHANNEL_SIZE || KZIMP_MULTICAST_CHANNEL_SIZE + 1 != CHANNEL_SIZE)
+#error "KZIMP_SPLICE with KZIMP_CTL needs channels of CHANNEL_SIZE-1 messages"
+#endif
+
 #if defined(KZIMP_READ_SPLICE) && defined(ONE_CHANNEL_PER_LEARNER)
 #error "KZIMP_READ_SPLICE with ONE_CHANNEL_PER_LEARNER not implemented"
 #endif
 
+#if defined(KZIMP_BATCH_SIZE) && (defined(KZIMP_SPLICE) || defined(KZIMP_READ_SPLICE) || defined(ONE_CHANNEL_PER_LEARNER))
+#error "KZIMP_BATCH_SIZE with KZIMP_(READ_)SPLICE or ONE_CHANNEL_PER_LEARNER not implemented"
+#endif
+
 #ifdef KZIMP_SPLICE
 #define PAGE_SIZE 4096
 #define KZIMP_IOCTL_SPLICE_WRITE 0x1
@@ -55,6 +88,28 @@
 #define KZIMP_IOCTL_SPLICE_FINISH_READ 0x8
 #endif
 
+#ifdef ONE_CHANNEL_PER_LEARNER
+#define KZIMP_IOCTL_PENDING 0x9
+#endif
+
+#ifdef KZIMP_BATCH_SIZE
+#define KZIMP_IOCTL_WRITE_BATCH 0x2
+#define KZIMP_IOCTL_READ_BATCH 0x3
+#endif
+
+// number of messages lost at the last gap, when the channel skips the late readers
+#define KZIMP_IOCTL_GAP 0xA
+
+#ifdef KZIMP_CTL
+#if defined(KZIMP_SPLICE)
+#define KZIMP_CHANNELS_DATA_PATH KZIMP_DATA_PATH_WRITER_SPLICE
+#elif defined(KZIMP_READ_SPLICE)
+#define KZIMP_CHANNELS_DATA_PATH KZIMP_DATA_PATH_READER_SPLICE
+#else
+#define KZIMP_CHANNELS_DATA_PATH KZIMP_DATA_PATH_COPY
+#endif
+#endif
+
 #define MAX(a, b) (((a)>(b))?(a):(b))
 #define MIN(a, b) (((a)<(b))?(a):(b))
 
@@ -74,6 +129,10 @@ static int leader_to_acceptor; // leader -> acceptor
 static int acceptor_multicast; // acceptor -> learners
 #ifdef ONE_CHANNEL_PER_LEARNER
 static int *learneri_to_client; // learner i -> client 0
+static int learners_epoll; // epoll instance of the channels learner i -> client 0, edge-triggered
+static struct epoll_event *learners_events; // events returned by epoll_wait()
+static int *learneri_pending; // number of messages client 0 can read without blocking on learneri_to_client[i]
+static int next_learner; // next channel learner i -> client 0 to read, in a round robin fashion
 #else
 static int learners_to_client; // learners -> client 0
 #endif
@@ -88,6 +147,21 @@ static char *messages; // mmapped area
 static size_t msg_area_len; // size of the mmapped area
 #endif
 
+#ifdef KZIMP_BATCH_SIZE
+// a batch of messages
+struct kzimp_batch
+{
+  int fd; // channel of the batch
+  int nb_msg; // number of messages in the batch
+  int next_msg; // next message to return, for a received batch
+  struct iovec iov[KZIMP_BATCH_SIZE];
+  char msgs[KZIMP_BATCH_SIZE][MESSAGE_MAX_SIZE];
+};
+
+static struct kzimp_batch send_batch; // messages waiting to be sent
+static struct kzimp_batch recv_batch; // received messages
+#endif
+
 #ifdef KZIMP_SPLICE
 char* get_next_message(void)
 {
@@ -95,12 +169,108 @@ char* get_next_message(void)
 }
 #endif
 
+#ifdef KZIMP_BATCH_SIZE
+// send the messages of send_batch with a single call
+static void flush_send_batch(void)
+{
+  int r, nb_sent;
+  unsigned long kzimp_batch_struct[2];
+
+  nb_sent = 0;
+  while (nb_sent < send_batch.nb_msg)
+  {
+    kzimp_batch_struct[0] = (unsigned long) &send_batch.iov[nb_sent];
+    kzimp_batch_struct[1] = send_batch.nb_msg - nb_sent;
+
+    r = ioctl(send_batch.fd, KZIMP_IOCTL_WRITE_BATCH, kzimp_batch_struct);
+    if (r <= 0)
+    {
+      perror("Error in ioctl");
+      printf("Node %i: write batch error @ %s:%i. Aborting.\n", node_id,
+          __FILE__, __LINE__);
+      exit(-1);
+    }
+
+    nb_sent += r;
+  }
+
+  send_batch.nb_msg = 0;
+}
+
+// add the message buf of size count to send_batch.
+// The batch is sent if it is full.
+// Return count.
+static ssize_t add_to_send_batch(int fd, const void *buf, size_t count)
+{
+  if (send_batch.nb_msg > 0 && send_batch.fd != fd)
+  {
+    flush_send_batch();
+  }
+
+  count = MIN(count, MESSAGE_MAX_SIZE);
+  memcpy(send_batch.msgs[send_batch.nb_msg], buf, count);
+  send_batch.iov[send_batch.nb_msg].iov_base = send_batch.msgs[send_batch.nb_msg];
+  send_batch.iov[send_batch.nb_msg].iov_len = count;
+  send_batch.fd = fd;
+  send_batch.nb_msg++;
+
+  if (send_batch.nb_msg == KZIMP_BATCH_SIZE)
+  {
+    flush_send_batch();
+  }
+
+  return count;
+}
+
+// get the next message of recv_batch and place it in buf (which is a buffer of size count).
+// Receive a new batch from fd if it is empty, after having sent the pending messages.
+// Return the size of the message or -1 if an error has occurred.
+static ssize_t read_from_recv_batch(int fd, void *buf, size_t count)
+{
+  int i, r;
+  unsigned long kzimp_batch_struct[2];
+
+  if (recv_batch.next_msg == recv_batch.nb_msg)
+  {
+    // the call may block: send the pending messages first
+    flush_send_batch();
+
+    for (i = 0; i < KZIMP_BATCH_SIZE; i++)
+    {
+      recv_batch.iov[i].iov_base = recv_batch.msgs[i];
+      recv_batch.iov[i].iov_len = MESSAGE_MAX_SIZE;
+    }
+
+    kzimp_batch_struct[0] = (unsigned long) recv_batch.iov;
+    kzimp_batch_struct[1] = KZIMP_BATCH_SIZE;
+
+    r = ioctl(fd, KZIMP_IOCTL_READ_BATCH, kzimp_batch_struct);
+    if (r <= 0)
+    {
+      return -1;
+    }
+
+    recv_batch.fd = fd;
+    recv_batch.nb_msg = r;
+    recv_batch.next_msg = 0;
+  }
+
+  count = MIN(count, recv_batch.iov[recv_batch.next_msg].iov_len);
+  memcpy(buf, recv_batch.msgs[recv_batch.next_msg], count);
+  recv_batch.next_msg++;
+
+  return count;
+}
+#endif
+
 // write wrapper which handles the errors
 ssize_t Write(int fd, const void *buf, size_t count)
 {
   int r;
 
-#ifndef KZIMP_SPLICE
+#if defined(KZIMP_BATCH_SIZE)
+  r = add_to_send_batch(fd, buf, count);
+#elif !defined(KZIMP_SPLICE)
   r = write(fd, buf, count);
 #else
   unsigned long kzimp_addr_struct[3];
@@ -174,7 +344,11 @@ ssize_t Read(int fd, void *buf, size_t count)
 {
   int r;
 
+#ifdef KZIMP_BATCH_SIZE
+  r = read_from_recv_batch(fd, buf, count);
+#else
   r = read(fd, buf, count);
+#endif
   if (r == -1)
   {
     switch (errno)
@@ -209,6 +383,12 @@ ssize_t Read(int fd, void *buf, size_t count)
       return 0;
       break;
 
+    case EPIPE:
+      printf("Node %i: %i messages have been skipped @ %s:%i.\n", node_id,
+          ioctl(fd, KZIMP_IOCTL_GAP), __FILE__, __LINE__);
+      return 0;
+      break;
+
     default:
       perror("Error in read");
       printf("Node %i: read error @ %s:%i. Aborting.\n", node_id, __FILE__,
@@ -232,6 +412,20 @@ void IPC_initialize(int _nb_nodes, int _nb_clients)
 #ifdef KZIMP_READ_SPLICE
   msg_area_len = (size_t)MESSAGE_MAX_SIZE * (size_t)CHANNEL_SIZE;
 #endif
+
+#ifdef KZIMP_CTL
+  // the leader is the bottleneck: its channels are deeper
+  if (kzimp_resize_channel(0, KZIMP_LEADER_CHANNEL_SIZE, MESSAGE_MAX_SIZE, -1, -1, -1,
+          KZIMP_CHANNELS_DATA_PATH) < 0
+      || kzimp_resize_channel(1, KZIMP_LEADER_CHANNEL_SIZE, MESSAGE_MAX_SIZE, -1, -1, -1,
+          KZIMP_CHANNELS_DATA_PATH) < 0
+      || kzimp_resize_channel(2, KZIMP_MULTICAST_CHANNEL_SIZE, MESSAGE_MAX_SIZE, -1, -1, -1,
+          KZIMP_CHANNELS_DATA_PATH) < 0)
+  {
+    perror("kzimp_resize_channel");
+    exit(-1);
+  }
+#endif
 }
 
 #ifdef KZIMP_SPLICE
@@ -351,6 +545,29 @@ static void init_node(int _node_id)
         perror(">>> Error while opening channels\n");
       }
     }
+
+    learners_epoll = epoll_create(nb_learners);
+    learners_events = (struct epoll_event*) malloc(sizeof(struct epoll_event) * nb_learners);
+    learneri_pending = (int*) calloc(nb_learners, sizeof(int));
+    if (learners_epoll < 0 || !learners_events || !learneri_pending)
+    {
+      perror("Epoll initialization failed: ");
+      exit(-1);
+    }
+    next_learner = 0;
+
+    for (i = 0; i < nb_learners; i++)
+    {
+      struct epoll_event ev;
+
+      ev.events = EPOLLIN | EPOLLET;
+      ev.data.u32 = i;
+      if (epoll_ctl(learners_epoll, EPOLL_CTL_ADD, learneri_to_client[i], &ev) < 0)
+      {
+        printf("Node %i experiences an error at %i\n", node_id, __LINE__);
+        perror(">>> Error while adding a channel to epoll\n");
+      }
+    }
 #else
     snprintf(chaname, 256, "%s%i", KZIMP_CHAR_DEV_FILE, 3);
     learners_to_client = open(chaname, O_RDONLY);
@@ -455,6 +672,10 @@ void IPC_clean(void)
 
 static void clean_node(void)
 {
+#ifdef KZIMP_BATCH_SIZE
+  flush_send_batch();
+#endif
+
   if (node_id == 0)
   {
 #ifdef KZIMP_READ_SPLICE
@@ -487,6 +708,10 @@ static void clean_node(void)
   {
 #ifdef ONE_CHANNEL_PER_LEARNER
     int i;
+    close(learners_epoll);
+    free(learners_events);
+    free(learneri_pending);
+
     for (i = 0; i < nb_learners; i++)
     {
       close(learneri_to_client[i]);
@@ -641,31 +866,31 @@ size_t IPC_receive(void *msg, size_t length)
 #ifdef ONE_CHANNEL_PER_LEARNER
     while (1)
     {
-      int i, ret;
-      fd_set set_read;
-      struct timeval tv;
-
-      FD_ZERO(&set_read);
+      int i, n, nb, ret;
 
-      tv.tv_sec = 1; // timeout in seconds
-      tv.tv_usec = 0;
-
-      int max = 0;
-      for (i = 0; i < nb_learners; i++)
+      // read the messages that are known to be there, in a round robin fashion
+      for (n = 0; n < nb_learners; n++)
       {
-        FD_SET(learneri_to_client[i], &set_read);
-        max = ((learneri_to_client[i] > max) ? learneri_to_client[i] : max);
+        i = (next_learner + n) % nb_learners;
+        if (learneri_pending[i] > 0)
+        {
+          learneri_pending[i]--;
+          next_learner = (i + 1) % nb_learners;
+          return Read(learneri_to_client[i], msg, length);
+        }
       }
 
-      ret = select(max + 1, &set_read, NULL, NULL, &tv);
-      if (ret)
+      // The channels are edge-triggered: kzimp reports a channel each time a message
+      // arrives on it, thus the messages that arrive while we are reading the
+      // pending ones are not lost. Ask kzimp how many messages are there.
+      nb = epoll_wait(learners_epoll, learners_events, nb_learners, -1);
+      for (n = 0; n < nb; n++)
       {
-        for (i = 0; i < nb_learners; i++)
+        i = learners_events[n].data.u32;
+        ret = ioctl(learneri_to_client[i], KZIMP_IOCTL_PENDING);
+        if (ret > 0)
         {
-          if (FD_ISSET(learneri_to_client[i], &set_read))
-          {
-            return Read(learneri_to_client[i], msg, length);
-          }
+          learneri_pending[i] = ret;
         }
       }
     }
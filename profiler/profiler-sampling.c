@@ -21,7 +21,6 @@ static event_t default_events[] = {
     .sampling_period = 1000000,
     .exclude_user = 0,
   },
-  /*
   {
     .name = "CACHE_MISSES",
     .type = PERF_TYPE_HARDWARE,
@@ -29,6 +28,7 @@ static event_t default_events[] = {
     .sampling_period = 10000,
     .exclude_user = 0,
   },
+  /*
   {
     .name = "L3_CACHE_MISS",
     .type = PERF_TYPE_RAW,